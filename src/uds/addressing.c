@@ -0,0 +1,135 @@
+#include <uds/addressing.h>
+#include <uds/uds.h>
+#include <string.h>
+
+#define ARBITRATION_ID_OFFSET 0x8
+#define EXTENDED_ID_MASK 0x1fffffff
+#define FUNCTIONAL_RESPONSE_MASK 0x1ffffff8
+#define NORMAL_FIXED_FORMAT_MASK 0xff0000
+#define NORMAL_FIXED_PHYSICAL_FORMAT 0xda0000
+#define NORMAL_FIXED_FUNCTIONAL_FORMAT 0xdb0000
+#define NORMAL_FIXED_PRIORITY_MASK 0x1f000000
+#define NORMAL_FIXED_ECU_MASK 0x1fffff00
+
+// Probing wraps with a mask, and the slots are indexed by the top 8 bits of
+// the hash and hold the entry index + 1 in a byte.
+_Static_assert((DIAGNOSTIC_ADDRESSING_MAX_ENTRIES &
+            (DIAGNOSTIC_ADDRESSING_MAX_ENTRIES - 1)) == 0,
+        "DIAGNOSTIC_ADDRESSING_MAX_ENTRIES must be a power of 2");
+_Static_assert(DIAGNOSTIC_ADDRESSING_MAX_ENTRIES > 0 &&
+            DIAGNOSTIC_ADDRESSING_SLOT_COUNT <= 256,
+        "DIAGNOSTIC_ADDRESSING_MAX_ENTRIES must be from 1 to 128");
+
+static uint8_t slot_for(uint32_t request_id, uint8_t target_address) {
+    // Fibonacci hashing - the top bits of the product are well mixed
+    uint32_t hash = (request_id ^ ((uint32_t) target_address << 24)) *
+            2654435761UL;
+    return (hash >> 24) & (DIAGNOSTIC_ADDRESSING_SLOT_COUNT - 1);
+}
+
+static bool is_key(const DiagnosticAddress* entry, uint32_t request_id,
+        uint8_t target_address) {
+    return entry->request_id == request_id &&
+            entry->target_address == target_address;
+}
+
+void diagnostic_addressing_reset(DiagnosticAddressingTable* table) {
+    memset(table, 0, sizeof(DiagnosticAddressingTable));
+}
+
+bool diagnostic_addressing_add(DiagnosticAddressingTable* table,
+        const DiagnosticAddress* address) {
+    uint8_t slot = slot_for(address->request_id, address->target_address);
+    while(table->slots[slot] != 0) {
+        DiagnosticAddress* entry = &table->entries[table->slots[slot] - 1];
+        if(is_key(entry, address->request_id, address->target_address)) {
+            *entry = *address;
+            return true;
+        }
+        slot = (slot + 1) & (DIAGNOSTIC_ADDRESSING_SLOT_COUNT - 1);
+    }
+
+    if(table->count >= DIAGNOSTIC_ADDRESSING_MAX_ENTRIES) {
+        return false;
+    }
+
+    table->entries[table->count] = *address;
+    table->slots[slot] = ++table->count;
+    return true;
+}
+
+const DiagnosticAddress* diagnostic_addressing_lookup(
+        const DiagnosticAddressingTable* table, uint32_t request_id,
+        uint8_t target_address) {
+    uint8_t slot = slot_for(request_id, target_address);
+    while(table->slots[slot] != 0) {
+        const DiagnosticAddress* entry =
+                &table->entries[table->slots[slot] - 1];
+        if(is_key(entry, request_id, target_address)) {
+            return entry;
+        }
+        slot = (slot + 1) & (DIAGNOSTIC_ADDRESSING_SLOT_COUNT - 1);
+    }
+    return NULL;
+}
+
+DiagnosticAddress diagnostic_addressing_default(uint32_t request_id) {
+    DiagnosticAddress address = {
+        request_id: request_id,
+        target_address: 0,
+        mode: DIAGNOSTIC_ADDRESSING_NORMAL,
+        response_id: request_id + ARBITRATION_ID_OFFSET,
+        response_mask: EXTENDED_ID_MASK,
+        response_address: 0
+    };
+
+    if(request_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
+        address.response_id = OBD2_FUNCTIONAL_RESPONSE_START;
+        address.response_mask = FUNCTIONAL_RESPONSE_MASK;
+    } else if(request_id > 0x7ff) {
+        uint32_t source = request_id & 0xff;
+        uint32_t target = (request_id >> 8) & 0xff;
+        uint32_t format = request_id & NORMAL_FIXED_FORMAT_MASK;
+        uint32_t priority = request_id & NORMAL_FIXED_PRIORITY_MASK;
+        if(format == NORMAL_FIXED_FUNCTIONAL_FORMAT) {
+            address.mode = DIAGNOSTIC_ADDRESSING_NORMAL_FIXED;
+            address.response_id = priority | NORMAL_FIXED_PHYSICAL_FORMAT |
+                    (source << 8);
+            address.response_mask = NORMAL_FIXED_ECU_MASK;
+        } else if(format == NORMAL_FIXED_PHYSICAL_FORMAT) {
+            address.mode = DIAGNOSTIC_ADDRESSING_NORMAL_FIXED;
+            address.response_id = priority | NORMAL_FIXED_PHYSICAL_FORMAT |
+                    (source << 8) | target;
+        }
+    }
+    return address;
+}
+
+DiagnosticAddress diagnostic_addressing_resolve(
+        const DiagnosticAddressingTable* table, uint32_t request_id,
+        uint8_t target_address) {
+    if(table != NULL) {
+        const DiagnosticAddress* entry = diagnostic_addressing_lookup(table,
+                request_id, target_address);
+        if(entry != NULL) {
+            return *entry;
+        }
+    }
+    return diagnostic_addressing_default(request_id);
+}
+
+bool diagnostic_addressing_is_functional(const DiagnosticAddress* address) {
+    return (address->response_mask & EXTENDED_ID_MASK) != EXTENDED_ID_MASK;
+}
+
+uint32_t diagnostic_addressing_flow_control_id(
+        const DiagnosticAddress* address, uint32_t response_id) {
+    if(!diagnostic_addressing_is_functional(address)) {
+        return address->request_id;
+    } else if(address->mode == DIAGNOSTIC_ADDRESSING_NORMAL_FIXED) {
+        // swap the target and source addresses
+        return (response_id & 0x1fff0000) | ((response_id & 0xff) << 8) |
+                ((response_id >> 8) & 0xff);
+    }
+    return response_id - ARBITRATION_ID_OFFSET;
+}
@@ -0,0 +1,93 @@
+#ifndef __UDS_ADDRESSING_H__
+#define __UDS_ADDRESSING_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A power of 2, up to 128 - the slots are found with 8 bits of a hash and
+// hold 8-bit entry indexes.
+#ifndef DIAGNOSTIC_ADDRESSING_MAX_ENTRIES
+#define DIAGNOSTIC_ADDRESSING_MAX_ENTRIES 64
+#endif
+
+#define DIAGNOSTIC_ADDRESSING_SLOT_COUNT (DIAGNOSTIC_ADDRESSING_MAX_ENTRIES * 2)
+
+/* Public: A table of DiagnosticAddress entries, keyed by request arbitration
+ * ID and target address, for ECUs that don't follow the default addressing.
+ *
+ * Assign an instance to the 'addressing' field of a DiagnosticShims. Requests
+ * to IDs that aren't in the table fall back to
+ * diagnostic_addressing_default(...).
+ *
+ * Lookups are a hash and (usually) a single comparison, so the table can be
+ * as large as a vehicle needs without slowing anything down.
+ *
+ * entries - The entries, in the order they were added.
+ * count - The number of entries in use.
+ */
+typedef struct DiagnosticAddressingTable {
+    DiagnosticAddress entries[DIAGNOSTIC_ADDRESSING_MAX_ENTRIES];
+    uint8_t count;
+
+    // Private - index + 1 of the entry in each slot, 0 if empty
+    uint8_t slots[DIAGNOSTIC_ADDRESSING_SLOT_COUNT];
+} DiagnosticAddressingTable;
+
+/* Public: Clear all entries from the table.
+ */
+void diagnostic_addressing_reset(DiagnosticAddressingTable* table);
+
+/* Public: Add an entry to the table, replacing any existing entry for the
+ * same request_id and target_address.
+ *
+ * Returns false if the table is full.
+ */
+bool diagnostic_addressing_add(DiagnosticAddressingTable* table,
+        const DiagnosticAddress* address);
+
+/* Public: Find the entry for a request arbitration ID and target address.
+ *
+ * Returns the entry, or NULL if there isn't one.
+ */
+const DiagnosticAddress* diagnostic_addressing_lookup(
+        const DiagnosticAddressingTable* table, uint32_t request_id,
+        uint8_t target_address);
+
+/* Public: The addressing used for a request arbitration ID when it isn't in a
+ * table:
+ *
+ *  - 0x7df is a functional request, answered on 0x7e8-0x7ef.
+ *  - 29-bit 0x18DB<target><source> is a functional request, answered on
+ *      0x18DA<source><any ECU>.
+ *  - 29-bit 0x18DA<target><source> is answered on 0x18DA<source><target>.
+ *  - Anything else is answered on the request ID + 0x8.
+ */
+DiagnosticAddress diagnostic_addressing_default(uint32_t request_id);
+
+/* Public: Look up the addressing for a request in the table (which may be
+ * NULL), falling back to the default.
+ */
+DiagnosticAddress diagnostic_addressing_resolve(
+        const DiagnosticAddressingTable* table, uint32_t request_id,
+        uint8_t target_address);
+
+/* Public: Returns true if the address covers more than one responding ECU.
+ */
+bool diagnostic_addressing_is_functional(const DiagnosticAddress* address);
+
+/* Public: The arbitration ID to send flow control frames to while receiving a
+ * multi-frame response from the given ECU.
+ */
+uint32_t diagnostic_addressing_flow_control_id(
+        const DiagnosticAddress* address, uint32_t response_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_ADDRESSING_H__
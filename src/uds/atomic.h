@@ -0,0 +1,27 @@
+#ifndef __UDS_ATOMIC_H__
+#define __UDS_ATOMIC_H__
+
+/* Private: Thin wrappers around the GCC __atomic builtins, used for the
+ * statistics that may be read from a different thread than the one driving
+ * the diagnostic requests.
+ *
+ * Only 32-bit (or smaller) values are used with these so that they stay
+ * lock-free on 32-bit microcontrollers without libatomic.
+ */
+
+#define UDS_ATOMIC_LOAD(pointer) __atomic_load_n((pointer), __ATOMIC_RELAXED)
+#define UDS_ATOMIC_LOAD_ACQUIRE(pointer) \
+        __atomic_load_n((pointer), __ATOMIC_ACQUIRE)
+#define UDS_ATOMIC_STORE(pointer, value) \
+        __atomic_store_n((pointer), (value), __ATOMIC_RELAXED)
+#define UDS_ATOMIC_STORE_RELEASE(pointer, value) \
+        __atomic_store_n((pointer), (value), __ATOMIC_RELEASE)
+#define UDS_ATOMIC_INCREMENT(pointer) \
+        __atomic_fetch_add((pointer), 1, __ATOMIC_RELAXED)
+#define UDS_ATOMIC_EXCHANGE(pointer, value) \
+        __atomic_exchange_n((pointer), (value), __ATOMIC_RELAXED)
+#define UDS_ATOMIC_COMPARE_EXCHANGE(pointer, expected, desired) \
+        __atomic_compare_exchange_n((pointer), (expected), (desired), false, \
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#endif // __UDS_ATOMIC_H__
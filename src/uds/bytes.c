@@ -0,0 +1,55 @@
+#include <uds/bytes.h>
+#include <bitfield/bitfield.h>
+#include <limits.h>
+
+uint64_t diagnostic_read_field(const uint8_t* source, size_t source_length,
+        uint16_t bit_offset, uint16_t bit_count) {
+    if(bit_count == 0 || bit_count > 64 ||
+            (size_t) bit_offset + bit_count > source_length * CHAR_BIT) {
+        return 0;
+    }
+
+    if(bit_offset % CHAR_BIT != 0 || bit_count % CHAR_BIT != 0) {
+        // bitfield-c can only address the first 255 bytes
+        if(source_length > UINT8_MAX) {
+            source_length = UINT8_MAX;
+        }
+        return get_bitfield(source, source_length, bit_offset, bit_count);
+    }
+
+    const uint8_t* bytes = &source[bit_offset / CHAR_BIT];
+    switch(bit_count) {
+        case 8:
+            return bytes[0];
+        case 16:
+            return diagnostic_read_uint16(bytes);
+        case 24:
+            return diagnostic_read_uint24(bytes);
+        case 32:
+            return diagnostic_read_uint32(bytes);
+        default: {
+            uint64_t value = 0;
+            uint8_t i;
+            for(i = 0; i < bit_count / CHAR_BIT; ++i) {
+                value = (value << CHAR_BIT) | bytes[i];
+            }
+            return value;
+        }
+    }
+}
+
+void diagnostic_read_uint16_array(const uint8_t* source,
+        uint16_t* destination, size_t count) {
+    size_t i;
+    for(i = 0; i < count; ++i) {
+        destination[i] = diagnostic_read_uint16(&source[i * 2]);
+    }
+}
+
+void diagnostic_read_uint32_array(const uint8_t* source,
+        uint32_t* destination, size_t count) {
+    size_t i;
+    for(i = 0; i < count; ++i) {
+        destination[i] = diagnostic_read_uint32(&source[i * 4]);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef __UDS_BYTES_H__
+#define __UDS_BYTES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Public: Loads and stores of the byte-aligned, big-endian fields that make
+ * up nearly all of a diagnostic payload (PIDs, DIDs, lengths and most
+ * signals).
+ *
+ * These are written as shifts of single bytes, which GCC and Clang turn in to
+ * a single (possibly byte-swapped) load or store, with no alignment
+ * requirement on the pointer.
+ */
+static inline uint16_t diagnostic_read_uint16(const uint8_t* source) {
+    return (uint16_t) ((source[0] << 8) | source[1]);
+}
+
+static inline uint32_t diagnostic_read_uint24(const uint8_t* source) {
+    return ((uint32_t) source[0] << 16) | ((uint32_t) source[1] << 8) |
+            source[2];
+}
+
+static inline uint32_t diagnostic_read_uint32(const uint8_t* source) {
+    return ((uint32_t) source[0] << 24) | ((uint32_t) source[1] << 16) |
+            ((uint32_t) source[2] << 8) | source[3];
+}
+
+static inline void diagnostic_write_uint16(uint8_t* destination,
+        uint16_t value) {
+    destination[0] = value >> 8;
+    destination[1] = value;
+}
+
+static inline void diagnostic_write_uint32(uint8_t* destination,
+        uint32_t value) {
+    destination[0] = value >> 24;
+    destination[1] = value >> 16;
+    destination[2] = value >> 8;
+    destination[3] = value;
+}
+
+/* Public: Read a big-endian field of up to 64 bits from a payload.
+ *
+ * Whole bytes are read directly - only fields that don't start and end on a
+ * byte boundary go through the bit-level get_bitfield(...) from bitfield-c.
+ *
+ * source - The payload.
+ * source_length - The length of the payload in bytes.
+ * bit_offset - The offset of the most significant bit of the field, counting
+ *      from the most significant bit of the first byte.
+ * bit_count - The size of the field in bits.
+ *
+ * Returns the value of the field, or 0 if it doesn't fit in the payload.
+ */
+uint64_t diagnostic_read_field(const uint8_t* source, size_t source_length,
+        uint16_t bit_offset, uint16_t bit_count);
+
+/* Public: Convert an array of big-endian 16-bit values (e.g. a list of
+ * supported DIDs, or samples from a periodic response) to host integers.
+ *
+ * A plain loop over contiguous values - at -O3, GCC vectorizes it with byte
+ * shuffles, and turns each read of the 32-bit version in to one byte-swapped
+ * load.
+ *
+ * source - count * 2 bytes of big-endian values.
+ * destination - Room for count values.
+ */
+void diagnostic_read_uint16_array(const uint8_t* source,
+        uint16_t* destination, size_t count);
+
+/* Public: Like diagnostic_read_uint16_array(...), for 32-bit values.
+ */
+void diagnostic_read_uint32_array(const uint8_t* source,
+        uint32_t* destination, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_BYTES_H__
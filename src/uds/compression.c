@@ -0,0 +1,196 @@
+#include <uds/compression.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+// The ring holds the window behind the position and up to a window of the
+// image read ahead of it.
+#define RING_SIZE (2 * DIAGNOSTIC_LZSS_WINDOW_SIZE)
+#define RING_MASK (RING_SIZE - 1)
+#define WINDOW_MASK (DIAGNOSTIC_LZSS_WINDOW_SIZE - 1)
+
+void diagnostic_lzss_init(DiagnosticLzssCompressor* compressor,
+        uint32_t length, DiagnosticImageReadShim read, void* context) {
+    memset(compressor, 0, sizeof(*compressor));
+    compressor->length = length;
+    compressor->read = read;
+    compressor->context = context;
+}
+
+bool diagnostic_lzss_finished(const DiagnosticLzssCompressor* compressor) {
+    return compressor->consumed == compressor->length;
+}
+
+// Read ahead until there's a whole match after the position, or the image
+// ends.
+static bool fill(DiagnosticLzssCompressor* compressor) {
+    while(compressor->filled < compressor->length &&
+            compressor->filled - compressor->consumed <
+                DIAGNOSTIC_LZSS_MAX_MATCH) {
+        uint32_t start = compressor->filled & RING_MASK;
+        uint32_t count = MIN(compressor->length - compressor->filled,
+                RING_SIZE - start);
+        // without overwriting the window
+        count = MIN(count, compressor->consumed + DIAGNOSTIC_LZSS_WINDOW_SIZE -
+                compressor->filled);
+        if(compressor->read == NULL || !compressor->read(compressor->filled,
+                    &compressor->ring[start], count, compressor->context)) {
+            compressor->failed = true;
+            return false;
+        }
+        compressor->filled += count;
+    }
+    return true;
+}
+
+static uint8_t byte_at(const DiagnosticLzssCompressor* compressor,
+        uint32_t position) {
+    return compressor->ring[position & RING_MASK];
+}
+
+static uint32_t hash(const DiagnosticLzssCompressor* compressor,
+        uint32_t position) {
+    uint32_t prefix = byte_at(compressor, position) << 16 |
+            byte_at(compressor, position + 1) << 8 |
+            byte_at(compressor, position + 2);
+    return (prefix * 2654435761u) >> (32 - DIAGNOSTIC_LZSS_HASH_BITS);
+}
+
+// Remember the position as the latest with its prefix, chained to the one
+// before it if that's still in the window.
+static void insert(DiagnosticLzssCompressor* compressor, uint32_t position) {
+    uint32_t* head = &compressor->head[hash(compressor, position)];
+    uint32_t distance = *head != 0 ? position - (*head - 1) : 0;
+    compressor->previous[position & WINDOW_MASK] =
+            distance <= DIAGNOSTIC_LZSS_WINDOW_SIZE ? distance : 0;
+    *head = position + 1;
+}
+
+// Returns the length of the longest match for the position, or 0 if there
+// isn't one worth encoding.
+static uint32_t find_match(const DiagnosticLzssCompressor* compressor,
+        uint32_t* distance) {
+    uint32_t position = compressor->consumed;
+    uint32_t available = MIN(compressor->length - position,
+            DIAGNOSTIC_LZSS_MAX_MATCH);
+    if(available < DIAGNOSTIC_LZSS_MIN_MATCH) {
+        return 0;
+    }
+
+    uint32_t entry = compressor->head[hash(compressor, position)];
+    if(entry == 0) {
+        return 0;
+    }
+
+    uint32_t best = 0;
+    uint32_t candidate = entry - 1;
+    int chain;
+    for(chain = 0; chain < DIAGNOSTIC_LZSS_MAX_CHAIN &&
+            position - candidate <= DIAGNOSTIC_LZSS_WINDOW_SIZE; ++chain) {
+        uint32_t length = 0;
+        while(length < available && byte_at(compressor, candidate + length) ==
+                byte_at(compressor, position + length)) {
+            ++length;
+        }
+        if(length > best) {
+            best = length;
+            *distance = position - candidate;
+            if(length == available) {
+                break;
+            }
+        }
+
+        uint16_t step = compressor->previous[candidate & WINDOW_MASK];
+        if(step == 0) {
+            break;
+        }
+        candidate -= step;
+    }
+    return best >= DIAGNOSTIC_LZSS_MIN_MATCH ? best : 0;
+}
+
+uint32_t diagnostic_lzss_compress_block(DiagnosticLzssCompressor* compressor,
+        uint8_t* output, uint32_t output_length) {
+    uint32_t used = 0;
+    while(output_length - used >= DIAGNOSTIC_LZSS_GROUP_SIZE) {
+        if(!fill(compressor)) {
+            return 0;
+        }
+        if(diagnostic_lzss_finished(compressor)) {
+            break;
+        }
+
+        uint8_t* flags = &output[used++];
+        *flags = 0;
+        int token;
+        for(token = 0; token < 8; ++token) {
+            if(!fill(compressor)) {
+                return 0;
+            }
+            if(diagnostic_lzss_finished(compressor)) {
+                break;
+            }
+
+            uint32_t distance = 0;
+            uint32_t length = find_match(compressor, &distance);
+            if(length > 0) {
+                *flags |= 1 << token;
+                output[used++] = (distance - 1) & 0xff;
+                output[used++] = ((distance - 1) >> 8) << 4 |
+                        (length - DIAGNOSTIC_LZSS_MIN_MATCH);
+            } else {
+                length = 1;
+                output[used++] = byte_at(compressor, compressor->consumed);
+            }
+
+            // the last few positions of a long match may not be read yet,
+            // and are left out
+            while(length-- > 0) {
+                if(compressor->consumed + DIAGNOSTIC_LZSS_MIN_MATCH <=
+                        compressor->filled) {
+                    insert(compressor, compressor->consumed);
+                }
+                ++compressor->consumed;
+            }
+        }
+    }
+    return used;
+}
+
+uint32_t diagnostic_lzss_decompress(const uint8_t* input,
+        uint32_t input_length, uint8_t* output, uint32_t output_length) {
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while(in < input_length) {
+        uint8_t flags = input[in++];
+        int token;
+        for(token = 0; token < 8 && in < input_length; ++token) {
+            if(!(flags & (1 << token))) {
+                if(out == output_length) {
+                    return 0;
+                }
+                output[out++] = input[in++];
+                continue;
+            }
+
+            if(input_length - in < 2) {
+                return 0;
+            }
+            uint32_t distance = (input[in] | (input[in + 1] >> 4) << 8) + 1;
+            uint32_t length = (input[in + 1] & 0xf) +
+                    DIAGNOSTIC_LZSS_MIN_MATCH;
+            in += 2;
+            if(distance > out || output_length - out < length) {
+                return 0;
+            }
+            while(length-- > 0) {
+                output[out] = output[out - distance];
+                ++out;
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,119 @@
+#ifndef __UDS_COMPRESSION_H__
+#define __UDS_COMPRESSION_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// How many of the 3 byte prefixes the compressor remembers the last
+// position of, as a power of 2. Each costs 4 bytes.
+#ifndef DIAGNOSTIC_LZSS_HASH_BITS
+#define DIAGNOSTIC_LZSS_HASH_BITS 10
+#endif
+
+// How many earlier positions with the same prefix are tried for each match -
+// more finds longer matches, at the cost of time.
+#ifndef DIAGNOSTIC_LZSS_MAX_CHAIN
+#define DIAGNOSTIC_LZSS_MAX_CHAIN 32
+#endif
+
+#define DIAGNOSTIC_LZSS_WINDOW_SIZE 4096
+#define DIAGNOSTIC_LZSS_MIN_MATCH 3
+#define DIAGNOSTIC_LZSS_MAX_MATCH 18
+// A flag byte and 8 matches - the smallest block that can hold any group.
+#define DIAGNOSTIC_LZSS_GROUP_SIZE 17
+
+/* Public: The signature for a function that reads part of an image to be
+ * sent to an ECU, e.g. from a file or from flash. Parts are read in order.
+ *
+ * offset - Where in the image to start.
+ * buffer - Where to write the bytes.
+ * length - How many bytes to read - all of them must be.
+ * context - The context given with the shim.
+ *
+ * Returns false if the bytes couldn't be read.
+ */
+typedef bool (*DiagnosticImageReadShim)(uint32_t offset, uint8_t* buffer,
+        uint32_t length, void* context);
+
+/* Public: Compresses an image with LZSS a block at a time, reading it as it
+ * goes, so an image of any size only needs the compressor's own fixed memory
+ * (a little over 20KB) and never a copy of the whole image.
+ *
+ * The compressed stream is groups of up to 8 tokens, each group led by a
+ * flag byte whose bits (least significant first) say what each token is:
+ *
+ *  0 - a literal byte, copied as it is.
+ *  1 - a match of 2 bytes, 'dddddddd DDDDLLLL': copy L + 3 bytes from D:d + 1
+ *      bytes back in the output (the copy may overlap what it writes).
+ *
+ * so a match reaches up to DIAGNOSTIC_LZSS_WINDOW_SIZE bytes back and is 3 to
+ * 18 bytes long. The stream simply ends after the last token.
+ *
+ * Groups are never split between blocks, so each block can be decompressed
+ * as it arrives - the window carries on from the block before.
+ *
+ * consumed - How many bytes of the image have been compressed.
+ * failed - True if the image couldn't be read.
+ *
+ * Use diagnostic_lzss_init(...) to create an instance.
+ */
+typedef struct {
+    uint32_t consumed;
+    bool failed;
+
+    // Private
+    DiagnosticImageReadShim read;
+    void* context;
+    uint32_t length;
+    uint32_t filled;
+    uint8_t ring[2 * DIAGNOSTIC_LZSS_WINDOW_SIZE];
+    uint32_t head[1 << DIAGNOSTIC_LZSS_HASH_BITS];
+    uint16_t previous[DIAGNOSTIC_LZSS_WINDOW_SIZE];
+} DiagnosticLzssCompressor;
+
+/* Public: Start compressing an image.
+ *
+ * length - The size of the image.
+ * read - Reads the image, in order.
+ * context - Passed to the read shim.
+ */
+void diagnostic_lzss_init(DiagnosticLzssCompressor* compressor,
+        uint32_t length, DiagnosticImageReadShim read, void* context);
+
+/* Public: Compress as much more of the image as fits in a block.
+ *
+ * A block ends at the last whole group that fits, so it may be up to
+ * DIAGNOSTIC_LZSS_GROUP_SIZE - 1 bytes short of output_length.
+ *
+ * output - Where to write the block.
+ * output_length - The most the block can hold, at least
+ *      DIAGNOSTIC_LZSS_GROUP_SIZE.
+ *
+ * Returns the size of the block, or 0 once the whole image is compressed or
+ * if it couldn't be read (see 'failed').
+ */
+uint32_t diagnostic_lzss_compress_block(DiagnosticLzssCompressor* compressor,
+        uint8_t* output, uint32_t output_length);
+
+/* Public: Returns true if the whole image has been compressed.
+ */
+bool diagnostic_lzss_finished(const DiagnosticLzssCompressor* compressor);
+
+/* Public: Decompress a whole LZSS stream, e.g. to check an image before it's
+ * sent.
+ *
+ * Returns the size of the decompressed data, or 0 if the stream is malformed
+ * or doesn't fit in the output.
+ */
+uint32_t diagnostic_lzss_decompress(const uint8_t* input,
+        uint32_t input_length, uint8_t* output, uint32_t output_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_COMPRESSION_H__
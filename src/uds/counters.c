@@ -0,0 +1,26 @@
+#include <uds/counters.h>
+#include <uds/atomic.h>
+
+#define COUNTER_COUNT (sizeof(DiagnosticCounters) / sizeof(uint32_t))
+
+void diagnostic_counters_snapshot(DiagnosticCounters* counters,
+        DiagnosticCounters* destination, bool reset) {
+    uint32_t* source = (uint32_t*) counters;
+    uint32_t* copy = (uint32_t*) destination;
+    size_t i;
+    for(i = 0; i < COUNTER_COUNT; ++i) {
+        if(reset) {
+            copy[i] = UDS_ATOMIC_EXCHANGE(&source[i], 0);
+        } else {
+            copy[i] = UDS_ATOMIC_LOAD(&source[i]);
+        }
+    }
+}
+
+void diagnostic_counters_reset(DiagnosticCounters* counters) {
+    uint32_t* source = (uint32_t*) counters;
+    size_t i;
+    for(i = 0; i < COUNTER_COUNT; ++i) {
+        UDS_ATOMIC_STORE(&source[i], 0);
+    }
+}
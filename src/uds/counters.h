@@ -0,0 +1,89 @@
+#ifndef __UDS_COUNTERS_H__
+#define __UDS_COUNTERS_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Public: Counters of what the library has done, for monitoring throughput
+ * and failures in production.
+ *
+ * Zero-initialize an instance (or use diagnostic_counters_reset(...)) and
+ * assign it to the 'counters' field of a DiagnosticShims. Every counter is a
+ * 32-bit value updated with a relaxed atomic increment, so they may be read
+ * with diagnostic_counters_snapshot(...) from another thread at any time.
+ *
+ * All fields must be uint32_t - the snapshot and reset functions treat the
+ * struct as an array of them.
+ *
+ * requests_sent - Requests whose first frame was accepted by the CAN driver.
+ * send_failures - Requests that failed because a frame couldn't be sent, or
+ *      the transport refused them.
+ * frames_offered - Calls to diagnostic_receive_can_frame(...). If you offer
+ *      each frame to several handles, each call is counted.
+ * frames_routed - Offered frames that matched an arbitration ID the handle
+ *      was waiting on.
+ * frames_ignored - Offered frames on an arbitration ID the handle wasn't
+ *      waiting on.
+ * responses_positive - Completed positive responses.
+ * responses_negative - Completed negative responses, broken down by code in
+ *      'negative_response_codes'.
+ * responses_unmatched - Completed ISO-TP messages that didn't match the
+ *      request's mode or PID.
+ * empty_responses - Completed ISO-TP messages with no payload.
+ * multi_frame_responses - Completed multi-frame ISO-TP messages.
+ * timeouts - Requests that were given up on by diagnostic_process_request(...)
+ *      because the ECU didn't respond in time.
+ * responses_pending - Response pending (0x78) negative responses, which
+ *      extend the time allowed for the real response.
+ * busy_retries - Requests sent again after a busy (0x21) negative response.
+ * frames_deferred - Frames the CAN driver couldn't take right away, held in
+ *      the shims' DiagnosticTxQueue.
+ * negative_response_codes - The count of negative responses for each NRC.
+ */
+typedef struct DiagnosticCounters {
+    uint32_t requests_sent;
+    uint32_t send_failures;
+    uint32_t frames_offered;
+    uint32_t frames_routed;
+    uint32_t frames_ignored;
+    uint32_t responses_positive;
+    uint32_t responses_negative;
+    uint32_t responses_unmatched;
+    uint32_t empty_responses;
+    uint32_t multi_frame_responses;
+    uint32_t timeouts;
+    uint32_t responses_pending;
+    uint32_t busy_retries;
+    uint32_t frames_deferred;
+    uint32_t negative_response_codes[256];
+} DiagnosticCounters;
+
+/* Public: Copy the current value of all counters in to the destination.
+ *
+ * Each counter is read atomically, but the snapshot as a whole is not - the
+ * counters may have moved on between reading the first and the last.
+ *
+ * reset - If true, each counter is atomically swapped with 0 as it is read, so
+ *      no increments are lost between one snapshot and the next.
+ */
+void diagnostic_counters_snapshot(DiagnosticCounters* counters,
+        DiagnosticCounters* destination, bool reset);
+
+/* Public: Set all counters to 0.
+ *
+ * This is safe to call while the counters are being updated, but increments
+ * that race with it may be lost - use diagnostic_counters_snapshot(..., true)
+ * to avoid that.
+ */
+void diagnostic_counters_reset(DiagnosticCounters* counters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_COUNTERS_H__
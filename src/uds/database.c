@@ -0,0 +1,228 @@
+#include <uds/database.h>
+#include <uds/bytes.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 0x811c9dc5
+#define FNV_PRIME 0x01000193
+
+// The tables are used in place, so their layout is part of the format.
+_Static_assert(sizeof(DiagnosticDatabaseHeader) == 40,
+        "database header layout changed");
+_Static_assert(sizeof(DiagnosticDatabaseEcu) == 28,
+        "database ECU layout changed");
+_Static_assert(sizeof(DiagnosticDatabaseParameter) == 32,
+        "database parameter layout changed");
+
+// A table of count entries of a size fits in the image, at an aligned offset.
+static bool table_fits(const DiagnosticDatabaseHeader* header,
+        uint32_t offset, uint32_t count, size_t size) {
+    return offset % sizeof(uint32_t) == 0 && offset >= sizeof(*header) &&
+            (uint64_t) offset + (uint64_t) count * size <= header->length;
+}
+
+bool diagnostic_database_open(DiagnosticDatabase* database,
+        const void* image, size_t length) {
+    memset(database, 0, sizeof(*database));
+    const DiagnosticDatabaseHeader* header =
+            (const DiagnosticDatabaseHeader*) image;
+    if(image == NULL || (uintptr_t) image % sizeof(uint32_t) != 0 ||
+            length < sizeof(*header) ||
+            header->magic != DIAGNOSTIC_DATABASE_MAGIC ||
+            header->version != DIAGNOSTIC_DATABASE_VERSION ||
+            header->length > length) {
+        return false;
+    }
+
+    // an empty index would never end a lookup
+    if(header->index_size == 0 ||
+            (header->index_size & (header->index_size - 1)) != 0 ||
+            header->index_size < header->parameter_count ||
+            header->strings_length == 0 ||
+            !table_fits(header, header->ecus_offset, header->ecu_count,
+                sizeof(DiagnosticDatabaseEcu)) ||
+            !table_fits(header, header->parameters_offset,
+                header->parameter_count,
+                sizeof(DiagnosticDatabaseParameter)) ||
+            !table_fits(header, header->index_offset, header->index_size,
+                sizeof(uint32_t)) ||
+            (uint64_t) header->strings_offset + header->strings_length >
+                header->length) {
+        return false;
+    }
+
+    const uint8_t* bytes = (const uint8_t*) image;
+    const char* strings = (const char*) &bytes[header->strings_offset];
+    // so every string ends inside the table
+    if(strings[header->strings_length - 1] != '\0') {
+        return false;
+    }
+
+    database->header = header;
+    database->ecus = (const DiagnosticDatabaseEcu*) &bytes[header->ecus_offset];
+    database->parameters = (const DiagnosticDatabaseParameter*)
+            &bytes[header->parameters_offset];
+    database->index = (const uint32_t*) &bytes[header->index_offset];
+    database->strings = strings;
+    return true;
+}
+
+uint32_t diagnostic_database_hash(const char* name) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for(; *name != '\0'; ++name) {
+        hash = (hash ^ (uint8_t) *name) * FNV_PRIME;
+    }
+    return hash;
+}
+
+const char* diagnostic_database_string(const DiagnosticDatabase* database,
+        uint32_t offset) {
+    return offset < database->header->strings_length ?
+            &database->strings[offset] : "";
+}
+
+const DiagnosticDatabaseParameter* diagnostic_database_find(
+        const DiagnosticDatabase* database, const char* name) {
+    const DiagnosticDatabaseHeader* header = database->header;
+    uint32_t mask = header->index_size - 1;
+    uint32_t slot = diagnostic_database_hash(name) & mask;
+    uint32_t probes;
+    for(probes = 0; probes < header->index_size; ++probes) {
+        uint32_t entry = database->index[slot];
+        if(entry == 0) {
+            break;
+        }
+        if(entry <= header->parameter_count) {
+            const DiagnosticDatabaseParameter* parameter =
+                    &database->parameters[entry - 1];
+            if(strcmp(diagnostic_database_string(database, parameter->name),
+                        name) == 0) {
+                return parameter;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+const DiagnosticDatabaseEcu* diagnostic_database_find_ecu(
+        const DiagnosticDatabase* database, uint32_t request_id) {
+    uint32_t low = 0;
+    uint32_t high = database->header->ecu_count;
+    while(low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const DiagnosticDatabaseEcu* ecu = &database->ecus[middle];
+        if(ecu->request_id == request_id) {
+            return ecu;
+        } else if(ecu->request_id < request_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+const DiagnosticDatabaseParameter* diagnostic_database_find_request(
+        const DiagnosticDatabase* database, uint32_t request_id,
+        uint8_t mode, uint16_t pid) {
+    const DiagnosticDatabaseEcu* ecu = diagnostic_database_find_ecu(database,
+            request_id);
+    uint32_t parameter_count = database->header->parameter_count;
+    if(ecu == NULL || ecu->first_parameter > parameter_count ||
+            ecu->parameter_count > parameter_count - ecu->first_parameter) {
+        return NULL;
+    }
+
+    // the first of the parameters the request reads
+    uint32_t key = ((uint32_t) mode << 16) | pid;
+    uint32_t low = ecu->first_parameter;
+    uint32_t end = low + ecu->parameter_count;
+    uint32_t high = end;
+    while(low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const DiagnosticDatabaseParameter* parameter =
+                &database->parameters[middle];
+        if((((uint32_t) parameter->mode << 16) | parameter->pid) < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if(low < end && database->parameters[low].mode == mode &&
+            database->parameters[low].pid == pid) {
+        return &database->parameters[low];
+    }
+    return NULL;
+}
+
+const DiagnosticDatabaseEcu* diagnostic_database_parameter_ecu(
+        const DiagnosticDatabase* database,
+        const DiagnosticDatabaseParameter* parameter) {
+    return parameter->ecu < database->header->ecu_count ?
+            &database->ecus[parameter->ecu] : NULL;
+}
+
+void diagnostic_database_address(const DiagnosticDatabaseEcu* ecu,
+        DiagnosticAddress* address) {
+    memset(address, 0, sizeof(*address));
+    address->request_id = ecu->request_id;
+    address->target_address = ecu->target_address;
+    address->mode = (DiagnosticAddressingMode) ecu->addressing_mode;
+    address->response_id = ecu->response_id;
+    address->response_mask = ecu->response_mask;
+    address->response_address = ecu->response_address;
+    address->frame_size = ecu->frame_size;
+}
+
+bool diagnostic_database_request(const DiagnosticDatabase* database,
+        const DiagnosticDatabaseParameter* parameter,
+        DiagnosticRequest* request) {
+    const DiagnosticDatabaseEcu* ecu = diagnostic_database_parameter_ecu(
+            database, parameter);
+    if(ecu == NULL) {
+        return false;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->arbitration_id = ecu->request_id;
+    request->mode = parameter->mode;
+    request->has_pid = parameter->pid_length > 0;
+    request->pid = parameter->pid;
+    request->pid_length = parameter->pid_length;
+    return true;
+}
+
+bool diagnostic_database_decode(const DiagnosticDatabaseParameter* parameter,
+        const DiagnosticResponse* response, DiagnosticFixedPoint* value) {
+    const uint8_t* payload = response->payload;
+    size_t payload_length = response->payload_length;
+    if(response->extended_payload != NULL) {
+        payload = response->extended_payload;
+        payload_length = response->extended_payload_length;
+    }
+
+    // the raw value fits in 32 bits, so the product fits in 64
+    if(!response->completed || !response->success ||
+            parameter->bit_count == 0 || parameter->bit_count > 32 ||
+            parameter->shift > 32 || (size_t) parameter->bit_offset +
+                parameter->bit_count > payload_length * 8) {
+        return false;
+    }
+
+    int64_t raw = (int64_t) diagnostic_read_field(payload, payload_length,
+            parameter->bit_offset, parameter->bit_count);
+    if((parameter->flags & DIAGNOSTIC_DATABASE_SIGNED) &&
+            (raw & ((int64_t) 1 << (parameter->bit_count - 1)))) {
+        raw -= (int64_t) 1 << parameter->bit_count;
+    }
+
+    int64_t scaled = raw * parameter->multiplier;
+    if(parameter->shift > 0) {
+        scaled = (scaled + ((int64_t) 1 << (parameter->shift - 1))) >>
+                parameter->shift;
+    }
+    value->value = (int32_t) (scaled + parameter->offset);
+    value->exponent = parameter->exponent;
+    return true;
+}
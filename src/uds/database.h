@@ -0,0 +1,210 @@
+#ifndef __UDS_DATABASE_H__
+#define __UDS_DATABASE_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "UDDB" read as a little-endian uint32
+#define DIAGNOSTIC_DATABASE_MAGIC 0x42444455
+#define DIAGNOSTIC_DATABASE_VERSION 1
+
+#define DIAGNOSTIC_DATABASE_SIGNED 0x1
+
+/* Public: The start of a compiled diagnostic database.
+ *
+ * A database is a single image, written by tools/uds-database.c, that's used
+ * exactly as it's stored - map it (or link it in to flash) and open it with
+ * diagnostic_database_open(...). Every field is little-endian, and every
+ * table starts on a 4 byte boundary and is an array of the structs below, so
+ * nothing is converted or copied. Images are only written and read on
+ * little-endian hosts.
+ *
+ * ecus_offset, parameters_offset, index_offset, strings_offset - Where each
+ *      table starts, in bytes from the start of the image.
+ * index_size - The number of slots in the name index, a power of 2.
+ * strings_length - The size of the string table, ending with a NUL.
+ * length - The size of the whole image.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ecu_count;
+    uint32_t parameter_count;
+    uint32_t index_size;
+    uint32_t ecus_offset;
+    uint32_t parameters_offset;
+    uint32_t index_offset;
+    uint32_t strings_offset;
+    uint32_t strings_length;
+    uint32_t length;
+} DiagnosticDatabaseHeader;
+
+/* Public: An ECU in a database. ECUs are sorted by request_id.
+ *
+ * name - The offset of the ECU's name in the string table.
+ * request_id, response_id, response_mask, target_address, response_address,
+ *      frame_size - As in DiagnosticAddress.
+ * addressing_mode - A DiagnosticAddressingMode.
+ * first_parameter - The index of the ECU's first parameter - they're all
+ *      together, sorted by mode and PID, and then by bit_offset where one
+ *      response carries several.
+ * parameter_count - The number of parameters read from the ECU.
+ */
+typedef struct {
+    uint32_t name;
+    uint32_t request_id;
+    uint32_t response_id;
+    uint32_t response_mask;
+    uint8_t addressing_mode;
+    uint8_t target_address;
+    uint8_t response_address;
+    uint8_t frame_size;
+    uint32_t first_parameter;
+    uint32_t parameter_count;
+} DiagnosticDatabaseEcu;
+
+/* Public: A value read from an ECU with a single request - an OBD-II PID or
+ * a DID, for example. This is what DiagnosticParameter in extras.h was for.
+ *
+ * The value is a field of the response payload (after the PID echo), scaled
+ * with integer operations only, like diagnostic_decode_obd2_pid_fixed(...):
+ *
+ *  value = ((raw * multiplier + rounding) >> shift) + offset
+ *
+ * giving a DiagnosticFixedPoint with the parameter's exponent.
+ *
+ * name - The offset of the parameter's name in the string table.
+ * ecu - The index of the ECU it's read from.
+ * mode - The service of the request.
+ * pid_length - 0 for a request without a PID, or 1 or 2.
+ * pid - The PID or DID.
+ * response_length - The length of the response payload.
+ * flags - DIAGNOSTIC_DATABASE_SIGNED if the field is two's complement.
+ * bit_offset, bit_count - The field, as in diagnostic_read_field(...).
+ * multiplier, shift, offset, exponent - The scaling.
+ * poll_interval_ms - How often the parameter should be read, or 0 if it's
+ *      only read on demand.
+ */
+typedef struct {
+    uint32_t name;
+    uint16_t ecu;
+    uint8_t mode;
+    uint8_t pid_length;
+    uint16_t pid;
+    uint8_t response_length;
+    uint8_t flags;
+    uint16_t bit_offset;
+    uint16_t bit_count;
+    int32_t multiplier;
+    int32_t offset;
+    uint8_t shift;
+    int8_t exponent;
+    uint16_t reserved;
+    uint32_t poll_interval_ms;
+} DiagnosticDatabaseParameter;
+
+/* Public: An open database - pointers in to the image, which must stay
+ * mapped for as long as this is used.
+ *
+ * Use diagnostic_database_open(...) to create an instance.
+ */
+typedef struct {
+    const DiagnosticDatabaseHeader* header;
+    const DiagnosticDatabaseEcu* ecus;
+    const DiagnosticDatabaseParameter* parameters;
+    // Private - each slot holds a parameter index + 1, or 0 if it's empty
+    const uint32_t* index;
+    const char* strings;
+} DiagnosticDatabase;
+
+/* Public: Open a database image that's already in memory, usually because
+ * it's been mapped with mmap(...) - which lets every process on a host share
+ * the same pages.
+ *
+ * Only the header is read, to check the tables are all in the image - so
+ * opening takes the same time however big the database is, and the pages of
+ * the tables are only touched when they're looked up.
+ *
+ * image - The database, aligned to 4 bytes.
+ * length - The size of the image.
+ *
+ * Returns false if the image isn't a database of this version, or was
+ * written for a host of the other byte order.
+ */
+bool diagnostic_database_open(DiagnosticDatabase* database,
+        const void* image, size_t length);
+
+/* Public: The hash of a name in the database's name index (32-bit FNV-1a).
+ */
+uint32_t diagnostic_database_hash(const char* name);
+
+/* Public: Returns the string at an offset in the string table (e.g. a
+ * name), or an empty string if the offset is out of range.
+ */
+const char* diagnostic_database_string(const DiagnosticDatabase* database,
+        uint32_t offset);
+
+/* Public: Find a parameter by name, with a single hash table lookup.
+ *
+ * Returns the parameter, or NULL if there's none with that name.
+ */
+const DiagnosticDatabaseParameter* diagnostic_database_find(
+        const DiagnosticDatabase* database, const char* name);
+
+/* Public: Find the ECU with a request arbitration ID, with a binary search.
+ *
+ * Returns the ECU, or NULL if it isn't in the database.
+ */
+const DiagnosticDatabaseEcu* diagnostic_database_find_ecu(
+        const DiagnosticDatabase* database, uint32_t request_id);
+
+/* Public: Find the parameters a request reads (e.g. to decode a response
+ * that arrived for it), with a binary search.
+ *
+ * Returns the first of them - any others carried by the same response follow
+ * it, with the same mode and pid - or NULL if it isn't in the database.
+ */
+const DiagnosticDatabaseParameter* diagnostic_database_find_request(
+        const DiagnosticDatabase* database, uint32_t request_id,
+        uint8_t mode, uint16_t pid);
+
+/* Public: Returns the ECU a parameter is read from, or NULL if the database
+ * is inconsistent.
+ */
+const DiagnosticDatabaseEcu* diagnostic_database_parameter_ecu(
+        const DiagnosticDatabase* database,
+        const DiagnosticDatabaseParameter* parameter);
+
+/* Public: Fill in the addressing of an ECU, e.g. to add it to a
+ * DiagnosticAddressingTable.
+ */
+void diagnostic_database_address(const DiagnosticDatabaseEcu* ecu,
+        DiagnosticAddress* address);
+
+/* Public: Fill in the request that reads a parameter, ready for
+ * generate_diagnostic_request(...).
+ *
+ * Returns false if the database is inconsistent.
+ */
+bool diagnostic_database_request(const DiagnosticDatabase* database,
+        const DiagnosticDatabaseParameter* parameter,
+        DiagnosticRequest* request);
+
+/* Public: Decode a parameter from a successful response to its request.
+ *
+ * Returns false if the response is unsuccessful or too short for the field.
+ */
+bool diagnostic_database_decode(const DiagnosticDatabaseParameter* parameter,
+        const DiagnosticResponse* response, DiagnosticFixedPoint* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_DATABASE_H__
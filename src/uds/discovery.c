@@ -0,0 +1,217 @@
+#include <uds/discovery.h>
+#include <uds/uds.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+#define EXTENDED_ID_MASK 0x1fffffff
+
+void diagnostic_discovery_init(DiagnosticDiscovery* discovery,
+        DiagnosticShims* shims, DiagnosticEcuDiscoveredHandler discovered,
+        void* context) {
+    memset(discovery, 0, sizeof(*discovery));
+    discovery->shims = shims;
+    discovery->discovered = discovered;
+    discovery->context = context;
+    discovery->probe.mode = DIAGNOSTIC_SERVICE_TESTER_PRESENT;
+    discovery->probe.has_pid = true;
+    discovery->probe.pid = 0x0;
+    discovery->probe.pid_length = 1;
+    discovery->max_in_flight = DIAGNOSTIC_DISCOVERY_DEFAULT_IN_FLIGHT;
+}
+
+static void record_answer(const DiagnosticResponse* response, void* context) {
+    DiagnosticDiscoveryProbe* probe = (DiagnosticDiscoveryProbe*) context;
+    DiagnosticDiscovery* discovery = probe->discovery;
+    if(response->timed_out || !response->completed) {
+        return;
+    }
+
+    const DiagnosticTimestamps* timestamps = &response->timestamps;
+    DiagnosticDiscoveredEcu ecu = {
+        request_id: probe->handle.address.request_id,
+        response_id: response->arbitration_id,
+        success: response->success,
+        negative_response_code: response->negative_response_code,
+        latency_us: timestamps->first_frame_sent != 0 &&
+                timestamps->completed >= timestamps->first_frame_sent ?
+                timestamps->completed - timestamps->first_frame_sent : 0
+    };
+    if(discovery->ecu_count < DIAGNOSTIC_DISCOVERY_MAX_ECUS) {
+        discovery->ecus[discovery->ecu_count++] = ecu;
+    }
+    if(discovery->discovered != NULL) {
+        discovery->discovered(&ecu, discovery->context);
+    }
+}
+
+// Returns the next request ID to probe, skipping functional IDs (like 0x7df)
+// that fall inside the range, or false if the range is used up.
+static bool next_request_id(DiagnosticDiscovery* discovery,
+        uint32_t* request_id) {
+    while(discovery->sweeping) {
+        uint32_t candidate = discovery->next_id;
+        if(discovery->last_id - candidate < discovery->step) {
+            discovery->sweeping = false;
+        } else {
+            discovery->next_id += discovery->step;
+        }
+
+        DiagnosticAddress address = diagnostic_addressing_resolve(
+                discovery->shims->addressing, candidate, 0);
+        if(!diagnostic_addressing_is_functional(&address)) {
+            *request_id = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fill the free slots with probes for the next addresses in the range. A
+// probe that can't be sent is counted as probed and skipped.
+static void fill_slots(DiagnosticDiscovery* discovery) {
+    uint8_t limit = MIN(MAX(discovery->max_in_flight, 1),
+            DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT);
+    uint8_t i;
+    for(i = 0; i < limit; ++i) {
+        DiagnosticDiscoveryProbe* probe = &discovery->probes[i];
+        while(!probe->active) {
+            DiagnosticRequest request = discovery->probe;
+            if(!next_request_id(discovery, &request.arbitration_id)) {
+                return;
+            }
+            if(request.timeout_ms == 0) {
+                request.timeout_ms = DIAGNOSTIC_DISCOVERY_TIMEOUT_MS;
+            }
+
+            ++discovery->probes_sent;
+            probe->discovery = discovery;
+            probe->handle = generate_diagnostic_request(discovery->shims,
+                    &request, NULL);
+            probe->handle.handler = record_answer;
+            probe->handle.context = probe;
+            start_diagnostic_request(discovery->shims, &probe->handle);
+            probe->active = !probe->handle.completed;
+        }
+    }
+}
+
+bool diagnostic_discovery_sweep(DiagnosticDiscovery* discovery,
+        uint32_t first_id, uint32_t last_id, uint32_t step) {
+    diagnostic_discovery_cancel(discovery);
+    discovery->ecu_count = 0;
+    discovery->probes_sent = 0;
+    if(step == 0 || last_id < first_id) {
+        return false;
+    }
+
+    discovery->next_id = first_id;
+    discovery->last_id = last_id;
+    discovery->step = step;
+    discovery->sweeping = true;
+    fill_slots(discovery);
+    return true;
+}
+
+void diagnostic_discovery_receive_can_frame(DiagnosticDiscovery* discovery,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    bool freed = false;
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT; ++i) {
+        DiagnosticDiscoveryProbe* probe = &discovery->probes[i];
+        if(probe->active) {
+            diagnostic_receive_can_frame(discovery->shims, &probe->handle,
+                    arbitration_id, data, size);
+            if(probe->handle.completed) {
+                probe->active = false;
+                freed = true;
+            }
+        }
+    }
+
+    if(freed) {
+        fill_slots(discovery);
+    }
+}
+
+uint64_t diagnostic_discovery_process(DiagnosticDiscovery* discovery,
+        uint64_t now) {
+    bool freed = false;
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT; ++i) {
+        DiagnosticDiscoveryProbe* probe = &discovery->probes[i];
+        if(probe->active) {
+            diagnostic_process_request(discovery->shims, &probe->handle, now);
+            if(probe->handle.completed) {
+                probe->active = false;
+                freed = true;
+            }
+        }
+    }
+
+    if(freed) {
+        fill_slots(discovery);
+    }
+
+    uint64_t deadline = DIAGNOSTIC_NO_DEADLINE;
+    for(i = 0; i < DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT; ++i) {
+        if(discovery->probes[i].active) {
+            deadline = MIN(deadline, diagnostic_request_deadline(
+                        &discovery->probes[i].handle));
+        }
+    }
+    return deadline;
+}
+
+bool diagnostic_discovery_finished(const DiagnosticDiscovery* discovery) {
+    if(discovery->sweeping) {
+        return false;
+    }
+
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT; ++i) {
+        if(discovery->probes[i].active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void diagnostic_discovery_cancel(DiagnosticDiscovery* discovery) {
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT; ++i) {
+        DiagnosticDiscoveryProbe* probe = &discovery->probes[i];
+        if(probe->active) {
+            diagnostic_request_release(discovery->shims, &probe->handle);
+            probe->active = false;
+        }
+    }
+    discovery->sweeping = false;
+}
+
+uint16_t diagnostic_discovery_to_addressing(
+        const DiagnosticDiscovery* discovery,
+        DiagnosticAddressingTable* table) {
+    uint16_t added = 0;
+    uint16_t i;
+    for(i = 0; i < discovery->ecu_count; ++i) {
+        const DiagnosticDiscoveredEcu* ecu = &discovery->ecus[i];
+        DiagnosticAddress address = diagnostic_addressing_resolve(
+                discovery->shims->addressing, ecu->request_id, 0);
+        address.response_id = ecu->response_id;
+        address.response_mask = EXTENDED_ID_MASK;
+        if(!diagnostic_addressing_add(table, &address)) {
+            break;
+        }
+        ++added;
+    }
+    return added;
+}
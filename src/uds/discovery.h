@@ -0,0 +1,162 @@
+#ifndef __UDS_DISCOVERY_H__
+#define __UDS_DISCOVERY_H__
+
+#include <uds/uds_types.h>
+#include <uds/addressing.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT
+#define DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT 32
+#endif
+
+#ifndef DIAGNOSTIC_DISCOVERY_MAX_ECUS
+#define DIAGNOSTIC_DISCOVERY_MAX_ECUS 64
+#endif
+
+#define DIAGNOSTIC_DISCOVERY_DEFAULT_IN_FLIGHT 16
+// An ECU that's there answers a TesterPresent well within P2 (50ms).
+#define DIAGNOSTIC_DISCOVERY_TIMEOUT_MS 50
+
+#define DIAGNOSTIC_SERVICE_TESTER_PRESENT 0x3e
+
+/* Public: An ECU that answered a discovery probe.
+ *
+ * request_id - The arbitration ID the probe was sent to.
+ * response_id - The arbitration ID the ECU answered on.
+ * success - True if the answer was positive. A negative response still means
+ *      there's an ECU at the address, one that doesn't support the probe.
+ * negative_response_code - If the answer was negative, its code.
+ * latency_us - The time from sending the probe to the answer, if a
+ *      GetTimeShim is available.
+ */
+typedef struct {
+    uint32_t request_id;
+    uint32_t response_id;
+    bool success;
+    DiagnosticNegativeResponseCode negative_response_code;
+    uint32_t latency_us;
+} DiagnosticDiscoveredEcu;
+
+typedef struct DiagnosticDiscovery DiagnosticDiscovery;
+
+/* Public: The signature for a function called as each ECU answers.
+ */
+typedef void (*DiagnosticEcuDiscoveredHandler)(
+        const DiagnosticDiscoveredEcu* ecu, void* context);
+
+// Private - one probe slot.
+typedef struct {
+    DiagnosticDiscovery* discovery;
+    DiagnosticRequestHandle handle;
+    bool active;
+} DiagnosticDiscoveryProbe;
+
+/* Public: Sweeps a range of physical request arbitration IDs for ECUs,
+ * keeping many probes in flight at once.
+ *
+ * Each address is sent the probe request - TesterPresent (0x3e 0x00) unless
+ * 'probe' is changed - and any answer, positive or negative, counts as an
+ * ECU. Addresses that stay silent for the probe's timeout are moved past, and
+ * the next address is probed in the freed slot.
+ *
+ * Use diagnostic_discovery_init(...) to create an instance. It must not move
+ * while a sweep is running.
+ *
+ * probe - The request sent to each address. The arbitration_id is replaced
+ *      for each probe, and a timeout_ms of 0 means
+ *      DIAGNOSTIC_DISCOVERY_TIMEOUT_MS rather than the usual default.
+ * max_in_flight - How many addresses are probed at once, up to
+ *      DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT.
+ * ecus - The ECUs that have answered, in the order they answered.
+ * ecu_count - The number of ECUs found. Answers beyond
+ *      DIAGNOSTIC_DISCOVERY_MAX_ECUS are still passed to the handler, but
+ *      aren't kept.
+ * probes_sent - The number of addresses probed so far.
+ */
+struct DiagnosticDiscovery {
+    DiagnosticShims* shims;
+    DiagnosticEcuDiscoveredHandler discovered;
+    void* context;
+    DiagnosticRequest probe;
+    uint8_t max_in_flight;
+    DiagnosticDiscoveredEcu ecus[DIAGNOSTIC_DISCOVERY_MAX_ECUS];
+    uint16_t ecu_count;
+    uint32_t probes_sent;
+
+    // Private
+    DiagnosticDiscoveryProbe probes[DIAGNOSTIC_DISCOVERY_MAX_IN_FLIGHT];
+    uint32_t next_id;
+    uint32_t last_id;
+    uint32_t step;
+    bool sweeping;
+};
+
+/* Public: Initialize a discovery with the default TesterPresent probe.
+ *
+ * discovered - (optional) Called as each ECU answers, with the context.
+ */
+void diagnostic_discovery_init(DiagnosticDiscovery* discovery,
+        DiagnosticShims* shims, DiagnosticEcuDiscoveredHandler discovered,
+        void* context);
+
+/* Public: Start sweeping the request arbitration IDs from first_id to last_id
+ * (inclusive), 'step' apart, forgetting any ECUs found before. The first
+ * probes are sent right away.
+ *
+ * For 11-bit IDs the step is usually 1 (e.g. 0x700-0x7f7). For 29-bit
+ * normal fixed addressing, the target address is the third byte, so sweep
+ * 0x18da00f1-0x18dafff1 with a step of 0x100.
+ *
+ * Returns false if the range is empty or the step is 0.
+ */
+bool diagnostic_discovery_sweep(DiagnosticDiscovery* discovery,
+        uint32_t first_id, uint32_t last_id, uint32_t step);
+
+/* Public: Pass a received CAN frame to the probes in flight. Probes that
+ * finish are replaced with the next addresses in the range.
+ */
+void diagnostic_discovery_receive_can_frame(DiagnosticDiscovery* discovery,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Time out silent addresses and probe the next ones - see
+ * diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE
+ * once the sweep is finished.
+ */
+uint64_t diagnostic_discovery_process(DiagnosticDiscovery* discovery,
+        uint64_t now);
+
+/* Public: Returns true once every address in the range has been probed and
+ * has answered or timed out.
+ */
+bool diagnostic_discovery_finished(const DiagnosticDiscovery* discovery);
+
+/* Public: Stop the sweep, releasing the probes in flight. The ECUs found so
+ * far are kept.
+ */
+void diagnostic_discovery_cancel(DiagnosticDiscovery* discovery);
+
+/* Public: Add the ECUs found to an addressing table, so the topology can be
+ * reused - and saved - without sweeping again. Only ECUs that answered on
+ * an ID other than the default for their request ID need an entry, but all
+ * are added so the table is a complete map of the vehicle.
+ *
+ * Returns the number of ECUs added, which is less than ecu_count if the
+ * table filled up.
+ */
+uint16_t diagnostic_discovery_to_addressing(
+        const DiagnosticDiscovery* discovery,
+        DiagnosticAddressingTable* table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_DISCOVERY_H__
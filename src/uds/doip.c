@@ -0,0 +1,278 @@
+#include <uds/doip.h>
+#include <uds/uds.h>
+#include <uds/bytes.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define ADDRESS_SIZE 2
+#define ROUTING_ACTIVATION_REQUEST_SIZE 7
+#define ROUTING_ACTIVATION_RESPONSE_SIZE 9
+#define DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE 4
+#define DEFAULT_ACTIVATION 0x0
+#define INVALID_HEADER_NACK 0x0
+// The service ID, PID and short payload of a request - see request_header in
+// DiagnosticRequestHandle.
+#define MAX_REQUEST_HEADER_SIZE (3 + MAX_UDS_REQUEST_PAYLOAD_LENGTH)
+
+size_t diagnostic_doip_write_header(uint8_t* destination,
+        DiagnosticDoipPayloadType payload_type, uint32_t payload_length) {
+    destination[0] = DIAGNOSTIC_DOIP_VERSION;
+    destination[1] = ~DIAGNOSTIC_DOIP_VERSION;
+    diagnostic_write_uint16(&destination[2], payload_type);
+    diagnostic_write_uint32(&destination[4], payload_length);
+    return DIAGNOSTIC_DOIP_HEADER_SIZE;
+}
+
+// The header's version and its inverse are the only sync pattern - anything
+// else means the stream can't be trusted.
+static bool valid_header(const uint8_t* header) {
+    return header[1] == (uint8_t) ~header[0];
+}
+
+// The payload length is checked against what's there before the header is
+// added to it, so a length near 2^32 can't wrap around.
+static uint32_t payload_length(const uint8_t* header) {
+    return diagnostic_read_uint32(&header[4]);
+}
+
+static bool write_message(DiagnosticDoipConnection* connection,
+        DiagnosticDoipPayloadType payload_type, const uint8_t* payload,
+        uint32_t payload_length) {
+    uint8_t message[DIAGNOSTIC_DOIP_HEADER_SIZE +
+            ROUTING_ACTIVATION_REQUEST_SIZE];
+    if(payload_length > sizeof(message) - DIAGNOSTIC_DOIP_HEADER_SIZE) {
+        return false;
+    }
+
+    size_t length = diagnostic_doip_write_header(message, payload_type,
+            payload_length);
+    memcpy(&message[length], payload, payload_length);
+    return connection->write(message, length + payload_length,
+            connection->context);
+}
+
+// The UDS message goes out as a header with the addresses and the short
+// part of the request, then the extended payload straight from the request.
+static bool send_diagnostic_message(const DiagnosticAddress* address,
+        const uint8_t* header, uint8_t header_length, const uint8_t* body,
+        uint32_t body_length, void* context) {
+    DiagnosticDoipConnection* connection = (DiagnosticDoipConnection*) context;
+    if(!connection->routing_active ||
+            header_length > MAX_REQUEST_HEADER_SIZE) {
+        return false;
+    }
+
+    uint8_t message[DIAGNOSTIC_DOIP_HEADER_SIZE +
+            DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE + MAX_REQUEST_HEADER_SIZE];
+    size_t length = diagnostic_doip_write_header(message,
+            DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE,
+            DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE + header_length + body_length);
+    diagnostic_write_uint16(&message[length], connection->tester_address);
+    diagnostic_write_uint16(&message[length + ADDRESS_SIZE],
+            address->request_id);
+    length += DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE;
+    memcpy(&message[length], header, header_length);
+    length += header_length;
+
+    return connection->write(message, length, connection->context) &&
+            (body_length == 0 ||
+                connection->write(body, body_length, connection->context));
+}
+
+void diagnostic_doip_init(DiagnosticDoipConnection* connection,
+        uint16_t tester_address, DiagnosticDoipWriteShim write,
+        void* context) {
+    memset(connection, 0, sizeof(*connection));
+    connection->write = write;
+    connection->context = context;
+    connection->tester_address = tester_address;
+    connection->transport.send = send_diagnostic_message;
+    connection->transport.context = connection;
+}
+
+bool diagnostic_doip_activate_routing(DiagnosticDoipConnection* connection) {
+    uint8_t request[ROUTING_ACTIVATION_REQUEST_SIZE] = {0};
+    diagnostic_write_uint16(request, connection->tester_address);
+    request[ADDRESS_SIZE] = DEFAULT_ACTIVATION;
+    connection->routing_active = false;
+    return write_message(connection,
+            DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_REQUEST, request,
+            sizeof(request));
+}
+
+static void receive_diagnostic_message(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims, DiagnosticRequestHandle* handles[],
+        size_t handle_count, const uint8_t* payload, uint32_t length) {
+    if(length < DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE ||
+            diagnostic_read_uint16(&payload[ADDRESS_SIZE]) !=
+                connection->tester_address) {
+        return;
+    }
+
+    uint16_t source = diagnostic_read_uint16(payload);
+    size_t i;
+    for(i = 0; i < handle_count; ++i) {
+        DiagnosticRequestHandle* handle = handles[i];
+        if(handle != NULL &&
+                (handle->address.request_id & 0xffff) == source) {
+            diagnostic_receive_message(shims, handle,
+                    handle->address.response_id,
+                    &payload[DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE],
+                    length - DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE);
+        }
+    }
+}
+
+// The entity refused a message, so the request it carried won't be
+// answered.
+static void receive_diagnostic_nack(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims, DiagnosticRequestHandle* handles[],
+        size_t handle_count, const uint8_t* payload, uint32_t length) {
+    ++connection->nacks;
+    if(length <= DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE ||
+            diagnostic_read_uint16(&payload[ADDRESS_SIZE]) !=
+                connection->tester_address) {
+        return;
+    }
+
+    uint16_t source = diagnostic_read_uint16(payload);
+    uint8_t code = payload[DIAGNOSTIC_MESSAGE_ADDRESSES_SIZE];
+    if(shims->log != NULL) {
+        shims->log("DoIP entity refused a message to 0x%x: 0x%x", source,
+                code);
+    }
+    size_t i;
+    for(i = 0; i < handle_count; ++i) {
+        DiagnosticRequestHandle* handle = handles[i];
+        if(handle != NULL &&
+                (handle->address.request_id & 0xffff) == source) {
+            diagnostic_request_refused(shims, handle,
+                    (DiagnosticNegativeResponseCode) code);
+        }
+    }
+}
+
+static void receive_message(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims, DiagnosticRequestHandle* handles[],
+        size_t handle_count, const uint8_t* message,
+        uint32_t payload_length) {
+    const uint8_t* payload = &message[DIAGNOSTIC_DOIP_HEADER_SIZE];
+    uint8_t tester_address[ADDRESS_SIZE];
+
+    switch(diagnostic_read_uint16(&message[2])) {
+        case DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE:
+            receive_diagnostic_message(connection, shims, handles,
+                    handle_count, payload, payload_length);
+            break;
+        case DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_RESPONSE:
+            if(payload_length >= ROUTING_ACTIVATION_RESPONSE_SIZE) {
+                connection->entity_address = diagnostic_read_uint16(
+                        &payload[ADDRESS_SIZE]);
+                connection->routing_response_code = payload[ADDRESS_SIZE * 2];
+                connection->routing_active =
+                        connection->routing_response_code ==
+                            DIAGNOSTIC_DOIP_ROUTING_SUCCESSFUL;
+            }
+            break;
+        case DIAGNOSTIC_DOIP_ALIVE_CHECK_REQUEST:
+            diagnostic_write_uint16(tester_address,
+                    connection->tester_address);
+            write_message(connection, DIAGNOSTIC_DOIP_ALIVE_CHECK_RESPONSE,
+                    tester_address, sizeof(tester_address));
+            break;
+        case DIAGNOSTIC_DOIP_DIAGNOSTIC_NACK:
+            receive_diagnostic_nack(connection, shims, handles, handle_count,
+                    payload, payload_length);
+            break;
+        default:
+            // acknowledgements and anything a tester doesn't need
+            break;
+    }
+}
+
+// Drop everything buffered and tell the entity - the stream is out of sync,
+// so the connection should be closed.
+static void reject_header(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims) {
+    uint8_t code = INVALID_HEADER_NACK;
+    connection->buffered = 0;
+    write_message(connection, DIAGNOSTIC_DOIP_GENERIC_NACK, &code, 1);
+    if(shims->log != NULL) {
+        shims->log("%s", "Invalid DoIP header received");
+    }
+}
+
+void diagnostic_doip_receive(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims, DiagnosticRequestHandle* handles[],
+        size_t handle_count, const uint8_t* data, size_t size) {
+    while(size > 0) {
+        if(connection->discarding > 0) {
+            size_t skipped = MIN(connection->discarding, size);
+            connection->discarding -= skipped;
+            data += skipped;
+            size -= skipped;
+            continue;
+        }
+
+        // a whole message at the front of the data is handled in place
+        if(connection->buffered == 0 && size >= DIAGNOSTIC_DOIP_HEADER_SIZE) {
+            if(!valid_header(data)) {
+                reject_header(connection, shims);
+                return;
+            }
+
+            uint32_t length = payload_length(data);
+            if(size - DIAGNOSTIC_DOIP_HEADER_SIZE >= length) {
+                receive_message(connection, shims, handles, handle_count,
+                        data, length);
+                data += DIAGNOSTIC_DOIP_HEADER_SIZE + (size_t) length;
+                size -= DIAGNOSTIC_DOIP_HEADER_SIZE + (size_t) length;
+                continue;
+            }
+        }
+
+        // otherwise, collect the message until it's all here - a buffered
+        // header has already been checked to fit
+        uint32_t wanted = DIAGNOSTIC_DOIP_HEADER_SIZE;
+        if(connection->buffered >= DIAGNOSTIC_DOIP_HEADER_SIZE) {
+            wanted += payload_length(connection->buffer);
+        }
+        size_t copied = MIN(wanted - connection->buffered, size);
+        memcpy(&connection->buffer[connection->buffered], data, copied);
+        connection->buffered += copied;
+        data += copied;
+        size -= copied;
+
+        if(connection->buffered == DIAGNOSTIC_DOIP_HEADER_SIZE) {
+            if(!valid_header(connection->buffer)) {
+                reject_header(connection, shims);
+                return;
+            }
+
+            uint32_t length = payload_length(connection->buffer);
+            if(length > sizeof(connection->buffer) -
+                    DIAGNOSTIC_DOIP_HEADER_SIZE) {
+                if(shims->log != NULL) {
+                    shims->log("DoIP message of %u bytes is too long",
+                            (unsigned) length);
+                }
+                connection->discarding = length;
+                connection->buffered = 0;
+                continue;
+            }
+            wanted = DIAGNOSTIC_DOIP_HEADER_SIZE + length;
+        }
+
+        if(connection->buffered >= DIAGNOSTIC_DOIP_HEADER_SIZE &&
+                connection->buffered == wanted) {
+            receive_message(connection, shims, handles, handle_count,
+                    connection->buffer,
+                    connection->buffered - DIAGNOSTIC_DOIP_HEADER_SIZE);
+            connection->buffered = 0;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef __UDS_DOIP_H__
+#define __UDS_DOIP_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTIC_DOIP_PORT 13400
+#define DIAGNOSTIC_DOIP_HEADER_SIZE 8
+#define DIAGNOSTIC_DOIP_VERSION 0x2
+#define DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS 0x0e00
+#define DIAGNOSTIC_DOIP_ROUTING_SUCCESSFUL 0x10
+
+// The longest message that can arrive split across reads - longer ones are
+// only handled when they're passed to diagnostic_doip_receive(...) whole.
+#ifndef DIAGNOSTIC_DOIP_BUFFER_SIZE
+#define DIAGNOSTIC_DOIP_BUFFER_SIZE (4096 + DIAGNOSTIC_DOIP_HEADER_SIZE + 4)
+#endif
+
+/* Public: The DoIP (ISO 13400-2) payload types used by a tester.
+ */
+typedef enum {
+    DIAGNOSTIC_DOIP_GENERIC_NACK = 0x0000,
+    DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_REQUEST = 0x0005,
+    DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_RESPONSE = 0x0006,
+    DIAGNOSTIC_DOIP_ALIVE_CHECK_REQUEST = 0x0007,
+    DIAGNOSTIC_DOIP_ALIVE_CHECK_RESPONSE = 0x0008,
+    DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE = 0x8001,
+    DIAGNOSTIC_DOIP_DIAGNOSTIC_ACK = 0x8002,
+    DIAGNOSTIC_DOIP_DIAGNOSTIC_NACK = 0x8003
+} DiagnosticDoipPayloadType;
+
+/* Public: The signature for a function that writes bytes to the TCP
+ * connection to a DoIP entity, e.g. with send(...).
+ *
+ * Returns true if all of the bytes were written.
+ */
+typedef bool (*DiagnosticDoipWriteShim)(const uint8_t* data, uint32_t size,
+        void* context);
+
+/* Public: A DoIP connection to a vehicle, and the DiagnosticTransport that
+ * sends requests over it.
+ *
+ * The connection doesn't own a socket - bytes are written with the 'write'
+ * shim, and bytes read from the socket are passed to
+ * diagnostic_doip_receive(...). Assign &connection->transport to the
+ * 'transport' field of the DiagnosticShims, then activate routing before
+ * sending requests.
+ *
+ * Requests are addressed by DoIP logical address: a request's
+ * arbitration_id is the ECU's logical address (e.g. 0x1001), and responses
+ * from that address are passed to the request's handle.
+ *
+ * Use diagnostic_doip_init(...) to create an instance. It must not move once
+ * its transport is in use.
+ *
+ * tester_address - The logical address of the tester.
+ * entity_address - The logical address of the DoIP entity, from the routing
+ *      activation response.
+ * routing_active - True once the entity has accepted routing activation.
+ * routing_response_code - The code of the last routing activation response.
+ * nacks - The number of diagnostic messages the entity refused (0x8003).
+ *      The requests they carried fail right away, with the entity's NACK
+ *      code (0x02-0x08, below any UDS code) as their
+ *      negative_response_code.
+ * transport - The transport for the DiagnosticShims.
+ */
+typedef struct {
+    DiagnosticDoipWriteShim write;
+    void* context;
+    uint16_t tester_address;
+    uint16_t entity_address;
+    bool routing_active;
+    uint8_t routing_response_code;
+    uint32_t nacks;
+    DiagnosticTransport transport;
+
+    // Private
+    uint8_t buffer[DIAGNOSTIC_DOIP_BUFFER_SIZE];
+    uint32_t buffered;
+    uint32_t discarding;
+} DiagnosticDoipConnection;
+
+void diagnostic_doip_init(DiagnosticDoipConnection* connection,
+        uint16_t tester_address, DiagnosticDoipWriteShim write,
+        void* context);
+
+/* Public: Ask the DoIP entity to route diagnostic messages from the tester
+ * (activation type 0x00, default). Routing is active once the response has
+ * been passed to diagnostic_doip_receive(...).
+ *
+ * Returns false if the request couldn't be written.
+ */
+bool diagnostic_doip_activate_routing(DiagnosticDoipConnection* connection);
+
+/* Public: Process bytes read from the connection, in any size of chunk.
+ *
+ * Diagnostic messages are passed to the handles whose request was sent to
+ * the message's source address, with diagnostic_receive_message(...), and
+ * refused ones fail those handles with diagnostic_request_refused(...).
+ * Alive checks are answered. A message that arrives whole in one chunk is
+ * handled in place, without being copied.
+ *
+ * handles - The requests in progress. NULL entries are skipped.
+ */
+void diagnostic_doip_receive(DiagnosticDoipConnection* connection,
+        DiagnosticShims* shims, DiagnosticRequestHandle* handles[],
+        size_t handle_count, const uint8_t* data, size_t size);
+
+/* Public: Write a DoIP generic header.
+ *
+ * destination - Room for DIAGNOSTIC_DOIP_HEADER_SIZE bytes.
+ *
+ * Returns DIAGNOSTIC_DOIP_HEADER_SIZE.
+ */
+size_t diagnostic_doip_write_header(uint8_t* destination,
+        DiagnosticDoipPayloadType payload_type, uint32_t payload_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_DOIP_H__
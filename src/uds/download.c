@@ -0,0 +1,237 @@
+#include <uds/download.h>
+#include <uds/uds.h>
+#include <uds/request_driver.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define DEFAULT_FIELD_LENGTH 4
+
+static bool in_flight(const DiagnosticDownload* download) {
+    return download->state == DIAGNOSTIC_DOWNLOAD_REQUESTING ||
+            download->state == DIAGNOSTIC_DOWNLOAD_TRANSFERRING ||
+            download->state == DIAGNOSTIC_DOWNLOAD_EXITING;
+}
+
+static uint8_t field_length(uint8_t length) {
+    return length >= 1 && length <= 4 ? length : DEFAULT_FIELD_LENGTH;
+}
+
+void diagnostic_download_init(DiagnosticDownload* download,
+        DiagnosticShims* shims, const DiagnosticDownloadConfig* config) {
+    memset(download, 0, sizeof(*download));
+    download->shims = shims;
+    download->config = *config;
+    download->state = DIAGNOSTIC_DOWNLOAD_IDLE;
+}
+
+bool diagnostic_download_finished(const DiagnosticDownload* download) {
+    return download->state == DIAGNOSTIC_DOWNLOAD_COMPLETE ||
+            download->state == DIAGNOSTIC_DOWNLOAD_FAILED;
+}
+
+static void fail(DiagnosticDownload* download,
+        DiagnosticNegativeResponseCode negative_response_code,
+        bool timed_out) {
+    download->state = DIAGNOSTIC_DOWNLOAD_FAILED;
+    download->negative_response_code = negative_response_code;
+    download->timed_out = timed_out;
+}
+
+static bool send(DiagnosticDownload* download, DiagnosticDownloadState state,
+        uint8_t mode, bool has_pid, uint8_t pid, const uint8_t* payload,
+        uint32_t payload_length) {
+    DiagnosticRequest request = {
+        arbitration_id: download->config.arbitration_id,
+        mode: mode,
+        has_pid: has_pid,
+        pid: pid,
+        pid_length: has_pid ? 1 : 0
+    };
+    diagnostic_request_set_payload(&request, payload, payload_length);
+
+    download->state = state;
+    if(!diagnostic_request_driver_send(download->shims, &download->driver,
+                &request)) {
+        fail(download, NRC_SUCCESS, false);
+        return false;
+    }
+    return true;
+}
+
+static void write_field(uint8_t* destination, uint32_t value,
+        uint8_t length) {
+    uint8_t i;
+    for(i = 0; i < length; ++i) {
+        destination[i] = value >> ((length - 1 - i) * 8);
+    }
+}
+
+static bool request_download(DiagnosticDownload* download) {
+    const DiagnosticDownloadConfig* config = &download->config;
+    uint8_t address_length = field_length(config->address_length);
+    uint8_t size_length = field_length(config->size_length);
+    uint8_t* request = download->request;
+    // compressionMethod and encryptingMethod
+    request[0] = download->compressed ? config->compression_method << 4 : 0;
+    // addressAndLengthFormatIdentifier
+    request[1] = size_length << 4 | address_length;
+    write_field(&request[2], config->memory_address, address_length);
+    write_field(&request[2 + address_length], config->memory_size,
+            size_length);
+    return send(download, DIAGNOSTIC_DOWNLOAD_REQUESTING,
+            DIAGNOSTIC_SERVICE_REQUEST_DOWNLOAD, false, 0, request,
+            2 + address_length + size_length);
+}
+
+// Read or compress the next block and send it, or end the transfer once the
+// whole image is sent.
+static void send_next_block(DiagnosticDownload* download) {
+    const DiagnosticDownloadConfig* config = &download->config;
+    uint32_t length;
+    if(download->compressed) {
+        length = diagnostic_lzss_compress_block(&download->compressor,
+                download->block, download->block_length);
+        if(download->compressor.failed) {
+            fail(download, NRC_SUCCESS, false);
+            return;
+        }
+        download->image_offset = download->compressor.consumed;
+    } else {
+        length = MIN(download->block_length,
+                config->memory_size - download->image_offset);
+        if(length > 0 && (config->read == NULL || !config->read(
+                        download->image_offset, download->block, length,
+                        config->context))) {
+            fail(download, NRC_SUCCESS, false);
+            return;
+        }
+        download->image_offset += length;
+    }
+
+    if(length == 0) {
+        send(download, DIAGNOSTIC_DOWNLOAD_EXITING,
+                DIAGNOSTIC_SERVICE_REQUEST_TRANSFER_EXIT, false, 0, NULL, 0);
+        return;
+    }
+
+    download->transferred += length;
+    send(download, DIAGNOSTIC_DOWNLOAD_TRANSFERRING,
+            DIAGNOSTIC_SERVICE_TRANSFER_DATA, true, download->sequence,
+            download->block, length);
+}
+
+// The positive response to RequestDownload has the length of the
+// maxNumberOfBlockLength in its first nibble, then the length itself, which
+// counts the service ID and block sequence counter.
+static void start_transfer(DiagnosticDownload* download) {
+    const uint8_t* payload = download->driver.response.payload;
+    uint8_t payload_length = download->driver.response.payload_length;
+    uint8_t length_size = payload_length > 0 ? payload[0] >> 4 : 0;
+    if(length_size < 1 || length_size > 4 ||
+            payload_length < 1 + length_size) {
+        fail(download, NRC_SUCCESS, false);
+        return;
+    }
+
+    uint32_t max_block_length = 0;
+    uint8_t i;
+    for(i = 0; i < length_size; ++i) {
+        max_block_length = max_block_length << 8 | payload[1 + i];
+    }
+    download->block_length = max_block_length > 2 ?
+            MIN(max_block_length - 2, DIAGNOSTIC_DOWNLOAD_BLOCK_SIZE) : 0;
+    if(download->block_length == 0 || (download->compressed &&
+                download->block_length < DIAGNOSTIC_LZSS_GROUP_SIZE)) {
+        fail(download, NRC_SUCCESS, false);
+        return;
+    }
+
+    if(download->compressed) {
+        diagnostic_lzss_init(&download->compressor,
+                download->config.memory_size, download->config.read,
+                download->config.context);
+    }
+    download->image_offset = 0;
+    download->transferred = 0;
+    download->blocks = 0;
+    // the first block is 1, and the counter wraps around to 0
+    download->sequence = 1;
+    send_next_block(download);
+}
+
+static void handle_response(DiagnosticDownload* download) {
+    download->driver.response_received = false;
+    const DiagnosticResponse* response = &download->driver.response;
+    if(!response->success) {
+        if(response->timed_out) {
+            fail(download, NRC_SUCCESS, true);
+        } else if(download->state == DIAGNOSTIC_DOWNLOAD_REQUESTING &&
+                download->compressed && response->negative_response_code ==
+                    NRC_REQUEST_OUT_OF_RANGE) {
+            // the bootloader doesn't have the compression
+            download->compressed = false;
+            request_download(download);
+        } else {
+            fail(download, response->negative_response_code, false);
+        }
+        return;
+    }
+
+    switch(download->state) {
+        case DIAGNOSTIC_DOWNLOAD_REQUESTING:
+            start_transfer(download);
+            break;
+        case DIAGNOSTIC_DOWNLOAD_TRANSFERRING:
+            ++download->blocks;
+            ++download->sequence;
+            send_next_block(download);
+            break;
+        case DIAGNOSTIC_DOWNLOAD_EXITING:
+            download->state = DIAGNOSTIC_DOWNLOAD_COMPLETE;
+            break;
+        default:
+            break;
+    }
+}
+
+bool diagnostic_download_start(DiagnosticDownload* download) {
+    if(in_flight(download)) {
+        diagnostic_request_release(download->shims, &download->driver.handle);
+    }
+    download->compressed =
+            download->config.compression != DIAGNOSTIC_COMPRESSION_NONE;
+    download->negative_response_code = NRC_SUCCESS;
+    download->timed_out = false;
+    return request_download(download);
+}
+
+void diagnostic_download_receive_can_frame(DiagnosticDownload* download,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    if(in_flight(download)) {
+        diagnostic_receive_can_frame(download->shims, &download->driver.handle,
+                arbitration_id, data, size);
+        if(download->driver.response_received) {
+            handle_response(download);
+        }
+    }
+}
+
+uint64_t diagnostic_download_process(DiagnosticDownload* download,
+        uint64_t now) {
+    if(!in_flight(download)) {
+        return DIAGNOSTIC_NO_DEADLINE;
+    }
+
+    diagnostic_process_request(download->shims, &download->driver.handle, now);
+    if(download->driver.response_received) {
+        handle_response(download);
+    }
+    return in_flight(download) ?
+            diagnostic_request_deadline(&download->driver.handle) :
+            DIAGNOSTIC_NO_DEADLINE;
+}
@@ -0,0 +1,145 @@
+#ifndef __UDS_DOWNLOAD_H__
+#define __UDS_DOWNLOAD_H__
+
+#include <uds/uds_types.h>
+#include <uds/compression.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The most data sent in one TransferData request - the most a classic
+// ISO-TP message holds, less the service ID and block sequence counter. The
+// ECU's maxNumberOfBlockLength may make blocks smaller.
+#ifndef DIAGNOSTIC_DOWNLOAD_BLOCK_SIZE
+#define DIAGNOSTIC_DOWNLOAD_BLOCK_SIZE 4093
+#endif
+
+#define DIAGNOSTIC_SERVICE_REQUEST_DOWNLOAD 0x34
+#define DIAGNOSTIC_SERVICE_TRANSFER_DATA 0x36
+#define DIAGNOSTIC_SERVICE_REQUEST_TRANSFER_EXIT 0x37
+
+/* Public: The ways the library can compress an image on its way to an ECU.
+ */
+typedef enum {
+    DIAGNOSTIC_COMPRESSION_NONE,
+    DIAGNOSTIC_COMPRESSION_LZSS
+} DiagnosticCompression;
+
+/* Public: Where a download is.
+ */
+typedef enum {
+    DIAGNOSTIC_DOWNLOAD_IDLE,
+    DIAGNOSTIC_DOWNLOAD_REQUESTING,
+    DIAGNOSTIC_DOWNLOAD_TRANSFERRING,
+    DIAGNOSTIC_DOWNLOAD_EXITING,
+    DIAGNOSTIC_DOWNLOAD_COMPLETE,
+    DIAGNOSTIC_DOWNLOAD_FAILED
+} DiagnosticDownloadState;
+
+/* Public: What to download to an ECU, and how it takes it.
+ *
+ * arbitration_id - The request arbitration ID of the ECU.
+ * memory_address - Where the image goes, as the ECU understands it.
+ * memory_size - The size of the image, uncompressed.
+ * address_length - The number of bytes of the memoryAddress to send, from 1
+ *      to 4. If 0, 4 are sent.
+ * size_length - The number of bytes of the memorySize to send, from 1 to 4.
+ *      If 0, 4 are sent.
+ * compression - How to compress the image, if the ECU's bootloader supports
+ *      it.
+ * compression_method - The compressionMethod the ECU's bootloader has for the
+ *      compression, sent in the high nibble of the dataFormatIdentifier. The
+ *      values are the manufacturer's, so this is per ECU.
+ * read - Reads the image. It's read a block at a time, as it's sent.
+ * context - Passed to the read shim.
+ */
+typedef struct {
+    uint32_t arbitration_id;
+    uint32_t memory_address;
+    uint32_t memory_size;
+    uint8_t address_length;
+    uint8_t size_length;
+    DiagnosticCompression compression;
+    uint8_t compression_method;
+    DiagnosticImageReadShim read;
+    void* context;
+} DiagnosticDownloadConfig;
+
+/* Public: Downloads an image to an ECU (already in the programming session
+ * and unlocked, e.g. with uds/session.h): RequestDownload (0x34), a
+ * TransferData (0x36) for each block and RequestTransferExit (0x37).
+ *
+ * With compression, each block is compressed from the image as it's sent, so
+ * a compressible image takes a fraction of the bus time and still only the
+ * download's own fixed memory. If the ECU refuses the dataFormatIdentifier
+ * (requestOutOfRange), the download is requested again uncompressed.
+ *
+ * state - Where the download is.
+ * compressed - True if the image is being sent compressed.
+ * block_length - The most data in each TransferData, from the ECU's
+ *      maxNumberOfBlockLength.
+ * image_offset - How much of the image has been read in to blocks.
+ * transferred - How much data has been sent in blocks, compressed or not.
+ * blocks - The number of blocks the ECU has accepted.
+ * negative_response_code - If the download failed because of a negative
+ *      response, its code.
+ * timed_out - If the download failed because the ECU didn't respond.
+ *
+ * Use diagnostic_download_init(...) to create an instance. It must not move
+ * once it's started.
+ */
+typedef struct {
+    DiagnosticDownloadState state;
+    bool compressed;
+    uint32_t block_length;
+    uint32_t image_offset;
+    uint32_t transferred;
+    uint32_t blocks;
+    DiagnosticNegativeResponseCode negative_response_code;
+    bool timed_out;
+
+    // Private
+    DiagnosticShims* shims;
+    DiagnosticDownloadConfig config;
+    DiagnosticRequestDriver driver;
+    uint8_t sequence;
+    uint8_t request[10];
+    uint8_t block[DIAGNOSTIC_DOWNLOAD_BLOCK_SIZE];
+    DiagnosticLzssCompressor compressor;
+} DiagnosticDownload;
+
+void diagnostic_download_init(DiagnosticDownload* download,
+        DiagnosticShims* shims, const DiagnosticDownloadConfig* config);
+
+/* Public: Send the RequestDownload.
+ *
+ * Returns false if it couldn't be sent.
+ */
+bool diagnostic_download_start(DiagnosticDownload* download);
+
+/* Public: Pass a received CAN frame to the download.
+ */
+void diagnostic_download_receive_can_frame(DiagnosticDownload* download,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Send the frames of a block that are due and time out the ECU - see
+ * diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE.
+ */
+uint64_t diagnostic_download_process(DiagnosticDownload* download,
+        uint64_t now);
+
+/* Public: Returns true if the download has completed or failed.
+ */
+bool diagnostic_download_finished(const DiagnosticDownload* download);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_DOWNLOAD_H__
@@ -0,0 +1,410 @@
+#include <uds/dynamic.h>
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <uds/bytes.h>
+#include <uds/framing.h>
+#include <uds/request_driver.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+// The response SID and the 2 byte DID in front of the data
+#define READ_RESPONSE_OVERHEAD 3
+
+void diagnostic_dynamic_poller_init(DiagnosticDynamicPoller* poller,
+        DiagnosticShims* shims, uint32_t arbitration_id) {
+    memset(poller, 0, sizeof(*poller));
+    poller->shims = shims;
+    poller->arbitration_id = arbitration_id;
+    poller->first_identifier = DIAGNOSTIC_DYNAMIC_FIRST_DID;
+    poller->max_response_frames = 1;
+    poller->max_elements = DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS;
+}
+
+bool diagnostic_dynamic_add_signal(DiagnosticDynamicPoller* poller,
+        uint16_t source_did, uint8_t position, uint8_t length,
+        DiagnosticDynamicSignalReceived handler, void* context) {
+    if(poller->signal_count >= DIAGNOSTIC_DYNAMIC_MAX_SIGNALS ||
+            poller->state != DIAGNOSTIC_DYNAMIC_IDLE || length == 0) {
+        return false;
+    }
+
+    DiagnosticDynamicSignal* signal = &poller->signals[poller->signal_count++];
+    memset(signal, 0, sizeof(*signal));
+    signal->source_did = source_did;
+    signal->position = position;
+    signal->length = length;
+    signal->handler = handler;
+    signal->context = context;
+    poller->planned = false;
+    return true;
+}
+
+uint8_t diagnostic_dynamic_capacity(const DiagnosticAddress* address,
+        uint8_t frames) {
+    uint8_t frame_size = address->frame_size > DIAGNOSTIC_CLASSIC_FRAME_SIZE ?
+            MIN(address->frame_size, DIAGNOSTIC_FD_FRAME_SIZE) :
+            DIAGNOSTIC_CLASSIC_FRAME_SIZE;
+    if(address->mode == DIAGNOSTIC_ADDRESSING_EXTENDED ||
+            address->mode == DIAGNOSTIC_ADDRESSING_MIXED) {
+        --frame_size;
+    }
+
+    // single frames have a 1 byte PCI on classic CAN and 2 on CAN FD, first
+    // frames 2 and consecutive frames 1
+    uint32_t data_length;
+    if(frames <= 1) {
+        data_length = frame_size - (frame_size > DIAGNOSTIC_CLASSIC_FRAME_SIZE ?
+                2 : 1);
+    } else {
+        data_length = (frame_size - 2) + (frames - 1) * (frame_size - 1);
+    }
+    return MIN(data_length - READ_RESPONSE_OVERHEAD,
+            MAX_UDS_RESPONSE_PAYLOAD_LENGTH);
+}
+
+typedef struct {
+    DiagnosticDynamicElement element;
+    uint8_t composite;
+    uint8_t offset;
+} PlannedElement;
+
+bool diagnostic_dynamic_plan(DiagnosticDynamicPoller* poller) {
+    DiagnosticAddress address = diagnostic_addressing_resolve(
+            poller->shims->addressing, poller->arbitration_id, 0);
+    uint8_t capacity = diagnostic_dynamic_capacity(&address,
+            poller->max_response_frames);
+    uint8_t max_elements = MAX(1, MIN(poller->max_elements,
+            DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS));
+
+    // sort the signals by where they are, so ranges of the same DID are
+    // next to each other
+    uint8_t order[DIAGNOSTIC_DYNAMIC_MAX_SIGNALS];
+    uint8_t i, j;
+    for(i = 0; i < poller->signal_count; ++i) {
+        const DiagnosticDynamicSignal* signal = &poller->signals[i];
+        for(j = i; j > 0; --j) {
+            const DiagnosticDynamicSignal* other =
+                    &poller->signals[order[j - 1]];
+            if(other->source_did < signal->source_did ||
+                    (other->source_did == signal->source_did &&
+                        other->position <= signal->position)) {
+                break;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    // merge overlapping and adjacent ranges, as long as they still fit
+    PlannedElement elements[DIAGNOSTIC_DYNAMIC_MAX_SIGNALS];
+    uint8_t element_of[DIAGNOSTIC_DYNAMIC_MAX_SIGNALS];
+    uint8_t element_count = 0;
+    for(i = 0; i < poller->signal_count; ++i) {
+        const DiagnosticDynamicSignal* signal = &poller->signals[order[i]];
+        uint16_t end = signal->position + signal->length;
+        DiagnosticDynamicElement* last = element_count > 0 ?
+                &elements[element_count - 1].element : NULL;
+        if(last != NULL && last->source_did == signal->source_did &&
+                signal->position <= last->position + last->length &&
+                MAX(end, last->position + last->length) - last->position <=
+                    capacity) {
+            last->length = MAX(end, last->position + last->length) -
+                    last->position;
+        } else {
+            last = &elements[element_count++].element;
+            last->source_did = signal->source_did;
+            last->position = signal->position;
+            last->length = signal->length;
+        }
+        element_of[order[i]] = element_count - 1;
+    }
+
+    // pack the ranges in to as few DIDs as hold them, longest first
+    for(i = 0; i < element_count; ++i) {
+        order[i] = i;
+        for(j = i; j > 0 && elements[order[j - 1]].element.length <
+                elements[i].element.length; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    memset(poller->composites, 0, sizeof(poller->composites));
+    poller->composite_count = 0;
+    for(i = 0; i < element_count; ++i) {
+        PlannedElement* planned = &elements[order[i]];
+        DiagnosticDynamicComposite* composite = NULL;
+        for(j = 0; j < poller->composite_count; ++j) {
+            if(poller->composites[j].element_count < max_elements &&
+                    poller->composites[j].length +
+                        planned->element.length <= capacity) {
+                composite = &poller->composites[j];
+                break;
+            }
+        }
+        if(composite == NULL) {
+            if(poller->composite_count >= DIAGNOSTIC_DYNAMIC_MAX_COMPOSITES) {
+                poller->composite_count = 0;
+                return false;
+            }
+            composite = &poller->composites[poller->composite_count];
+            composite->identifier = poller->first_identifier +
+                    poller->composite_count++;
+        }
+
+        planned->composite = composite - poller->composites;
+        planned->offset = composite->length;
+        composite->elements[composite->element_count++] = planned->element;
+        composite->length += planned->element.length;
+    }
+
+    for(i = 0; i < poller->signal_count; ++i) {
+        DiagnosticDynamicSignal* signal = &poller->signals[i];
+        const PlannedElement* planned = &elements[element_of[i]];
+        signal->composite = planned->composite;
+        signal->offset = planned->offset + signal->position -
+                planned->element.position;
+    }
+    poller->planned = true;
+    return true;
+}
+
+static bool send(DiagnosticDynamicPoller* poller, uint8_t mode, uint16_t pid,
+        uint8_t pid_length, const uint8_t* payload, uint8_t payload_length) {
+    DiagnosticRequest request = {
+        arbitration_id: poller->arbitration_id,
+        mode: mode,
+        has_pid: true,
+        pid: pid,
+        pid_length: pid_length
+    };
+    diagnostic_request_set_payload(&request, payload, payload_length);
+    if(!diagnostic_request_driver_send(poller->shims, &poller->driver,
+                &request)) {
+        poller->state = DIAGNOSTIC_DYNAMIC_IDLE;
+        return false;
+    }
+    return true;
+}
+
+static bool send_clear(DiagnosticDynamicPoller* poller,
+        const DiagnosticDynamicComposite* composite) {
+    uint8_t payload[2];
+    diagnostic_write_uint16(payload, composite->identifier);
+    return send(poller, DIAGNOSTIC_SERVICE_DYNAMICALLY_DEFINE,
+            DIAGNOSTIC_DYNAMIC_CLEAR, 1, payload, sizeof(payload));
+}
+
+// Each element is its source DID, its 1-based position and its size.
+static bool send_definition(DiagnosticDynamicPoller* poller,
+        const DiagnosticDynamicComposite* composite) {
+    uint8_t* payload = poller->request_payload;
+    uint8_t length = 0;
+    diagnostic_write_uint16(payload, composite->identifier);
+    length += 2;
+
+    uint8_t i;
+    for(i = 0; i < composite->element_count; ++i) {
+        const DiagnosticDynamicElement* element = &composite->elements[i];
+        diagnostic_write_uint16(&payload[length], element->source_did);
+        payload[length + 2] = element->position + 1;
+        payload[length + 3] = element->length;
+        length += 4;
+    }
+    return send(poller, DIAGNOSTIC_SERVICE_DYNAMICALLY_DEFINE,
+            DIAGNOSTIC_DYNAMIC_DEFINE_BY_IDENTIFIER, 1, payload, length);
+}
+
+static bool send_read(DiagnosticDynamicPoller* poller,
+        const DiagnosticDynamicComposite* composite) {
+    return send(poller, OBD2_MODE_ENHANCED_DIAGNOSTIC_REQUEST,
+            composite->direct ? composite->elements[0].source_did :
+                composite->identifier, 2, NULL, 0);
+}
+
+// Send the next request of the poll - clearing the next DID that isn't
+// defined, or reading the next DID - or finish the poll.
+static bool advance(DiagnosticDynamicPoller* poller) {
+    if(poller->state == DIAGNOSTIC_DYNAMIC_CLEARING) {
+        while(poller->current < poller->composite_count) {
+            DiagnosticDynamicComposite* composite =
+                    &poller->composites[poller->current];
+            if(!composite->defined && !composite->direct) {
+                // definitions add to what's already there, so each DID is
+                // cleared first
+                return send_clear(poller, composite);
+            }
+            ++poller->current;
+        }
+        poller->state = DIAGNOSTIC_DYNAMIC_READING;
+        poller->current = poller->resume;
+    }
+
+    if(poller->current < poller->composite_count) {
+        return send_read(poller, &poller->composites[poller->current]);
+    }
+
+    poller->state = DIAGNOSTIC_DYNAMIC_IDLE;
+    ++poller->polls;
+    return true;
+}
+
+static void start_definitions(DiagnosticDynamicPoller* poller,
+        uint8_t resume) {
+    poller->state = DIAGNOSTIC_DYNAMIC_CLEARING;
+    poller->current = 0;
+    poller->resume = resume;
+}
+
+static void pass_signals(DiagnosticDynamicPoller* poller,
+        const DiagnosticDynamicComposite* composite,
+        const DiagnosticResponse* response) {
+    const uint8_t* data = response->extended_payload != NULL ?
+            response->extended_payload : response->payload;
+    uint32_t length = response->extended_payload != NULL ?
+            response->extended_payload_length : response->payload_length;
+    // a source DID read directly has all of its data
+    uint8_t base = composite->direct ? composite->elements[0].position : 0;
+
+    uint8_t i;
+    for(i = 0; i < poller->signal_count; ++i) {
+        const DiagnosticDynamicSignal* signal = &poller->signals[i];
+        if(signal->composite == poller->current &&
+                base + signal->offset + signal->length <= length &&
+                signal->handler != NULL) {
+            signal->handler(signal, &data[base + signal->offset],
+                    signal->context);
+        }
+    }
+}
+
+static void handle_definition(DiagnosticDynamicPoller* poller,
+        const DiagnosticResponse* response) {
+    DiagnosticDynamicComposite* composite =
+            &poller->composites[poller->current];
+    if(response->success) {
+        composite->defined = true;
+        ++poller->current;
+    } else if(composite->element_count > 1) {
+        // the ECU may have a lower limit on the ranges in a definition than
+        // we assumed - try again with half as many
+        poller->max_elements = composite->element_count / 2;
+        ++poller->replans;
+        diagnostic_dynamic_plan(poller);
+        start_definitions(poller, 0);
+        return;
+    } else {
+        composite->direct = true;
+        ++poller->current;
+    }
+    poller->state = DIAGNOSTIC_DYNAMIC_CLEARING;
+}
+
+static void handle_read(DiagnosticDynamicPoller* poller,
+        const DiagnosticResponse* response) {
+    DiagnosticDynamicComposite* composite =
+            &poller->composites[poller->current];
+    if(response->success) {
+        pass_signals(poller, composite, response);
+    } else if(!composite->direct && !poller->redefined &&
+            response->negative_response_code == NRC_REQUEST_OUT_OF_RANGE) {
+        // the ECU doesn't know the DID any more, so it's lost all of them
+        poller->redefined = true;
+        ++poller->redefinitions;
+        diagnostic_dynamic_redefine(poller);
+        start_definitions(poller, poller->current);
+        return;
+    } else {
+        ++poller->read_failures;
+    }
+    ++poller->current;
+}
+
+static void handle_response(DiagnosticDynamicPoller* poller) {
+    poller->driver.response_received = false;
+    const DiagnosticResponse* response = &poller->driver.response;
+    if(response->timed_out) {
+        if(poller->state == DIAGNOSTIC_DYNAMIC_READING) {
+            ++poller->read_failures;
+            ++poller->current;
+        } else {
+            // an ECU that doesn't answer can't be set up
+            poller->state = DIAGNOSTIC_DYNAMIC_IDLE;
+            return;
+        }
+    } else {
+        switch(poller->state) {
+            case DIAGNOSTIC_DYNAMIC_CLEARING:
+                // it's fine if there was nothing to clear
+                poller->state = DIAGNOSTIC_DYNAMIC_DEFINING;
+                send_definition(poller, &poller->composites[poller->current]);
+                return;
+            case DIAGNOSTIC_DYNAMIC_DEFINING:
+                handle_definition(poller, response);
+                break;
+            case DIAGNOSTIC_DYNAMIC_READING:
+                handle_read(poller, response);
+                break;
+            default:
+                return;
+        }
+    }
+    advance(poller);
+}
+
+bool diagnostic_dynamic_poll(DiagnosticDynamicPoller* poller) {
+    if(poller->state != DIAGNOSTIC_DYNAMIC_IDLE ||
+            (!poller->planned && !diagnostic_dynamic_plan(poller))) {
+        return false;
+    }
+
+    poller->redefined = false;
+    start_definitions(poller, 0);
+    return advance(poller);
+}
+
+void diagnostic_dynamic_redefine(DiagnosticDynamicPoller* poller) {
+    uint8_t i;
+    for(i = 0; i < poller->composite_count; ++i) {
+        poller->composites[i].defined = false;
+    }
+}
+
+void diagnostic_dynamic_receive_can_frame(DiagnosticDynamicPoller* poller,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    if(poller->state != DIAGNOSTIC_DYNAMIC_IDLE) {
+        diagnostic_receive_can_frame(poller->shims, &poller->driver.handle,
+                arbitration_id, data, size);
+        if(poller->driver.response_received) {
+            handle_response(poller);
+        }
+    }
+}
+
+uint64_t diagnostic_dynamic_process(DiagnosticDynamicPoller* poller,
+        uint64_t now) {
+    if(poller->state == DIAGNOSTIC_DYNAMIC_IDLE) {
+        return DIAGNOSTIC_NO_DEADLINE;
+    }
+
+    diagnostic_process_request(poller->shims, &poller->driver.handle, now);
+    if(poller->driver.response_received) {
+        handle_response(poller);
+    }
+    return poller->state != DIAGNOSTIC_DYNAMIC_IDLE ?
+            diagnostic_request_deadline(&poller->driver.handle) :
+            DIAGNOSTIC_NO_DEADLINE;
+}
+
+bool diagnostic_dynamic_finished(const DiagnosticDynamicPoller* poller) {
+    return poller->state == DIAGNOSTIC_DYNAMIC_IDLE;
+}
@@ -0,0 +1,211 @@
+#ifndef __UDS_DYNAMIC_H__
+#define __UDS_DYNAMIC_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DIAGNOSTIC_DYNAMIC_MAX_SIGNALS
+#define DIAGNOSTIC_DYNAMIC_MAX_SIGNALS 64
+#endif
+
+#ifndef DIAGNOSTIC_DYNAMIC_MAX_COMPOSITES
+#define DIAGNOSTIC_DYNAMIC_MAX_COMPOSITES 16
+#endif
+
+// The most source ranges in one dynamic DID - ECUs often accept fewer, see
+// max_elements in DiagnosticDynamicPoller.
+#ifndef DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS
+#define DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS 16
+#endif
+
+#define DIAGNOSTIC_SERVICE_DYNAMICALLY_DEFINE 0x2c
+#define DIAGNOSTIC_DYNAMIC_DEFINE_BY_IDENTIFIER 0x1
+#define DIAGNOSTIC_DYNAMIC_CLEAR 0x3
+// The first of the DIDs ISO 14229 sets aside for dynamic definitions.
+#define DIAGNOSTIC_DYNAMIC_FIRST_DID 0xf300
+
+typedef struct DiagnosticDynamicSignal DiagnosticDynamicSignal;
+
+/* Public: The signature for a function that handles a polled signal.
+ *
+ * data - The signal's bytes, signal->length of them - only valid during the
+ *      callback.
+ */
+typedef void (*DiagnosticDynamicSignalReceived)(
+        const DiagnosticDynamicSignal* signal, const uint8_t* data,
+        void* context);
+
+/* Public: A value to poll - a range of bytes in the data of a DID.
+ *
+ * source_did - The DID the value is read from.
+ * position - The offset of the value in the DID's data, from 0.
+ * length - The length of the value.
+ */
+struct DiagnosticDynamicSignal {
+    uint16_t source_did;
+    uint8_t position;
+    uint8_t length;
+
+    // Private
+    DiagnosticDynamicSignalReceived handler;
+    void* context;
+    uint8_t composite;
+    uint8_t offset;
+};
+
+/* Public: A range of bytes copied from a source DID in to a dynamic DID.
+ */
+typedef struct {
+    uint16_t source_did;
+    uint8_t position;
+    uint8_t length;
+} DiagnosticDynamicElement;
+
+/* Public: One DID read by the poller - a dynamic DID made of the elements in
+ * order, or (if 'direct') the single element's source DID read as it is.
+ *
+ * identifier - The dynamic DID.
+ * length - The length of the dynamic DID's data.
+ * direct - True if the ECU wouldn't define the dynamic DID, so the source
+ *      is read instead.
+ * defined - True if the ECU has accepted the definition.
+ */
+typedef struct {
+    uint16_t identifier;
+    DiagnosticDynamicElement elements[DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS];
+    uint8_t element_count;
+    uint8_t length;
+    bool direct;
+    bool defined;
+} DiagnosticDynamicComposite;
+
+typedef enum {
+    DIAGNOSTIC_DYNAMIC_IDLE,
+    DIAGNOSTIC_DYNAMIC_CLEARING,
+    DIAGNOSTIC_DYNAMIC_DEFINING,
+    DIAGNOSTIC_DYNAMIC_READING
+} DiagnosticDynamicState;
+
+/* Public: Polls a list of signals from an ECU with as few requests as
+ * possible, by merging them in to dynamically defined DIDs (0x2C).
+ *
+ * Overlapping and adjacent ranges of the same source DID are read once. The
+ * ranges are then packed in to as few dynamic DIDs as hold them, each no
+ * longer than fits in max_response_frames frames of the ECU's responses.
+ * Each poll reads the dynamic DIDs and passes every signal to its handler.
+ *
+ * If the ECU refuses a definition, the plan is made again with fewer ranges
+ * in each dynamic DID, down to reading a single range's source DID
+ * directly. If the ECU forgets its definitions (e.g. it was reset) reading
+ * them fails with requestOutOfRange, and they're defined again.
+ *
+ * Use diagnostic_dynamic_poller_init(...) to create an instance. It must not
+ * move once a poll is started.
+ *
+ * arbitration_id - The request arbitration ID of the ECU.
+ * first_identifier - The first dynamic DID to define - they're numbered
+ *      from here.
+ * max_response_frames - How many frames each dynamic DID's response may
+ *      take. 1 (the default) keeps every read to a single frame each way.
+ * max_elements - The most ranges to put in one dynamic DID.
+ * composites - The plan.
+ * composite_count - The number of composites in the plan.
+ * polls - The number of completed polls.
+ * replans - The number of times the ECU refused a definition and the plan
+ *      was made again.
+ * redefinitions - The number of times the ECU forgot its definitions.
+ * read_failures - The number of reads that failed or went unanswered.
+ */
+typedef struct {
+    DiagnosticShims* shims;
+    uint32_t arbitration_id;
+    uint16_t first_identifier;
+    uint8_t max_response_frames;
+    uint8_t max_elements;
+    DiagnosticDynamicComposite composites[DIAGNOSTIC_DYNAMIC_MAX_COMPOSITES];
+    uint8_t composite_count;
+    uint32_t polls;
+    uint32_t replans;
+    uint32_t redefinitions;
+    uint32_t read_failures;
+
+    // Private
+    DiagnosticDynamicSignal signals[DIAGNOSTIC_DYNAMIC_MAX_SIGNALS];
+    uint8_t signal_count;
+    bool planned;
+    bool redefined;
+    DiagnosticDynamicState state;
+    uint8_t current;
+    uint8_t resume;
+    DiagnosticRequestDriver driver;
+    uint8_t request_payload[2 + 4 * DIAGNOSTIC_DYNAMIC_MAX_ELEMENTS];
+} DiagnosticDynamicPoller;
+
+void diagnostic_dynamic_poller_init(DiagnosticDynamicPoller* poller,
+        DiagnosticShims* shims, uint32_t arbitration_id);
+
+/* Public: Add a signal to poll. The plan is made again before the next poll.
+ *
+ * Returns false if DIAGNOSTIC_DYNAMIC_MAX_SIGNALS are already added, or a poll
+ * is in progress.
+ */
+bool diagnostic_dynamic_add_signal(DiagnosticDynamicPoller* poller,
+        uint16_t source_did, uint8_t position, uint8_t length,
+        DiagnosticDynamicSignalReceived handler, void* context);
+
+/* Public: The most bytes of data a DID's response can carry in a number of
+ * frames to an ECU.
+ */
+uint8_t diagnostic_dynamic_capacity(const DiagnosticAddress* address,
+        uint8_t frames);
+
+/* Public: Work out the dynamic DIDs for the signals, without sending
+ * anything. This is done by the first poll after the signals change, so it's
+ * only needed to look at the plan beforehand.
+ *
+ * Returns false if the signals need more than
+ * DIAGNOSTIC_DYNAMIC_MAX_COMPOSITES DIDs.
+ */
+bool diagnostic_dynamic_plan(DiagnosticDynamicPoller* poller);
+
+/* Public: Define whatever dynamic DIDs aren't yet, then read all of them and
+ * pass the signals to their handlers.
+ *
+ * Returns false if a poll is already in progress, or the plan couldn't be
+ * made.
+ */
+bool diagnostic_dynamic_poll(DiagnosticDynamicPoller* poller);
+
+/* Public: The ECU has been reset or left its session - define the dynamic
+ * DIDs again before the next read.
+ */
+void diagnostic_dynamic_redefine(DiagnosticDynamicPoller* poller);
+
+/* Public: Pass a received CAN frame to the poll in progress.
+ */
+void diagnostic_dynamic_receive_can_frame(DiagnosticDynamicPoller* poller,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Time out the request in progress - see
+ * diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE.
+ */
+uint64_t diagnostic_dynamic_process(DiagnosticDynamicPoller* poller,
+        uint64_t now);
+
+/* Public: Returns true if no poll is in progress.
+ */
+bool diagnostic_dynamic_finished(const DiagnosticDynamicPoller* poller);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_DYNAMIC_H__
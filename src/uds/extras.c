@@ -1,28 +1,87 @@
 #include <uds/extras.h>
 #include <uds/uds.h>
+#include <uds/vehicle_info.h>
+#include <string.h>
 
-// TODO everything below here is for future work...not critical for now.
+#define MIL_STATUS_PID 0x1
+#define MIL_STATUS_BIT 0x80
+
+// The typed callbacks don't take a context, so each is kept in the handle's
+// typed_callback and called from its typed_handler.
+
+static void receive_mil_status(const DiagnosticResponse* response,
+        DiagnosticTypedCallback callback) {
+    if(response->success && response->payload_length > 0) {
+        callback.mil_status(response->payload[0] & MIL_STATUS_BIT);
+    }
+}
+
+static void receive_vin(const DiagnosticResponse* response,
+        DiagnosticTypedCallback callback) {
+    // the payload is the number of data items (1) and the VIN, sometimes
+    // with padding in front
+    if(response->success &&
+            response->payload_length > DIAGNOSTIC_VIN_LENGTH) {
+        uint8_t vin[DIAGNOSTIC_VIN_LENGTH + 1];
+        memcpy(vin, &response->payload[response->payload_length -
+                DIAGNOSTIC_VIN_LENGTH], DIAGNOSTIC_VIN_LENGTH);
+        vin[DIAGNOSTIC_VIN_LENGTH] = '\0';
+        callback.vin(vin);
+    }
+}
+
+static DiagnosticRequestHandle request_obd2(DiagnosticShims* shims,
+        DiagnosticMode mode, uint16_t pid,
+        DiagnosticTypedResponseHandler handler,
+        DiagnosticTypedCallback callback) {
+    DiagnosticRequest request = {
+        arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
+        mode: mode,
+        has_pid: true,
+        pid: pid,
+        pid_length: 1
+    };
+    DiagnosticRequestHandle handle = generate_diagnostic_request(shims,
+            &request, NULL);
+    handle.typed_handler = handler;
+    handle.typed_callback = callback;
+    start_diagnostic_request(shims, &handle);
+    return handle;
+}
+
+// A handle for a request that isn't supported yet - already completed,
+// without success.
+static DiagnosticRequestHandle unsupported_request() {
+    DiagnosticRequestHandle handle;
+    memset(&handle, 0, sizeof(handle));
+    handle.completed = true;
+    handle.success = false;
+    return handle;
+}
 
 DiagnosticRequestHandle diagnostic_request_malfunction_indicator_status(
         DiagnosticShims* shims,
         DiagnosticMilStatusReceived callback) {
-    // TODO request malfunction indicator light (MIL) status - request mode 1
-    // pid 1, parse first bit
-    DiagnosticRequestHandle handle;
-    return handle;
+    DiagnosticTypedCallback typed_callback = {mil_status: callback};
+    return request_obd2(shims, OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+            MIL_STATUS_PID, callback != NULL ? receive_mil_status : NULL,
+            typed_callback);
 }
 
 DiagnosticRequestHandle diagnostic_request_vin(DiagnosticShims* shims,
         DiagnosticVinReceived callback) {
-    DiagnosticRequestHandle handle;
-    return handle;
+    DiagnosticTypedCallback typed_callback = {vin: callback};
+    return request_obd2(shims, OBD2_MODE_VEHICLE_INFORMATION,
+            DIAGNOSTIC_INFO_TYPE_VIN, callback != NULL ? receive_vin : NULL,
+            typed_callback);
 }
 
+// TODO everything below here is for future work...not critical for now.
+
 DiagnosticRequestHandle diagnostic_request_dtc(DiagnosticShims* shims,
         DiagnosticTroubleCodeType dtc_type,
         DiagnosticTroubleCodesReceived callback) {
-    DiagnosticRequestHandle handle;
-    return handle;
+    return unsupported_request();
 }
 
 bool diagnostic_clear_dtc(DiagnosticShims* shims) {
@@ -34,6 +93,5 @@ DiagnosticRequestHandle diagnostic_enumerate_pids(DiagnosticShims* shims,
     // before calling the callback, split up the received bytes into 1 or 2 byte
     // chunks depending on the mode so the final pid list is actual 1 or 2 byte PIDs
     // TODO request supported PIDs  - request PID 0 and parse 4 bytes in response
-    DiagnosticRequestHandle handle;
-    return handle;
+    return unsupported_request();
 }
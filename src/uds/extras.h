@@ -7,7 +7,8 @@
 extern "C" {
 #endif
 
-// TODO everything in here is unused for the moment!
+// TODO the DTC and PID enumeration requests aren't implemented yet - they
+// return a handle that's already completed, without success.
 
 typedef enum {
     POWERTRAIN = 0x0,
@@ -32,7 +33,9 @@ typedef enum {
 } DiagnosticTroubleCodeType;
 
 
-// TODO should we enumerate every OBD-II PID? need conversion formulas, too
+// TODO should we enumerate every OBD-II PID? need conversion formulas, too.
+// Definitions with their scaling can be loaded from a compiled database
+// instead - see DiagnosticDatabaseParameter in uds/database.h.
 typedef struct {
     uint16_t pid;
     uint8_t bytes_returned;
@@ -40,17 +43,25 @@ typedef struct {
     float max_value;
 } DiagnosticParameter;
 
-typedef void (*DiagnosticMilStatusReceived)(bool malfunction_indicator_status);
-typedef void (*DiagnosticVinReceived)(uint8_t vin[]);
+// DiagnosticMilStatusReceived and DiagnosticVinReceived are in
+// uds/uds_types.h, as the handle keeps them.
 typedef void (*DiagnosticTroubleCodesReceived)(
         DiagnosticMode mode, DiagnosticTroubleCode* codes);
 typedef void (*DiagnosticPidEnumerationReceived)(
         const DiagnosticResponse* response, uint16_t* pids);
 
+/* Public: Ask the emission-relevant ECUs (functionally, on 0x7df) if the
+ * malfunction indicator light is on - mode 0x01 PID 0x01. The callback is
+ * called once for each ECU that answers.
+ */
 DiagnosticRequestHandle diagnostic_request_malfunction_indicator_status(
         DiagnosticShims* shims,
         DiagnosticMilStatusReceived callback);
 
+/* Public: Ask the emission-relevant ECUs (functionally, on 0x7df) for the
+ * VIN - mode 0x09 InfoType 0x02. The callback is called once for each ECU
+ * that answers.
+ */
 DiagnosticRequestHandle diagnostic_request_vin(DiagnosticShims* shims,
         DiagnosticVinReceived callback);
 
@@ -0,0 +1,225 @@
+#include <uds/filter.h>
+#include <string.h>
+
+void diagnostic_filter_reset(DiagnosticAcceptFilter* filter) {
+    memset(filter, 0, sizeof(DiagnosticAcceptFilter));
+}
+
+static void set_standard_id(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, bool accepted) {
+    uint32_t bit = 1UL << (arbitration_id & 0x1f);
+    if(accepted) {
+        filter->standard_ids[arbitration_id >> 5] |= bit;
+    } else {
+        filter->standard_ids[arbitration_id >> 5] &= ~bit;
+    }
+}
+
+static bool is_standard_entry(uint32_t arbitration_id, uint32_t mask) {
+    return arbitration_id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT &&
+            mask == DIAGNOSTIC_FILTER_EXTENDED_ID_MASK;
+}
+
+static void remove_extended_id(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask) {
+    uint8_t i;
+    for(i = 0; i < filter->extended_id_count; ++i) {
+        if(filter->extended_ids[i] == arbitration_id &&
+                filter->extended_masks[i] == mask) {
+            --filter->extended_id_count;
+            filter->extended_ids[i] =
+                    filter->extended_ids[filter->extended_id_count];
+            filter->extended_masks[i] =
+                    filter->extended_masks[filter->extended_id_count];
+            return;
+        }
+    }
+}
+
+static bool add_entry(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask) {
+    int free_slot = -1;
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_FILTER_MAX_IDS; ++i) {
+        if(filter->references[i] > 0 && filter->ids[i] == arbitration_id &&
+                filter->masks[i] == mask) {
+            ++filter->references[i];
+            return true;
+        } else if(filter->references[i] == 0 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+
+    bool standard = is_standard_entry(arbitration_id, mask);
+    if(free_slot < 0 || (!standard && filter->extended_id_count >=
+                DIAGNOSTIC_FILTER_MAX_EXTENDED_IDS)) {
+        ++filter->overflows;
+        ++filter->generation;
+        return false;
+    }
+
+    filter->ids[free_slot] = arbitration_id;
+    filter->masks[free_slot] = mask;
+    filter->references[free_slot] = 1;
+    if(standard) {
+        set_standard_id(filter, arbitration_id, true);
+    } else {
+        filter->extended_ids[filter->extended_id_count] = arbitration_id;
+        filter->extended_masks[filter->extended_id_count] = mask;
+        ++filter->extended_id_count;
+    }
+    ++filter->generation;
+    return true;
+}
+
+static void remove_entry(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask) {
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_FILTER_MAX_IDS; ++i) {
+        if(filter->references[i] > 0 && filter->ids[i] == arbitration_id &&
+                filter->masks[i] == mask) {
+            if(--filter->references[i] == 0) {
+                if(is_standard_entry(arbitration_id, mask)) {
+                    set_standard_id(filter, arbitration_id, false);
+                } else {
+                    remove_extended_id(filter, arbitration_id, mask);
+                }
+                ++filter->generation;
+            }
+            return;
+        }
+    }
+
+    // a reference that wasn't in the filter must be one that overflowed it
+    if(filter->overflows > 0) {
+        --filter->overflows;
+        ++filter->generation;
+    }
+}
+
+// A masked range of 11-bit IDs is expanded in to the bitmap, anything wider
+// is kept as a single masked entry.
+static bool is_standard_range(uint32_t arbitration_id, uint32_t mask) {
+    return arbitration_id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT &&
+            (mask | DIAGNOSTIC_FILTER_STANDARD_ID_MASK) ==
+                DIAGNOSTIC_FILTER_EXTENDED_ID_MASK;
+}
+
+bool diagnostic_filter_add(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id) {
+    return add_entry(filter, arbitration_id,
+            DIAGNOSTIC_FILTER_EXTENDED_ID_MASK);
+}
+
+void diagnostic_filter_remove(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id) {
+    remove_entry(filter, arbitration_id, DIAGNOSTIC_FILTER_EXTENDED_ID_MASK);
+}
+
+bool diagnostic_filter_add_masked(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask) {
+    mask &= DIAGNOSTIC_FILTER_EXTENDED_ID_MASK;
+    arbitration_id &= mask;
+    if(mask == DIAGNOSTIC_FILTER_EXTENDED_ID_MASK ||
+            !is_standard_range(arbitration_id, mask)) {
+        return add_entry(filter, arbitration_id, mask);
+    }
+
+    bool added = true;
+    uint32_t id;
+    for(id = arbitration_id; id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT; ++id) {
+        if((id & mask) == arbitration_id) {
+            added = add_entry(filter, id, DIAGNOSTIC_FILTER_EXTENDED_ID_MASK)
+                    && added;
+        }
+    }
+    return added;
+}
+
+void diagnostic_filter_remove_masked(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask) {
+    mask &= DIAGNOSTIC_FILTER_EXTENDED_ID_MASK;
+    arbitration_id &= mask;
+    if(mask == DIAGNOSTIC_FILTER_EXTENDED_ID_MASK ||
+            !is_standard_range(arbitration_id, mask)) {
+        remove_entry(filter, arbitration_id, mask);
+        return;
+    }
+
+    uint32_t id;
+    for(id = arbitration_id; id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT; ++id) {
+        if((id & mask) == arbitration_id) {
+            remove_entry(filter, id, DIAGNOSTIC_FILTER_EXTENDED_ID_MASK);
+        }
+    }
+}
+
+static bool standard_id_accepted(const DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id) {
+    return (filter->standard_ids[arbitration_id >> 5] >>
+            (arbitration_id & 0x1f)) & 1;
+}
+
+static bool standard_block_accepted(const DiagnosticAcceptFilter* filter,
+        uint32_t start, uint32_t length) {
+    uint32_t id;
+    for(id = start; id < start + length; ++id) {
+        if(!standard_id_accepted(filter, id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint16_t diagnostic_filter_export(const DiagnosticAcceptFilter* filter,
+        DiagnosticFilterRule* rules, uint16_t max_rules) {
+    if(filter->overflows > 0) {
+        if(max_rules > 0) {
+            rules[0].id = 0;
+            rules[0].mask = 0;
+            rules[0].extended = true;
+        }
+        return 1;
+    }
+
+    uint16_t count = 0;
+    uint32_t id = 0;
+    while(id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT) {
+        if(filter->standard_ids[id >> 5] == 0) {
+            id = (id | 0x1f) + 1;
+            continue;
+        }
+        if(!standard_id_accepted(filter, id)) {
+            ++id;
+            continue;
+        }
+
+        // grow the block while it stays aligned and fully accepted
+        uint32_t length = 1;
+        while((id & (length * 2 - 1)) == 0 &&
+                id + length * 2 <= DIAGNOSTIC_FILTER_STANDARD_ID_COUNT &&
+                standard_block_accepted(filter, id + length, length)) {
+            length *= 2;
+        }
+
+        if(count < max_rules) {
+            rules[count].id = id;
+            rules[count].mask = DIAGNOSTIC_FILTER_STANDARD_ID_MASK &
+                    ~(length - 1);
+            rules[count].extended = false;
+        }
+        ++count;
+        id += length;
+    }
+
+    uint8_t i;
+    for(i = 0; i < filter->extended_id_count; ++i) {
+        if(count < max_rules) {
+            rules[count].id = filter->extended_ids[i];
+            rules[count].mask = filter->extended_masks[i];
+            rules[count].extended = true;
+        }
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,144 @@
+#ifndef __UDS_FILTER_H__
+#define __UDS_FILTER_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTIC_FILTER_STANDARD_ID_COUNT 0x800
+#define DIAGNOSTIC_FILTER_STANDARD_ID_MASK 0x7ff
+#define DIAGNOSTIC_FILTER_EXTENDED_ID_MASK 0x1fffffff
+
+#ifndef DIAGNOSTIC_FILTER_MAX_IDS
+#define DIAGNOSTIC_FILTER_MAX_IDS 64
+#endif
+
+#ifndef DIAGNOSTIC_FILTER_MAX_EXTENDED_IDS
+#define DIAGNOSTIC_FILTER_MAX_EXTENDED_IDS 16
+#endif
+
+/* Public: The set of arbitration IDs that any request in progress is waiting
+ * on, for rejecting unrelated broadcast traffic before it gets anywhere near
+ * a DiagnosticRequestHandle.
+ *
+ * Assign an instance to the 'filter' field of a DiagnosticShims and the
+ * library keeps it up to date: the response IDs of a request are added when
+ * it's started and removed when it completes (or, for functional broadcast
+ * requests that collect responses from several ECUs, when it's released with
+ * diagnostic_request_release(...)). IDs are reference counted, so overlapping
+ * requests to the same ECU work as expected.
+ *
+ * Check each incoming frame with diagnostic_filter_accepts(...) once, before
+ * offering it to each handle. Use diagnostic_filter_export(...) to program
+ * hardware or driver acceptance filters, whenever 'generation' changes.
+ *
+ * IDs up to 0x7ff are kept in a bitmap, anything larger is treated as a
+ * 29-bit ID and kept in a short list, along with a mask for functional
+ * requests answered on a range of 29-bit IDs.
+ *
+ * generation - Incremented every time an ID is added to or removed from the
+ *      set of accepted IDs.
+ * overflows - References that couldn't be added because the filter was full,
+ *      less those since removed. While this is non-zero, the filter accepts
+ *      everything.
+ */
+typedef struct DiagnosticAcceptFilter {
+    uint32_t standard_ids[DIAGNOSTIC_FILTER_STANDARD_ID_COUNT / 32];
+    uint32_t extended_ids[DIAGNOSTIC_FILTER_MAX_EXTENDED_IDS];
+    uint32_t extended_masks[DIAGNOSTIC_FILTER_MAX_EXTENDED_IDS];
+    uint8_t extended_id_count;
+    uint32_t generation;
+    uint32_t overflows;
+
+    // Private
+    uint32_t ids[DIAGNOSTIC_FILTER_MAX_IDS];
+    uint32_t masks[DIAGNOSTIC_FILTER_MAX_IDS];
+    uint16_t references[DIAGNOSTIC_FILTER_MAX_IDS];
+} DiagnosticAcceptFilter;
+
+/* Public: An acceptance rule for a hardware filter - a frame is accepted if
+ * (frame ID & mask) == (id & mask).
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    bool extended;
+} DiagnosticFilterRule;
+
+/* Public: Clear the filter, so it rejects everything.
+ */
+void diagnostic_filter_reset(DiagnosticAcceptFilter* filter);
+
+/* Public: Add a reference to an arbitration ID.
+ *
+ * Returns false if the filter is full - it will then accept everything until
+ * the reference is removed again, or the filter is reset.
+ */
+bool diagnostic_filter_add(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id);
+
+/* Public: Remove a reference to an arbitration ID added with
+ * diagnostic_filter_add(...). The ID stays accepted until the last reference
+ * is removed.
+ */
+void diagnostic_filter_remove(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id);
+
+/* Public: Add a reference to every arbitration ID matching 'arbitration_id'
+ * in the bits set in 'mask'.
+ *
+ * Returns false if the filter is full.
+ */
+bool diagnostic_filter_add_masked(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask);
+
+/* Public: Remove a reference added with diagnostic_filter_add_masked(...).
+ */
+void diagnostic_filter_remove_masked(DiagnosticAcceptFilter* filter,
+        uint32_t arbitration_id, uint32_t mask);
+
+/* Public: Returns true if a frame with the given arbitration ID may be a
+ * response to a request in progress.
+ */
+static inline bool diagnostic_filter_accepts(
+        const DiagnosticAcceptFilter* filter, uint32_t arbitration_id) {
+    if(arbitration_id < DIAGNOSTIC_FILTER_STANDARD_ID_COUNT) {
+        if((filter->standard_ids[arbitration_id >> 5] >>
+                (arbitration_id & 0x1f)) & 1) {
+            return true;
+        }
+    } else {
+        uint8_t i;
+        for(i = 0; i < filter->extended_id_count; ++i) {
+            if((arbitration_id & filter->extended_masks[i]) ==
+                    filter->extended_ids[i]) {
+                return true;
+            }
+        }
+    }
+    return filter->overflows > 0;
+}
+
+/* Public: Describe the accepted IDs as a list of ID and mask rules, merging
+ * runs of standard IDs (like the 0x7e8-0x7ef functional responses) in to a
+ * single masked rule where possible.
+ *
+ * rules - The destination for the rules.
+ * max_rules - The size of the destination.
+ *
+ * Returns the number of rules needed, which may be more than max_rules - in
+ * that case only the first max_rules were written. If the filter has
+ * overflowed, this is a single rule that accepts everything.
+ */
+uint16_t diagnostic_filter_export(const DiagnosticAcceptFilter* filter,
+        DiagnosticFilterRule* rules, uint16_t max_rules);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_FILTER_H__
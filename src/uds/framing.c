@@ -0,0 +1,319 @@
+#include <uds/framing.h>
+#include <uds/bytes.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#define PCI_SINGLE 0x0
+#define PCI_FIRST_FRAME 0x1
+#define PCI_CONSECUTIVE_FRAME 0x2
+#define PCI_FLOW_CONTROL_FRAME 0x3
+
+#define FLOW_CONTROL_CONTINUE 0x0
+#define FLOW_CONTROL_WAIT 0x1
+#define FLOW_CONTROL_OVERFLOW 0x2
+
+#define MAX_CLASSIC_SINGLE_FRAME_LENGTH 7
+#define MAX_FIRST_FRAME_LENGTH 0xfff
+#define FIRST_FRAME_HEADER_LENGTH 2
+#define ESCAPED_FIRST_FRAME_HEADER_LENGTH 6
+#define ESCAPED_SINGLE_FRAME_HEADER_LENGTH 2
+
+static const uint8_t FD_FRAME_LENGTHS[] = {8, 12, 16, 20, 24, 32, 48, 64};
+
+uint8_t diagnostic_framing_frame_length(uint8_t length) {
+    if(length <= DIAGNOSTIC_CLASSIC_FRAME_SIZE) {
+        return length;
+    }
+
+    uint8_t i;
+    for(i = 0; i < sizeof(FD_FRAME_LENGTHS); ++i) {
+        if(length <= FD_FRAME_LENGTHS[i]) {
+            return FD_FRAME_LENGTHS[i];
+        }
+    }
+    return DIAGNOSTIC_FD_FRAME_SIZE;
+}
+
+uint8_t diagnostic_framing_max_frame_length(uint8_t size) {
+    if(size <= DIAGNOSTIC_CLASSIC_FRAME_SIZE) {
+        return DIAGNOSTIC_CLASSIC_FRAME_SIZE;
+    }
+
+    uint8_t i = sizeof(FD_FRAME_LENGTHS) - 1;
+    while(FD_FRAME_LENGTHS[i] > size) {
+        --i;
+    }
+    return FD_FRAME_LENGTHS[i];
+}
+
+uint32_t diagnostic_framing_separation_time_us(uint8_t separation_time) {
+    if(separation_time <= 0x7f) {
+        return separation_time * 1000;
+    } else if(separation_time >= 0xf1 && separation_time <= 0xf9) {
+        return (separation_time - 0xf0) * 100;
+    }
+    // reserved values must be treated as the longest time
+    return 0x7f * 1000;
+}
+
+void diagnostic_framing_send_init(DiagnosticFrameSender* sender,
+        uint8_t frame_size, const uint8_t* head, uint32_t head_length,
+        const uint8_t* body, uint32_t body_length) {
+    memset(sender, 0, sizeof(DiagnosticFrameSender));
+    sender->frame_size = frame_size;
+    sender->head = head;
+    sender->head_length = head_length;
+    sender->body = body;
+    sender->body_length = body_length;
+}
+
+// Copy the next 'length' bytes of the message from the head and body.
+static void copy_message(DiagnosticFrameSender* sender, uint8_t* destination,
+        uint32_t length) {
+    while(length > 0) {
+        const uint8_t* source;
+        uint32_t available;
+        if(sender->offset < sender->head_length) {
+            source = &sender->head[sender->offset];
+            available = sender->head_length - sender->offset;
+        } else {
+            source = &sender->body[sender->offset - sender->head_length];
+            available = sender->head_length + sender->body_length -
+                    sender->offset;
+        }
+
+        uint32_t count = length < available ? length : available;
+        memcpy(destination, source, count);
+        destination += count;
+        sender->offset += count;
+        length -= count;
+    }
+}
+
+uint8_t diagnostic_framing_next_frame(DiagnosticFrameSender* sender,
+        uint8_t* frame) {
+    if(sender->completed || sender->waiting_for_flow_control) {
+        return 0;
+    }
+
+    uint32_t total = sender->head_length + sender->body_length;
+    uint8_t length;
+    if(sender->offset == 0) {
+        uint32_t single_frame_capacity =
+                sender->frame_size <= DIAGNOSTIC_CLASSIC_FRAME_SIZE ?
+                    sender->frame_size - 1 :
+                    sender->frame_size - ESCAPED_SINGLE_FRAME_HEADER_LENGTH;
+        if(total <= MAX_CLASSIC_SINGLE_FRAME_LENGTH &&
+                total < sender->frame_size) {
+            frame[0] = (PCI_SINGLE << 4) | total;
+            copy_message(sender, &frame[1], total);
+            length = total + 1;
+        } else if(total <= single_frame_capacity) {
+            frame[0] = PCI_SINGLE << 4;
+            frame[1] = total;
+            copy_message(sender, &frame[ESCAPED_SINGLE_FRAME_HEADER_LENGTH],
+                    total);
+            length = total + ESCAPED_SINGLE_FRAME_HEADER_LENGTH;
+        } else {
+            uint8_t header_length;
+            if(total <= MAX_FIRST_FRAME_LENGTH) {
+                frame[0] = (PCI_FIRST_FRAME << 4) | (total >> 8);
+                frame[1] = total & 0xff;
+                header_length = FIRST_FRAME_HEADER_LENGTH;
+            } else {
+                frame[0] = PCI_FIRST_FRAME << 4;
+                frame[1] = 0;
+                diagnostic_write_uint32(&frame[2], total);
+                header_length = ESCAPED_FIRST_FRAME_HEADER_LENGTH;
+            }
+            copy_message(sender, &frame[header_length],
+                    sender->frame_size - header_length);
+            sender->sequence = 1;
+            sender->waiting_for_flow_control = true;
+            return sender->frame_size;
+        }
+    } else {
+        uint32_t remaining = total - sender->offset;
+        uint32_t count = sender->frame_size - 1;
+        if(remaining < count) {
+            count = remaining;
+        }
+        frame[0] = (PCI_CONSECUTIVE_FRAME << 4) | (sender->sequence & 0xf);
+        copy_message(sender, &frame[1], count);
+        length = count + 1;
+        sender->sequence = (sender->sequence + 1) & 0xf;
+
+        if(sender->offset < total) {
+            if(sender->block_size > 0 && --sender->block_remaining == 0) {
+                sender->waiting_for_flow_control = true;
+            }
+            return length;
+        }
+    }
+
+    sender->completed = true;
+    sender->success = true;
+    return length;
+}
+
+DiagnosticFramingStatus diagnostic_framing_flow_control(
+        DiagnosticFrameSender* sender, const uint8_t* frame, uint8_t size) {
+    if(size < 1 || (frame[0] >> 4) != PCI_FLOW_CONTROL_FRAME ||
+            !sender->waiting_for_flow_control) {
+        return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+
+    uint8_t flow_status = frame[0] & 0xf;
+    if(flow_status == FLOW_CONTROL_CONTINUE &&
+            size >= DIAGNOSTIC_FLOW_CONTROL_LENGTH) {
+        sender->block_size = frame[1];
+        sender->block_remaining = frame[1];
+        sender->separation_time_us =
+                diagnostic_framing_separation_time_us(frame[2]);
+        sender->waiting_for_flow_control = false;
+        return DIAGNOSTIC_FRAMING_IN_PROGRESS;
+    } else if(flow_status == FLOW_CONTROL_WAIT) {
+        return DIAGNOSTIC_FRAMING_IN_PROGRESS;
+    }
+
+    sender->waiting_for_flow_control = false;
+    sender->completed = true;
+    sender->success = false;
+    return DIAGNOSTIC_FRAMING_ERROR;
+}
+
+void diagnostic_framing_receive_init(DiagnosticFrameReceiver* receiver,
+        uint8_t* buffer, uint32_t buffer_size) {
+    memset(receiver, 0, sizeof(DiagnosticFrameReceiver));
+    receiver->buffer = buffer;
+    receiver->buffer_size = buffer_size;
+}
+
+// Copy what fits of part of a multi-frame message in to the buffer, and
+// point the chunk at all of it.
+static void keep(DiagnosticFrameReceiver* receiver, uint32_t offset,
+        const uint8_t* data, uint32_t length) {
+    if(offset < receiver->buffer_size) {
+        memcpy(&receiver->buffer[offset], data,
+                MIN(length, receiver->buffer_size - offset));
+    }
+    receiver->chunk = data;
+    receiver->chunk_offset = offset;
+    receiver->chunk_length = length;
+}
+
+static DiagnosticFramingStatus receive_single_frame(
+        DiagnosticFrameReceiver* receiver, const uint8_t* frame,
+        uint8_t size) {
+    uint32_t length = frame[0] & 0xf;
+    uint8_t header_length = 1;
+    if(length == 0 && size > DIAGNOSTIC_CLASSIC_FRAME_SIZE) {
+        length = frame[1];
+        header_length = ESCAPED_SINGLE_FRAME_HEADER_LENGTH;
+    }
+
+    if(length == 0 || length > size - header_length ||
+            length > receiver->buffer_size) {
+        return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+
+    memcpy(receiver->buffer, &frame[header_length], length);
+    receiver->length = length;
+    receiver->multi_frame = false;
+    receiver->in_progress = false;
+    return DIAGNOSTIC_FRAMING_COMPLETE;
+}
+
+static DiagnosticFramingStatus receive_first_frame(
+        DiagnosticFrameReceiver* receiver, const uint8_t* frame,
+        uint8_t size, uint8_t* flow_control, uint8_t* flow_control_length) {
+    if(size < FIRST_FRAME_HEADER_LENGTH) {
+        return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+
+    uint32_t length = ((frame[0] & 0xf) << 8) | frame[1];
+    uint8_t header_length = FIRST_FRAME_HEADER_LENGTH;
+    if(length == 0) {
+        if(size < ESCAPED_FIRST_FRAME_HEADER_LENGTH) {
+            return DIAGNOSTIC_FRAMING_IGNORED;
+        }
+        length = diagnostic_read_uint32(&frame[2]);
+        header_length = ESCAPED_FIRST_FRAME_HEADER_LENGTH;
+    }
+
+    receiver->in_progress = false;
+    flow_control[1] = 0;
+    flow_control[2] = 0;
+    *flow_control_length = DIAGNOSTIC_FLOW_CONTROL_LENGTH;
+    if((length > receiver->buffer_size && !receiver->streaming) ||
+            length < size - header_length) {
+        flow_control[0] = (PCI_FLOW_CONTROL_FRAME << 4) |
+                FLOW_CONTROL_OVERFLOW;
+        return DIAGNOSTIC_FRAMING_ERROR;
+    }
+
+    // no block size or separation time - the sender can send everything
+    flow_control[0] = (PCI_FLOW_CONTROL_FRAME << 4) | FLOW_CONTROL_CONTINUE;
+    receiver->received = size - header_length;
+    keep(receiver, 0, &frame[header_length], receiver->received);
+    receiver->length = length;
+    receiver->multi_frame = true;
+    receiver->sequence = 1;
+    receiver->in_progress = true;
+    return DIAGNOSTIC_FRAMING_IN_PROGRESS;
+}
+
+static DiagnosticFramingStatus receive_consecutive_frame(
+        DiagnosticFrameReceiver* receiver, const uint8_t* frame,
+        uint8_t size) {
+    if(!receiver->in_progress) {
+        return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+
+    if((frame[0] & 0xf) != receiver->sequence) {
+        receiver->in_progress = false;
+        return DIAGNOSTIC_FRAMING_ERROR;
+    }
+
+    uint32_t count = size - 1;
+    uint32_t remaining = receiver->length - receiver->received;
+    if(count > remaining) {
+        // the rest is padding
+        count = remaining;
+    }
+    keep(receiver, receiver->received, &frame[1], count);
+    receiver->received += count;
+    receiver->sequence = (receiver->sequence + 1) & 0xf;
+
+    if(receiver->received < receiver->length) {
+        return DIAGNOSTIC_FRAMING_IN_PROGRESS;
+    }
+    receiver->in_progress = false;
+    return DIAGNOSTIC_FRAMING_COMPLETE;
+}
+
+DiagnosticFramingStatus diagnostic_framing_receive(
+        DiagnosticFrameReceiver* receiver, const uint8_t* frame,
+        uint8_t size, uint8_t* flow_control, uint8_t* flow_control_length) {
+    *flow_control_length = 0;
+    receiver->chunk_length = 0;
+    if(size < 1) {
+        return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+
+    switch(frame[0] >> 4) {
+        case PCI_SINGLE:
+            return receive_single_frame(receiver, frame, size);
+        case PCI_FIRST_FRAME:
+            return receive_first_frame(receiver, frame, size, flow_control,
+                    flow_control_length);
+        case PCI_CONSECUTIVE_FRAME:
+            return receive_consecutive_frame(receiver, frame, size);
+        default:
+            return DIAGNOSTIC_FRAMING_IGNORED;
+    }
+}
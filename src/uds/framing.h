@@ -0,0 +1,164 @@
+#ifndef __UDS_FRAMING_H__
+#define __UDS_FRAMING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTIC_CLASSIC_FRAME_SIZE 8
+#define DIAGNOSTIC_FD_FRAME_SIZE 64
+#define DIAGNOSTIC_FRAME_PADDING_BYTE 0xcc
+#define DIAGNOSTIC_FLOW_CONTROL_LENGTH 3
+
+/* Public: ISO 15765-2 (ISO-TP) segmentation for classic and CAN FD frames,
+ * used instead of isotp-c for messages it can't handle - anything sent in
+ * more than one frame, and anything sent or received in frames larger than
+ * 8 bytes.
+ *
+ * These functions only build and parse frame payloads, they don't send
+ * anything.
+ */
+
+/* Public: The result of passing a frame to a sender or receiver.
+ */
+typedef enum {
+    DIAGNOSTIC_FRAMING_IGNORED,
+    DIAGNOSTIC_FRAMING_IN_PROGRESS,
+    DIAGNOSTIC_FRAMING_COMPLETE,
+    DIAGNOSTIC_FRAMING_ERROR
+} DiagnosticFramingStatus;
+
+/* Public: The state of a message being split in to frames.
+ *
+ * The message is sent from two segments, 'head' followed by 'body', so a
+ * request header can be combined with a large payload without copying it.
+ * Both must stay valid until the send is completed.
+ *
+ * frame_size - The largest frame to send, 8 for classic CAN or one of the
+ *      CAN FD sizes up to 64.
+ * separation_time_us - The minimum time between consecutive frames requested
+ *      by the receiver in its last flow control frame.
+ * waiting_for_flow_control - True if the receiver must send a flow control
+ *      frame before any more frames can be sent.
+ * completed - True if the whole message was sent, or the receiver aborted.
+ * success - True if the whole message was sent.
+ */
+typedef struct {
+    uint8_t frame_size;
+    uint32_t separation_time_us;
+    bool waiting_for_flow_control;
+    bool completed;
+    bool success;
+
+    // Private
+    const uint8_t* head;
+    uint32_t head_length;
+    const uint8_t* body;
+    uint32_t body_length;
+    uint32_t offset;
+    uint8_t sequence;
+    uint8_t block_size;
+    uint8_t block_remaining;
+} DiagnosticFrameSender;
+
+/* Public: The state of a message being reassembled from frames.
+ *
+ * buffer - Storage for the message.
+ * buffer_size - The size of the buffer. Longer messages are refused with an
+ *      overflow flow control frame, unless 'streaming'.
+ * streaming - If true, messages longer than the buffer are accepted, and only
+ *      their start is kept in it - the rest is only seen in 'chunk'.
+ * length - The length of the message, once the first frame has arrived.
+ * multi_frame - True if the message is being sent in more than one frame.
+ * chunk - The part of the message carried by the last first or consecutive
+ *      frame, pointing in to that frame.
+ * chunk_offset - Where the chunk starts in the message.
+ * chunk_length - The length of the chunk, or 0 if the last frame didn't carry
+ *      any of a multi-frame message.
+ */
+typedef struct {
+    uint8_t* buffer;
+    uint32_t buffer_size;
+    bool streaming;
+    uint32_t length;
+    bool multi_frame;
+    const uint8_t* chunk;
+    uint32_t chunk_offset;
+    uint8_t chunk_length;
+
+    // Private
+    uint32_t received;
+    uint8_t sequence;
+    bool in_progress;
+} DiagnosticFrameReceiver;
+
+/* Public: Returns the smallest valid CAN FD frame length (8, 12, 16, 20, 24,
+ * 32, 48 or 64) that can hold 'length' bytes, or 'length' itself if it's 8 or
+ * less.
+ */
+uint8_t diagnostic_framing_frame_length(uint8_t length);
+
+/* Public: Returns the largest valid CAN FD frame length no bigger than
+ * 'size', up to 64, or 8 for classic CAN if 'size' is 8 or less.
+ */
+uint8_t diagnostic_framing_max_frame_length(uint8_t size);
+
+/* Public: Decode the STmin byte of a flow control frame in to microseconds.
+ */
+uint32_t diagnostic_framing_separation_time_us(uint8_t separation_time);
+
+/* Public: Prepare to send a message.
+ */
+void diagnostic_framing_send_init(DiagnosticFrameSender* sender,
+        uint8_t frame_size, const uint8_t* head, uint32_t head_length,
+        const uint8_t* body, uint32_t body_length);
+
+/* Public: Build the next frame of the message.
+ *
+ * frame - The destination for the frame, at least 'frame_size' bytes.
+ *
+ * Returns the length of the frame, or 0 if nothing can be sent until a flow
+ * control frame arrives (or the message is completed).
+ */
+uint8_t diagnostic_framing_next_frame(DiagnosticFrameSender* sender,
+        uint8_t* frame);
+
+/* Public: Pass a frame from the receiver to the sender, in case it's a flow
+ * control frame.
+ *
+ * Returns DIAGNOSTIC_FRAMING_IN_PROGRESS if the sender should continue (or
+ * keep waiting), DIAGNOSTIC_FRAMING_ERROR if the receiver aborted the
+ * transfer and DIAGNOSTIC_FRAMING_IGNORED if it wasn't a flow control frame.
+ */
+DiagnosticFramingStatus diagnostic_framing_flow_control(
+        DiagnosticFrameSender* sender, const uint8_t* frame, uint8_t size);
+
+/* Public: Prepare to receive messages in to a buffer.
+ */
+void diagnostic_framing_receive_init(DiagnosticFrameReceiver* receiver,
+        uint8_t* buffer, uint32_t buffer_size);
+
+/* Public: Pass a received frame to the receiver.
+ *
+ * flow_control - The destination for a flow control frame that must be sent
+ *      back, at least DIAGNOSTIC_FLOW_CONTROL_LENGTH bytes.
+ * flow_control_length - Set to the length of the flow control frame, or 0 if
+ *      there isn't one to send.
+ *
+ * Returns DIAGNOSTIC_FRAMING_COMPLETE once the whole message is in the
+ * buffer, DIAGNOSTIC_FRAMING_IN_PROGRESS if more frames are expected,
+ * DIAGNOSTIC_FRAMING_ERROR if the message was too large or frames were lost
+ * and DIAGNOSTIC_FRAMING_IGNORED if the frame wasn't part of a message.
+ */
+DiagnosticFramingStatus diagnostic_framing_receive(
+        DiagnosticFrameReceiver* receiver, const uint8_t* frame,
+        uint8_t size, uint8_t* flow_control, uint8_t* flow_control_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_FRAMING_H__
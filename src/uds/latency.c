@@ -0,0 +1,162 @@
+#include <uds/latency.h>
+#include <uds/atomic.h>
+#include <string.h>
+
+#define SERIES_FREE 0
+#define SERIES_CLAIMING 1
+#define SERIES_READY 2
+
+uint8_t diagnostic_latency_bucket_index(uint32_t latency_us) {
+    if(latency_us < 2 * DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT) {
+        return latency_us;
+    }
+
+    uint8_t magnitude = 31 - __builtin_clz(latency_us);
+    if(magnitude > DIAGNOSTIC_LATENCY_MAX_MAGNITUDE) {
+        return DIAGNOSTIC_LATENCY_BUCKET_COUNT - 1;
+    }
+    return (magnitude - DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS) *
+            DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT +
+            (latency_us >> (magnitude - DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS));
+}
+
+uint32_t diagnostic_latency_bucket_lower_bound(uint8_t bucket) {
+    if(bucket < 2 * DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT) {
+        return bucket;
+    }
+
+    uint8_t magnitude = bucket / DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT +
+            DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS - 1;
+    uint32_t mantissa = bucket % DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT +
+            DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT;
+    return mantissa << (magnitude - DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS);
+}
+
+static DiagnosticLatencyHistogram* find_or_claim_series(
+        DiagnosticLatencyStats* stats, uint32_t arbitration_id,
+        uint8_t mode) {
+    uint8_t start = (arbitration_id ^ (mode * 31)) %
+            DIAGNOSTIC_LATENCY_MAX_SERIES;
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_LATENCY_MAX_SERIES; ++i) {
+        DiagnosticLatencyHistogram* series = &stats->series[
+                (start + i) % DIAGNOSTIC_LATENCY_MAX_SERIES];
+        uint32_t state = UDS_ATOMIC_LOAD_ACQUIRE(&series->state);
+        if(state == SERIES_FREE) {
+            uint32_t expected = SERIES_FREE;
+            if(UDS_ATOMIC_COMPARE_EXCHANGE(&series->state, &expected,
+                        SERIES_CLAIMING)) {
+                series->arbitration_id = arbitration_id;
+                series->mode = mode;
+                UDS_ATOMIC_STORE_RELEASE(&series->state, SERIES_READY);
+                return series;
+            }
+            state = expected;
+        }
+
+        // another recorder is in the middle of filling in the key for this
+        // series - it only has two fields left to write
+        while(state == SERIES_CLAIMING) {
+            state = UDS_ATOMIC_LOAD_ACQUIRE(&series->state);
+        }
+
+        if(series->arbitration_id == arbitration_id && series->mode == mode) {
+            return series;
+        }
+    }
+    return NULL;
+}
+
+bool diagnostic_latency_record(DiagnosticLatencyStats* stats,
+        uint32_t arbitration_id, uint8_t mode, uint32_t latency_us) {
+    DiagnosticLatencyHistogram* series = find_or_claim_series(stats,
+            arbitration_id, mode);
+    if(series == NULL) {
+        UDS_ATOMIC_INCREMENT(&stats->dropped);
+        return false;
+    }
+
+    UDS_ATOMIC_INCREMENT(&series->buckets[
+            diagnostic_latency_bucket_index(latency_us)]);
+    UDS_ATOMIC_INCREMENT(&series->count);
+
+    uint32_t max_us = UDS_ATOMIC_LOAD(&series->max_us);
+    while(latency_us > max_us && !UDS_ATOMIC_COMPARE_EXCHANGE(
+                &series->max_us, &max_us, latency_us)) {
+    }
+    return true;
+}
+
+uint8_t diagnostic_latency_snapshot(DiagnosticLatencyStats* stats,
+        DiagnosticLatencyStats* destination) {
+    memset(destination, 0, sizeof(DiagnosticLatencyStats));
+    destination->dropped = UDS_ATOMIC_LOAD(&stats->dropped);
+
+    uint8_t count = 0;
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_LATENCY_MAX_SERIES; ++i) {
+        DiagnosticLatencyHistogram* series = &stats->series[i];
+        if(UDS_ATOMIC_LOAD_ACQUIRE(&series->state) != SERIES_READY) {
+            continue;
+        }
+
+        DiagnosticLatencyHistogram* copy = &destination->series[count++];
+        copy->state = SERIES_READY;
+        copy->arbitration_id = series->arbitration_id;
+        copy->mode = series->mode;
+        copy->count = UDS_ATOMIC_LOAD(&series->count);
+        copy->max_us = UDS_ATOMIC_LOAD(&series->max_us);
+        uint8_t bucket;
+        for(bucket = 0; bucket < DIAGNOSTIC_LATENCY_BUCKET_COUNT; ++bucket) {
+            copy->buckets[bucket] = UDS_ATOMIC_LOAD(&series->buckets[bucket]);
+        }
+    }
+    return count;
+}
+
+void diagnostic_latency_reset(DiagnosticLatencyStats* stats) {
+    memset(stats, 0, sizeof(DiagnosticLatencyStats));
+}
+
+const DiagnosticLatencyHistogram* diagnostic_latency_find(
+        const DiagnosticLatencyStats* stats, uint32_t arbitration_id,
+        uint8_t mode) {
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_LATENCY_MAX_SERIES; ++i) {
+        const DiagnosticLatencyHistogram* series = &stats->series[i];
+        if(series->state == SERIES_READY &&
+                series->arbitration_id == arbitration_id &&
+                series->mode == mode) {
+            return series;
+        }
+    }
+    return NULL;
+}
+
+uint32_t diagnostic_latency_percentile(
+        const DiagnosticLatencyHistogram* histogram, uint8_t percentile) {
+    if(histogram->count == 0) {
+        return 0;
+    }
+
+    // the rank of the sample we're looking for, rounded up
+    uint64_t rank = ((uint64_t)histogram->count * percentile + 99) / 100;
+    if(rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    uint8_t bucket;
+    for(bucket = 0; bucket < DIAGNOSTIC_LATENCY_BUCKET_COUNT; ++bucket) {
+        seen += histogram->buckets[bucket];
+        if(seen >= rank) {
+            break;
+        }
+    }
+
+    if(bucket >= DIAGNOSTIC_LATENCY_BUCKET_COUNT - 1) {
+        return histogram->max_us;
+    }
+    uint32_t upper_bound = diagnostic_latency_bucket_lower_bound(bucket + 1);
+    return upper_bound < histogram->max_us ? upper_bound : histogram->max_us;
+}
@@ -0,0 +1,130 @@
+#ifndef __UDS_LATENCY_H__
+#define __UDS_LATENCY_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Each power of two is split into 2^DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS linear
+// sub-buckets, so a bucket's width is at most 25% of its lower bound.
+#define DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS 2
+#define DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT \
+        (1 << DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS)
+// Latencies at or above 2^(DIAGNOSTIC_LATENCY_MAX_MAGNITUDE + 1)us (~67s) all
+// land in the last bucket.
+#define DIAGNOSTIC_LATENCY_MAX_MAGNITUDE 25
+#define DIAGNOSTIC_LATENCY_BUCKET_COUNT ((DIAGNOSTIC_LATENCY_MAX_MAGNITUDE - \
+        DIAGNOSTIC_LATENCY_SUB_BUCKET_BITS + 2) * \
+        DIAGNOSTIC_LATENCY_SUB_BUCKET_COUNT)
+
+#ifndef DIAGNOSTIC_LATENCY_MAX_SERIES
+#define DIAGNOSTIC_LATENCY_MAX_SERIES 16
+#endif
+
+/* Public: A log-linear histogram of the round trip latency of the responses
+ * from one ECU for one service.
+ *
+ * The round trip latency is measured from the first frame of the request
+ * being sent to the response being completed, in microseconds.
+ *
+ * arbitration_id - The arbitration ID the responses were received on.
+ * mode - The service (mode) of the requests.
+ * count - The total number of samples in the histogram.
+ * max_us - The largest single sample.
+ * buckets - The sample counts. Use diagnostic_latency_bucket_lower_bound(...)
+ *      to find the range of each bucket.
+ */
+typedef struct {
+    uint32_t arbitration_id;
+    uint8_t mode;
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t buckets[DIAGNOSTIC_LATENCY_BUCKET_COUNT];
+
+    // Private
+    uint32_t state;
+} DiagnosticLatencyHistogram;
+
+/* Public: The latency histograms for every ECU and service pair seen so far.
+ *
+ * Zero-initialize an instance (or use diagnostic_latency_reset(...)) and
+ * assign it to the 'latency_stats' field of a DiagnosticShims. A new series is
+ * claimed the first time a response arrives from an ECU for a service - if all
+ * DIAGNOSTIC_LATENCY_MAX_SERIES series are in use, the sample is counted in
+ * 'dropped' instead.
+ *
+ * Recording a sample is lock-free, so the stats may be read with
+ * diagnostic_latency_snapshot(...) from another thread while requests are in
+ * progress.
+ */
+struct DiagnosticLatencyStats {
+    DiagnosticLatencyHistogram series[DIAGNOSTIC_LATENCY_MAX_SERIES];
+    uint32_t dropped;
+};
+
+/* Public: Record a single latency sample.
+ *
+ * This is called by the library whenever a response is completed, but may be
+ * called directly to record latencies measured elsewhere.
+ *
+ * Returns true if the sample was recorded, or false if there was no free
+ * series left for this ECU and mode.
+ */
+bool diagnostic_latency_record(DiagnosticLatencyStats* stats,
+        uint32_t arbitration_id, uint8_t mode, uint32_t latency_us);
+
+/* Public: Copy the current state of all histograms in to the destination.
+ *
+ * Each counter is read atomically, but the snapshot as a whole is not - a
+ * sample recorded while the snapshot is taken may appear in a bucket but not
+ * yet in the 'count'.
+ *
+ * Returns the number of series in use, which will be at the front of the
+ * destination's 'series' array.
+ */
+uint8_t diagnostic_latency_snapshot(DiagnosticLatencyStats* stats,
+        DiagnosticLatencyStats* destination);
+
+/* Public: Clear all histograms and release all series.
+ *
+ * This must not be called while samples are being recorded.
+ */
+void diagnostic_latency_reset(DiagnosticLatencyStats* stats);
+
+/* Public: Find the histogram for the given ECU and mode, e.g. in a snapshot.
+ *
+ * Returns a pointer to the histogram, or NULL if none has been recorded yet.
+ */
+const DiagnosticLatencyHistogram* diagnostic_latency_find(
+        const DiagnosticLatencyStats* stats, uint32_t arbitration_id,
+        uint8_t mode);
+
+/* Public: Returns the index of the bucket that a latency falls into.
+ */
+uint8_t diagnostic_latency_bucket_index(uint32_t latency_us);
+
+/* Public: Returns the smallest latency, in microseconds, that falls into the
+ * given bucket.
+ */
+uint32_t diagnostic_latency_bucket_lower_bound(uint8_t bucket);
+
+/* Public: Estimate a percentile of the latencies in a histogram.
+ *
+ * percentile - A value from 0 to 100.
+ *
+ * Returns the upper bound (exclusive) of the bucket containing the requested
+ * percentile, clamped to the largest sample seen, or 0 if the histogram is
+ * empty.
+ */
+uint32_t diagnostic_latency_percentile(
+        const DiagnosticLatencyHistogram* histogram, uint8_t percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_LATENCY_H__
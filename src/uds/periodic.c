@@ -0,0 +1,277 @@
+#include <uds/periodic.h>
+#include <uds/uds.h>
+#include <uds/request_driver.h>
+#include <string.h>
+
+#define PERIODIC_RESPONSE_SID (DIAGNOSTIC_SERVICE_READ_PERIODIC + 0x40)
+#define SINGLE_FRAME_PCI_MASK 0xf0
+#define SINGLE_FRAME_LENGTH_MASK 0x0f
+
+void diagnostic_periodic_init(DiagnosticPeriodicReceiver* receiver,
+        DiagnosticShims* shims, uint32_t request_id, uint32_t response_id,
+        DiagnosticPeriodicFormat format) {
+    memset(receiver, 0, sizeof(*receiver));
+    receiver->shims = shims;
+    receiver->request_id = request_id;
+    receiver->response_id = response_id;
+    receiver->format = format;
+}
+
+static DiagnosticPeriodicSubscriber* find_subscriber(
+        DiagnosticPeriodicReceiver* receiver, uint8_t identifier) {
+    // the index holds each identifier's slot + 1, so 0 means none
+    uint8_t slot = receiver->index[identifier];
+    return slot != 0 ? &receiver->subscribers[slot - 1] : NULL;
+}
+
+static void remove_subscriber(DiagnosticPeriodicReceiver* receiver,
+        DiagnosticPeriodicSubscriber* subscriber) {
+    receiver->index[subscriber->identifier] = 0;
+    subscriber->in_use = false;
+}
+
+// A subscriber needs a request if the ECU isn't sending it at the rate it
+// wants, and the last attempt didn't fail.
+static bool needs_request(const DiagnosticPeriodicSubscriber* subscriber) {
+    if(!subscriber->in_use || subscriber->in_request || subscriber->failed) {
+        return false;
+    }
+    return subscriber->rate == DIAGNOSTIC_PERIODIC_STOP ?
+            subscriber->active_rate != 0 :
+            subscriber->rate != subscriber->active_rate;
+}
+
+bool diagnostic_periodic_subscribe(DiagnosticPeriodicReceiver* receiver,
+        uint16_t identifier, DiagnosticPeriodicRate rate,
+        DiagnosticPeriodicDataReceived handler, void* context) {
+    if((identifier & 0xff00) != DIAGNOSTIC_PERIODIC_DID_BASE ||
+            rate == DIAGNOSTIC_PERIODIC_STOP) {
+        return false;
+    }
+
+    DiagnosticPeriodicSubscriber* subscriber = find_subscriber(receiver,
+            identifier & 0xff);
+    if(subscriber == NULL) {
+        uint8_t i;
+        for(i = 0; i < DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS; ++i) {
+            if(!receiver->subscribers[i].in_use) {
+                subscriber = &receiver->subscribers[i];
+                memset(subscriber, 0, sizeof(*subscriber));
+                subscriber->identifier = identifier & 0xff;
+                subscriber->in_use = true;
+                receiver->index[subscriber->identifier] = i + 1;
+                break;
+            }
+        }
+        if(subscriber == NULL) {
+            return false;
+        }
+    }
+
+    subscriber->rate = rate;
+    subscriber->handler = handler;
+    subscriber->context = context;
+    subscriber->failed = false;
+    subscriber->negative_response_code = NRC_SUCCESS;
+    return true;
+}
+
+bool diagnostic_periodic_unsubscribe(DiagnosticPeriodicReceiver* receiver,
+        uint16_t identifier) {
+    DiagnosticPeriodicSubscriber* subscriber = NULL;
+    if((identifier & 0xff00) == DIAGNOSTIC_PERIODIC_DID_BASE) {
+        subscriber = find_subscriber(receiver, identifier & 0xff);
+    }
+    if(subscriber == NULL || subscriber->rate == DIAGNOSTIC_PERIODIC_STOP) {
+        return false;
+    }
+
+    subscriber->rate = DIAGNOSTIC_PERIODIC_STOP;
+    subscriber->failed = false;
+    // one the ECU was never sending can go now - anything else waits for
+    // the ECU to stop, or for the request in progress to finish
+    if(!subscriber->in_request && subscriber->active_rate == 0) {
+        remove_subscriber(receiver, subscriber);
+    }
+    return true;
+}
+
+void diagnostic_periodic_unsubscribe_all(
+        DiagnosticPeriodicReceiver* receiver) {
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS; ++i) {
+        if(receiver->subscribers[i].in_use) {
+            diagnostic_periodic_unsubscribe(receiver,
+                    DIAGNOSTIC_PERIODIC_DID_BASE |
+                        receiver->subscribers[i].identifier);
+        }
+    }
+}
+
+static void finish_request(DiagnosticPeriodicReceiver* receiver,
+        bool success, DiagnosticNegativeResponseCode negative_response_code) {
+    DiagnosticPeriodicRate requested = receiver->request_payload[0];
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS; ++i) {
+        DiagnosticPeriodicSubscriber* subscriber = &receiver->subscribers[i];
+        if(!subscriber->in_use || !subscriber->in_request) {
+            continue;
+        }
+
+        subscriber->in_request = false;
+        if(success) {
+            subscriber->active_rate = requested == DIAGNOSTIC_PERIODIC_STOP ?
+                    0 : requested;
+        } else {
+            subscriber->failed = true;
+            subscriber->negative_response_code = negative_response_code;
+        }
+
+        // an ECU that won't stop sending is ignored
+        if(subscriber->rate == DIAGNOSTIC_PERIODIC_STOP &&
+                (subscriber->active_rate == 0 || !success)) {
+            remove_subscriber(receiver, subscriber);
+        }
+    }
+}
+
+// Send one request moving every identifier that wants the same rate, e.g.
+// all of the new fast ones, or all of the ones being stopped.
+static void send_next(DiagnosticPeriodicReceiver* receiver) {
+    while(!receiver->in_flight) {
+        uint8_t length = 0;
+        uint8_t i;
+        for(i = 0; i < DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS; ++i) {
+            DiagnosticPeriodicSubscriber* subscriber =
+                    &receiver->subscribers[i];
+            if(!needs_request(subscriber) || (length > 0 &&
+                        subscriber->rate != receiver->request_payload[0])) {
+                continue;
+            }
+            if(length == 0) {
+                receiver->request_payload[length++] = subscriber->rate;
+            }
+            receiver->request_payload[length++] = subscriber->identifier;
+            subscriber->in_request = true;
+        }
+        if(length == 0) {
+            return;
+        }
+
+        DiagnosticRequest request = {
+            arbitration_id: receiver->request_id,
+            mode: DIAGNOSTIC_SERVICE_READ_PERIODIC
+        };
+        diagnostic_request_set_payload(&request, receiver->request_payload,
+                length);
+        if(!diagnostic_request_driver_send(receiver->shims, &receiver->driver,
+                    &request)) {
+            finish_request(receiver, false, NRC_SUCCESS);
+        } else {
+            receiver->in_flight = true;
+        }
+    }
+}
+
+static void handle_response(DiagnosticPeriodicReceiver* receiver) {
+    receiver->in_flight = false;
+    receiver->driver.response_received = false;
+    finish_request(receiver, receiver->driver.response.success,
+            receiver->driver.response.negative_response_code);
+}
+
+// Find the identifier and data in a pushed frame, if it is one.
+static bool parse_periodic_frame(const DiagnosticPeriodicReceiver* receiver,
+        const uint8_t data[], uint8_t size, uint8_t* identifier,
+        const uint8_t** payload, uint8_t* length) {
+    if(receiver->format == DIAGNOSTIC_PERIODIC_FORMAT_UUDT) {
+        if(size < 1) {
+            return false;
+        }
+        *identifier = data[0];
+        *payload = &data[1];
+        *length = size - 1;
+        return true;
+    }
+
+    // a positive response to a request is just the SID, so anything with an
+    // identifier after it is periodic data
+    uint8_t frame_length = data[0] & SINGLE_FRAME_LENGTH_MASK;
+    if(size < 3 || (data[0] & SINGLE_FRAME_PCI_MASK) != 0 ||
+            frame_length < 2 || frame_length > size - 1 ||
+            data[1] != PERIODIC_RESPONSE_SID) {
+        return false;
+    }
+    *identifier = data[2];
+    *payload = &data[3];
+    *length = frame_length - 2;
+    return true;
+}
+
+bool diagnostic_periodic_receive_can_frame(
+        DiagnosticPeriodicReceiver* receiver, const uint32_t arbitration_id,
+        const uint8_t data[], const uint8_t size) {
+    uint8_t identifier;
+    DiagnosticPeriodicSample sample;
+    if(arbitration_id == receiver->response_id && parse_periodic_frame(
+                receiver, data, size, &identifier, &sample.data,
+                &sample.length)) {
+        DiagnosticPeriodicSubscriber* subscriber = find_subscriber(receiver,
+                identifier);
+        if(subscriber == NULL ||
+                subscriber->rate == DIAGNOSTIC_PERIODIC_STOP) {
+            ++receiver->samples_unsubscribed;
+            return true;
+        }
+
+        sample.identifier = DIAGNOSTIC_PERIODIC_DID_BASE | identifier;
+        sample.time = diagnostic_current_time(receiver->shims);
+        ++receiver->samples_received;
+        ++subscriber->samples;
+        subscriber->last_sample_time = sample.time;
+        if(subscriber->handler != NULL) {
+            subscriber->handler(&sample, subscriber->context);
+        }
+        return true;
+    }
+
+    if(receiver->in_flight) {
+        diagnostic_receive_can_frame(receiver->shims, &receiver->driver.handle,
+                arbitration_id, data, size);
+        if(receiver->driver.response_received) {
+            handle_response(receiver);
+            send_next(receiver);
+        }
+    }
+    return false;
+}
+
+uint64_t diagnostic_periodic_process(DiagnosticPeriodicReceiver* receiver,
+        uint64_t now) {
+    if(receiver->in_flight) {
+        diagnostic_process_request(receiver->shims, &receiver->driver.handle,
+                now);
+        if(receiver->driver.response_received) {
+            handle_response(receiver);
+        }
+    }
+    send_next(receiver);
+
+    return receiver->in_flight ?
+            diagnostic_request_deadline(&receiver->driver.handle) :
+            DIAGNOSTIC_NO_DEADLINE;
+}
+
+bool diagnostic_periodic_settled(const DiagnosticPeriodicReceiver* receiver) {
+    if(receiver->in_flight) {
+        return false;
+    }
+
+    uint8_t i;
+    for(i = 0; i < DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS; ++i) {
+        if(needs_request(&receiver->subscribers[i])) {
+            return false;
+        }
+    }
+    return true;
+}
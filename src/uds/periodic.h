@@ -0,0 +1,187 @@
+#ifndef __UDS_PERIODIC_H__
+#define __UDS_PERIODIC_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS
+#define DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS 32
+#endif
+
+#define DIAGNOSTIC_SERVICE_READ_PERIODIC 0x2a
+// Periodic data identifiers are the DIDs 0xf200 - 0xf2ff, sent as just their
+// low byte.
+#define DIAGNOSTIC_PERIODIC_DID_BASE 0xf200
+
+/* Public: The transmissionMode of a ReadDataByPeriodicIdentifier (0x2A)
+ * request. The ECU decides the actual period of each rate.
+ */
+typedef enum {
+    DIAGNOSTIC_PERIODIC_RATE_SLOW = 0x1,
+    DIAGNOSTIC_PERIODIC_RATE_MEDIUM = 0x2,
+    DIAGNOSTIC_PERIODIC_RATE_FAST = 0x3,
+    DIAGNOSTIC_PERIODIC_STOP = 0x4
+} DiagnosticPeriodicRate;
+
+/* Public: How an ECU sends its periodic data.
+ *
+ * DIAGNOSTIC_PERIODIC_FORMAT_SINGLE_FRAME - As an ISO-TP single frame with
+ *      the 0x6A response SID, followed by the identifier and the data. This
+ *      can share the ECU's response arbitration ID.
+ * DIAGNOSTIC_PERIODIC_FORMAT_UUDT - As a bare frame with the identifier in
+ *      the first byte and up to 7 bytes of data, on an arbitration ID of its
+ *      own.
+ */
+typedef enum {
+    DIAGNOSTIC_PERIODIC_FORMAT_SINGLE_FRAME,
+    DIAGNOSTIC_PERIODIC_FORMAT_UUDT
+} DiagnosticPeriodicFormat;
+
+/* Public: A value pushed by an ECU.
+ *
+ * identifier - The DID, e.g. 0xf201.
+ * data - The value - only valid during the callback.
+ * length - The length of data.
+ * time - When the frame was received, from the get_time shim.
+ */
+typedef struct {
+    uint16_t identifier;
+    const uint8_t* data;
+    uint8_t length;
+    uint64_t time;
+} DiagnosticPeriodicSample;
+
+/* Public: The signature for a function that handles the samples of a
+ * periodic identifier.
+ */
+typedef void (*DiagnosticPeriodicDataReceived)(
+        const DiagnosticPeriodicSample* sample, void* context);
+
+/* Public: A subscription to one periodic identifier.
+ *
+ * identifier - The periodic data identifier (the low byte of the DID).
+ * rate - The rate the subscriber wants, or DIAGNOSTIC_PERIODIC_STOP once
+ *      it's unsubscribed.
+ * active_rate - The rate the ECU has accepted, or 0 if it isn't sending.
+ * failed - If the ECU refused or didn't answer the last request for this
+ *      identifier. It isn't sent again until it's subscribed again.
+ * negative_response_code - If it failed with a negative response, its code.
+ * samples - The number of samples received.
+ * last_sample_time - When the last sample was received.
+ */
+typedef struct {
+    uint8_t identifier;
+    DiagnosticPeriodicRate rate;
+    uint8_t active_rate;
+    bool failed;
+    DiagnosticNegativeResponseCode negative_response_code;
+    uint32_t samples;
+    uint64_t last_sample_time;
+
+    // Private
+    DiagnosticPeriodicDataReceived handler;
+    void* context;
+    bool in_use;
+    bool in_request;
+} DiagnosticPeriodicSubscriber;
+
+/* Public: Starts and stops the periodic transmission of DIDs by an ECU
+ * (0x2A), and passes the frames the ECU pushes to the subscriber of each
+ * identifier.
+ *
+ * Pushed frames aren't responses to any request, so they're matched by the
+ * arbitration ID they arrive on and the identifier in the frame. That's a
+ * table lookup, so it keeps up with any rate the bus can carry.
+ *
+ * Changes to the subscriptions are sent from diagnostic_periodic_process(...),
+ * one request at a time, with every identifier moving to the same rate in the
+ * same request.
+ *
+ * Use diagnostic_periodic_init(...) to create an instance. It must not move
+ * while it has subscribers.
+ *
+ * request_id - The arbitration ID requests are sent to.
+ * response_id - The arbitration ID the periodic data arrives on.
+ * format - How the periodic data is sent.
+ * samples_received - The number of periodic frames passed to a subscriber.
+ * samples_unsubscribed - The number of periodic frames for identifiers
+ *      with no subscriber, e.g. ones still being stopped.
+ */
+typedef struct {
+    DiagnosticShims* shims;
+    uint32_t request_id;
+    uint32_t response_id;
+    DiagnosticPeriodicFormat format;
+    DiagnosticPeriodicSubscriber subscribers[
+            DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS];
+    uint32_t samples_received;
+    uint32_t samples_unsubscribed;
+
+    // Private
+    uint8_t index[256];
+    DiagnosticRequestDriver driver;
+    bool in_flight;
+    uint8_t request_payload[1 + DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS];
+} DiagnosticPeriodicReceiver;
+
+void diagnostic_periodic_init(DiagnosticPeriodicReceiver* receiver,
+        DiagnosticShims* shims, uint32_t request_id, uint32_t response_id,
+        DiagnosticPeriodicFormat format);
+
+/* Public: Ask the ECU to send a DID at a rate, and pass each value it sends
+ * to a handler. Subscribing to an identifier again changes its rate and
+ * handler.
+ *
+ * identifier - A periodic DID, 0xf200 - 0xf2ff.
+ *
+ * Returns false if the identifier isn't a periodic DID, or if
+ * DIAGNOSTIC_PERIODIC_MAX_SUBSCRIBERS are already subscribed.
+ */
+bool diagnostic_periodic_subscribe(DiagnosticPeriodicReceiver* receiver,
+        uint16_t identifier, DiagnosticPeriodicRate rate,
+        DiagnosticPeriodicDataReceived handler, void* context);
+
+/* Public: Stop passing a DID's values to its handler, and ask the ECU to
+ * stop sending it.
+ *
+ * Returns false if the identifier isn't subscribed.
+ */
+bool diagnostic_periodic_unsubscribe(DiagnosticPeriodicReceiver* receiver,
+        uint16_t identifier);
+
+/* Public: Unsubscribe from every identifier.
+ */
+void diagnostic_periodic_unsubscribe_all(DiagnosticPeriodicReceiver* receiver);
+
+/* Public: Pass a received CAN frame to the receiver.
+ *
+ * Returns true if the frame was periodic data, so it needn't be passed to
+ * anything else.
+ */
+bool diagnostic_periodic_receive_can_frame(
+        DiagnosticPeriodicReceiver* receiver, const uint32_t arbitration_id,
+        const uint8_t data[], const uint8_t size);
+
+/* Public: Send the next change to the subscriptions, and time out the one in
+ * progress - see diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE.
+ */
+uint64_t diagnostic_periodic_process(DiagnosticPeriodicReceiver* receiver,
+        uint64_t now);
+
+/* Public: Returns true if every subscription change has been answered - check
+ * each subscriber for any that failed.
+ */
+bool diagnostic_periodic_settled(const DiagnosticPeriodicReceiver* receiver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_PERIODIC_H__
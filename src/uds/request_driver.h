@@ -0,0 +1,46 @@
+#ifndef __UDS_REQUEST_DRIVER_H__
+#define __UDS_REQUEST_DRIVER_H__
+
+/* Private: The pieces shared by the modules that run a series of requests to
+ * an ECU over one DiagnosticRequestDriver - sessions, downloads, periodic
+ * and dynamic DIDs.
+ *
+ * A response is only recorded by the request's handler, and handled by the
+ * module once diagnostic_receive_can_frame(...) or
+ * diagnostic_process_request(...) has returned, so the next request can
+ * reuse the handle.
+ */
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Private: Returns the time from the shims' GetTimeShim, or 0 if there's no
+ * clock.
+ */
+uint64_t diagnostic_current_time(const DiagnosticShims* shims);
+
+/* Private: Set a request's payload - copied in to it if it fits, otherwise
+ * as its extended_payload, which must outlive the request.
+ */
+void diagnostic_request_set_payload(DiagnosticRequest* request,
+        const uint8_t* payload, uint32_t payload_length);
+
+/* Private: Start a request on the driver's handle, replacing whatever was
+ * there.
+ *
+ * Returns false if the request couldn't be sent, leaving the handle
+ * completed.
+ */
+bool diagnostic_request_driver_send(DiagnosticShims* shims,
+        DiagnosticRequestDriver* driver, DiagnosticRequest* request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_REQUEST_DRIVER_H__
@@ -0,0 +1,128 @@
+#include <uds/ring.h>
+#include <uds/uds.h>
+#include <uds/atomic.h>
+#include <string.h>
+
+#define SUBMISSION_MASK (DIAGNOSTIC_SUBMISSION_RING_SIZE - 1)
+#define COMPLETION_MASK (DIAGNOSTIC_COMPLETION_RING_SIZE - 1)
+
+void diagnostic_submission_ring_init(DiagnosticSubmissionRing* ring) {
+    memset(ring, 0, sizeof(*ring));
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_SUBMISSION_RING_SIZE; ++i) {
+        ring->slots[i].sequence = i;
+    }
+}
+
+// Each slot's sequence is its position when it's free for a producer, and
+// position + 1 once it holds a submission - so producers only contend on the
+// tail, and the consumer can tell a claimed slot that isn't written yet from
+// a full one.
+bool diagnostic_submission_ring_push(DiagnosticSubmissionRing* ring,
+        const DiagnosticSubmission* submission) {
+    uint32_t position = UDS_ATOMIC_LOAD(&ring->tail);
+    DiagnosticSubmissionSlot* slot;
+    while(true) {
+        slot = &ring->slots[position & SUBMISSION_MASK];
+        uint32_t sequence = UDS_ATOMIC_LOAD_ACQUIRE(&slot->sequence);
+        int32_t difference = (int32_t) (sequence - position);
+        if(difference == 0) {
+            if(UDS_ATOMIC_COMPARE_EXCHANGE(&ring->tail, &position,
+                        position + 1)) {
+                break;
+            }
+        } else if(difference < 0) {
+            UDS_ATOMIC_INCREMENT(&ring->full);
+            return false;
+        } else {
+            position = UDS_ATOMIC_LOAD(&ring->tail);
+        }
+    }
+
+    slot->submission = *submission;
+    UDS_ATOMIC_STORE_RELEASE(&slot->sequence, position + 1);
+    return true;
+}
+
+bool diagnostic_submission_ring_pop(DiagnosticSubmissionRing* ring,
+        DiagnosticSubmission* submission) {
+    uint32_t position = ring->head;
+    DiagnosticSubmissionSlot* slot = &ring->slots[position & SUBMISSION_MASK];
+    if(UDS_ATOMIC_LOAD_ACQUIRE(&slot->sequence) != position + 1) {
+        return false;
+    }
+
+    *submission = slot->submission;
+    UDS_ATOMIC_STORE_RELEASE(&slot->sequence,
+            position + DIAGNOSTIC_SUBMISSION_RING_SIZE);
+    ring->head = position + 1;
+    return true;
+}
+
+void diagnostic_completion_ring_init(DiagnosticCompletionRing* ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool diagnostic_completion_ring_push(DiagnosticCompletionRing* ring,
+        uint64_t user_data, const DiagnosticResponse* response) {
+    uint32_t tail = ring->tail;
+    if(tail - UDS_ATOMIC_LOAD_ACQUIRE(&ring->head) >=
+            DIAGNOSTIC_COMPLETION_RING_SIZE) {
+        UDS_ATOMIC_INCREMENT(&ring->overflows);
+        return false;
+    }
+
+    DiagnosticCompletion* completion =
+            &ring->completions[tail & COMPLETION_MASK];
+    completion->user_data = user_data;
+    completion->response = *response;
+    UDS_ATOMIC_STORE_RELEASE(&ring->tail, tail + 1);
+    return true;
+}
+
+bool diagnostic_completion_ring_pop(DiagnosticCompletionRing* ring,
+        DiagnosticCompletion* completion) {
+    uint32_t head = ring->head;
+    if(head == UDS_ATOMIC_LOAD_ACQUIRE(&ring->tail)) {
+        return false;
+    }
+
+    *completion = ring->completions[head & COMPLETION_MASK];
+    UDS_ATOMIC_STORE_RELEASE(&ring->head, head + 1);
+    return true;
+}
+
+static void post_completion(const DiagnosticResponse* response,
+        void* context) {
+    DiagnosticSubmittedRequest* request = (DiagnosticSubmittedRequest*) context;
+    if(request->completions != NULL) {
+        diagnostic_completion_ring_push(request->completions,
+                request->user_data, response);
+    }
+}
+
+void diagnostic_submission_start(DiagnosticShims* shims,
+        const DiagnosticSubmission* submission,
+        DiagnosticSubmittedRequest* request) {
+    DiagnosticRequest copy = submission->request;
+    request->completions = submission->completions;
+    request->user_data = submission->user_data;
+    request->handle = generate_diagnostic_request(shims, &copy, NULL);
+    request->handle.handler = post_completion;
+    request->handle.context = request;
+    start_diagnostic_request(shims, &request->handle);
+
+    if(request->handle.completed) {
+        // not sent, so the handler won't be called
+        DiagnosticResponse response = {
+            arbitration_id: request->handle.address.request_id,
+            mode: copy.mode,
+            has_pid: copy.has_pid,
+            pid: copy.pid,
+            success: false,
+            completed: true,
+            timestamps: request->handle.timestamps
+        };
+        post_completion(&response, request);
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef __UDS_RING_H__
+#define __UDS_RING_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Both must be powers of 2.
+#ifndef DIAGNOSTIC_SUBMISSION_RING_SIZE
+#define DIAGNOSTIC_SUBMISSION_RING_SIZE 64
+#endif
+
+#ifndef DIAGNOSTIC_COMPLETION_RING_SIZE
+#define DIAGNOSTIC_COMPLETION_RING_SIZE 64
+#endif
+
+// Keeps the indices written by different threads out of each other's cache
+// lines.
+#define DIAGNOSTIC_RING_ALIGNED __attribute__((aligned(64)))
+
+typedef struct DiagnosticCompletionRing DiagnosticCompletionRing;
+
+/* Public: A request submitted to the thread that owns the CAN bus.
+ *
+ * request - The request to send.
+ * completions - (optional) The ring to post the responses to, usually one
+ *      per submitting thread. If NULL, the responses are dropped.
+ * user_data - Passed back unchanged with each response, to tell the
+ *      submitter which of its requests it was for.
+ */
+typedef struct {
+    DiagnosticRequest request;
+    DiagnosticCompletionRing* completions;
+    uint64_t user_data;
+} DiagnosticSubmission;
+
+/* Public: A response posted back to a submitting thread.
+ *
+ * user_data - The user_data of the DiagnosticSubmission.
+ * response - The response. It's completed but not successful (and not
+ *      timed_out) if the request couldn't be sent. An 'extended_payload'
+ *      points in to the request's response_buffer.
+ */
+typedef struct {
+    uint64_t user_data;
+    DiagnosticResponse response;
+} DiagnosticCompletion;
+
+/* Private: A slot in a DiagnosticSubmissionRing, with the sequence number
+ * that says whether it's free for the producer at that position, or holds a
+ * submission for the consumer.
+ */
+typedef struct {
+    uint32_t sequence;
+    DiagnosticSubmission submission;
+} DiagnosticSubmissionSlot;
+
+/* Public: A bounded, lock-free queue of requests from any number of threads
+ * to the one thread that drives the diagnostic requests.
+ *
+ * Submitting is a compare-and-swap on the tail and a copy in to the claimed
+ * slot - submitters never wait for each other or for the consumer, and the
+ * consumer never takes a lock.
+ *
+ * Use diagnostic_submission_ring_init(...) to create an instance.
+ *
+ * full - The number of submissions rejected because the ring was full.
+ */
+typedef struct {
+    uint32_t tail DIAGNOSTIC_RING_ALIGNED;
+    uint32_t head DIAGNOSTIC_RING_ALIGNED;
+    uint32_t full;
+    DiagnosticSubmissionSlot slots[DIAGNOSTIC_SUBMISSION_RING_SIZE]
+            DIAGNOSTIC_RING_ALIGNED;
+} DiagnosticSubmissionRing;
+
+/* Public: A bounded, lock-free queue of responses from the thread that
+ * drives the diagnostic requests to a single consuming thread.
+ *
+ * The driving thread never waits for the consumer - if the ring is full, the
+ * response is dropped and counted in 'overflows'.
+ *
+ * Use diagnostic_completion_ring_init(...) to create an instance.
+ *
+ * overflows - The number of responses dropped because the ring was full.
+ */
+struct DiagnosticCompletionRing {
+    uint32_t tail DIAGNOSTIC_RING_ALIGNED;
+    uint32_t head DIAGNOSTIC_RING_ALIGNED;
+    uint32_t overflows;
+    DiagnosticCompletion completions[DIAGNOSTIC_COMPLETION_RING_SIZE]
+            DIAGNOSTIC_RING_ALIGNED;
+};
+
+/* Public: A request started from a DiagnosticSubmission, owned by the
+ * driving thread. It's the context of the handle's handler, so it must not
+ * move while the request is in progress.
+ *
+ * handle - Pass frames to this with diagnostic_receive_can_frame(...) and
+ *      process it with diagnostic_process_request(...) like any other.
+ */
+typedef struct {
+    DiagnosticRequestHandle handle;
+    DiagnosticCompletionRing* completions;
+    uint64_t user_data;
+} DiagnosticSubmittedRequest;
+
+void diagnostic_submission_ring_init(DiagnosticSubmissionRing* ring);
+
+/* Public: Queue a request for the driving thread. Safe to call from any
+ * number of threads at once.
+ *
+ * The driving thread may be asleep waiting for a frame or a deadline, so
+ * wake it up afterwards (e.g. with an eventfd it also polls).
+ *
+ * Returns false if the ring is full.
+ */
+bool diagnostic_submission_ring_push(DiagnosticSubmissionRing* ring,
+        const DiagnosticSubmission* submission);
+
+/* Public: Take the oldest submission off the ring. Only the driving thread
+ * may call this.
+ *
+ * Returns false if there are no submissions waiting.
+ */
+bool diagnostic_submission_ring_pop(DiagnosticSubmissionRing* ring,
+        DiagnosticSubmission* submission);
+
+void diagnostic_completion_ring_init(DiagnosticCompletionRing* ring);
+
+/* Public: Post a response to the ring. Only the driving thread may call
+ * this.
+ *
+ * Returns false if the ring was full, and the response was dropped.
+ */
+bool diagnostic_completion_ring_push(DiagnosticCompletionRing* ring,
+        uint64_t user_data, const DiagnosticResponse* response);
+
+/* Public: Take the oldest response off the ring. Only the thread that owns
+ * the ring may call this.
+ *
+ * Returns false if there are no responses waiting.
+ */
+bool diagnostic_completion_ring_pop(DiagnosticCompletionRing* ring,
+        DiagnosticCompletion* completion);
+
+/* Public: Start the request from a submission, with a handler that posts
+ * each response (or a failure to send) to the submission's completion ring.
+ *
+ * shims - The DiagnosticShims of the driving thread.
+ * submission - A submission taken off a DiagnosticSubmissionRing.
+ * request - Where to keep the request while it's in progress.
+ */
+void diagnostic_submission_start(DiagnosticShims* shims,
+        const DiagnosticSubmission* submission,
+        DiagnosticSubmittedRequest* request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_RING_H__
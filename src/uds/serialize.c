@@ -0,0 +1,523 @@
+#include <uds/serialize.h>
+#include <uds/filter.h>
+#include <uds/framing.h>
+#include <string.h>
+
+#define FLAG_COMPLETED 0x1
+#define FLAG_SUCCESS 0x2
+#define FLAG_HAS_PID 0x4
+#define FLAG_MULTI_FRAME 0x8
+#define FLAG_TIMED_OUT 0x10
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// Appends to a fixed buffer, remembering if anything didn't fit so the
+// caller only has to check once at the end.
+typedef struct {
+    char* destination;
+    size_t length;
+    size_t used;
+    bool overflowed;
+} Writer;
+
+static char* reserve(Writer* writer, size_t count) {
+    if(writer->overflowed || writer->length - writer->used < count) {
+        writer->overflowed = true;
+        return NULL;
+    }
+    char* position = writer->destination + writer->used;
+    writer->used += count;
+    return position;
+}
+
+static void append(Writer* writer, const char* string) {
+    size_t count = strlen(string);
+    char* position = reserve(writer, count);
+    if(position != NULL) {
+        memcpy(position, string, count);
+    }
+}
+
+static void append_decimal(Writer* writer, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while(value > 0);
+
+    char* position = reserve(writer, count);
+    if(position != NULL) {
+        while(count > 0) {
+            *position++ = digits[--count];
+        }
+    }
+}
+
+static void append_hex(Writer* writer, const uint8_t* data, size_t size) {
+    char* position = reserve(writer, size * 2);
+    if(position != NULL) {
+        size_t i;
+        for(i = 0; i < size; ++i) {
+            *position++ = HEX_DIGITS[data[i] >> 4];
+            *position++ = HEX_DIGITS[data[i] & 0xf];
+        }
+    }
+}
+
+static void response_payload(const DiagnosticResponse* response,
+        const uint8_t** payload, uint32_t* length) {
+    if(response->extended_payload != NULL) {
+        *payload = response->extended_payload;
+        *length = response->extended_payload_length;
+    } else {
+        *payload = response->payload;
+        *length = response->payload_length;
+    }
+}
+
+size_t diagnostic_response_to_json(const DiagnosticResponse* response,
+        char* destination, size_t destination_length) {
+    Writer writer = {
+        destination: destination,
+        length: destination_length,
+        used: 0,
+        overflowed: false
+    };
+
+    append(&writer, "{\"time\":");
+    append_decimal(&writer, response->timestamps.completed);
+    append(&writer, ",\"arb_id\":");
+    append_decimal(&writer, response->arbitration_id);
+    append(&writer, ",\"mode\":");
+    append_decimal(&writer, response->mode);
+    if(response->has_pid) {
+        append(&writer, ",\"pid\":");
+        append_decimal(&writer, response->pid);
+    }
+    append(&writer, response->success ? ",\"success\":true" :
+            ",\"success\":false");
+    if(!response->success) {
+        append(&writer, ",\"nrc\":");
+        append_decimal(&writer, response->negative_response_code);
+    }
+    if(response->timed_out) {
+        append(&writer, ",\"timed_out\":true");
+    }
+    if(response->multi_frame) {
+        append(&writer, ",\"multi_frame\":true");
+    }
+
+    const DiagnosticTimestamps* timestamps = &response->timestamps;
+    if(timestamps->first_frame_sent != 0 &&
+            timestamps->completed >= timestamps->first_frame_sent) {
+        append(&writer, ",\"latency_us\":");
+        append_decimal(&writer,
+                timestamps->completed - timestamps->first_frame_sent);
+    }
+
+    const uint8_t* payload;
+    uint32_t payload_length;
+    response_payload(response, &payload, &payload_length);
+    append(&writer, ",\"payload\":\"");
+    append_hex(&writer, payload, payload_length);
+    append(&writer, "\"}\n");
+
+    if(writer.overflowed) {
+        return 0;
+    }
+    if(writer.used < destination_length) {
+        destination[writer.used] = '\0';
+    }
+    return writer.used;
+}
+
+static void write_uint16(uint8_t* destination, uint16_t value) {
+    destination[0] = value;
+    destination[1] = value >> 8;
+}
+
+static void write_uint32(uint8_t* destination, uint32_t value) {
+    write_uint16(destination, value);
+    write_uint16(destination + 2, value >> 16);
+}
+
+static void write_uint64(uint8_t* destination, uint64_t value) {
+    write_uint32(destination, value);
+    write_uint32(destination + 4, value >> 32);
+}
+
+static uint16_t read_uint16(const uint8_t* source) {
+    return source[0] | (source[1] << 8);
+}
+
+static uint32_t read_uint32(const uint8_t* source) {
+    return read_uint16(source) | ((uint32_t) read_uint16(source + 2) << 16);
+}
+
+static uint64_t read_uint64(const uint8_t* source) {
+    return read_uint32(source) | ((uint64_t) read_uint32(source + 4) << 32);
+}
+
+size_t diagnostic_response_to_binary(const DiagnosticResponse* response,
+        uint8_t* destination, size_t destination_length) {
+    const uint8_t* payload;
+    uint32_t payload_length;
+    response_payload(response, &payload, &payload_length);
+    size_t size = DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE + payload_length;
+    if(size > destination_length) {
+        return 0;
+    }
+
+    uint8_t flags = (response->completed ? FLAG_COMPLETED : 0) |
+            (response->success ? FLAG_SUCCESS : 0) |
+            (response->has_pid ? FLAG_HAS_PID : 0) |
+            (response->multi_frame ? FLAG_MULTI_FRAME : 0) |
+            (response->timed_out ? FLAG_TIMED_OUT : 0);
+    write_uint64(destination, response->timestamps.completed);
+    write_uint32(destination + 8, response->arbitration_id);
+    destination[12] = flags;
+    destination[13] = response->mode;
+    write_uint16(destination + 14, response->pid);
+    destination[16] = response->negative_response_code;
+    write_uint32(destination + 17, payload_length);
+    memcpy(destination + DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE, payload,
+            payload_length);
+    return size;
+}
+
+size_t diagnostic_response_record_read(const uint8_t* source, size_t length,
+        DiagnosticResponseRecord* record) {
+    if(length < DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE) {
+        return 0;
+    }
+
+    uint32_t payload_length = read_uint32(source + 17);
+    if(length - DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE < payload_length) {
+        return 0;
+    }
+
+    uint8_t flags = source[12];
+    record->timestamp = read_uint64(source);
+    record->arbitration_id = read_uint32(source + 8);
+    record->completed = flags & FLAG_COMPLETED;
+    record->success = flags & FLAG_SUCCESS;
+    record->has_pid = flags & FLAG_HAS_PID;
+    record->multi_frame = flags & FLAG_MULTI_FRAME;
+    record->timed_out = flags & FLAG_TIMED_OUT;
+    record->mode = source[13];
+    record->pid = read_uint16(source + 14);
+    record->negative_response_code = source[16];
+    record->payload = source + DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE;
+    record->payload_length = payload_length;
+    return DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE + payload_length;
+}
+
+#define STATE_COMPLETED 0x1
+#define STATE_SUCCESS 0x2
+#define STATE_HAS_PID 0x4
+#define STATE_RECEIVING 0x8
+#define STATE_FRAMED 0x10
+#define STATE_SENT 0x20
+#define STATE_SEND_SUCCESS 0x40
+#define STATE_RESPONSE_PENDING 0x80
+#define STATE_RETRY_PENDING 0x100
+#define STATE_FILTER_REGISTERED 0x200
+#define STATE_WAITING_FOR_FLOW_CONTROL 0x400
+#define STATE_FRAMES_SENT 0x800
+#define STATE_FRAMES_SUCCESS 0x1000
+#define STATE_MULTI_FRAME 0x2000
+#define STATE_IN_PROGRESS 0x4000
+
+// The sizes of the groups of fields in the state that are read after they're
+// checked.
+#define STATE_TIMESTAMPS_SIZE 40
+#define STATE_TIMING_SIZE 25
+
+// The handle state is a long run of fields, so it's written and read in
+// order rather than at fixed offsets.
+static void put_uint8(uint8_t** position, uint8_t value) {
+    **position = value;
+    *position += 1;
+}
+
+static void put_uint16(uint8_t** position, uint16_t value) {
+    write_uint16(*position, value);
+    *position += 2;
+}
+
+static void put_uint32(uint8_t** position, uint32_t value) {
+    write_uint32(*position, value);
+    *position += 4;
+}
+
+static void put_uint64(uint8_t** position, uint64_t value) {
+    write_uint64(*position, value);
+    *position += 8;
+}
+
+static uint8_t take_uint8(const uint8_t** position) {
+    uint8_t value = **position;
+    *position += 1;
+    return value;
+}
+
+static uint16_t take_uint16(const uint8_t** position) {
+    uint16_t value = read_uint16(*position);
+    *position += 2;
+    return value;
+}
+
+static uint32_t take_uint32(const uint8_t** position) {
+    uint32_t value = read_uint32(*position);
+    *position += 4;
+    return value;
+}
+
+static uint64_t take_uint64(const uint8_t** position) {
+    uint64_t value = read_uint64(*position);
+    *position += 8;
+    return value;
+}
+
+static uint32_t extended_payload_length(const DiagnosticRequest* request) {
+    return request->extended_payload != NULL ?
+            request->extended_payload_length : 0;
+}
+
+// Frames are 8 bytes for classic CAN, or one of the CAN FD lengths.
+static bool valid_frame_size(uint8_t frame_size) {
+    return frame_size == diagnostic_framing_max_frame_length(frame_size);
+}
+
+static uint16_t handle_state_flags(const DiagnosticRequestHandle* handle) {
+    const DiagnosticFrameSender* sender = &handle->frame_sender;
+    const DiagnosticFrameReceiver* receiver = &handle->frame_receiver;
+    return (handle->completed ? STATE_COMPLETED : 0) |
+            (handle->success ? STATE_SUCCESS : 0) |
+            (handle->request.has_pid ? STATE_HAS_PID : 0) |
+            (handle->receiving ? STATE_RECEIVING : 0) |
+            (handle->framed ? STATE_FRAMED : 0) |
+            (handle->isotp_send_handle.completed ? STATE_SENT : 0) |
+            (handle->isotp_send_handle.success ? STATE_SEND_SUCCESS : 0) |
+            (handle->response_pending ? STATE_RESPONSE_PENDING : 0) |
+            (handle->retry_pending ? STATE_RETRY_PENDING : 0) |
+            (handle->filter_registered ? STATE_FILTER_REGISTERED : 0) |
+            (sender->waiting_for_flow_control ?
+                STATE_WAITING_FOR_FLOW_CONTROL : 0) |
+            (sender->completed ? STATE_FRAMES_SENT : 0) |
+            (sender->success ? STATE_FRAMES_SUCCESS : 0) |
+            (receiver->multi_frame ? STATE_MULTI_FRAME : 0) |
+            (receiver->in_progress ? STATE_IN_PROGRESS : 0);
+}
+
+// The part of a multi-frame response in the handle's buffer - a streamed
+// response may have had more than fits.
+static uint32_t received_length(const DiagnosticRequestHandle* handle) {
+    const DiagnosticFrameReceiver* receiver = &handle->frame_receiver;
+    if(!handle->framed || receiver->buffer == NULL) {
+        return 0;
+    }
+    return receiver->received < receiver->buffer_size ?
+            receiver->received : receiver->buffer_size;
+}
+
+size_t diagnostic_request_handle_save(const DiagnosticRequestHandle* handle,
+        uint8_t* destination, size_t destination_length) {
+    uint32_t buffered = received_length(handle);
+    size_t size = DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE + buffered;
+    if(handle->frame_queued || size > destination_length) {
+        return 0;
+    }
+
+    const DiagnosticRequest* request = &handle->request;
+    const DiagnosticTimestamps* timestamps = &handle->timestamps;
+    const DiagnosticFrameSender* sender = &handle->frame_sender;
+    const DiagnosticFrameReceiver* receiver = &handle->frame_receiver;
+    uint8_t* position = destination;
+    put_uint32(&position, DIAGNOSTIC_REQUEST_STATE_MAGIC);
+    put_uint8(&position, DIAGNOSTIC_REQUEST_STATE_VERSION);
+    put_uint16(&position, handle_state_flags(handle));
+
+    // to check it's restored in to the same request
+    put_uint32(&position, request->arbitration_id);
+    put_uint8(&position, request->mode);
+    put_uint16(&position, request->pid);
+    put_uint8(&position, request->pid_length);
+    put_uint8(&position, request->payload_length);
+    put_uint32(&position, extended_payload_length(request));
+
+    memcpy(position, handle->request_header, sizeof(handle->request_header));
+    position += sizeof(handle->request_header);
+    put_uint64(&position, timestamps->queued);
+    put_uint64(&position, timestamps->first_frame_sent);
+    put_uint64(&position, timestamps->last_frame_sent);
+    put_uint64(&position, timestamps->first_response_frame);
+    put_uint64(&position, timestamps->completed);
+    put_uint8(&position, handle->retries);
+    put_uint32(&position, handle->timeout_us);
+    put_uint64(&position, handle->timeout_deadline);
+    put_uint64(&position, handle->next_frame_time);
+    put_uint32(&position, handle->framed_response_id);
+
+    put_uint8(&position, handle->isotp_receive_handle_count);
+    int i;
+    for(i = 0; i < MAX_RESPONDING_ECU_COUNT; ++i) {
+        put_uint32(&position, i < handle->isotp_receive_handle_count ?
+                handle->response_ids[i] : 0);
+    }
+
+    put_uint8(&position, sender->frame_size);
+    put_uint32(&position, sender->separation_time_us);
+    put_uint8(&position, sender->head_length);
+    put_uint32(&position, sender->offset);
+    put_uint8(&position, sender->sequence);
+    put_uint8(&position, sender->block_size);
+    put_uint8(&position, sender->block_remaining);
+
+    put_uint32(&position, receiver->length);
+    put_uint32(&position, receiver->received);
+    put_uint8(&position, receiver->sequence);
+    put_uint32(&position, buffered);
+    if(buffered > 0) {
+        memcpy(position, receiver->buffer, buffered);
+    }
+    return position - destination + buffered;
+}
+
+bool diagnostic_request_handle_restore(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint8_t* source,
+        size_t length) {
+    if(length < DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE) {
+        return false;
+    }
+
+    const uint8_t* position = source;
+    if(take_uint32(&position) != DIAGNOSTIC_REQUEST_STATE_MAGIC ||
+            take_uint8(&position) != DIAGNOSTIC_REQUEST_STATE_VERSION) {
+        return false;
+    }
+    uint16_t flags = take_uint16(&position);
+
+    // the PID length is only filled in once the request is sent
+    DiagnosticRequest* request = &handle->request;
+    uint32_t arbitration_id = take_uint32(&position);
+    uint8_t mode = take_uint8(&position);
+    uint16_t pid = take_uint16(&position);
+    uint8_t pid_length = take_uint8(&position);
+    uint8_t payload_length = take_uint8(&position);
+    if(arbitration_id != request->arbitration_id || mode != request->mode ||
+            !(flags & STATE_HAS_PID) != !request->has_pid ||
+            pid != request->pid ||
+            (request->pid_length != 0 && pid_length != request->pid_length) ||
+            payload_length != request->payload_length ||
+            take_uint32(&position) != extended_payload_length(request)) {
+        return false;
+    }
+
+    const uint8_t* header = position;
+    position += sizeof(handle->request_header);
+    const uint8_t* timestamps = position;
+    position += STATE_TIMESTAMPS_SIZE;
+    const uint8_t* timing = position;
+    position += STATE_TIMING_SIZE;
+    uint8_t response_id_count = take_uint8(&position);
+    const uint8_t* response_ids = position;
+    position += 4 * MAX_RESPONDING_ECU_COUNT;
+    // the sender and receiver are checked against the request and buffers
+    // they're restored in to
+    uint8_t frame_size = take_uint8(&position);
+    uint32_t separation_time_us = take_uint32(&position);
+    uint8_t head_length = take_uint8(&position);
+    uint32_t offset = take_uint32(&position);
+    uint8_t send_sequence = take_uint8(&position);
+    uint8_t block_size = take_uint8(&position);
+    uint8_t block_remaining = take_uint8(&position);
+    uint32_t receive_length = take_uint32(&position);
+    uint32_t received = take_uint32(&position);
+    uint8_t receive_sequence = take_uint8(&position);
+    uint32_t buffered = take_uint32(&position);
+
+    uint32_t buffer_size = request->response_buffer != NULL ?
+            request->response_buffer_size : sizeof(handle->framing_buffer);
+    bool framed = flags & STATE_FRAMED;
+    if(response_id_count > MAX_RESPONDING_ECU_COUNT ||
+            ((framed || frame_size != 0) && !valid_frame_size(frame_size)) ||
+            head_length > sizeof(handle->request_header) ||
+            offset > head_length + extended_payload_length(request) ||
+            received > receive_length ||
+            (receive_length > buffer_size && handle->chunk_handler == NULL) ||
+            buffered > received || buffered > buffer_size ||
+            length - DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE < buffered) {
+        return false;
+    }
+
+    request->pid_length = pid_length;
+    handle->completed = flags & STATE_COMPLETED;
+    handle->success = flags & STATE_SUCCESS;
+    handle->receiving = flags & STATE_RECEIVING;
+    handle->framed = framed;
+    handle->isotp_send_handle.completed = flags & STATE_SENT;
+    handle->isotp_send_handle.success = flags & STATE_SEND_SUCCESS;
+    handle->response_pending = flags & STATE_RESPONSE_PENDING;
+    handle->retry_pending = flags & STATE_RETRY_PENDING;
+    handle->frame_queued = false;
+    memcpy(handle->request_header, header, sizeof(handle->request_header));
+
+    handle->timestamps.queued = take_uint64(&timestamps);
+    handle->timestamps.first_frame_sent = take_uint64(&timestamps);
+    handle->timestamps.last_frame_sent = take_uint64(&timestamps);
+    handle->timestamps.first_response_frame = take_uint64(&timestamps);
+    handle->timestamps.completed = take_uint64(&timestamps);
+    handle->retries = take_uint8(&timing);
+    handle->timeout_us = take_uint32(&timing);
+    handle->timeout_deadline = take_uint64(&timing);
+    handle->next_frame_time = take_uint64(&timing);
+    handle->framed_response_id = take_uint32(&timing);
+
+    // isotp-c's receive handles only hold the start of a message, so they
+    // can be made again
+    handle->isotp_receive_handle_count = response_id_count;
+    int i;
+    for(i = 0; i < response_id_count; ++i) {
+        handle->response_ids[i] = take_uint32(&response_ids);
+        handle->isotp_receive_handles[i] = isotp_receive(
+                &handle->isotp_shims, handle->response_ids[i], NULL);
+    }
+
+    DiagnosticFrameSender* sender = &handle->frame_sender;
+    sender->frame_size = frame_size;
+    sender->separation_time_us = separation_time_us;
+    sender->waiting_for_flow_control = flags & STATE_WAITING_FOR_FLOW_CONTROL;
+    sender->completed = flags & STATE_FRAMES_SENT;
+    sender->success = flags & STATE_FRAMES_SUCCESS;
+    sender->head = handle->request_header;
+    sender->head_length = head_length;
+    sender->body = request->extended_payload;
+    sender->body_length = extended_payload_length(request);
+    sender->offset = offset;
+    sender->sequence = send_sequence;
+    sender->block_size = block_size;
+    sender->block_remaining = block_remaining;
+
+    DiagnosticFrameReceiver* receiver = &handle->frame_receiver;
+    diagnostic_framing_receive_init(receiver, request->response_buffer != NULL ?
+                request->response_buffer : handle->framing_buffer,
+            buffer_size);
+    receiver->streaming = handle->chunk_handler != NULL;
+    receiver->length = receive_length;
+    receiver->received = received;
+    receiver->sequence = receive_sequence;
+    receiver->multi_frame = flags & STATE_MULTI_FRAME;
+    receiver->in_progress = flags & STATE_IN_PROGRESS;
+    memcpy(receiver->buffer, position, buffered);
+
+    // the new process has its own filter
+    handle->filter_registered = false;
+    if(shims->filter != NULL && (flags & STATE_FILTER_REGISTERED)) {
+        diagnostic_filter_add_masked(shims->filter,
+                handle->address.response_id, handle->address.response_mask);
+        handle->filter_registered = true;
+    }
+    return true;
+}
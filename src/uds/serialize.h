@@ -0,0 +1,159 @@
+#ifndef __UDS_SERIALIZE_H__
+#define __UDS_SERIALIZE_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE 21
+
+#define DIAGNOSTIC_REQUEST_STATE_MAGIC 0x48534455
+#define DIAGNOSTIC_REQUEST_STATE_VERSION 1
+// The saved state of a handle, before the part of a multi-frame response it
+// has already received.
+#define DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE (115 + \
+        MAX_UDS_REQUEST_PAYLOAD_LENGTH + 4 * MAX_RESPONDING_ECU_COUNT)
+
+/* Public: Write a response as a single line of JSON (with the trailing
+ * newline), for newline-delimited JSON exports:
+ *
+ *  {"time":1234,"arb_id":2024,"mode":1,"pid":12,"success":true,
+ *      "latency_us":850,"payload":"1aa0"}
+ *
+ * 'time' is the completed timestamp, 'pid' is only present if the response
+ * has one, 'nrc' is present for unsuccessful responses, 'timed_out' and
+ * 'multi_frame' only when true and 'latency_us' if the request was sent with
+ * a clock. The payload is the whole payload, including an extended_payload.
+ *
+ * Nothing is written with the libc formatting functions, so this is cheap
+ * enough to call for every response.
+ *
+ * destination - The buffer to write to. A payload of n bytes needs a little
+ *      under 200 + 2n bytes.
+ * destination_length - The size of the buffer.
+ *
+ * Returns the number of characters written (not including a NUL terminator,
+ * which is added if there's room), or 0 if the line didn't fit.
+ */
+size_t diagnostic_response_to_json(const DiagnosticResponse* response,
+        char* destination, size_t destination_length);
+
+/* Public: Write a response as a compact binary record, all little-endian:
+ *
+ *  completed time in us (uint64) | arbitration ID (uint32) | flags (uint8) |
+ *  mode (uint8) | pid (uint16) | negative response code (uint8) |
+ *  payload length (uint32) | payload
+ *
+ * Records can be written back to back in to a file or a stream, and read
+ * with diagnostic_response_record_read(...).
+ *
+ * destination - The buffer to write to, which needs
+ *      DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE bytes plus the payload.
+ * destination_length - The size of the buffer.
+ *
+ * Returns the number of bytes written, or 0 if the record didn't fit.
+ */
+size_t diagnostic_response_to_binary(const DiagnosticResponse* response,
+        uint8_t* destination, size_t destination_length);
+
+/* Public: A response read from a binary record. The payload points directly
+ * in to the source, so it's only valid as long as that is.
+ */
+typedef struct {
+    uint64_t timestamp;
+    uint32_t arbitration_id;
+    bool completed;
+    bool success;
+    bool multi_frame;
+    bool timed_out;
+    uint8_t mode;
+    bool has_pid;
+    uint16_t pid;
+    DiagnosticNegativeResponseCode negative_response_code;
+    const uint8_t* payload;
+    uint32_t payload_length;
+} DiagnosticResponseRecord;
+
+/* Public: Read the binary record at the start of the source.
+ *
+ * Returns the size of the record, to skip to the next one, or 0 if the
+ * source doesn't hold a whole record.
+ */
+size_t diagnostic_response_record_read(const uint8_t* source, size_t length,
+        DiagnosticResponseRecord* record);
+
+/* Public: Save the progress of a request that's still in flight, so another
+ * process (e.g. the daemon after a restart, or a standby taking over) can
+ * carry on with it using diagnostic_request_handle_restore(...) rather than
+ * starting again.
+ *
+ * The state is written little-endian with a magic number and a version, and
+ * holds everything the handle needs to carry on: how far a multi-frame
+ * request has been sent, the ECU's flow control, the sequence numbers, how
+ * much of a multi-frame response has arrived (and those bytes), retries and
+ * response pending, and the deadlines. The request itself, the callback,
+ * handlers and buffers aren't saved - they're supplied again when the handle
+ * is re-created.
+ *
+ * Deadlines are saved as they are, on the GetTimeShim's clock, so the new
+ * process needs the same clock (e.g. CLOCK_MONOTONIC on the same host). The
+ * ECU only waits N_Cr (DIAGNOSTIC_TRANSFER_TIMEOUT_MS) between frames of a
+ * transfer, so a handle has to be restored and fed frames again within that
+ * to keep a multi-frame response going - after that the ECU has given up,
+ * and the handle times out as it would have, failing the request.
+ *
+ * Call it when the handle isn't being used by another thread, e.g. from the
+ * main loop after processing it. Saving again over the same buffer keeps it
+ * up to date.
+ *
+ * destination - The buffer to write to, e.g. in a shared memory segment. It
+ *      needs DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE bytes plus what has arrived
+ *      of a multi-frame response (up to the size of the response buffer).
+ * destination_length - The size of the buffer.
+ *
+ * Returns the number of bytes written, or 0 if the state didn't fit or a
+ * frame of the request is still waiting in the shims' DiagnosticTxQueue (the
+ * queue isn't saved, so drain it and try again).
+ */
+size_t diagnostic_request_handle_save(const DiagnosticRequestHandle* handle,
+        uint8_t* destination, size_t destination_length);
+
+/* Public: Carry on with a request saved by diagnostic_request_handle_save(...).
+ *
+ * Re-create the handle with generate_diagnostic_request(...) from the same
+ * DiagnosticRequest - including the extended_payload and response_buffer -
+ * and assign its handler, context and chunk_handler as before, but don't
+ * start it. Then restore the state in to it, and use it as if it had never
+ * stopped: pass it the CAN frames that arrive, and continue and process it.
+ *
+ * The responses to a request sent with isotp-c (a single frame request
+ * without a response_buffer or chunk_handler) are reassembled by isotp-c, so
+ * one that was part way through arriving can't carry on - the rest of it is
+ * ignored, and the request fails when it times out.
+ * Give requests with long responses a response_buffer so they can carry on.
+ *
+ * shims - The shims of the new process. If it has a DiagnosticAcceptFilter,
+ *      the handle's response IDs are added to it again.
+ * handle - The re-created handle.
+ * source - The saved state.
+ * length - The number of bytes saved.
+ *
+ * Returns true if the state was restored, or false (leaving the handle as it
+ * was) if it's not saved state, is from another version, doesn't fit the
+ * response buffer, was saved from a different request or has a send or
+ * receive that can't be (e.g. a frame size that isn't a CAN FD length).
+ */
+bool diagnostic_request_handle_restore(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint8_t* source,
+        size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_SERIALIZE_H__
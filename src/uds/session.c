@@ -0,0 +1,320 @@
+#include <uds/session.h>
+#include <uds/uds.h>
+#include <uds/discovery.h>
+#include <uds/request_driver.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+static bool in_flight(const DiagnosticEcuSession* ecu) {
+    return ecu->state == DIAGNOSTIC_SESSION_CHANGING ||
+            ecu->state == DIAGNOSTIC_SESSION_REQUESTING_SEED ||
+            ecu->state == DIAGNOSTIC_SESSION_SENDING_KEY;
+}
+
+// The ECU drops back to the default session if it goes S3 without a request,
+// so the session manager's own requests and responses count.
+static bool needs_keep_alive(const DiagnosticEcuSession* ecu) {
+    return !in_flight(ecu) && ecu->session != DIAGNOSTIC_DEFAULT_SESSION;
+}
+
+static void schedule_keep_alive(DiagnosticEcuSession* ecu, uint64_t now) {
+    ecu->keep_alive_time = now != 0 ?
+            now + DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS * 1000ULL : 0;
+}
+
+void diagnostic_session_manager_init(DiagnosticSessionManager* manager,
+        DiagnosticShims* shims, DiagnosticSecurityKeyShim compute_key,
+        void* context) {
+    memset(manager, 0, sizeof(*manager));
+    manager->shims = shims;
+    manager->compute_key = compute_key;
+    manager->context = context;
+}
+
+DiagnosticEcuSession* diagnostic_session_find(
+        DiagnosticSessionManager* manager, uint32_t arbitration_id) {
+    uint8_t i;
+    for(i = 0; i < manager->ecu_count; ++i) {
+        if(manager->ecus[i].arbitration_id == arbitration_id) {
+            return &manager->ecus[i];
+        }
+    }
+    return NULL;
+}
+
+DiagnosticEcuSession* diagnostic_session_add(DiagnosticSessionManager* manager,
+        uint32_t arbitration_id) {
+    DiagnosticEcuSession* ecu = diagnostic_session_find(manager,
+            arbitration_id);
+    if(ecu != NULL) {
+        return ecu;
+    }
+
+    if(manager->ecu_count >= DIAGNOSTIC_SESSION_MAX_ECUS) {
+        return NULL;
+    }
+
+    ecu = &manager->ecus[manager->ecu_count++];
+    memset(ecu, 0, sizeof(*ecu));
+    ecu->arbitration_id = arbitration_id;
+    ecu->session = DIAGNOSTIC_DEFAULT_SESSION;
+    ecu->target_session = DIAGNOSTIC_DEFAULT_SESSION;
+    ecu->state = DIAGNOSTIC_SESSION_READY;
+    ecu->manager = manager;
+    return ecu;
+}
+
+static void fail(DiagnosticEcuSession* ecu,
+        DiagnosticNegativeResponseCode negative_response_code,
+        bool timed_out) {
+    ecu->state = DIAGNOSTIC_SESSION_FAILED;
+    ecu->negative_response_code = negative_response_code;
+    ecu->timed_out = timed_out;
+}
+
+static bool send(DiagnosticEcuSession* ecu, DiagnosticSessionState state,
+        uint8_t mode, uint8_t sub_function, const uint8_t* payload,
+        uint8_t payload_length) {
+    DiagnosticRequest request = {
+        arbitration_id: ecu->arbitration_id,
+        mode: mode,
+        has_pid: true,
+        pid: sub_function,
+        pid_length: 1
+    };
+    diagnostic_request_set_payload(&request, payload, payload_length);
+
+    ecu->state = state;
+    if(!diagnostic_request_driver_send(ecu->manager->shims, &ecu->driver,
+                &request)) {
+        fail(ecu, NRC_SUCCESS, false);
+        return false;
+    }
+    return true;
+}
+
+// With the positive response suppressed there's nothing to wait for, so the
+// request is released as soon as it's sent.
+static void send_tester_present(DiagnosticEcuSession* ecu) {
+    DiagnosticShims* shims = ecu->manager->shims;
+    DiagnosticRequest request = {
+        arbitration_id: ecu->arbitration_id,
+        mode: DIAGNOSTIC_SERVICE_TESTER_PRESENT,
+        has_pid: true,
+        pid: DIAGNOSTIC_SUPPRESS_POSITIVE_RESPONSE,
+        pid_length: 1
+    };
+    diagnostic_request_driver_send(shims, &ecu->driver, &request);
+    diagnostic_request_release(shims, &ecu->driver.handle);
+}
+
+// Take the next step towards the target session and security level.
+static bool step(DiagnosticEcuSession* ecu) {
+    if(ecu->session != ecu->target_session) {
+        return send(ecu, DIAGNOSTIC_SESSION_CHANGING,
+                DIAGNOSTIC_SERVICE_SESSION_CONTROL, ecu->target_session,
+                NULL, 0);
+    } else if(ecu->target_level != 0 &&
+            ecu->security_level != ecu->target_level) {
+        return send(ecu, DIAGNOSTIC_SESSION_REQUESTING_SEED,
+                DIAGNOSTIC_SERVICE_SECURITY_ACCESS, ecu->target_level,
+                NULL, 0);
+    }
+
+    ecu->state = DIAGNOSTIC_SESSION_READY;
+    return true;
+}
+
+static bool seed_is_cached(const DiagnosticEcuSession* ecu,
+        const uint8_t* seed, uint8_t seed_length) {
+    return ecu->cached_seed_length > 0 &&
+            ecu->cached_seed_length == seed_length &&
+            ecu->cached_level == ecu->target_level &&
+            memcmp(ecu->cached_seed, seed, seed_length) == 0;
+}
+
+static void send_key(DiagnosticEcuSession* ecu, const uint8_t* seed,
+        uint8_t seed_length) {
+    DiagnosticSessionManager* manager = ecu->manager;
+    if(!seed_is_cached(ecu, seed, seed_length)) {
+        ecu->cached_seed_length = 0;
+        ecu->key_length = 0;
+        if(manager->compute_key == NULL || !manager->compute_key(
+                    ecu->arbitration_id, ecu->target_level, seed,
+                    seed_length, ecu->key, &ecu->key_length,
+                    manager->context) ||
+                ecu->key_length > DIAGNOSTIC_SECURITY_KEY_MAX_LENGTH) {
+            fail(ecu, NRC_SUCCESS, false);
+            return;
+        }
+
+        if(seed_length <= sizeof(ecu->cached_seed)) {
+            memcpy(ecu->cached_seed, seed, seed_length);
+            ecu->cached_seed_length = seed_length;
+            ecu->cached_level = ecu->target_level;
+        }
+    }
+
+    send(ecu, DIAGNOSTIC_SESSION_SENDING_KEY,
+            DIAGNOSTIC_SERVICE_SECURITY_ACCESS, ecu->target_level + 1,
+            ecu->key, ecu->key_length);
+}
+
+static void handle_seed(DiagnosticEcuSession* ecu) {
+    const uint8_t* seed = ecu->driver.response.payload;
+    uint8_t seed_length = ecu->driver.response.payload_length;
+    uint8_t i;
+    for(i = 0; i < seed_length && seed[i] == 0; ++i);
+
+    // a seed of all zeroes means the level is already unlocked
+    if(i == seed_length) {
+        ecu->security_level = ecu->target_level;
+        step(ecu);
+    } else {
+        send_key(ecu, seed, seed_length);
+    }
+}
+
+static void handle_response(DiagnosticEcuSession* ecu, uint64_t now) {
+    ecu->driver.response_received = false;
+    schedule_keep_alive(ecu, now);
+    const DiagnosticResponse* response = &ecu->driver.response;
+    if(!response->success) {
+        DiagnosticNegativeResponseCode code = response->negative_response_code;
+        if(response->timed_out) {
+            fail(ecu, NRC_SUCCESS, true);
+        } else if(ecu->state != DIAGNOSTIC_SESSION_CHANGING &&
+                (code == NRC_TIME_DELAY_NOT_EXPIRED ||
+                    code == NRC_TOO_MANY_ATTEMPS)) {
+            ecu->state = DIAGNOSTIC_SESSION_WAITING_FOR_DELAY;
+            ecu->retry_time = now != 0 ?
+                    now + DIAGNOSTIC_SECURITY_DELAY_MS * 1000ULL : 0;
+        } else {
+            if(code == NRC_INVALID_KEY) {
+                ecu->cached_seed_length = 0;
+            }
+            fail(ecu, code, false);
+        }
+        return;
+    }
+
+    switch(ecu->state) {
+        case DIAGNOSTIC_SESSION_CHANGING:
+            ecu->session = ecu->target_session;
+            ecu->security_level = 0;
+            step(ecu);
+            break;
+        case DIAGNOSTIC_SESSION_REQUESTING_SEED:
+            handle_seed(ecu);
+            break;
+        case DIAGNOSTIC_SESSION_SENDING_KEY:
+            ecu->security_level = ecu->target_level;
+            step(ecu);
+            break;
+        default:
+            break;
+    }
+}
+
+bool diagnostic_session_enter(DiagnosticSessionManager* manager,
+        uint32_t arbitration_id, uint8_t session, uint8_t security_level) {
+    DiagnosticEcuSession* ecu = diagnostic_session_find(manager,
+            arbitration_id);
+    if(ecu == NULL) {
+        return false;
+    }
+
+    if(in_flight(ecu)) {
+        diagnostic_request_release(manager->shims, &ecu->driver.handle);
+    }
+    ecu->target_session = session;
+    ecu->target_level = security_level;
+    ecu->negative_response_code = NRC_SUCCESS;
+    ecu->timed_out = false;
+    return step(ecu);
+}
+
+bool diagnostic_session_enter_all(DiagnosticSessionManager* manager,
+        uint8_t session, uint8_t security_level) {
+    bool sent = true;
+    uint8_t i;
+    for(i = 0; i < manager->ecu_count; ++i) {
+        sent = diagnostic_session_enter(manager,
+                manager->ecus[i].arbitration_id, session, security_level) &&
+                sent;
+    }
+    return sent;
+}
+
+void diagnostic_session_receive_can_frame(DiagnosticSessionManager* manager,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    uint8_t i;
+    for(i = 0; i < manager->ecu_count; ++i) {
+        DiagnosticEcuSession* ecu = &manager->ecus[i];
+        if(in_flight(ecu)) {
+            diagnostic_receive_can_frame(manager->shims, &ecu->driver.handle,
+                    arbitration_id, data, size);
+            if(ecu->driver.response_received) {
+                handle_response(ecu, diagnostic_current_time(manager->shims));
+            }
+        }
+    }
+}
+
+uint64_t diagnostic_session_process(DiagnosticSessionManager* manager,
+        uint64_t now) {
+    uint64_t deadline = DIAGNOSTIC_NO_DEADLINE;
+    uint8_t i;
+    for(i = 0; i < manager->ecu_count; ++i) {
+        DiagnosticEcuSession* ecu = &manager->ecus[i];
+        if(in_flight(ecu)) {
+            diagnostic_process_request(manager->shims, &ecu->driver.handle,
+                    now);
+            if(ecu->driver.response_received) {
+                handle_response(ecu, now);
+            }
+        }
+
+        if(ecu->state == DIAGNOSTIC_SESSION_WAITING_FOR_DELAY) {
+            if(ecu->retry_time == 0) {
+                ecu->retry_time = now + DIAGNOSTIC_SECURITY_DELAY_MS * 1000ULL;
+            } else if(now >= ecu->retry_time) {
+                step(ecu);
+            }
+        }
+
+        if(needs_keep_alive(ecu)) {
+            if(ecu->keep_alive_time == 0) {
+                schedule_keep_alive(ecu, now);
+            } else if(now >= ecu->keep_alive_time) {
+                send_tester_present(ecu);
+                schedule_keep_alive(ecu, now);
+            }
+            deadline = MIN(deadline, ecu->keep_alive_time);
+        }
+
+        if(in_flight(ecu)) {
+            deadline = MIN(deadline,
+                    diagnostic_request_deadline(&ecu->driver.handle));
+        } else if(ecu->state == DIAGNOSTIC_SESSION_WAITING_FOR_DELAY) {
+            deadline = MIN(deadline, ecu->retry_time);
+        }
+    }
+    return deadline;
+}
+
+bool diagnostic_session_settled(const DiagnosticSessionManager* manager) {
+    uint8_t i;
+    for(i = 0; i < manager->ecu_count; ++i) {
+        if(in_flight(&manager->ecus[i]) || manager->ecus[i].state ==
+                DIAGNOSTIC_SESSION_WAITING_FOR_DELAY) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,187 @@
+#ifndef __UDS_SESSION_H__
+#define __UDS_SESSION_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DIAGNOSTIC_SESSION_MAX_ECUS
+#define DIAGNOSTIC_SESSION_MAX_ECUS 32
+#endif
+
+// How often to send TesterPresent to an ECU outside the default session.
+// Well inside S3, the 5 seconds without a request after which the ECU goes
+// back to the default session.
+#ifndef DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS
+#define DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS 2000
+#endif
+
+#define DIAGNOSTIC_SECURITY_KEY_MAX_LENGTH 64
+#define DIAGNOSTIC_DEFAULT_SESSION 0x1
+// How long to wait before asking for a new seed after a time delay (0x37)
+// or too many attempts (0x36), if the ECU doesn't say.
+#define DIAGNOSTIC_SECURITY_DELAY_MS 10000
+
+#define DIAGNOSTIC_SERVICE_SESSION_CONTROL 0x10
+#define DIAGNOSTIC_SERVICE_SECURITY_ACCESS 0x27
+// Set in a sub-function to ask the ECU not to send a positive response.
+#define DIAGNOSTIC_SUPPRESS_POSITIVE_RESPONSE 0x80
+
+/* Public: The signature for a function that computes the key for a
+ * SecurityAccess seed - usually a manufacturer's algorithm.
+ *
+ * arbitration_id - The request arbitration ID of the ECU.
+ * level - The requestSeed sub-function (an odd number).
+ * seed - The seed sent by the ECU.
+ * seed_length - The length of the seed.
+ * key - Where to write the key, with room for
+ *      DIAGNOSTIC_SECURITY_KEY_MAX_LENGTH bytes.
+ * key_length - Where to write the length of the key.
+ * context - The context given to diagnostic_session_manager_init(...).
+ *
+ * Returns false if there's no key for the seed, which fails the unlock.
+ */
+typedef bool (*DiagnosticSecurityKeyShim)(uint32_t arbitration_id,
+        uint8_t level, const uint8_t* seed, uint8_t seed_length, uint8_t* key,
+        uint8_t* key_length, void* context);
+
+/* Public: Where an ECU is in its move to the requested session and
+ * security level.
+ */
+typedef enum {
+    DIAGNOSTIC_SESSION_READY,
+    DIAGNOSTIC_SESSION_CHANGING,
+    DIAGNOSTIC_SESSION_REQUESTING_SEED,
+    DIAGNOSTIC_SESSION_SENDING_KEY,
+    DIAGNOSTIC_SESSION_WAITING_FOR_DELAY,
+    DIAGNOSTIC_SESSION_FAILED
+} DiagnosticSessionState;
+
+typedef struct DiagnosticSessionManager DiagnosticSessionManager;
+
+/* Public: The session and security state of a single ECU.
+ *
+ * arbitration_id - The request arbitration ID of the ECU.
+ * session - The session the ECU is known to be in.
+ * security_level - The requestSeed sub-function of the security level that's
+ *      unlocked, or 0 if the ECU is locked.
+ * target_session - The session the ECU is moving to.
+ * target_level - The security level the ECU is being unlocked to, or 0.
+ * state - Where the ECU is in the move.
+ * negative_response_code - If the move failed because of a negative
+ *      response, its code.
+ * timed_out - If the move failed because the ECU didn't respond.
+ */
+typedef struct {
+    uint32_t arbitration_id;
+    uint8_t session;
+    uint8_t security_level;
+    uint8_t target_session;
+    uint8_t target_level;
+    DiagnosticSessionState state;
+    DiagnosticNegativeResponseCode negative_response_code;
+    bool timed_out;
+
+    // Private
+    DiagnosticSessionManager* manager;
+    DiagnosticRequestDriver driver;
+    uint64_t retry_time;
+    uint64_t keep_alive_time;
+    uint8_t key[DIAGNOSTIC_SECURITY_KEY_MAX_LENGTH];
+    uint8_t key_length;
+    uint8_t cached_seed[DIAGNOSTIC_SECURITY_KEY_MAX_LENGTH];
+    uint8_t cached_seed_length;
+    uint8_t cached_level;
+} DiagnosticEcuSession;
+
+/* Public: Moves a set of ECUs in to diagnostic sessions (0x10) and unlocks
+ * their security access (0x27), all in parallel.
+ *
+ * Each ECU's session and security level is tracked, so transitions it's
+ * already made are skipped. An ECU that's locked out with the time delay
+ * NRC (0x37, or 0x36 for too many attempts) asks for a new seed when the
+ * delay has passed, without holding up the others. Keys for a seed an ECU
+ * has sent before are reused without calling the key function again.
+ *
+ * Entering any session locks an ECU's security again, as the ECU does.
+ *
+ * An ECU outside the default session is sent TesterPresent (0x3e, with the
+ * positive response suppressed) every DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS
+ * from diagnostic_session_process(...), so it stays in the session it's
+ * known to be in.
+ *
+ * Use diagnostic_session_manager_init(...) to create an instance. It must not
+ * move once ECUs are added.
+ */
+struct DiagnosticSessionManager {
+    DiagnosticShims* shims;
+    DiagnosticSecurityKeyShim compute_key;
+    void* context;
+    DiagnosticEcuSession ecus[DIAGNOSTIC_SESSION_MAX_ECUS];
+    uint8_t ecu_count;
+};
+
+void diagnostic_session_manager_init(DiagnosticSessionManager* manager,
+        DiagnosticShims* shims, DiagnosticSecurityKeyShim compute_key,
+        void* context);
+
+/* Public: Start tracking an ECU, assumed to be in the default session and
+ * locked.
+ *
+ * Returns the ECU's state, or NULL if DIAGNOSTIC_SESSION_MAX_ECUS are already
+ * tracked. Adding an ECU twice returns the same state.
+ */
+DiagnosticEcuSession* diagnostic_session_add(DiagnosticSessionManager* manager,
+        uint32_t arbitration_id);
+
+DiagnosticEcuSession* diagnostic_session_find(
+        DiagnosticSessionManager* manager, uint32_t arbitration_id);
+
+/* Public: Start moving an ECU to a session, and optionally unlocking it.
+ *
+ * session - The diagnosticSessionType, e.g. 0x2 for programming.
+ * security_level - The requestSeed sub-function (e.g. 0x1), or 0 to leave the
+ *      ECU locked.
+ *
+ * Returns false if the ECU isn't tracked, or if the first request couldn't
+ * be sent.
+ */
+bool diagnostic_session_enter(DiagnosticSessionManager* manager,
+        uint32_t arbitration_id, uint8_t session, uint8_t security_level);
+
+/* Public: Start moving every tracked ECU to a session, as
+ * diagnostic_session_enter(...).
+ *
+ * Returns false if any of the requests couldn't be sent.
+ */
+bool diagnostic_session_enter_all(DiagnosticSessionManager* manager,
+        uint8_t session, uint8_t security_level);
+
+/* Public: Pass a received CAN frame to the ECUs that are moving.
+ */
+void diagnostic_session_receive_can_frame(DiagnosticSessionManager* manager,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Time out requests, retry ECUs whose time delay has passed and keep
+ * ECUs in their sessions - see diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE.
+ */
+uint64_t diagnostic_session_process(DiagnosticSessionManager* manager,
+        uint64_t now);
+
+/* Public: Returns true if no ECU is still moving - check each ECU's state
+ * for any that failed.
+ */
+bool diagnostic_session_settled(const DiagnosticSessionManager* manager);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_SESSION_H__
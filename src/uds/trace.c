@@ -0,0 +1,174 @@
+#include <uds/trace.h>
+#include <string.h>
+
+// The log is a 12 byte header followed by the records, all little-endian:
+//
+//  header: "UDSTRACE" | version (uint16) | reserved (uint16)
+//  record: time since previous record in us (uint32) |
+//          arbitration ID and flags (uint32) | size (uint8) | data
+//
+// If the time since the previous record doesn't fit in 32 bits, a
+// synchronization record with the absolute time as its 8 data bytes is
+// written first.
+#define TRACE_MAGIC "UDSTRACE"
+#define TRACE_MAGIC_LENGTH 8
+#define FLAG_SENT 0x80000000
+#define FLAG_TIME_SYNC 0x40000000
+#define ARBITRATION_ID_MASK 0x1fffffff
+
+static void write_uint16(uint8_t* destination, uint16_t value) {
+    destination[0] = value;
+    destination[1] = value >> 8;
+}
+
+static void write_uint32(uint8_t* destination, uint32_t value) {
+    write_uint16(destination, value);
+    write_uint16(destination + 2, value >> 16);
+}
+
+static uint32_t read_uint32(const uint8_t* source) {
+    return (uint32_t)source[0] | ((uint32_t)source[1] << 8) |
+            ((uint32_t)source[2] << 16) | ((uint32_t)source[3] << 24);
+}
+
+DiagnosticTraceRecorder diagnostic_trace_recorder_init(
+        DiagnosticTraceWriteShim write, void* context, uint8_t directions) {
+    DiagnosticTraceRecorder recorder = {
+        write: write,
+        context: context,
+        directions: directions,
+        records: 0,
+        write_failures: 0,
+        header_written: false,
+        last_timestamp: 0
+    };
+    return recorder;
+}
+
+static bool write_record(DiagnosticTraceRecorder* recorder, uint32_t delta,
+        uint32_t id_and_flags, const uint8_t data[], const uint8_t size) {
+    uint8_t record[DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE +
+            DIAGNOSTIC_TRACE_MAX_FRAME_SIZE];
+    write_uint32(record, delta);
+    write_uint32(record + 4, id_and_flags);
+    record[8] = size;
+    memcpy(record + DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE, data, size);
+    return recorder->write(recorder->context, record,
+            DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE + size);
+}
+
+bool diagnostic_trace_record(DiagnosticTraceRecorder* recorder,
+        DiagnosticTraceDirection direction, uint64_t timestamp,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    if(size > DIAGNOSTIC_TRACE_MAX_FRAME_SIZE) {
+        ++recorder->write_failures;
+        return false;
+    }
+
+    if(!recorder->header_written) {
+        uint8_t header[DIAGNOSTIC_TRACE_HEADER_SIZE] = {0};
+        memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LENGTH);
+        write_uint16(header + TRACE_MAGIC_LENGTH, DIAGNOSTIC_TRACE_VERSION);
+        if(!recorder->write(recorder->context, header, sizeof(header))) {
+            ++recorder->write_failures;
+            return false;
+        }
+        recorder->header_written = true;
+    }
+
+    // a clock that isn't monotonic (or no clock at all) is recorded as no
+    // time passing, rather than as a huge jump forward
+    uint64_t delta = timestamp > recorder->last_timestamp ?
+            timestamp - recorder->last_timestamp : 0;
+    if(delta > UINT32_MAX) {
+        uint8_t absolute[8];
+        write_uint32(absolute, timestamp);
+        write_uint32(absolute + 4, timestamp >> 32);
+        if(!write_record(recorder, 0, FLAG_TIME_SYNC, absolute,
+                    sizeof(absolute))) {
+            ++recorder->write_failures;
+            return false;
+        }
+        delta = 0;
+        recorder->last_timestamp = timestamp;
+    } else {
+        recorder->last_timestamp += delta;
+    }
+
+    uint32_t id_and_flags = arbitration_id & ARBITRATION_ID_MASK;
+    if(direction == DIAGNOSTIC_TRACE_SENT) {
+        id_and_flags |= FLAG_SENT;
+    }
+
+    if(!write_record(recorder, delta, id_and_flags, data, size)) {
+        ++recorder->write_failures;
+        return false;
+    }
+    ++recorder->records;
+    return true;
+}
+
+bool diagnostic_trace_reader_init(DiagnosticTraceReader* reader,
+        const uint8_t* data, size_t length) {
+    reader->data = data;
+    reader->length = length;
+    reader->timestamp = 0;
+    bool valid = length >= DIAGNOSTIC_TRACE_HEADER_SIZE &&
+            memcmp(data, TRACE_MAGIC, TRACE_MAGIC_LENGTH) == 0 &&
+            data[TRACE_MAGIC_LENGTH] == DIAGNOSTIC_TRACE_VERSION &&
+            data[TRACE_MAGIC_LENGTH + 1] == 0;
+    // a reader for anything else is already at its end
+    reader->position = valid ? DIAGNOSTIC_TRACE_HEADER_SIZE : length;
+    return valid;
+}
+
+bool diagnostic_trace_next(DiagnosticTraceReader* reader,
+        DiagnosticTraceRecord* record) {
+    while(reader->length - reader->position >=
+            DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE) {
+        const uint8_t* source = reader->data + reader->position;
+        uint32_t id_and_flags = read_uint32(source + 4);
+        uint8_t size = source[8];
+        if(size > DIAGNOSTIC_TRACE_MAX_FRAME_SIZE ||
+                reader->length - reader->position <
+                    (size_t) DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE + size) {
+            break;
+        }
+        reader->position += DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE + size;
+
+        const uint8_t* data = source + DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE;
+        if(id_and_flags & FLAG_TIME_SYNC) {
+            if(size == 8) {
+                reader->timestamp = read_uint32(data) |
+                        ((uint64_t)read_uint32(data + 4) << 32);
+            }
+            continue;
+        }
+
+        reader->timestamp += read_uint32(source);
+        record->timestamp = reader->timestamp;
+        record->direction = id_and_flags & FLAG_SENT ?
+                DIAGNOSTIC_TRACE_SENT : DIAGNOSTIC_TRACE_RECEIVED;
+        record->arbitration_id = id_and_flags & ARBITRATION_ID_MASK;
+        record->data = data;
+        record->size = size;
+        return true;
+    }
+    return false;
+}
+
+size_t diagnostic_trace_replay(DiagnosticTraceReader* reader,
+        DiagnosticTraceReplayMode mode, DiagnosticTraceWaitShim wait,
+        DiagnosticTraceFrameHandler handler, void* context) {
+    size_t delivered = 0;
+    DiagnosticTraceRecord record;
+    while(diagnostic_trace_next(reader, &record)) {
+        if(mode == DIAGNOSTIC_TRACE_REPLAY_REAL_TIME && wait != NULL) {
+            wait(context, record.timestamp);
+        }
+        handler(context, &record);
+        ++delivered;
+    }
+    return delivered;
+}
@@ -0,0 +1,173 @@
+#ifndef __UDS_TRACE_H__
+#define __UDS_TRACE_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAGNOSTIC_TRACE_VERSION 1
+#define DIAGNOSTIC_TRACE_HEADER_SIZE 12
+#define DIAGNOSTIC_TRACE_RECORD_HEADER_SIZE 9
+#define DIAGNOSTIC_TRACE_MAX_FRAME_SIZE 64
+
+/* Public: The direction of a traced CAN frame. These are also used as flags
+ * to select what a DiagnosticTraceRecorder captures.
+ */
+typedef enum {
+    DIAGNOSTIC_TRACE_RECEIVED = 0x1,
+    DIAGNOSTIC_TRACE_SENT = 0x2
+} DiagnosticTraceDirection;
+
+/* Public: The signature for a function that appends bytes to a trace log,
+ * e.g. a file or a ring buffer in RAM.
+ *
+ * context - The context pointer given to diagnostic_trace_recorder_init.
+ *
+ * Returns true if all bytes were written.
+ */
+typedef bool (*DiagnosticTraceWriteShim)(void* context, const uint8_t* data,
+        size_t size);
+
+/* Public: Captures CAN frames to a compact binary log.
+ *
+ * Attach a recorder to the 'trace' field of a DiagnosticShims to capture every
+ * frame the library sends through the SendCanMessageShim and every frame
+ * offered to diagnostic_receive_can_frame(...), stamped with the time from the
+ * GetTimeShim. Frames can also be recorded directly with
+ * diagnostic_trace_record(...).
+ *
+ * Every call to diagnostic_receive_can_frame(...) is recorded, so if you
+ * offer each frame to several handles, leave DIAGNOSTIC_TRACE_RECEIVED out of
+ * the recorder's directions and record received frames once yourself.
+ *
+ * Use diagnostic_trace_recorder_init(...) to create an instance.
+ *
+ * records - The number of frames recorded so far.
+ * write_failures - The number of frames that couldn't be written.
+ */
+typedef struct DiagnosticTraceRecorder {
+    DiagnosticTraceWriteShim write;
+    void* context;
+    uint8_t directions;
+    uint32_t records;
+    uint32_t write_failures;
+
+    // Private
+    bool header_written;
+    uint64_t last_timestamp;
+} DiagnosticTraceRecorder;
+
+/* Public: A single frame read from a trace log. The data points directly in
+ * to the log, so it's only valid as long as the log is.
+ */
+typedef struct {
+    uint64_t timestamp;
+    DiagnosticTraceDirection direction;
+    uint32_t arbitration_id;
+    const uint8_t* data;
+    uint8_t size;
+} DiagnosticTraceRecord;
+
+/* Public: Reads records from a trace log that's already in memory, usually
+ * because it's been mapped with mmap(...). Nothing is copied.
+ *
+ * Use diagnostic_trace_reader_init(...) to create an instance.
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+
+    // Private
+    size_t position;
+    uint64_t timestamp;
+} DiagnosticTraceReader;
+
+/* Public: How fast diagnostic_trace_replay(...) delivers frames.
+ *
+ * DIAGNOSTIC_TRACE_REPLAY_MAX_SPEED - Deliver each frame as soon as the
+ *      previous one has been handled.
+ * DIAGNOSTIC_TRACE_REPLAY_REAL_TIME - Call the wait function with each frame's
+ *      timestamp before delivering it, to reproduce the original timing.
+ */
+typedef enum {
+    DIAGNOSTIC_TRACE_REPLAY_MAX_SPEED,
+    DIAGNOSTIC_TRACE_REPLAY_REAL_TIME
+} DiagnosticTraceReplayMode;
+
+/* Public: The signature for a function called by diagnostic_trace_replay for
+ * each frame in the log.
+ */
+typedef void (*DiagnosticTraceFrameHandler)(void* context,
+        const DiagnosticTraceRecord* record);
+
+/* Public: The signature for a function that blocks until the given trace
+ * timestamp, for real time replay. The function is free to choose how trace
+ * time maps to wall clock time, e.g. by remembering the first timestamp.
+ */
+typedef void (*DiagnosticTraceWaitShim)(void* context, uint64_t timestamp);
+
+/* Public: Initialize a DiagnosticTraceRecorder.
+ *
+ * write - The function used to write the log.
+ * context - An optional pointer passed back to the write function.
+ * directions - A combination of DiagnosticTraceDirection flags selecting
+ *      which frames are captured automatically when the recorder is attached
+ *      to a DiagnosticShims.
+ */
+DiagnosticTraceRecorder diagnostic_trace_recorder_init(
+        DiagnosticTraceWriteShim write, void* context, uint8_t directions);
+
+/* Public: Append a single frame to the log, writing the log header first if
+ * this is the first frame.
+ *
+ * Returns true if the frame was written.
+ */
+bool diagnostic_trace_record(DiagnosticTraceRecorder* recorder,
+        DiagnosticTraceDirection direction, uint64_t timestamp,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Initialize a DiagnosticTraceReader for a complete log in memory.
+ *
+ * Returns false if the data doesn't start with a valid trace header - the
+ * reader then has no frames to read.
+ */
+bool diagnostic_trace_reader_init(DiagnosticTraceReader* reader,
+        const uint8_t* data, size_t length);
+
+/* Public: Read the next frame from the log.
+ *
+ * Returns false at the end of the log, or if the rest of the log is
+ * truncated or corrupt.
+ */
+bool diagnostic_trace_next(DiagnosticTraceReader* reader,
+        DiagnosticTraceRecord* record);
+
+/* Public: Deliver every remaining frame in the log to a handler, in order.
+ *
+ * The frames and their timestamps are always delivered in exactly the same
+ * order, so a replay is deterministic as long as the handler uses the
+ * record's timestamp (not the wall clock) as the library's GetTimeShim.
+ *
+ * mode - How fast to deliver the frames.
+ * wait - The function used to wait in DIAGNOSTIC_TRACE_REPLAY_REAL_TIME mode.
+ *      May be NULL in DIAGNOSTIC_TRACE_REPLAY_MAX_SPEED mode.
+ * handler - The function to receive each frame.
+ * context - An optional pointer passed to the handler and wait functions.
+ *
+ * Returns the number of frames delivered.
+ */
+size_t diagnostic_trace_replay(DiagnosticTraceReader* reader,
+        DiagnosticTraceReplayMode mode, DiagnosticTraceWaitShim wait,
+        DiagnosticTraceFrameHandler handler, void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_TRACE_H__
@@ -0,0 +1,91 @@
+#include <uds/tx_queue.h>
+#include <uds/counters.h>
+#include <uds/trace.h>
+#include <uds/atomic.h>
+#include <string.h>
+
+#define QUEUE_MASK (DIAGNOSTIC_TX_QUEUE_SIZE - 1)
+
+void diagnostic_tx_queue_init(DiagnosticTxQueue* queue) {
+    memset(queue, 0, sizeof(*queue));
+}
+
+uint16_t diagnostic_tx_queue_length(const DiagnosticTxQueue* queue) {
+    return queue->count;
+}
+
+bool diagnostic_tx_queue_full(const DiagnosticTxQueue* queue) {
+    return queue->count == DIAGNOSTIC_TX_QUEUE_SIZE;
+}
+
+// Hand a frame to the driver, and trace it if it took it.
+static bool transmit(DiagnosticShims* shims, uint32_t arbitration_id,
+        const uint8_t* data, uint8_t size) {
+    if(shims->send_can_message == NULL ||
+            !shims->send_can_message(arbitration_id, data, size)) {
+        return false;
+    }
+
+    if(shims->trace != NULL &&
+            (shims->trace->directions & DIAGNOSTIC_TRACE_SENT)) {
+        diagnostic_trace_record(shims->trace, DIAGNOSTIC_TRACE_SENT,
+                shims->get_time != NULL ? shims->get_time() : 0,
+                arbitration_id, data, size);
+    }
+    return true;
+}
+
+static bool push(DiagnosticShims* shims, uint32_t arbitration_id,
+        const uint8_t* data, uint8_t size) {
+    DiagnosticTxQueue* queue = shims->tx_queue;
+    if(diagnostic_tx_queue_full(queue) || size > DIAGNOSTIC_FD_FRAME_SIZE) {
+        ++queue->overflows;
+        return false;
+    }
+
+    DiagnosticQueuedFrame* frame =
+            &queue->frames[(queue->head + queue->count) & QUEUE_MASK];
+    frame->arbitration_id = arbitration_id;
+    frame->size = size;
+    memcpy(frame->data, data, size);
+    ++queue->count;
+    ++queue->deferred;
+    if(queue->count > queue->high_water) {
+        queue->high_water = queue->count;
+    }
+    if(shims->counters != NULL) {
+        UDS_ATOMIC_INCREMENT(&shims->counters->frames_deferred);
+    }
+    return true;
+}
+
+bool diagnostic_tx_queue_send(DiagnosticShims* shims,
+        uint32_t arbitration_id, const uint8_t* data, uint8_t size) {
+    if(shims->tx_queue == NULL) {
+        return transmit(shims, arbitration_id, data, size);
+    }
+
+    // nothing overtakes a frame that's already waiting
+    if(shims->tx_queue->count == 0 &&
+            transmit(shims, arbitration_id, data, size)) {
+        return true;
+    }
+    return shims->send_can_message != NULL &&
+            push(shims, arbitration_id, data, size);
+}
+
+uint16_t diagnostic_tx_queue_drain(DiagnosticShims* shims) {
+    DiagnosticTxQueue* queue = shims->tx_queue;
+    uint16_t sent = 0;
+    while(queue != NULL && queue->count > 0) {
+        const DiagnosticQueuedFrame* frame = &queue->frames[queue->head];
+        if(!transmit(shims, frame->arbitration_id, frame->data,
+                    frame->size)) {
+            break;
+        }
+        queue->head = (queue->head + 1) & QUEUE_MASK;
+        --queue->count;
+        ++sent;
+    }
+    return sent;
+}
@@ -0,0 +1,92 @@
+#ifndef __UDS_TX_QUEUE_H__
+#define __UDS_TX_QUEUE_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Must be a power of 2.
+#ifndef DIAGNOSTIC_TX_QUEUE_SIZE
+#define DIAGNOSTIC_TX_QUEUE_SIZE 16
+#endif
+
+/* Private: A frame waiting for the CAN driver.
+ */
+typedef struct {
+    uint32_t arbitration_id;
+    uint8_t size;
+    uint8_t data[DIAGNOSTIC_FD_FRAME_SIZE];
+} DiagnosticQueuedFrame;
+
+/* Public: Holds frames the CAN driver can't take yet (its SendCanMessageShim
+ * returned false, e.g. because every TX mailbox is full) until it can,
+ * instead of failing the request that sent them.
+ *
+ * Assign an instance to the 'tx_queue' field of a DiagnosticShims, and call
+ * diagnostic_tx_queue_drain(...) when the driver signals it has room (from
+ * the same thread that sends requests - e.g. set a flag in the TX interrupt
+ * and drain from the main loop), then diagnostic_continue_request(...) for
+ * requests that are still being sent.
+ *
+ * Frames always leave in the order they were sent. While any are waiting,
+ * new frames join the back of the queue rather than overtaking them, and a
+ * multi-frame request doesn't send its next consecutive frame until its last
+ * one has left, so the ECU's separation time is still kept. Only when the
+ * queue is full is a frame refused, and its request fails as it would
+ * without a queue.
+ *
+ * Use diagnostic_tx_queue_init(...) to create an instance.
+ *
+ * deferred - The number of frames that had to wait.
+ * overflows - The number of frames refused because the queue was full.
+ * high_water - The most frames that have waited at once.
+ */
+typedef struct DiagnosticTxQueue {
+    uint32_t deferred;
+    uint32_t overflows;
+    uint16_t high_water;
+
+    // Private
+    DiagnosticQueuedFrame frames[DIAGNOSTIC_TX_QUEUE_SIZE];
+    uint16_t head;
+    uint16_t count;
+} DiagnosticTxQueue;
+
+void diagnostic_tx_queue_init(DiagnosticTxQueue* queue);
+
+/* Public: Returns the number of frames waiting for the driver. Callers can
+ * use this to hold back new requests while the bus is congested.
+ */
+uint16_t diagnostic_tx_queue_length(const DiagnosticTxQueue* queue);
+
+/* Public: Returns true if the next frame that can't be sent right away would
+ * be refused.
+ */
+bool diagnostic_tx_queue_full(const DiagnosticTxQueue* queue);
+
+/* Public: Pass waiting frames to the driver, in order, until it refuses one
+ * or none are left.
+ *
+ * Returns the number of frames sent.
+ */
+uint16_t diagnostic_tx_queue_drain(DiagnosticShims* shims);
+
+/* Public: Send a frame with the shims' SendCanMessageShim, or queue it if
+ * the driver can't take it yet or other frames are already waiting. This is
+ * how the library sends every frame, and it records the frame to the shims'
+ * trace once it's actually sent.
+ *
+ * Returns true if the frame was sent or queued.
+ */
+bool diagnostic_tx_queue_send(DiagnosticShims* shims,
+        uint32_t arbitration_id, const uint8_t* data, uint8_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_TX_QUEUE_H__
@@ -1,4 +1,13 @@
 #include <uds/uds.h>
+#include <uds/latency.h>
+#include <uds/counters.h>
+#include <uds/trace.h>
+#include <uds/filter.h>
+#include <uds/addressing.h>
+#include <uds/tx_queue.h>
+#include <uds/atomic.h>
+#include <uds/bytes.h>
+#include <uds/request_driver.h>
 #include <bitfield/bitfield.h>
 #include <canutil/read.h>
 #include <string.h>
@@ -7,10 +16,8 @@
 #include <sys/param.h>
 #include <inttypes.h>
 
-#define ARBITRATION_ID_OFFSET 0x8
 #define MODE_RESPONSE_OFFSET 0x40
 #define NEGATIVE_RESPONSE_MODE 0x7f
-#define MAX_DIAGNOSTIC_PAYLOAD_SIZE 6
 #define MODE_BYTE_INDEX 0
 #define PID_BYTE_INDEX 1
 #define NEGATIVE_RESPONSE_MODE_INDEX 1
@@ -20,33 +27,243 @@
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #endif
 
+#define INCREMENT_COUNTER(shims, counter) do { \
+        if((shims)->counters != NULL) { \
+            UDS_ATOMIC_INCREMENT(&(shims)->counters->counter); \
+        } \
+    } while(0)
+
 DiagnosticShims diagnostic_init_shims(LogShim log,
         SendCanMessageShim send_can_message,
         SetTimerShim set_timer) {
     DiagnosticShims shims = {
         log: log,
         send_can_message: send_can_message,
-        set_timer: set_timer
+        set_timer: set_timer,
+        get_time: NULL,
+        latency_stats: NULL,
+        counters: NULL,
+        trace: NULL,
+        filter: NULL,
+        addressing: NULL,
+        transport: NULL,
+        tx_queue: NULL
     };
     return shims;
 }
 
+uint64_t diagnostic_current_time(const DiagnosticShims* shims) {
+    return shims->get_time != NULL ? shims->get_time() : 0;
+}
+
+/* Private: The request being processed by isotp-c on this thread.
+ *
+ * shims - The DiagnosticShims to send with.
+ * handle - The request, for its addressing and padding.
+ * destination - The full arbitration ID for the frames isotp-c sends - it
+ *      only handles 11-bit IDs, and sends flow control frames to the response
+ *      ID - 0x8, so its choice of ID is ignored.
+ */
+typedef struct {
+    DiagnosticShims* shims;
+    const DiagnosticRequestHandle* handle;
+    uint32_t destination;
+} ActiveRequest;
+
+// Threads driving their own DiagnosticShims each need their own active
+// request. A single threaded target without thread-local storage can define
+// DIAGNOSTIC_THREAD_LOCAL as nothing to share one.
+#ifndef DIAGNOSTIC_THREAD_LOCAL
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define DIAGNOSTIC_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define DIAGNOSTIC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define DIAGNOSTIC_THREAD_LOCAL __declspec(thread)
+#else
+#error "No thread-local storage - define DIAGNOSTIC_THREAD_LOCAL"
+#endif
+#endif
+
+// isotp-c calls its SendCanMessageShim without any context, so every handle's
+// IsoTpShims point at send_can_message(...) below and the details of the
+// request being processed are stashed here before each call in to isotp-c.
+static DIAGNOSTIC_THREAD_LOCAL ActiveRequest active_request;
+
+static void set_active_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, uint32_t destination) {
+    active_request.shims = shims;
+    active_request.handle = handle;
+    active_request.destination = destination;
+}
+
+static bool uses_address_byte(const DiagnosticAddress* address) {
+    return address->mode == DIAGNOSTIC_ADDRESSING_EXTENDED ||
+            address->mode == DIAGNOSTIC_ADDRESSING_MIXED;
+}
+
+// A frame size that isn't a CAN FD length is rounded down to one, so no
+// frame sent is bigger than the ECU accepts.
+static uint8_t max_frame_size(const DiagnosticAddress* address) {
+    return diagnostic_framing_max_frame_length(address->frame_size);
+}
+
+// Returns the room left for ISO-TP in each frame sent to the ECU.
+static uint8_t transport_frame_size(const DiagnosticAddress* address) {
+    return max_frame_size(address) - (uses_address_byte(address) ? 1 : 0);
+}
+
+static bool send_can_message(const uint32_t arbitration_id,
+        const uint8_t* data, const uint8_t size) {
+    DiagnosticShims* shims = active_request.shims;
+    if(shims == NULL || shims->send_can_message == NULL) {
+        return false;
+    }
+
+    const DiagnosticRequestHandle* handle = active_request.handle;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    uint8_t offset = 0;
+    if(uses_address_byte(&handle->address)) {
+        frame[offset++] = handle->address.target_address;
+    }
+
+    // anything pushed off the end by the address byte is padding, the
+    // payload size was checked before sending
+    uint8_t length = MIN(size + offset, max_frame_size(&handle->address));
+    memcpy(&frame[offset], data, length - offset);
+
+    // CAN FD frames can only be certain lengths, so those are always padded
+    uint8_t padded_length = diagnostic_framing_frame_length(length);
+    if(padded_length <= DIAGNOSTIC_CLASSIC_FRAME_SIZE &&
+            handle->isotp_shims.frame_padding) {
+        padded_length = DIAGNOSTIC_CLASSIC_FRAME_SIZE;
+    }
+    memset(&frame[length], DIAGNOSTIC_FRAME_PADDING_BYTE,
+            padded_length - length);
+
+    return diagnostic_tx_queue_send(shims, active_request.destination, frame,
+            padded_length);
+}
+
+// True if frames are waiting for the CAN driver in the shims' TX queue.
+static bool tx_backlogged(const DiagnosticShims* shims) {
+    return shims->tx_queue != NULL &&
+            diagnostic_tx_queue_length(shims->tx_queue) > 0;
+}
+
+static void record_latency(DiagnosticShims* shims,
+        const DiagnosticResponse* response) {
+    if(shims->latency_stats != NULL &&
+            response->timestamps.first_frame_sent != 0) {
+        uint64_t latency = response->timestamps.completed -
+                response->timestamps.first_frame_sent;
+        diagnostic_latency_record(shims->latency_stats,
+                response->arbitration_id, response->mode,
+                latency > UINT32_MAX ? UINT32_MAX : (uint32_t) latency);
+    }
+}
+
+static bool add_receive_handle(DiagnosticRequestHandle* handle,
+        uint32_t response_id) {
+    if(handle->isotp_receive_handle_count >= MAX_RESPONDING_ECU_COUNT) {
+        return false;
+    }
+
+    uint8_t index = handle->isotp_receive_handle_count++;
+    handle->response_ids[index] = response_id;
+    handle->isotp_receive_handles[index] = isotp_receive(&handle->isotp_shims,
+            response_id, NULL);
+    return true;
+}
+
+// Functional requests claim a receive handle for each ECU as its first
+// response arrives, so the range of response IDs can be as large as the
+// addressing needs (e.g. any 0x18DAF1xx).
 static void setup_receive_handle(DiagnosticRequestHandle* handle) {
-    if(handle->request.arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
-        uint32_t response_id;
-        for(response_id = 0;
-                response_id < OBD2_FUNCTIONAL_RESPONSE_COUNT; ++response_id) {
-            handle->isotp_receive_handles[response_id] = isotp_receive(
-                    &handle->isotp_shims,
-                    OBD2_FUNCTIONAL_RESPONSE_START + response_id,
-                    NULL);
+    handle->isotp_receive_handle_count = 0;
+    handle->receiving = true;
+    if(!diagnostic_addressing_is_functional(&handle->address)) {
+        add_receive_handle(handle, handle->address.response_id);
+    }
+}
+
+// Returns the index of the receive handle for the arbitration ID, or -1 if
+// it's not a response to this request.
+static int find_receive_handle(DiagnosticRequestHandle* handle,
+        const uint32_t arbitration_id) {
+    if(!handle->receiving) {
+        return -1;
+    }
+
+    uint8_t i;
+    for(i = 0; i < handle->isotp_receive_handle_count; ++i) {
+        if(handle->response_ids[i] == arbitration_id) {
+            return i;
         }
-        handle->isotp_receive_handle_count = OBD2_FUNCTIONAL_RESPONSE_COUNT;
+    }
+
+    uint32_t mask = handle->address.response_mask;
+    if(diagnostic_addressing_is_functional(&handle->address) &&
+            (arbitration_id & mask) == (handle->address.response_id & mask) &&
+            add_receive_handle(handle, arbitration_id)) {
+        return handle->isotp_receive_handle_count - 1;
+    }
+    return -1;
+}
+
+static void register_response_ids(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    if(shims->filter == NULL || handle->filter_registered) {
+        return;
+    }
+
+    diagnostic_filter_add_masked(shims->filter, handle->address.response_id,
+            handle->address.response_mask);
+    handle->filter_registered = true;
+}
+
+static void unregister_response_ids(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    if(shims->filter == NULL || !handle->filter_registered) {
+        return;
+    }
+
+    diagnostic_filter_remove_masked(shims->filter,
+            handle->address.response_id, handle->address.response_mask);
+    handle->filter_registered = false;
+}
+
+// Once the ECU has said the response is pending, it has P2* to send it.
+static uint32_t response_timeout_us(const DiagnosticRequestHandle* handle) {
+    uint32_t timeout_ms = handle->request.timeout_ms > 0 ?
+            handle->request.timeout_ms : DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS;
+    if(handle->response_pending) {
+        timeout_ms = MAX(timeout_ms, DIAGNOSTIC_RESPONSE_PENDING_TIMEOUT_MS);
+    }
+    return timeout_ms * 1000;
+}
+
+// Start waiting for the next thing the ECU has to do. Without a clock, the
+// deadline is set by the next call to diagnostic_process_request(...).
+static void arm_timeout(DiagnosticRequestHandle* handle, uint64_t now,
+        uint32_t timeout_us) {
+    handle->timeout_us = timeout_us;
+    handle->timeout_deadline = now != 0 && timeout_us > 0 ?
+            now + timeout_us : 0;
+}
+
+// Flow control must arrive within N_Bs of the frame that asked for it, and
+// the response within the response timeout of the last frame. Frames held
+// back by the separation time have their own deadline, next_frame_time.
+static void arm_send_timeout(DiagnosticRequestHandle* handle, uint64_t now) {
+    DiagnosticFrameSender* sender = &handle->frame_sender;
+    if(sender->completed) {
+        arm_timeout(handle, now, sender->success ?
+                response_timeout_us(handle) : 0);
+    } else if(sender->waiting_for_flow_control) {
+        arm_timeout(handle, now, DIAGNOSTIC_TRANSFER_TIMEOUT_MS * 1000);
     } else {
-        handle->isotp_receive_handle_count = 1;
-        handle->isotp_receive_handles[0] = isotp_receive(&handle->isotp_shims,
-                handle->request.arbitration_id + ARBITRATION_ID_OFFSET,
-                NULL);
+        arm_timeout(handle, now, 0);
     }
 }
 
@@ -64,16 +281,131 @@ static uint16_t autoset_pid_length(uint8_t mode, uint16_t pid,
     return pid_length;
 }
 
+// The sender and receiver point in to the handle, which may have been copied
+// since they were last used.
+static void refresh_framing_buffers(DiagnosticRequestHandle* handle) {
+    handle->frame_sender.head = handle->request_header;
+    handle->frame_sender.body = handle->request.extended_payload;
+    if(handle->request.response_buffer != NULL) {
+        handle->frame_receiver.buffer = handle->request.response_buffer;
+        handle->frame_receiver.buffer_size =
+                handle->request.response_buffer_size;
+    } else {
+        handle->frame_receiver.buffer = handle->framing_buffer;
+        handle->frame_receiver.buffer_size = sizeof(handle->framing_buffer);
+    }
+    handle->frame_receiver.streaming = handle->chunk_handler != NULL;
+}
+
+// Send as many frames of a framed request as the receiver allows right now,
+// spacing them out by its separation time if there's a clock (i.e. now isn't
+// 0).
+//
+// A frame left waiting in the TX queue holds back the next one until it has
+// gone, and the separation time then counts from when that was seen - no
+// earlier than the frame actually left.
+static void continue_framed_send(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, uint64_t now) {
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    DiagnosticFrameSender* sender = &handle->frame_sender;
+    bool was_completed = sender->completed;
+    bool sent_any = false;
+    if(handle->frame_queued) {
+        if(tx_backlogged(shims)) {
+            return;
+        }
+        handle->frame_queued = false;
+        if(sender->separation_time_us > 0 && now != 0) {
+            handle->next_frame_time = now + sender->separation_time_us;
+        }
+    }
+
+    set_active_request(shims, handle, handle->address.request_id);
+    while(true) {
+        bool paced = sender->separation_time_us > 0 && now != 0;
+        if(paced && now < handle->next_frame_time) {
+            break;
+        }
+
+        uint8_t length = diagnostic_framing_next_frame(sender, frame);
+        if(length == 0) {
+            break;
+        }
+
+        if(!send_can_message(handle->address.request_id, frame, length)) {
+            sender->completed = true;
+            sender->success = false;
+            break;
+        }
+
+        sent_any = true;
+        if(paced) {
+            handle->next_frame_time = now + sender->separation_time_us;
+        }
+        if(tx_backlogged(shims)) {
+            handle->frame_queued = !sender->completed;
+            break;
+        }
+    }
+
+    handle->isotp_send_handle.completed = sender->completed;
+    handle->isotp_send_handle.success = sender->success;
+    if(sender->completed && !was_completed) {
+        handle->timestamps.last_frame_sent = diagnostic_current_time(shims);
+    }
+    if(sent_any) {
+        arm_send_timeout(handle, now);
+    }
+}
+
+// Send the request as ISO-TP on CAN - with isotp-c when it fits in a single
+// classic frame, and the framing module otherwise.
+static void send_can_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, uint8_t size,
+        uint32_t extended_payload_length) {
+    uint8_t* payload = handle->request_header;
+    // isotp-c can only send single frames, and only classic CAN frames, and
+    // doesn't hand over a response until it's all there
+    handle->framed = max_frame_size(&handle->address) >
+                DIAGNOSTIC_CLASSIC_FRAME_SIZE ||
+            handle->request.response_buffer != NULL ||
+            handle->chunk_handler != NULL ||
+            size + extended_payload_length >=
+                transport_frame_size(&handle->address);
+    if(handle->framed) {
+        diagnostic_framing_send_init(&handle->frame_sender,
+                transport_frame_size(&handle->address), payload, size,
+                handle->request.extended_payload, extended_payload_length);
+        diagnostic_framing_receive_init(&handle->frame_receiver, NULL, 0);
+        refresh_framing_buffers(handle);
+        handle->next_frame_time = 0;
+        handle->frame_queued = false;
+        continue_framed_send(shims, handle, diagnostic_current_time(shims));
+    } else {
+        set_active_request(shims, handle, handle->address.request_id);
+        handle->isotp_send_handle = isotp_send(&handle->isotp_shims,
+                handle->address.request_id, payload, size, NULL);
+    }
+}
+
 static void send_diagnostic_request(DiagnosticShims* shims,
         DiagnosticRequestHandle* handle) {
-    uint8_t payload[MAX_DIAGNOSTIC_PAYLOAD_SIZE] = {0};
+    uint8_t* payload = handle->request_header;
+    memset(payload, 0, sizeof(handle->request_header));
     payload[MODE_BYTE_INDEX] = handle->request.mode;
     if(handle->request.has_pid) {
         handle->request.pid_length = autoset_pid_length(handle->request.mode,
                 handle->request.pid, handle->request.pid_length);
-        set_bitfield(handle->request.pid, PID_BYTE_INDEX * CHAR_BIT,
-                handle->request.pid_length * CHAR_BIT, payload,
-                sizeof(payload));
+        if(handle->request.pid_length == 1) {
+            payload[PID_BYTE_INDEX] = handle->request.pid;
+        } else if(handle->request.pid_length == 2) {
+            diagnostic_write_uint16(&payload[PID_BYTE_INDEX],
+                    handle->request.pid);
+        } else {
+            set_bitfield(handle->request.pid, PID_BYTE_INDEX * CHAR_BIT,
+                    handle->request.pid_length * CHAR_BIT, payload,
+                    sizeof(handle->request_header));
+        }
     }
 
     if(handle->request.payload_length > 0) {
@@ -81,18 +413,45 @@ static void send_diagnostic_request(DiagnosticShims* shims,
                 handle->request.payload, handle->request.payload_length);
     }
 
-    handle->isotp_send_handle = isotp_send(&handle->isotp_shims,
-            handle->request.arbitration_id, payload,
-            1 + handle->request.payload_length + handle->request.pid_length,
-            NULL);
+    uint8_t size = 1 + handle->request.payload_length +
+            handle->request.pid_length;
+    uint32_t extended_payload_length =
+            handle->request.extended_payload != NULL ?
+                handle->request.extended_payload_length : 0;
+
+    // a message transport takes the whole request at once
+    if(shims->transport != NULL) {
+        handle->framed = false;
+        handle->isotp_send_handle.completed = true;
+        handle->isotp_send_handle.success = shims->transport->send(
+                &handle->address, payload, size,
+                handle->request.extended_payload, extended_payload_length,
+                shims->transport->context);
+    } else {
+        send_can_request(shims, handle, size, extended_payload_length);
+    }
+
+    uint64_t now = diagnostic_current_time(shims);
     if(handle->isotp_send_handle.completed &&
             !handle->isotp_send_handle.success) {
         handle->completed = true;
         handle->success = false;
+        handle->timestamps.completed = now;
+        INCREMENT_COUNTER(shims, send_failures);
         if(shims->log != NULL) {
             shims->log("%s", "Diagnostic request not sent");
         }
-    } else if(shims->log != NULL) {
+        return;
+    }
+
+    INCREMENT_COUNTER(shims, requests_sent);
+    handle->timestamps.first_frame_sent = now;
+    if(handle->isotp_send_handle.completed) {
+        handle->timestamps.last_frame_sent = now;
+        arm_timeout(handle, now, response_timeout_us(handle));
+    }
+
+    if(shims->log != NULL) {
         char request_string[128] = {0};
         diagnostic_request_to_string(&handle->request, request_string,
                 sizeof(request_string));
@@ -100,20 +459,256 @@ static void send_diagnostic_request(DiagnosticShims* shims,
     }
 }
 
+static void notify_response(const DiagnosticRequestHandle* handle,
+        const DiagnosticResponse* response) {
+    if(handle->callback != NULL) {
+        handle->callback(response);
+    }
+    if(handle->handler != NULL) {
+        handle->handler(response, handle->context);
+    }
+    if(handle->typed_handler != NULL) {
+        handle->typed_handler(response, handle->typed_callback);
+    }
+}
+
+// Tell the callbacks about a request that failed without a final response.
+static void notify_failure(DiagnosticRequestHandle* handle, bool timed_out,
+        DiagnosticNegativeResponseCode negative_response_code) {
+    DiagnosticResponse response = {
+        arbitration_id: handle->address.response_id,
+        mode: handle->request.mode,
+        has_pid: handle->request.has_pid,
+        pid: handle->request.pid,
+        success: false,
+        completed: true,
+        negative_response_code: negative_response_code,
+        timed_out: timed_out,
+        timestamps: handle->timestamps
+    };
+    notify_response(handle, &response);
+}
+
+// True if a multi-frame request was refused part way through - by the ECU's
+// flow control, or a frame that couldn't be sent - and hasn't failed yet.
+static bool send_aborted(const DiagnosticRequestHandle* handle) {
+    const DiagnosticFrameSender* sender = &handle->frame_sender;
+    return handle->framed && sender->completed && !sender->success &&
+            !handle->completed;
+}
+
+// An aborted request fails right away, as nothing more will come of it.
+static void check_send_aborted(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    if(!send_aborted(handle)) {
+        return;
+    }
+
+    diagnostic_request_release(shims, handle);
+    set_active_request(NULL, NULL, 0);
+    handle->success = false;
+    handle->timeout_us = 0;
+    handle->timestamps.completed = diagnostic_current_time(shims);
+    INCREMENT_COUNTER(shims, send_failures);
+    if(shims->log != NULL) {
+        shims->log("Diagnostic request to 0x%x aborted",
+                handle->address.request_id);
+    }
+    notify_failure(handle, false, NRC_SUCCESS);
+}
+
+void diagnostic_request_refused(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle,
+        DiagnosticNegativeResponseCode negative_response_code) {
+    if(handle->completed) {
+        return;
+    }
+
+    diagnostic_request_release(shims, handle);
+    handle->success = false;
+    handle->timeout_us = 0;
+    handle->timestamps.completed = diagnostic_current_time(shims);
+    INCREMENT_COUNTER(shims, send_failures);
+    if(shims->log != NULL) {
+        shims->log("Diagnostic request to 0x%x refused: 0x%x",
+                handle->address.request_id, negative_response_code);
+    }
+    notify_failure(handle, false, negative_response_code);
+}
+
 bool diagnostic_request_sent(DiagnosticRequestHandle* handle) {
     return handle->isotp_send_handle.completed;
 }
 
+void diagnostic_continue_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    if(handle->framed && !handle->frame_sender.completed) {
+        refresh_framing_buffers(handle);
+        continue_framed_send(shims, handle, diagnostic_current_time(shims));
+        check_send_aborted(shims, handle);
+    }
+}
+
+// True if the request is still waiting on the ECU - functional requests keep
+// listening for other ECUs after the first response, until they're released.
+static bool awaiting_response(const DiagnosticRequestHandle* handle) {
+    return !handle->completed || (handle->receiving &&
+            diagnostic_addressing_is_functional(&handle->address));
+}
+
+uint64_t diagnostic_request_deadline(const DiagnosticRequestHandle* handle) {
+    // e.g. restored from before the abort was seen - it's failed by the next
+    // process call
+    if(send_aborted(handle)) {
+        return 0;
+    }
+
+    uint64_t deadline = DIAGNOSTIC_NO_DEADLINE;
+    const DiagnosticFrameSender* sender = &handle->frame_sender;
+    if(handle->framed && !sender->completed &&
+            !sender->waiting_for_flow_control && !handle->frame_queued &&
+            handle->next_frame_time != 0) {
+        deadline = handle->next_frame_time;
+    }
+
+    // a timeout that hasn't been given a deadline yet is due right away
+    if(awaiting_response(handle) && handle->timeout_us > 0) {
+        deadline = MIN(deadline, handle->timeout_deadline);
+    }
+    return deadline;
+}
+
+static void time_out(DiagnosticShims* shims, DiagnosticRequestHandle* handle,
+        uint64_t now) {
+    bool was_completed = handle->completed;
+    diagnostic_request_release(shims, handle);
+    handle->timeout_us = 0;
+    if(was_completed) {
+        // a functional request that already has a response
+        return;
+    }
+
+    handle->success = false;
+    handle->timestamps.completed = now;
+    INCREMENT_COUNTER(shims, timeouts);
+    if(shims->log != NULL) {
+        shims->log("Diagnostic request to 0x%x timed out",
+                handle->address.request_id);
+    }
+    notify_failure(handle, true, NRC_SUCCESS);
+}
+
+// Send the request again after the ECU said it was busy. The latency is
+// still measured from the first attempt.
+static void retry_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    uint64_t first_frame_sent = handle->timestamps.first_frame_sent;
+    handle->retry_pending = false;
+    INCREMENT_COUNTER(shims, busy_retries);
+    send_diagnostic_request(shims, handle);
+    if(handle->completed) {
+        diagnostic_request_release(shims, handle);
+        notify_failure(handle, false, NRC_SUCCESS);
+        return;
+    }
+
+    handle->timestamps.first_frame_sent = first_frame_sent;
+    setup_receive_handle(handle);
+}
+
+uint64_t diagnostic_process_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, uint64_t now) {
+    if(handle->framed && !handle->frame_sender.completed) {
+        refresh_framing_buffers(handle);
+        continue_framed_send(shims, handle, now);
+    }
+    check_send_aborted(shims, handle);
+
+    if(awaiting_response(handle) && handle->timeout_us > 0) {
+        if(handle->timeout_deadline == 0) {
+            handle->timeout_deadline = now + handle->timeout_us;
+        } else if(now >= handle->timeout_deadline) {
+            if(handle->retry_pending) {
+                retry_request(shims, handle);
+            } else {
+                time_out(shims, handle, now);
+            }
+        }
+    }
+    return diagnostic_request_deadline(handle);
+}
+
+uint64_t diagnostic_process_requests(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handles[], size_t count, uint64_t now) {
+    uint64_t deadline = DIAGNOSTIC_NO_DEADLINE;
+    size_t i;
+    for(i = 0; i < count; ++i) {
+        if(handles[i] != NULL) {
+            deadline = MIN(deadline,
+                    diagnostic_process_request(shims, handles[i], now));
+        }
+    }
+    return deadline;
+}
+
 void start_diagnostic_request(DiagnosticShims* shims,
         DiagnosticRequestHandle* handle) {
     handle->success = false;
     handle->completed = false;
+    handle->timestamps.first_frame_sent = 0;
+    handle->timestamps.last_frame_sent = 0;
+    handle->timestamps.first_response_frame = 0;
+    handle->timestamps.completed = 0;
+    handle->timeout_us = 0;
+    handle->timeout_deadline = 0;
+    handle->response_pending = false;
+    handle->retry_pending = false;
+    handle->retries = 0;
+    unregister_response_ids(shims, handle);
     send_diagnostic_request(shims, handle);
     if(!handle->completed) {
         setup_receive_handle(handle);
+        register_response_ids(shims, handle);
     }
 }
 
+void diagnostic_request_release(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle) {
+    unregister_response_ids(shims, handle);
+    handle->receiving = false;
+    handle->completed = true;
+}
+
+void diagnostic_request_set_payload(DiagnosticRequest* request,
+        const uint8_t* payload, uint32_t payload_length) {
+    if(payload_length <= MAX_UDS_REQUEST_PAYLOAD_LENGTH) {
+        if(payload_length > 0) {
+            memcpy(request->payload, payload, payload_length);
+        }
+        request->payload_length = payload_length;
+    } else {
+        request->extended_payload = payload;
+        request->extended_payload_length = payload_length;
+    }
+}
+
+static void record_driver_response(const DiagnosticResponse* response,
+        void* context) {
+    DiagnosticRequestDriver* driver = (DiagnosticRequestDriver*) context;
+    driver->response = *response;
+    driver->response_received = true;
+}
+
+bool diagnostic_request_driver_send(DiagnosticShims* shims,
+        DiagnosticRequestDriver* driver, DiagnosticRequest* request) {
+    driver->response_received = false;
+    driver->handle = generate_diagnostic_request(shims, request, NULL);
+    driver->handle.handler = record_driver_response;
+    driver->handle.context = driver;
+    start_diagnostic_request(shims, &driver->handle);
+    return !driver->handle.completed;
+}
+
 DiagnosticRequestHandle generate_diagnostic_request(DiagnosticShims* shims,
         DiagnosticRequest* request, DiagnosticResponseReceived callback) {
     DiagnosticRequestHandle handle = {
@@ -124,9 +719,12 @@ DiagnosticRequestHandle generate_diagnostic_request(DiagnosticShims* shims,
     };
 
     handle.isotp_shims = isotp_init_shims(shims->log,
-            shims->send_can_message,
+            send_can_message,
             shims->set_timer);
     handle.isotp_shims.frame_padding = !request->no_frame_padding;
+    handle.address = diagnostic_addressing_resolve(shims->addressing,
+            request->arbitration_id, request->target_address);
+    handle.timestamps.queued = diagnostic_current_time(shims);
 
     return handle;
     // TODO notes on multi frame:
@@ -169,18 +767,18 @@ DiagnosticRequestHandle diagnostic_request_pid(DiagnosticShims* shims,
     return diagnostic_request(shims, &request, callback);
 }
 
-static bool handle_negative_response(IsoTpMessage* message,
+static bool handle_negative_response(const uint8_t* payload, uint32_t size,
         DiagnosticResponse* response, DiagnosticShims* shims) {
     bool response_was_negative = false;
     if(response->mode == NEGATIVE_RESPONSE_MODE) {
         response_was_negative = true;
-        if(message->size > NEGATIVE_RESPONSE_MODE_INDEX) {
-            response->mode = message->payload[NEGATIVE_RESPONSE_MODE_INDEX];
+        if(size > NEGATIVE_RESPONSE_MODE_INDEX) {
+            response->mode = payload[NEGATIVE_RESPONSE_MODE_INDEX];
         }
 
-        if(message->size > NEGATIVE_RESPONSE_NRC_INDEX) {
+        if(size > NEGATIVE_RESPONSE_NRC_INDEX) {
             response->negative_response_code =
-                    message->payload[NEGATIVE_RESPONSE_NRC_INDEX];
+                    payload[NEGATIVE_RESPONSE_NRC_INDEX];
         }
 
         response->success = false;
@@ -190,7 +788,7 @@ static bool handle_negative_response(IsoTpMessage* message,
 }
 
 static bool handle_positive_response(DiagnosticRequestHandle* handle,
-        IsoTpMessage* message, DiagnosticResponse* response,
+        const uint8_t* payload, uint32_t size, DiagnosticResponse* response,
         DiagnosticShims* shims) {
     bool response_was_positive = false;
     if(response->mode == handle->request.mode + MODE_RESPONSE_OFFSET) {
@@ -199,13 +797,13 @@ static bool handle_positive_response(DiagnosticRequestHandle* handle,
         // if it matched
         response->mode = handle->request.mode;
         response->has_pid = false;
-        if(handle->request.has_pid && message->size > 1) {
+        if(handle->request.has_pid && size > 1) {
             response->has_pid = true;
             if(handle->request.pid_length == 2) {
-                response->pid = get_bitfield(message->payload, message->size,
-                        PID_BYTE_INDEX * CHAR_BIT, sizeof(uint16_t) * CHAR_BIT);
+                response->pid = size > PID_BYTE_INDEX + 1 ?
+                        diagnostic_read_uint16(&payload[PID_BYTE_INDEX]) : 0;
             } else {
-                response->pid = message->payload[PID_BYTE_INDEX];
+                response->pid = payload[PID_BYTE_INDEX];
             }
 
         }
@@ -216,11 +814,19 @@ static bool handle_positive_response(DiagnosticRequestHandle* handle,
             response->completed = true;
 
             uint8_t payload_index = 1 + handle->request.pid_length;
-            response->payload_length = MAX(0, message->size - payload_index);
+            uint32_t payload_length = size > payload_index ?
+                    size - payload_index : 0;
+            response->payload_length = MIN(payload_length,
+                    MAX_UDS_RESPONSE_PAYLOAD_LENGTH);
             if(response->payload_length > 0) {
-                memcpy(response->payload, &message->payload[payload_index],
+                memcpy(response->payload, &payload[payload_index],
                         response->payload_length);
             }
+
+            if(payload_length > MAX_UDS_RESPONSE_PAYLOAD_LENGTH) {
+                response->extended_payload = &payload[payload_index];
+                response->extended_payload_length = payload_length;
+            }
         } else {
             response_was_positive = false;
         }
@@ -228,6 +834,222 @@ static bool handle_positive_response(DiagnosticRequestHandle* handle,
     return response_was_positive;
 }
 
+static void count_response(DiagnosticShims* shims,
+        const DiagnosticResponse* response) {
+    if(shims->counters == NULL) {
+        return;
+    }
+
+    if(response->success) {
+        UDS_ATOMIC_INCREMENT(&shims->counters->responses_positive);
+    } else {
+        UDS_ATOMIC_INCREMENT(&shims->counters->responses_negative);
+        UDS_ATOMIC_INCREMENT(&shims->counters->negative_response_codes[
+                (uint8_t) response->negative_response_code]);
+    }
+}
+
+// Returns true if the message is a negative response that means the real
+// response is still to come - response pending (0x78), or busy (0x21) if
+// the request can be sent again.
+static bool handle_busy_response(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint8_t* payload,
+        uint32_t size) {
+    if(size <= NEGATIVE_RESPONSE_NRC_INDEX ||
+            payload[MODE_BYTE_INDEX] != NEGATIVE_RESPONSE_MODE ||
+            payload[NEGATIVE_RESPONSE_MODE_INDEX] != handle->request.mode) {
+        return false;
+    }
+
+    uint8_t code = payload[NEGATIVE_RESPONSE_NRC_INDEX];
+    if(code == NRC_RESPONSE_PENDING) {
+        // the deadline is moved out to P2* once the frame is processed
+        handle->response_pending = true;
+        INCREMENT_COUNTER(shims, responses_pending);
+        return true;
+    }
+
+    // a functional request would be repeated to every ECU, so the busy
+    // response is final
+    if(code == NRC_BUSY_REPEAT_REQUEST &&
+            handle->retries < DIAGNOSTIC_BUSY_RETRY_COUNT &&
+            !diagnostic_addressing_is_functional(&handle->address)) {
+        handle->retry_pending = true;
+        arm_timeout(handle, diagnostic_current_time(shims),
+                (DIAGNOSTIC_BUSY_RETRY_DELAY_MS * 1000) << handle->retries);
+        ++handle->retries;
+        if(shims->log != NULL) {
+            shims->log("ECU 0x%x is busy, retrying", handle->address.request_id);
+        }
+        return true;
+    }
+    return false;
+}
+
+// Process a complete ISO-TP message received for the handle.
+static void complete_response(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint8_t* payload,
+        uint32_t size, DiagnosticResponse* response) {
+    if(response->multi_frame) {
+        INCREMENT_COUNTER(shims, multi_frame_responses);
+    }
+
+    if(handle_busy_response(shims, handle, payload, size)) {
+        return;
+    }
+
+    if(size > 0) {
+        response->mode = payload[0];
+        if(handle_negative_response(payload, size, response, shims) ||
+                handle_positive_response(handle, payload, size, response,
+                    shims)) {
+            response->timestamps = handle->timestamps;
+            response->timestamps.completed = diagnostic_current_time(shims);
+            if(!handle->completed) {
+                handle->timestamps.completed =
+                        response->timestamps.completed;
+            }
+            record_latency(shims, response);
+            count_response(shims, response);
+
+            if(shims->log != NULL) {
+                char response_string[128] = {0};
+                diagnostic_response_to_string(response, response_string,
+                        sizeof(response_string));
+                shims->log("Diagnostic response received: %s",
+                        response_string);
+            }
+
+            handle->success = true;
+            handle->completed = true;
+            // functional requests keep listening for the other ECUs until
+            // they're released
+            if(!diagnostic_addressing_is_functional(&handle->address)) {
+                unregister_response_ids(shims, handle);
+            }
+        } else {
+            INCREMENT_COUNTER(shims, responses_unmatched);
+        }
+    } else {
+        INCREMENT_COUNTER(shims, empty_responses);
+        if(shims->log != NULL) {
+            shims->log("Received an empty response on arb ID 0x%x",
+                    response->arbitration_id);
+        }
+    }
+
+    if(handle->completed) {
+        notify_response(handle, response);
+    }
+}
+
+static void receive_isotp_frame(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, int index,
+        const uint32_t arbitration_id, const uint8_t* frame,
+        uint8_t frame_size, DiagnosticResponse* response) {
+    if(!handle->isotp_send_handle.completed) {
+        set_active_request(shims, handle, handle->address.request_id);
+        isotp_continue_send(&handle->isotp_shims,
+                &handle->isotp_send_handle, arbitration_id, frame, frame_size);
+        if(handle->isotp_send_handle.completed) {
+            handle->timestamps.last_frame_sent = diagnostic_current_time(shims);
+            arm_timeout(handle, handle->timestamps.last_frame_sent,
+                    response_timeout_us(handle));
+        }
+        return;
+    }
+
+    // isotp-c only keeps 11 bits of the ID, so give it back the ID it stored
+    // rather than the full 29-bit one - the frame is already routed
+    IsoTpReceiveHandle* receive_handle = &handle->isotp_receive_handles[index];
+    set_active_request(shims, handle,
+            diagnostic_addressing_flow_control_id(&handle->address,
+                arbitration_id));
+    IsoTpMessage message = isotp_continue_receive(&handle->isotp_shims,
+            receive_handle, receive_handle->arbitration_id, frame, frame_size);
+    response->multi_frame = message.multi_frame;
+
+    if(message.completed) {
+        complete_response(shims, handle, message.payload, message.size,
+                response);
+        // ready for the next message from the ECU, e.g. after a response
+        // pending
+        if(awaiting_response(handle)) {
+            *receive_handle = isotp_receive(&handle->isotp_shims,
+                    handle->response_ids[index], NULL);
+        }
+    }
+}
+
+static void receive_framed_frame(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint32_t arbitration_id,
+        const uint8_t* frame, uint8_t frame_size,
+        DiagnosticResponse* response) {
+    refresh_framing_buffers(handle);
+    if(!handle->frame_sender.completed) {
+        if(diagnostic_framing_flow_control(&handle->frame_sender, frame,
+                    frame_size) != DIAGNOSTIC_FRAMING_IGNORED) {
+            uint64_t now = diagnostic_current_time(shims);
+            continue_framed_send(shims, handle, now);
+            arm_send_timeout(handle, now);
+            check_send_aborted(shims, handle);
+        }
+        return;
+    }
+
+    // only one ECU at a time can send a multi-frame response
+    DiagnosticFrameReceiver* receiver = &handle->frame_receiver;
+    if(receiver->in_progress && arbitration_id != handle->framed_response_id) {
+        return;
+    }
+
+    uint8_t flow_control[DIAGNOSTIC_FLOW_CONTROL_LENGTH];
+    uint8_t flow_control_length;
+    DiagnosticFramingStatus status = diagnostic_framing_receive(receiver,
+            frame, frame_size, flow_control, &flow_control_length);
+    if(flow_control_length > 0) {
+        uint32_t flow_control_id = diagnostic_addressing_flow_control_id(
+                &handle->address, arbitration_id);
+        set_active_request(shims, handle, flow_control_id);
+        send_can_message(flow_control_id, flow_control, flow_control_length);
+    }
+
+    if(receiver->chunk_length > 0 && handle->chunk_handler != NULL) {
+        DiagnosticResponseChunk chunk = {
+            arbitration_id: arbitration_id,
+            offset: receiver->chunk_offset,
+            data: receiver->chunk,
+            length: receiver->chunk_length,
+            total_length: receiver->length
+        };
+        handle->chunk_handler(&chunk, handle->context);
+    }
+
+    response->multi_frame = receiver->multi_frame;
+    if(status == DIAGNOSTIC_FRAMING_IN_PROGRESS) {
+        handle->framed_response_id = arbitration_id;
+    } else if(status == DIAGNOSTIC_FRAMING_COMPLETE) {
+        // a streamed response may only have its start in the buffer
+        complete_response(shims, handle, receiver->buffer,
+                MIN(receiver->length, receiver->buffer_size), response);
+    } else if(status == DIAGNOSTIC_FRAMING_ERROR && shims->log != NULL) {
+        shims->log("Multi-frame response from 0x%x failed", arbitration_id);
+    }
+}
+
+// The rest of a multi-frame response must keep coming within N_Cr, and
+// functional requests wait for the other ECUs from the last response.
+static void rearm_after_receive(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, bool sent,
+        const DiagnosticResponse* response) {
+    if(sent && awaiting_response(handle) && !handle->retry_pending) {
+        arm_timeout(handle, diagnostic_current_time(shims),
+                response->multi_frame && !response->completed ?
+                    DIAGNOSTIC_TRANSFER_TIMEOUT_MS * 1000 :
+                    response_timeout_us(handle));
+    }
+}
+
 DiagnosticResponse diagnostic_receive_can_frame(DiagnosticShims* shims,
         DiagnosticRequestHandle* handle, const uint32_t arbitration_id,
         const uint8_t data[], const uint8_t size) {
@@ -239,55 +1061,92 @@ DiagnosticResponse diagnostic_receive_can_frame(DiagnosticShims* shims,
         completed: false
     };
 
-    if(!handle->isotp_send_handle.completed) {
-        isotp_continue_send(&handle->isotp_shims,
-                &handle->isotp_send_handle, arbitration_id, data, size);
+    // with extended or mixed addressing, the first byte must also match
+    bool addressed = !uses_address_byte(&handle->address) ||
+            (size > 0 && data[0] == handle->address.response_address);
+    int index = addressed ? find_receive_handle(handle, arbitration_id) : -1;
+    bool routed = index >= 0;
+    if(shims->counters != NULL) {
+        UDS_ATOMIC_INCREMENT(&shims->counters->frames_offered);
+        if(routed) {
+            UDS_ATOMIC_INCREMENT(&shims->counters->frames_routed);
+        } else {
+            UDS_ATOMIC_INCREMENT(&shims->counters->frames_ignored);
+        }
+    }
+
+    if(shims->trace != NULL &&
+            (shims->trace->directions & DIAGNOSTIC_TRACE_RECEIVED)) {
+        diagnostic_trace_record(shims->trace, DIAGNOSTIC_TRACE_RECEIVED,
+                diagnostic_current_time(shims), arbitration_id, data, size);
+    }
+
+    if(!routed) {
+        return response;
+    }
+
+    const uint8_t* frame = data;
+    uint8_t frame_size = size;
+    if(uses_address_byte(&handle->address)) {
+        ++frame;
+        --frame_size;
+    }
+
+    bool sent = handle->isotp_send_handle.completed;
+    if(sent && handle->timestamps.first_response_frame == 0) {
+        handle->timestamps.first_response_frame =
+                diagnostic_current_time(shims);
+    }
+
+    if(handle->framed) {
+        receive_framed_frame(shims, handle, arbitration_id, frame, frame_size,
+                &response);
     } else {
-        uint8_t i;
-        for(i = 0; i < handle->isotp_receive_handle_count; ++i) {
-            IsoTpMessage message = isotp_continue_receive(&handle->isotp_shims,
-                    &handle->isotp_receive_handles[i], arbitration_id, data,
-                    size);
-            response.multi_frame = message.multi_frame;
-
-            if(message.completed) {
-                if(message.size > 0) {
-                    response.mode = message.payload[0];
-                    if(handle_negative_response(&message, &response, shims) ||
-                            handle_positive_response(handle, &message,
-                                &response, shims)) {
-                        if(shims->log != NULL) {
-                            char response_string[128] = {0};
-                            diagnostic_response_to_string(&response,
-                                    response_string, sizeof(response_string));
-                            shims->log("Diagnostic response received: %s",
-                                    response_string);
-                        }
-
-                        handle->success = true;
-                        handle->completed = true;
-                    }
-                } else {
-                    if(shims->log != NULL) {
-                        shims->log("Received an empty response on arb ID 0x%x",
-                                response.arbitration_id);
-                    }
-                }
-
-                if(handle->completed && handle->callback != NULL) {
-                    handle->callback(&response);
-                }
-
-                break;
-            }
+        receive_isotp_frame(shims, handle, index, arbitration_id, frame,
+                frame_size, &response);
+    }
+
+    rearm_after_receive(shims, handle, sent, &response);
+    return response;
+}
+
+DiagnosticResponse diagnostic_receive_message(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint32_t arbitration_id,
+        const uint8_t payload[], const uint32_t size) {
+    DiagnosticResponse response = {
+        arbitration_id: arbitration_id,
+        multi_frame: false,
+        success: false,
+        completed: false
+    };
+
+    bool routed = find_receive_handle(handle, arbitration_id) >= 0;
+    if(shims->counters != NULL) {
+        UDS_ATOMIC_INCREMENT(&shims->counters->frames_offered);
+        if(routed) {
+            UDS_ATOMIC_INCREMENT(&shims->counters->frames_routed);
+        } else {
+            UDS_ATOMIC_INCREMENT(&shims->counters->frames_ignored);
         }
     }
+
+    bool sent = handle->isotp_send_handle.completed;
+    if(!routed || !sent) {
+        return response;
+    }
+
+    if(handle->timestamps.first_response_frame == 0) {
+        handle->timestamps.first_response_frame =
+                diagnostic_current_time(shims);
+    }
+    complete_response(shims, handle, payload, size, &response);
+    rearm_after_receive(shims, handle, sent, &response);
     return response;
 }
 
 int diagnostic_payload_to_integer(const DiagnosticResponse* response) {
-    return get_bitfield(response->payload, response->payload_length, 0,
-            response->payload_length * CHAR_BIT);
+    return diagnostic_read_field(response->payload, response->payload_length,
+            0, response->payload_length * CHAR_BIT);
 }
 
 float diagnostic_decode_obd2_pid(const DiagnosticResponse* response) {
@@ -296,13 +1155,13 @@ float diagnostic_decode_obd2_pid(const DiagnosticResponse* response) {
         case 0xa:
             return response->payload[0] * 3;
         case 0xc:
-            return (response->payload[0] * 256 + response->payload[1]) / 4.0;
+            return diagnostic_read_uint16(response->payload) / 4.0;
         case 0xd:
         case 0x33:
         case 0xb:
             return response->payload[0];
         case 0x10:
-            return (response->payload[0] * 256 + response->payload[1]) / 100.0;
+            return diagnostic_read_uint16(response->payload) / 100.0;
         case 0x11:
         case 0x2f:
         case 0x45:
@@ -323,71 +1182,154 @@ float diagnostic_decode_obd2_pid(const DiagnosticResponse* response) {
     }
 }
 
+int8_t diagnostic_obd2_pid_exponent(uint16_t pid) {
+    switch(pid) {
+        case 0xc:
+        case 0x10:
+        case 0x11:
+        case 0x2f:
+        case 0x45:
+        case 0x4c:
+        case 0x52:
+        case 0x5a:
+        case 0x4:
+            return -2;
+        default:
+            return 0;
+    }
+}
+
+// A * 100 / 255 in hundredths, rounded: A * 2000 / 51 is 39A + 11A / 51,
+// and for n < 4096, n / 51 is (n * 5141) >> 18.
+static int32_t percent_hundredths(uint8_t value) {
+    return 39 * value + (((11 * value + 25) * 5141) >> 18);
+}
+
+DiagnosticFixedPoint diagnostic_decode_obd2_pid_fixed(
+        const DiagnosticResponse* response) {
+    DiagnosticFixedPoint result = {
+        value: 0,
+        exponent: diagnostic_obd2_pid_exponent(response->pid)
+    };
+
+    // the same cases as diagnostic_decode_obd2_pid
+    switch(response->pid) {
+        case 0xa:
+            result.value = response->payload[0] * 3;
+            break;
+        case 0xc:
+            // / 4 is * 25 hundredths
+            result.value = diagnostic_read_uint16(response->payload) * 25;
+            break;
+        case 0xd:
+        case 0x33:
+        case 0xb:
+            result.value = response->payload[0];
+            break;
+        case 0x10:
+            result.value = diagnostic_read_uint16(response->payload);
+            break;
+        case 0x11:
+        case 0x2f:
+        case 0x45:
+        case 0x4c:
+        case 0x52:
+        case 0x5a:
+        case 0x4:
+            result.value = percent_hundredths(response->payload[0]);
+            break;
+        case 0x46:
+        case 0x5c:
+        case 0xf:
+        case 0x5:
+            result.value = response->payload[0] - 40;
+            break;
+        case 0x62:
+            result.value = response->payload[0] - 125;
+            break;
+        default:
+            result.value = diagnostic_payload_to_integer(response);
+            break;
+    }
+    return result;
+}
+
+// Write the payload as hex after whatever is already in the destination,
+// truncating it if it doesn't fit.
+static void payload_to_string(const uint8_t* payload, uint32_t length,
+        char* destination, size_t destination_length, size_t bytes_used) {
+    static const char hex_digits[] = "0123456789abcdef";
+    if(bytes_used >= destination_length) {
+        return;
+    }
+
+    char* position = destination + bytes_used;
+    char* end = destination + destination_length - 1;
+    if(length == 0) {
+        snprintf(position, end - position + 1, "no payload");
+        return;
+    }
+
+    const char* prefix = "payload: 0x";
+    while(*prefix != '\0' && position < end) {
+        *position++ = *prefix++;
+    }
+
+    uint32_t i;
+    for(i = 0; i < length && end - position >= 2; ++i) {
+        *position++ = hex_digits[payload[i] >> 4];
+        *position++ = hex_digits[payload[i] & 0xf];
+    }
+    *position = '\0';
+}
+
 void diagnostic_response_to_string(const DiagnosticResponse* response,
         char* destination, size_t destination_length) {
-    int bytes_used = snprintf(destination, destination_length,
+    size_t bytes_used = snprintf(destination, destination_length,
             "arb_id: 0x%lx, mode: 0x%x, ",
             (unsigned long) response->arbitration_id,
             response->mode);
 
-    if(response->has_pid) {
+    if(response->has_pid && bytes_used < destination_length) {
         bytes_used += snprintf(destination + bytes_used,
                 destination_length - bytes_used,
                 "pid: 0x%x, ",
                 response->pid);
     }
 
-    if(!response->success) {
+    if(!response->success && bytes_used < destination_length) {
         bytes_used += snprintf(destination + bytes_used,
                 destination_length - bytes_used,
                 "nrc: 0x%x, ",
                 response->negative_response_code);
     }
 
-    if(response->payload_length > 0) {
-        snprintf(destination + bytes_used, destination_length - bytes_used,
-                "payload: 0x%02x%02x%02x%02x%02x%02x%02x",
-                response->payload[0],
-                response->payload[1],
-                response->payload[2],
-                response->payload[3],
-                response->payload[4],
-                response->payload[5],
-                response->payload[6]);
+    if(response->extended_payload != NULL) {
+        payload_to_string(response->extended_payload,
+                response->extended_payload_length, destination,
+                destination_length, bytes_used);
     } else {
-        snprintf(destination + bytes_used, destination_length - bytes_used,
-                "no payload");
+        payload_to_string(response->payload, response->payload_length,
+                destination, destination_length, bytes_used);
     }
 }
 
 void diagnostic_request_to_string(const DiagnosticRequest* request,
         char* destination, size_t destination_length) {
-    int bytes_used = snprintf(destination, destination_length,
+    size_t bytes_used = snprintf(destination, destination_length,
             "arb_id: 0x%lx, mode: 0x%x, ",
             (unsigned long) request->arbitration_id,
             request->mode);
 
-    if(request->has_pid) {
+    if(request->has_pid && bytes_used < destination_length) {
         bytes_used += snprintf(destination + bytes_used,
                 destination_length - bytes_used,
                 "pid: 0x%x, ",
                 request->pid);
     }
 
-    int remaining_space = destination_length - bytes_used;
-    if(request->payload_length > 0) {
-        snprintf(destination + bytes_used, remaining_space,
-                "payload: 0x%02x%02x%02x%02x%02x%02x%02x",
-                request->payload[0],
-                request->payload[1],
-                request->payload[2],
-                request->payload[3],
-                request->payload[4],
-                request->payload[5],
-                request->payload[6]);
-    } else {
-        snprintf(destination + bytes_used, remaining_space, "no payload");
-    }
+    payload_to_string(request->payload, request->payload_length, destination,
+            destination_length, bytes_used);
 }
 
 bool diagnostic_request_equals(const DiagnosticRequest* ours,
@@ -8,6 +8,7 @@
 #define OBD2_FUNCTIONAL_BROADCAST_ID 0x7df
 #define OBD2_FUNCTIONAL_RESPONSE_START 0x7e8
 #define OBD2_FUNCTIONAL_RESPONSE_COUNT 8
+#define DIAGNOSTIC_NO_DEADLINE UINT64_MAX
 
 #ifdef __cplusplus
 extern "C" {
@@ -69,6 +70,21 @@ DiagnosticRequestHandle generate_diagnostic_request(DiagnosticShims* shims,
 void start_diagnostic_request(DiagnosticShims* shims,
                 DiagnosticRequestHandle* handle);
 
+/* Public: Stop processing a request, and remove its response arbitration IDs
+ * from the DiagnosticAcceptFilter in the shims (if any).
+ *
+ * Physical requests are released automatically when their response arrives,
+ * but functional broadcast requests keep waiting for responses from other
+ * ECUs until they're released with this function.
+ *
+ * shims -  Low-level shims required to send and receive CAN messages, etc.
+ * handle - A DiagnosticRequestHandle previously started with
+ *      start_diagnostic_request(...) or one of the diagnostic_request*(..)
+ *      functions.
+ */
+void diagnostic_request_release(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle);
+
 /* Public: Request a PID from the given arbitration ID, determining the mode
  * automatically based on the PID type.
  *
@@ -109,6 +125,30 @@ DiagnosticResponse diagnostic_receive_can_frame(DiagnosticShims* shims,
         const uint32_t arbitration_id, const uint8_t data[],
         const uint8_t size);
 
+/* Public: Like diagnostic_receive_can_frame(...), for a whole UDS message
+ * received over the shims' transport (e.g. DoIP) rather than a CAN frame.
+ *
+ * arbitration_id - The response ID of the ECU the message came from.
+ * payload - The message, starting with the service ID. A response too long
+ *      for the DiagnosticResponse's payload is passed to the callbacks as
+ *      its extended_payload, pointing in to this buffer.
+ * size - The length of the message.
+ */
+DiagnosticResponse diagnostic_receive_message(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, const uint32_t arbitration_id,
+        const uint8_t payload[], const uint32_t size);
+
+/* Public: Fail a request that the shims' transport refused to deliver (e.g.
+ * a DoIP diagnostic message negative acknowledgement), rather than waiting
+ * for it to time out. Does nothing if the request has already completed.
+ *
+ * negative_response_code - The transport's reason, passed to the callbacks
+ *      as the response's negative_response_code.
+ */
+void diagnostic_request_refused(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle,
+        DiagnosticNegativeResponseCode negative_response_code);
+
 /* Public: Parse the entier payload of the reponse as a single integer.
  *
  * response - the received DiagnosticResponse.
@@ -145,6 +185,26 @@ void diagnostic_request_to_string(const DiagnosticRequest* request,
  */
 float diagnostic_decode_obd2_pid(const DiagnosticResponse* response);
 
+/* Public: Like diagnostic_decode_obd2_pid(...), but with integer multiplies
+ * and shifts only - no floating point, and no division (which Cortex-M0 and
+ * similar cores don't have in hardware).
+ *
+ * The result is the same as the float formula's, rounded to the exponent.
+ * That's exact for every PID except the percentages (A * 100 / 255), which
+ * are rounded to the nearest 0.01%.
+ *
+ * Returns the translated value, with the exponent from
+ * diagnostic_obd2_pid_exponent(...).
+ */
+DiagnosticFixedPoint diagnostic_decode_obd2_pid_fixed(
+        const DiagnosticResponse* response);
+
+/* Public: The decimal exponent of a PID's value from
+ * diagnostic_decode_obd2_pid_fixed(...) - 0 for whole numbers, -2 for
+ * hundredths. It only depends on the PID, so a logger can record it once.
+ */
+int8_t diagnostic_obd2_pid_exponent(uint16_t pid);
+
 /* Public: Returns true if the "fingerprint" of the two diagnostic messages
  * matches - the arbitration_id, mode and pid (or lack of pid).
  */
@@ -158,6 +218,72 @@ bool diagnostic_request_equals(const DiagnosticRequest* ours,
  */
 bool diagnostic_request_sent(DiagnosticRequestHandle* handle);
 
+/* Public: Send any frames of a multi-frame request that are waiting for the
+ * separation time requested by the ECU to pass. Call this repeatedly from the
+ * main loop until diagnostic_request_sent(...) returns true - it does nothing
+ * if there are no frames due.
+ *
+ * Without a GetTimeShim in the shims, all frames are sent as soon as the ECU
+ * allows, ignoring the separation time.
+ *
+ * With a DiagnosticTxQueue in the shims, the next frame also waits for the
+ * request's last frame to leave the queue - call this after
+ * diagnostic_tx_queue_drain(...) too.
+ */
+void diagnostic_continue_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle);
+
+/* Public: Returns the time (from the same clock as the GetTimeShim) when
+ * diagnostic_process_request(...) next has something to do for the request -
+ * a frame held back by the ECU's separation time, or the end of the wait for
+ * a flow control frame or a response. An event loop can sleep until then, or
+ * until a CAN frame arrives, whichever is first.
+ *
+ * Returns DIAGNOSTIC_NO_DEADLINE if the request isn't waiting on anything
+ * (e.g. it's completed), or 0 if diagnostic_process_request(...) should be
+ * called right away - a timeout is pending but there's no clock in the shims
+ * to say when it started, or the request's send was aborted and it has yet
+ * to fail.
+ */
+uint64_t diagnostic_request_deadline(const DiagnosticRequestHandle* handle);
+
+/* Public: Do anything that's due for the request at the given time - send
+ * frames that were waiting for the separation time to pass, and give up on
+ * the request if the ECU hasn't responded in time.
+ *
+ * A request that times out is completed without success, and its callback
+ * and handler are given a response with 'timed_out' set. Functional requests
+ * are released (see diagnostic_request_release(...)) once no ECU has
+ * responded for the timeout, without calling the callback again if one
+ * already did.
+ *
+ * The timeouts are the request's 'timeout_ms' for a response, and
+ * DIAGNOSTIC_TRANSFER_TIMEOUT_MS for each flow control frame and for the gaps
+ * in a multi-frame response (N_Bs and N_Cr in ISO 15765-2).
+ *
+ * shims -  Low-level shims required to send CAN messages, etc.
+ * handle - A DiagnosticRequestHandle previously started with
+ *      start_diagnostic_request(...) or one of the diagnostic_request*(..)
+ *      functions.
+ * now - The current time in microseconds, from the same clock as the
+ *      GetTimeShim if there is one. Must not be 0.
+ *
+ * Returns the next deadline for the request, as
+ * diagnostic_request_deadline(...).
+ */
+uint64_t diagnostic_process_request(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handle, uint64_t now);
+
+/* Public: Call diagnostic_process_request(...) for each of the handles.
+ *
+ * handles - The requests in progress. NULL entries are skipped.
+ * count - The number of entries in handles.
+ *
+ * Returns the earliest of their deadlines, or DIAGNOSTIC_NO_DEADLINE.
+ */
+uint64_t diagnostic_process_requests(DiagnosticShims* shims,
+        DiagnosticRequestHandle* handles[], size_t count, uint64_t now);
+
 #ifdef __cplusplus
 }
 #endif
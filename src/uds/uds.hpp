@@ -0,0 +1,488 @@
+#ifndef __UDS_HPP__
+#define __UDS_HPP__
+
+// A header-only C++20 layer over the C API: move-only request objects that
+// clean up after themselves, and requests that can be co_await-ed from a
+// coroutine and are resumed by the loop feeding CAN frames to the Client.
+//
+//     uds::Task read_speed(uds::Client& client) {
+//         uds::Response response = co_await client.read_pid(0x7e0, 0xd);
+//         if(response.success()) {
+//             printf("%f km/h\n", response.decode_obd2_pid());
+//         }
+//     }
+//
+//     // the frame ingest loop
+//     client.receive(arbitration_id, std::span(data, size));
+
+#if __cplusplus < 202002L
+#error "uds/uds.hpp requires C++20"
+#endif
+
+#include <uds/uds.h>
+#include <uds/filter.h>
+#include <uds/addressing.h>
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace uds {
+
+class Client;
+
+/* Public: A completed (or failed) response, owning a copy of the
+ * DiagnosticResponse from the C layer - and of a long response's payload, so
+ * it can outlive the request and its response_buffer.
+ */
+class Response {
+public:
+    Response() : response_() {}
+    explicit Response(const DiagnosticResponse& response) :
+            response_(response) {
+        if(response.extended_payload != nullptr) {
+            extended_payload_.assign(response.extended_payload,
+                    response.extended_payload +
+                        response.extended_payload_length);
+            adopt_payload();
+        }
+    }
+
+    Response(const Response& other) :
+            response_(other.response_),
+            extended_payload_(other.extended_payload_) {
+        adopt_payload();
+    }
+
+    Response& operator=(const Response& other) {
+        response_ = other.response_;
+        extended_payload_ = other.extended_payload_;
+        adopt_payload();
+        return *this;
+    }
+
+    // moving the vector keeps its storage, so the pointer stays valid
+    Response(Response&&) noexcept = default;
+    Response& operator=(Response&&) noexcept = default;
+
+    bool completed() const { return response_.completed; }
+    bool success() const { return response_.success; }
+    bool timed_out() const { return response_.timed_out; }
+    uint32_t arbitration_id() const { return response_.arbitration_id; }
+    uint8_t mode() const { return response_.mode; }
+    bool has_pid() const { return response_.has_pid; }
+    uint16_t pid() const { return response_.pid; }
+    DiagnosticNegativeResponseCode negative_response_code() const {
+        return response_.negative_response_code;
+    }
+    const DiagnosticTimestamps& timestamps() const {
+        return response_.timestamps;
+    }
+
+    // Public: The whole payload, including a long response's
+    // extended_payload.
+    std::span<const uint8_t> payload() const {
+        if(response_.extended_payload != nullptr) {
+            return {response_.extended_payload,
+                    response_.extended_payload_length};
+        }
+        return {response_.payload, response_.payload_length};
+    }
+
+    float decode_obd2_pid() const {
+        return diagnostic_decode_obd2_pid(&response_);
+    }
+
+    DiagnosticFixedPoint decode_obd2_pid_fixed() const {
+        return diagnostic_decode_obd2_pid_fixed(&response_);
+    }
+
+    // Public: The C response, with its extended_payload pointing in to this
+    // Response.
+    const DiagnosticResponse& raw() const { return response_; }
+
+private:
+    void adopt_payload() {
+        if(response_.extended_payload != nullptr) {
+            response_.extended_payload = extended_payload_.data();
+        }
+    }
+
+    DiagnosticResponse response_;
+    std::vector<uint8_t> extended_payload_;
+};
+
+/* Public: A diagnostic request in progress, started when it's created.
+ *
+ * Requests are move-only. Destroying a request that hasn't completed stops
+ * it, and removes its response IDs from the shims' accept filter.
+ *
+ * A request is awaitable - co_await-ing it suspends the coroutine until the
+ * Client is given a frame that completes it, and returns the Response.
+ *
+ * A functional request completes with the first ECU's response, and keeps
+ * collecting the others' in responses() until it's destroyed.
+ */
+class Request {
+public:
+    Request() = default;
+
+    Request(Client& client, const DiagnosticRequest& request);
+
+    Request(Request&& other) noexcept { take(other); }
+
+    Request& operator=(Request&& other) noexcept {
+        if(this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    Request(const Request&) = delete;
+    Request& operator=(const Request&) = delete;
+
+    ~Request() { release(); }
+
+    bool completed() const { return client_ == nullptr || handle_.completed; }
+    const Response& response() const { return response_; }
+    const std::vector<Response>& responses() const { return responses_; }
+    const DiagnosticRequestHandle& handle() const { return handle_; }
+
+    bool await_ready() const noexcept { return completed(); }
+    void await_suspend(std::coroutine_handle<> waiter) noexcept {
+        waiter_ = waiter;
+    }
+    Response await_resume() const { return response_; }
+
+private:
+    friend class Client;
+
+    static void on_response(const DiagnosticResponse* response,
+            void* context) {
+        Request* request = static_cast<Request*>(context);
+        request->responses_.emplace_back(*response);
+        if(!request->response_.completed()) {
+            request->response_ = request->responses_.back();
+            request->ready();
+        }
+    }
+
+    void take(Request& other) noexcept;
+    void release() noexcept;
+    void ready() noexcept;
+
+    Client* client_ = nullptr;
+    DiagnosticRequestHandle handle_ = {};
+    Response response_;
+    std::vector<Response> responses_;
+    std::coroutine_handle<> waiter_;
+
+    // Private - the intrusive list of requests waiting on the same
+    // response ID (or on a functional range)
+    Request* previous_ = nullptr;
+    Request* next_ = nullptr;
+    Request** head_ = nullptr;
+};
+
+/* Public: Owns the routing of incoming frames to the requests in progress.
+ *
+ * Frames are rejected with the shims' DiagnosticAcceptFilter (if there is
+ * one), then offered only to the requests waiting on that arbitration ID, so
+ * the cost of each frame doesn't grow with the number of requests in
+ * progress. Coroutines waiting on completed requests are resumed at the end
+ * of receive(...), from the thread calling it.
+ *
+ * A Client isn't thread safe - create requests and feed frames from one
+ * thread.
+ */
+class Client {
+public:
+    explicit Client(DiagnosticShims& shims) : shims_(shims) {}
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    DiagnosticShims& shims() { return shims_; }
+
+    Request request(const DiagnosticRequest& request) {
+        return Request(*this, request);
+    }
+
+    Request read_pid(uint32_t arbitration_id, uint16_t pid,
+            DiagnosticPidRequestType type = DIAGNOSTIC_STANDARD_PID) {
+        DiagnosticRequest request = {};
+        request.arbitration_id = arbitration_id;
+        request.mode = type == DIAGNOSTIC_STANDARD_PID ? 0x1 : 0x22;
+        request.has_pid = true;
+        request.pid = pid;
+        return Request(*this, request);
+    }
+
+    // Public: Start a request with an arbitrary mode. A payload longer than
+    // MAX_UDS_REQUEST_PAYLOAD_LENGTH isn't copied, and must outlive the
+    // request.
+    Request request(uint32_t arbitration_id, uint8_t mode,
+            std::span<const uint8_t> payload = {}) {
+        DiagnosticRequest request = {};
+        request.arbitration_id = arbitration_id;
+        request.mode = mode;
+        if(payload.size() <= MAX_UDS_REQUEST_PAYLOAD_LENGTH) {
+            std::memcpy(request.payload, payload.data(), payload.size());
+            request.payload_length = payload.size();
+        } else {
+            request.extended_payload = payload.data();
+            request.extended_payload_length = payload.size();
+        }
+        return Request(*this, request);
+    }
+
+    /* Public: Pass a received CAN frame to the requests waiting for it, and
+     * resume any coroutines whose requests it completed.
+     */
+    void receive(uint32_t arbitration_id, std::span<const uint8_t> data) {
+        if(shims_.filter != nullptr &&
+                !diagnostic_filter_accepts(shims_.filter, arbitration_id)) {
+            return;
+        }
+
+        auto found = physical_.find(arbitration_id);
+        if(found != physical_.end()) {
+            offer(found->second, arbitration_id, data);
+        }
+        offer(functional_, arbitration_id, data);
+        resume_ready();
+    }
+
+    /* Public: Send any frames of multi-frame requests that were held back by
+     * the ECU's separation time.
+     */
+    void continue_requests() {
+        for(auto& entry : physical_) {
+            continue_requests(entry.second);
+        }
+        continue_requests(functional_);
+    }
+
+    /* Public: Send frames held back by the separation time and time out
+     * requests the ECUs haven't responded to (see
+     * diagnostic_process_request(...)), then resume any coroutines whose
+     * requests timed out.
+     *
+     * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE -
+     * sleep until then or until a frame arrives.
+     */
+    uint64_t process(uint64_t now) {
+        // timing out a request unlinks it, so don't walk the lists directly
+        processing_.clear();
+        for(auto& entry : physical_) {
+            collect(entry.second);
+        }
+        collect(functional_);
+
+        uint64_t deadline = DIAGNOSTIC_NO_DEADLINE;
+        for(Request* request : processing_) {
+            deadline = std::min(deadline, diagnostic_process_request(&shims_,
+                    &request->handle_, now));
+        }
+        processing_.clear();
+        resume_ready();
+        return deadline;
+    }
+
+    std::size_t in_progress() const { return in_progress_; }
+
+private:
+    friend class Request;
+
+    void link(Request* request) {
+        const DiagnosticAddress& address = request->handle_.address;
+        Request** head = diagnostic_addressing_is_functional(&address) ?
+                &functional_ : &physical_[address.response_id];
+        request->head_ = head;
+        request->previous_ = nullptr;
+        request->next_ = *head;
+        if(*head != nullptr) {
+            (*head)->previous_ = request;
+        }
+        *head = request;
+        ++in_progress_;
+    }
+
+    void unlink(Request* request) {
+        if(request->head_ == nullptr) {
+            return;
+        }
+
+        if(request->previous_ != nullptr) {
+            request->previous_->next_ = request->next_;
+        } else {
+            *request->head_ = request->next_;
+        }
+        if(request->next_ != nullptr) {
+            request->next_->previous_ = request->previous_;
+        }
+
+        if(*request->head_ == nullptr && request->head_ != &functional_) {
+            physical_.erase(request->handle_.address.response_id);
+        }
+        request->head_ = nullptr;
+        request->previous_ = request->next_ = nullptr;
+        --in_progress_;
+    }
+
+    // A completed physical request is already unlinked while it waits to be
+    // resumed, so this is separate from unlink(...).
+    void unready(Request* request) {
+        for(auto& waiting : ready_) {
+            if(waiting == request) {
+                waiting = ready_.back();
+                ready_.pop_back();
+                break;
+            }
+        }
+    }
+
+    // Swap a moved request in to the place of the original.
+    void relink(Request* from, Request* to) {
+        to->head_ = from->head_;
+        to->previous_ = from->previous_;
+        to->next_ = from->next_;
+        if(to->previous_ != nullptr) {
+            to->previous_->next_ = to;
+        } else if(to->head_ != nullptr) {
+            *to->head_ = to;
+        }
+        if(to->next_ != nullptr) {
+            to->next_->previous_ = to;
+        }
+
+        for(auto& waiting : ready_) {
+            if(waiting == from) {
+                waiting = to;
+            }
+        }
+        from->head_ = nullptr;
+        from->previous_ = from->next_ = nullptr;
+    }
+
+    void offer(Request* request, uint32_t arbitration_id,
+            std::span<const uint8_t> data) {
+        while(request != nullptr) {
+            // the handler may complete and unlink the request
+            Request* next = request->next_;
+            diagnostic_receive_can_frame(&shims_, &request->handle_,
+                    arbitration_id, data.data(), data.size());
+            request = next;
+        }
+    }
+
+    void continue_requests(Request* request) {
+        for(; request != nullptr; request = request->next_) {
+            diagnostic_continue_request(&shims_, &request->handle_);
+        }
+    }
+
+    void collect(Request* request) {
+        for(; request != nullptr; request = request->next_) {
+            processing_.push_back(request);
+        }
+    }
+
+    void resume_ready() {
+        while(!ready_.empty()) {
+            Request* request = ready_.back();
+            ready_.pop_back();
+            std::coroutine_handle<> waiter = std::exchange(request->waiter_,
+                    nullptr);
+            if(waiter) {
+                // may destroy any request, including this one
+                waiter.resume();
+            }
+        }
+    }
+
+    DiagnosticShims& shims_;
+    std::unordered_map<uint32_t, Request*> physical_;
+    Request* functional_ = nullptr;
+    std::vector<Request*> ready_;
+    std::vector<Request*> processing_;
+    std::size_t in_progress_ = 0;
+};
+
+inline Request::Request(Client& client, const DiagnosticRequest& request) :
+        client_(&client) {
+    DiagnosticRequest copy = request;
+    handle_ = generate_diagnostic_request(&client.shims_, &copy, nullptr);
+    handle_.handler = on_response;
+    handle_.context = this;
+    start_diagnostic_request(&client.shims_, &handle_);
+    if(handle_.completed) {
+        // not sent
+        DiagnosticResponse failed = {};
+        failed.completed = true;
+        failed.arbitration_id = handle_.address.request_id;
+        failed.mode = handle_.request.mode;
+        failed.timestamps = handle_.timestamps;
+        response_ = Response(failed);
+        responses_.push_back(response_);
+    } else {
+        client.link(this);
+    }
+}
+
+inline void Request::take(Request& other) noexcept {
+    client_ = std::exchange(other.client_, nullptr);
+    handle_ = other.handle_;
+    handle_.context = this;
+    response_ = std::move(other.response_);
+    responses_ = std::move(other.responses_);
+    waiter_ = std::exchange(other.waiter_, nullptr);
+    if(client_ != nullptr) {
+        client_->relink(&other, this);
+    }
+}
+
+inline void Request::release() noexcept {
+    if(client_ != nullptr) {
+        client_->unlink(this);
+        client_->unready(this);
+        diagnostic_request_release(&client_->shims_, &handle_);
+        client_ = nullptr;
+    }
+}
+
+inline void Request::ready() noexcept {
+    if(client_ != nullptr) {
+        // functional requests keep collecting responses from other ECUs
+        // until they're destroyed
+        if(!diagnostic_addressing_is_functional(&handle_.address)) {
+            client_->unlink(this);
+        }
+        client_->ready_.push_back(this);
+    }
+}
+
+/* Public: A minimal coroutine type for diagnostic flows - it starts running
+ * immediately, and its frame is freed when it finishes. There's no way to
+ * wait for a Task, so report results from inside it.
+ */
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+} // namespace uds
+
+#endif // __UDS_HPP__
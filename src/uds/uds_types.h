@@ -2,6 +2,7 @@
 #define __UDS_TYPES_H__
 
 #include <isotp/isotp.h>
+#include <uds/framing.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -15,6 +16,11 @@ extern "C" {
 #define MAX_UDS_REQUEST_PAYLOAD_LENGTH 7
 #define MAX_RESPONDING_ECU_COUNT 8
 #define VIN_LENGTH 17
+#define DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS 100
+#define DIAGNOSTIC_TRANSFER_TIMEOUT_MS 1000
+#define DIAGNOSTIC_RESPONSE_PENDING_TIMEOUT_MS 5000
+#define DIAGNOSTIC_BUSY_RETRY_COUNT 3
+#define DIAGNOSTIC_BUSY_RETRY_DELAY_MS 20
 
 /* Private: The four main types of diagnositc requests that determine how the
  * request should be parsed and what type of callback should be used.
@@ -48,6 +54,23 @@ typedef enum {
  *      size of the CAN message to only be the actual data. By default padding
  *      is enabled (so this struct value can default to 0).
  * type - the type of the request (TODO unused)
+ * target_address - (optional) With extended or mixed addressing, the target
+ *      address (or address extension) byte of the ECU. Together with the
+ *      arbitration_id, this selects the entry in the DiagnosticAddressingTable
+ *      (see uds/addressing.h).
+ * extended_payload - (optional) More payload to send after 'payload', for
+ *      requests that don't fit in MAX_UDS_REQUEST_PAYLOAD_LENGTH (e.g. a block
+ *      of a software download). Must stay valid until the request is sent.
+ * extended_payload_length - The length of extended_payload.
+ * response_buffer - (optional) Storage for reassembling responses longer than
+ *      MAX_UDS_RESPONSE_PAYLOAD_LENGTH. Must stay valid until the request is
+ *      completed.
+ * response_buffer_size - The size of response_buffer.
+ * timeout_ms - (optional) How long to wait for a response after the request is
+ *      sent before giving up. If 0, DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS is
+ *      used. Timeouts are only enforced by diagnostic_process_request(...).
+ *      After a responsePending (0x78) answer, the wait is at least
+ *      DIAGNOSTIC_RESPONSE_PENDING_TIMEOUT_MS.
  */
 typedef struct {
     uint32_t arbitration_id;
@@ -59,8 +82,60 @@ typedef struct {
     uint8_t payload_length;
     bool no_frame_padding;
     DiagnosticRequestType type;
+    uint8_t target_address;
+    const uint8_t* extended_payload;
+    uint32_t extended_payload_length;
+    uint8_t* response_buffer;
+    uint32_t response_buffer_size;
+    uint16_t timeout_ms;
 } DiagnosticRequest;
 
+/* Public: The ISO 15765-2 addressing formats.
+ *
+ * DIAGNOSTIC_ADDRESSING_NORMAL - The arbitration ID identifies the ECU, e.g.
+ *      the usual 11-bit OBD-II IDs.
+ * DIAGNOSTIC_ADDRESSING_NORMAL_FIXED - 29-bit IDs with the target and source
+ *      addresses in the two low bytes (0x18DA<target><source>, or 0x18DB for
+ *      functional requests).
+ * DIAGNOSTIC_ADDRESSING_EXTENDED - The first byte of each frame is the target
+ *      address, leaving one less byte for ISO-TP.
+ * DIAGNOSTIC_ADDRESSING_MIXED - The first byte of each frame is an address
+ *      extension.
+ */
+typedef enum {
+    DIAGNOSTIC_ADDRESSING_NORMAL,
+    DIAGNOSTIC_ADDRESSING_NORMAL_FIXED,
+    DIAGNOSTIC_ADDRESSING_EXTENDED,
+    DIAGNOSTIC_ADDRESSING_MIXED
+} DiagnosticAddressingMode;
+
+/* Public: How to reach one ECU (or a group of ECUs, for functional requests)
+ * and where to expect its responses.
+ *
+ * request_id - The arbitration ID requests are sent to.
+ * target_address - For extended and mixed addressing, the byte prepended to
+ *      every frame sent. Ignored otherwise.
+ * mode - The addressing format.
+ * response_id - The arbitration ID of the responses.
+ * response_mask - The bits of response_id that must match - all ones for a
+ *      single ECU, fewer for a functional request answered on a range of IDs
+ *      (e.g. 0x7f8 for 0x7e8-0x7ef).
+ * response_address - For extended and mixed addressing, the first byte
+ *      expected in every response frame. Ignored otherwise.
+ * frame_size - The largest frame the ECU accepts - 0 or 8 for classic CAN,
+ *      or a CAN FD frame length up to 64. Responses are accepted in frames of
+ *      any size.
+ */
+typedef struct {
+    uint32_t request_id;
+    uint8_t target_address;
+    DiagnosticAddressingMode mode;
+    uint32_t response_id;
+    uint32_t response_mask;
+    uint8_t response_address;
+    uint8_t frame_size;
+} DiagnosticAddress;
+
 /* Public: All possible negative response codes that could be received from a
  * requested node.
  *
@@ -75,6 +150,7 @@ typedef enum {
     NRC_SERVICE_NOT_SUPPORTED = 0x11,
     NRC_SUB_FUNCTION_NOT_SUPPORTED = 0x12,
     NRC_INCORRECT_LENGTH_OR_FORMAT = 0x13,
+    NRC_BUSY_REPEAT_REQUEST = 0x21,
     NRC_CONDITIONS_NOT_CORRECT = 0x22,
     NRC_REQUEST_OUT_OF_RANGE = 0x31,
     NRC_SECURITY_ACCESS_DENIED = 0x33,
@@ -84,6 +160,35 @@ typedef enum {
     NRC_RESPONSE_PENDING = 0x78
 } DiagnosticNegativeResponseCode;
 
+/* Public: The signature for an optional function that returns the current time
+ * from a monotonic clock, in microseconds.
+ *
+ * The epoch doesn't matter, only that the value never goes backwards. A value
+ * of 0 is reserved to mean "not recorded".
+ */
+typedef uint64_t (*GetTimeShim)(void);
+
+/* Public: The points in the life of a diagnostic request that are stamped
+ * with the time from the optional GetTimeShim. Any field that has not been
+ * reached yet (or if there is no clock) is 0.
+ *
+ * queued - The request handle was generated.
+ * first_frame_sent - The first CAN frame of the request was sent.
+ * last_frame_sent - The last CAN frame of the request was sent. For a single
+ *      frame request this is the same as first_frame_sent.
+ * first_response_frame - The first CAN frame was received on one of the
+ *      expected response arbitration IDs.
+ * completed - The request was completed, either by a response or by a
+ *      failure to send.
+ */
+typedef struct {
+    uint64_t queued;
+    uint64_t first_frame_sent;
+    uint64_t last_frame_sent;
+    uint64_t first_response_frame;
+    uint64_t completed;
+} DiagnosticTimestamps;
+
 /* Public: A partially or fully completed response to a diagnostic request.
  *
  * completed - True if the request is complete - some functions return a
@@ -105,6 +210,14 @@ typedef enum {
  *      by the other node.
  * payload - An optional payload for the response - NULL if no payload.
  * payload_length - The length of the payload or 0 if none.
+ * extended_payload - If the payload was longer than
+ *      MAX_UDS_RESPONSE_PAYLOAD_LENGTH, the whole payload (in the request's
+ *      response_buffer) - 'payload' only has the start of it. NULL otherwise.
+ * extended_payload_length - The length of extended_payload.
+ * timestamps - The timestamps of the request this is a response to, where
+ *      'completed' is the time this particular response was completed.
+ * timed_out - True if the request was completed (without success) because no
+ *      response arrived before its timeout.
  */
 typedef struct {
     bool completed;
@@ -117,8 +230,22 @@ typedef struct {
     DiagnosticNegativeResponseCode negative_response_code;
     uint8_t payload[MAX_UDS_RESPONSE_PAYLOAD_LENGTH];
     uint8_t payload_length;
+    DiagnosticTimestamps timestamps;
+    const uint8_t* extended_payload;
+    uint32_t extended_payload_length;
+    bool timed_out;
 } DiagnosticResponse;
 
+/* Public: A number in fixed-point, for decoding on targets without an FPU.
+ *
+ * value - The value, scaled - the number is value * 10^exponent.
+ * exponent - The decimal exponent, e.g. -2 for hundredths.
+ */
+typedef struct {
+    int32_t value;
+    int8_t exponent;
+} DiagnosticFixedPoint;
+
 /* Public: Friendly names for all OBD-II modes.
  */
 typedef enum {
@@ -145,6 +272,57 @@ typedef enum {
  */
 typedef void (*DiagnosticResponseReceived)(const DiagnosticResponse* response);
 
+/* Public: Like DiagnosticResponseReceived, but also given the context pointer
+ * from the request handle - e.g. the object waiting for the response.
+ *
+ * response - the completed DiagnosticResponse.
+ * context - the 'context' field of the DiagnosticRequestHandle.
+ */
+typedef void (*DiagnosticResponseHandler)(const DiagnosticResponse* response,
+        void* context);
+
+/* Public: Part of a multi-frame response, as it arrives.
+ *
+ * arbitration_id - The arbitration ID of the frame.
+ * offset - Where the data starts in the whole response message, which begins
+ *      with the response SID.
+ * data - The bytes - only valid during the callback.
+ * length - The length of data.
+ * total_length - The length of the whole response message.
+ */
+typedef struct {
+    uint32_t arbitration_id;
+    uint32_t offset;
+    const uint8_t* data;
+    uint8_t length;
+    uint32_t total_length;
+} DiagnosticResponseChunk;
+
+/* Public: The signature for a function that handles the parts of a
+ * multi-frame response as each frame arrives.
+ *
+ * context - the 'context' field of the DiagnosticRequestHandle.
+ */
+typedef void (*DiagnosticResponseChunkHandler)(
+        const DiagnosticResponseChunk* chunk, void* context);
+
+typedef void (*DiagnosticMilStatusReceived)(bool malfunction_indicator_status);
+// The VIN is NUL-terminated. For the VIN, CALIDs and CVNs of every ECU in one
+// pass, see uds/vehicle_info.h.
+typedef void (*DiagnosticVinReceived)(uint8_t vin[]);
+
+/* Private: The callbacks of the requests in uds/extras.h, which don't take a
+ * context - kept in the handle with their own types, and called by a typed
+ * handler when the request completes.
+ */
+typedef union {
+    DiagnosticMilStatusReceived mil_status;
+    DiagnosticVinReceived vin;
+} DiagnosticTypedCallback;
+
+typedef void (*DiagnosticTypedResponseHandler)(
+        const DiagnosticResponse* response, DiagnosticTypedCallback callback);
+
 /* Public: A handle for initiating and continuing a single diagnostic request.
  *
  * A diagnostic request requires one or more CAN messages to be sent, and one
@@ -157,22 +335,66 @@ typedef void (*DiagnosticResponseReceived)(const DiagnosticResponse* response);
  *      cancelled.
  * success - True if the request send and receive process was successful. The
  *      value if this field isn't valid if 'completed' isn't true.
+ * timestamps - The progress of the request, if a GetTimeShim is available.
+ * handler - (optional) Called along with the callback when the request is
+ *      completed, with the context. Assign it after generating the request.
+ * context - (optional) Passed to the handler.
+ * chunk_handler - (optional) Called with the data of each frame of a
+ *      multi-frame response as it arrives, with the context, so it can be
+ *      used before the rest comes. Assign it after generating the request and
+ *      before starting it. Responses longer than the reassembly buffer (see
+ *      response_buffer) are then accepted, with only their start in the
+ *      completed response.
  */
 typedef struct {
     DiagnosticRequest request;
     bool success;
     bool completed;
+    DiagnosticTimestamps timestamps;
+    DiagnosticResponseHandler handler;
+    void* context;
+    DiagnosticResponseChunkHandler chunk_handler;
 
     // Private
     IsoTpShims isotp_shims;
     IsoTpSendHandle isotp_send_handle;
     IsoTpReceiveHandle isotp_receive_handles[MAX_RESPONDING_ECU_COUNT];
+    uint32_t response_ids[MAX_RESPONDING_ECU_COUNT];
     uint8_t isotp_receive_handle_count;
+    DiagnosticAddress address;
+    bool receiving;
+    bool framed;
+    uint8_t request_header[3 + MAX_UDS_REQUEST_PAYLOAD_LENGTH];
+    DiagnosticFrameSender frame_sender;
+    DiagnosticFrameReceiver frame_receiver;
+    uint32_t framed_response_id;
+    uint64_t next_frame_time;
+    bool frame_queued;
+    uint32_t timeout_us;
+    uint64_t timeout_deadline;
+    bool response_pending;
+    bool retry_pending;
+    uint8_t retries;
+    uint8_t framing_buffer[MAX_UDS_RESPONSE_PAYLOAD_LENGTH];
     DiagnosticResponseReceived callback;
-    // DiagnosticMilStatusReceived mil_status_callback;
-    // DiagnosticVinReceived vin_callback;
+    bool filter_registered;
+    DiagnosticTypedResponseHandler typed_handler;
+    DiagnosticTypedCallback typed_callback;
 } DiagnosticRequestHandle;
 
+/* Private: A handle reused for one request after another, by the modules
+ * that run a series of requests to an ECU (see uds/request_driver.h).
+ *
+ * response_received - True if the request has completed, until the module
+ *      has handled the response.
+ * response - The response, kept until the module handles it.
+ */
+typedef struct {
+    DiagnosticRequestHandle handle;
+    bool response_received;
+    DiagnosticResponse response;
+} DiagnosticRequestDriver;
+
 /* Public: The two major types of PIDs that determine the OBD-II mode and PID
  * field length.
  */
@@ -181,16 +403,83 @@ typedef enum {
     DIAGNOSTIC_ENHANCED_PID
 } DiagnosticPidRequestType;
 
-/* Public: A container for the 3 shim functions used by the library to interact
+typedef struct DiagnosticLatencyStats DiagnosticLatencyStats;
+typedef struct DiagnosticCounters DiagnosticCounters;
+typedef struct DiagnosticTraceRecorder DiagnosticTraceRecorder;
+typedef struct DiagnosticAcceptFilter DiagnosticAcceptFilter;
+typedef struct DiagnosticAddressingTable DiagnosticAddressingTable;
+typedef struct DiagnosticTxQueue DiagnosticTxQueue;
+
+/* Public: The signature for a function that sends a whole UDS message (the
+ * service ID first) over a message-based transport.
+ *
+ * The message is given in two parts, so a long request's extended_payload
+ * doesn't have to be copied behind its header.
+ *
+ * address - The addressing of the request - request_id says which ECU.
+ * header - The service ID, the PID and any short payload.
+ * header_length - The length of the header.
+ * body - The request's extended_payload, or NULL.
+ * body_length - The length of the body.
+ * context - The transport's context.
+ *
+ * Returns true if the message was sent.
+ */
+typedef bool (*DiagnosticTransportSendShim)(const DiagnosticAddress* address,
+        const uint8_t* header, uint8_t header_length, const uint8_t* body,
+        uint32_t body_length, void* context);
+
+/* Public: A transport that carries whole UDS messages, like DoIP over TCP,
+ * in place of ISO-TP on CAN. See uds/doip.h.
+ *
+ * Requests are sent with 'send' in one piece, and responses are passed to
+ * diagnostic_receive_message(...) in one piece, so there's no segmentation,
+ * flow control or separation time and no limit on the length of either.
+ *
+ * send - Sends a request.
+ * context - Passed to send.
+ */
+typedef struct {
+    DiagnosticTransportSendShim send;
+    void* context;
+} DiagnosticTransport;
+
+/* Public: A container for the shim functions used by the library to interact
  * with the wider system.
  *
  * Use the diagnostic_init_shims(...) function to create an instance of this
- * struct.
+ * struct. The optional fields below are left NULL by diagnostic_init_shims and
+ * may be assigned afterwards.
+ *
+ * get_time - (optional) A monotonic clock, used to timestamp requests.
+ * latency_stats - (optional) If set along with get_time, the round trip
+ *      latency of every response is recorded here. See uds/latency.h.
+ * counters - (optional) Runtime counters updated as frames are sent and
+ *      received. See uds/counters.h.
+ * trace - (optional) Captures the frames sent and received to a binary log.
+ *      See uds/trace.h.
+ * filter - (optional) Kept up to date with the arbitration IDs of responses
+ *      to requests in progress, to reject unrelated frames quickly. See
+ *      uds/filter.h.
+ * addressing - (optional) Maps request arbitration IDs to response IDs for
+ *      ECUs that don't follow the defaults. See uds/addressing.h.
+ * transport - (optional) Sends requests as whole messages instead of ISO-TP
+ *      frames with send_can_message.
+ * tx_queue - (optional) Holds frames send_can_message can't take yet, instead
+ *      of failing their requests. See uds/tx_queue.h.
  */
 typedef struct {
     LogShim log;
     SendCanMessageShim send_can_message;
     SetTimerShim set_timer;
+    GetTimeShim get_time;
+    DiagnosticLatencyStats* latency_stats;
+    DiagnosticCounters* counters;
+    DiagnosticTraceRecorder* trace;
+    DiagnosticAcceptFilter* filter;
+    DiagnosticAddressingTable* addressing;
+    DiagnosticTransport* transport;
+    DiagnosticTxQueue* tx_queue;
 } DiagnosticShims;
 
 #ifdef __cplusplus
@@ -0,0 +1,286 @@
+#include <uds/vehicle_info.h>
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <uds/bytes.h>
+#include <string.h>
+#include <sys/param.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+// InfoTypes 0x01-0x1f fit in the mask - 0x20 would need a 33rd bit.
+#define HIGHEST_INFO_TYPE 0x1f
+
+static void copy_string(char* destination, const uint8_t* source,
+        size_t length) {
+    memcpy(destination, source, length);
+    destination[length] = '\0';
+}
+
+// The supported InfoTypes come as a 32-bit big-endian field, with the most
+// significant bit for InfoType 0x01.
+static bool decode_supported(DiagnosticVehicleInfo* info,
+        const uint8_t* payload, uint32_t payload_length) {
+    if(payload_length < 4) {
+        return false;
+    }
+
+    uint32_t field = diagnostic_read_uint32(payload);
+    uint8_t info_type;
+    info->supported = 0;
+    for(info_type = 1; info_type <= HIGHEST_INFO_TYPE; ++info_type) {
+        if(field & (1UL << (32 - info_type))) {
+            info->supported |= DIAGNOSTIC_INFO_TYPE_BIT(info_type);
+        }
+    }
+    return true;
+}
+
+bool diagnostic_vehicle_info_decode(DiagnosticVehicleInfo* info,
+        uint8_t info_type, const uint8_t* payload, uint32_t payload_length) {
+    if(info_type == DIAGNOSTIC_INFO_TYPE_SUPPORTED) {
+        return decode_supported(info, payload, payload_length);
+    }
+
+    // everything else starts with the number of data items
+    if(payload_length < 1) {
+        return false;
+    }
+    uint8_t item_count = payload[0];
+    const uint8_t* data = &payload[1];
+    uint32_t length = payload_length - 1;
+    uint8_t i;
+
+    switch(info_type) {
+        case DIAGNOSTIC_INFO_TYPE_VIN:
+            if(length < DIAGNOSTIC_VIN_LENGTH) {
+                return false;
+            }
+            // some ECUs pad the front of the VIN
+            copy_string(info->vin, &data[length - DIAGNOSTIC_VIN_LENGTH],
+                    DIAGNOSTIC_VIN_LENGTH);
+            break;
+        case DIAGNOSTIC_INFO_TYPE_CALIBRATION_ID:
+            info->calibration_id_count = MIN(MIN(item_count,
+                    length / DIAGNOSTIC_CALIBRATION_ID_LENGTH),
+                    DIAGNOSTIC_MAX_CALIBRATIONS);
+            for(i = 0; i < info->calibration_id_count; ++i) {
+                copy_string(info->calibration_ids[i],
+                        &data[i * DIAGNOSTIC_CALIBRATION_ID_LENGTH],
+                        DIAGNOSTIC_CALIBRATION_ID_LENGTH);
+            }
+            if(info->calibration_id_count == 0) {
+                return false;
+            }
+            break;
+        case DIAGNOSTIC_INFO_TYPE_CVN:
+            info->cvn_count = MIN(MIN(item_count, length / 4),
+                    DIAGNOSTIC_MAX_CALIBRATIONS);
+            diagnostic_read_uint32_array(data, info->cvns, info->cvn_count);
+            if(info->cvn_count == 0) {
+                return false;
+            }
+            break;
+        case DIAGNOSTIC_INFO_TYPE_SPARK_PERFORMANCE_TRACKING:
+        case DIAGNOSTIC_INFO_TYPE_COMPRESSION_PERFORMANCE_TRACKING:
+            info->performance_tracking_count = MIN(MIN(item_count,
+                    length / 2), DIAGNOSTIC_MAX_PERFORMANCE_COUNTERS);
+            diagnostic_read_uint16_array(data, info->performance_tracking,
+                    info->performance_tracking_count);
+            if(info->performance_tracking_count == 0) {
+                return false;
+            }
+            break;
+        case DIAGNOSTIC_INFO_TYPE_ECU_NAME:
+            if(length < DIAGNOSTIC_ECU_NAME_LENGTH) {
+                return false;
+            }
+            copy_string(info->ecu_name, data, DIAGNOSTIC_ECU_NAME_LENGTH);
+            break;
+        default:
+            return false;
+    }
+
+    info->collected |= DIAGNOSTIC_INFO_TYPE_BIT(info_type);
+    return true;
+}
+
+static void decode_response(const DiagnosticResponse* response,
+        void* context) {
+    DiagnosticVehicleInfo* info = (DiagnosticVehicleInfo*) context;
+    if(response->success) {
+        const uint8_t* payload = response->extended_payload != NULL ?
+                response->extended_payload : response->payload;
+        uint32_t payload_length = response->extended_payload != NULL ?
+                response->extended_payload_length : response->payload_length;
+        diagnostic_vehicle_info_decode(info, response->pid, payload,
+                payload_length);
+    }
+}
+
+// Send the request for the ECU's next InfoType, skipping any that can't be
+// sent. The ECU is done once there are none left.
+static void request_next(DiagnosticVehicleInfo* info) {
+    DiagnosticVehicleInfoCollector* collector = info->collector;
+    while(info->remaining != 0) {
+        uint8_t info_type = __builtin_ctzl(info->remaining);
+        info->remaining &= ~DIAGNOSTIC_INFO_TYPE_BIT(info_type);
+
+        DiagnosticRequest request = {
+            arbitration_id: info->request_id,
+            mode: OBD2_MODE_VEHICLE_INFORMATION,
+            has_pid: true,
+            pid: info_type,
+            pid_length: 1
+        };
+        info->handle = generate_diagnostic_request(collector->shims, &request,
+                NULL);
+        info->handle.handler = decode_response;
+        info->handle.context = info;
+        start_diagnostic_request(collector->shims, &info->handle);
+        if(!info->handle.completed) {
+            return;
+        }
+    }
+
+    info->active = false;
+    if(collector->received != NULL) {
+        collector->received(info, collector->context);
+    }
+}
+
+static DiagnosticVehicleInfo* find_ecu(
+        DiagnosticVehicleInfoCollector* collector, uint32_t response_id) {
+    uint8_t i;
+    for(i = 0; i < collector->ecu_count; ++i) {
+        if(collector->ecus[i].response_id == response_id) {
+            return &collector->ecus[i];
+        }
+    }
+    return NULL;
+}
+
+// Each ECU that answers the functional request starts on its own InfoTypes
+// right away, without waiting for the others.
+static void add_ecu(const DiagnosticResponse* response, void* context) {
+    DiagnosticVehicleInfoCollector* collector =
+            (DiagnosticVehicleInfoCollector*) context;
+    if(!response->success || find_ecu(collector,
+                response->arbitration_id) != NULL ||
+            collector->ecu_count >= DIAGNOSTIC_VEHICLE_INFO_MAX_ECUS) {
+        return;
+    }
+
+    DiagnosticVehicleInfo* info = &collector->ecus[collector->ecu_count];
+    memset(info, 0, sizeof(*info));
+    if(!decode_supported(info, response->payload, response->payload_length)) {
+        return;
+    }
+    ++collector->ecu_count;
+
+    DiagnosticAddress address = diagnostic_addressing_resolve(
+            collector->shims->addressing,
+            collector->discovery.request.arbitration_id, 0);
+    info->collector = collector;
+    info->request_id = diagnostic_addressing_flow_control_id(&address,
+            response->arbitration_id);
+    info->response_id = response->arbitration_id;
+    info->remaining = info->supported & collector->info_types;
+    info->active = true;
+    request_next(info);
+}
+
+void diagnostic_vehicle_info_collector_init(
+        DiagnosticVehicleInfoCollector* collector, DiagnosticShims* shims,
+        DiagnosticVehicleInfoReceived received, void* context) {
+    memset(collector, 0, sizeof(*collector));
+    collector->shims = shims;
+    collector->received = received;
+    collector->context = context;
+    collector->info_types = DIAGNOSTIC_DEFAULT_INFO_TYPES;
+    collector->discovery.completed = true;
+}
+
+bool diagnostic_vehicle_info_collect(DiagnosticVehicleInfoCollector* collector,
+        uint32_t functional_id) {
+    uint8_t i;
+    for(i = 0; i < collector->ecu_count; ++i) {
+        if(collector->ecus[i].active) {
+            diagnostic_request_release(collector->shims,
+                    &collector->ecus[i].handle);
+        }
+    }
+    diagnostic_request_release(collector->shims, &collector->discovery);
+    collector->ecu_count = 0;
+
+    DiagnosticRequest request = {
+        arbitration_id: functional_id,
+        mode: OBD2_MODE_VEHICLE_INFORMATION,
+        has_pid: true,
+        pid: DIAGNOSTIC_INFO_TYPE_SUPPORTED,
+        pid_length: 1
+    };
+    collector->discovery = generate_diagnostic_request(collector->shims,
+            &request, NULL);
+    collector->discovery.handler = add_ecu;
+    collector->discovery.context = collector;
+    start_diagnostic_request(collector->shims, &collector->discovery);
+    return !collector->discovery.completed;
+}
+
+void diagnostic_vehicle_info_receive_can_frame(
+        DiagnosticVehicleInfoCollector* collector,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    // an ECU that's already answered the functional request is only listened
+    // to by its own request, so only one flow control frame is sent
+    DiagnosticVehicleInfo* info = find_ecu(collector, arbitration_id);
+    if(info == NULL) {
+        diagnostic_receive_can_frame(collector->shims, &collector->discovery,
+                arbitration_id, data, size);
+    } else if(info->active) {
+        diagnostic_receive_can_frame(collector->shims, &info->handle,
+                arbitration_id, data, size);
+        if(info->handle.completed) {
+            request_next(info);
+        }
+    }
+}
+
+uint64_t diagnostic_vehicle_info_process(
+        DiagnosticVehicleInfoCollector* collector, uint64_t now) {
+    uint64_t deadline = diagnostic_process_request(collector->shims,
+            &collector->discovery, now);
+    uint8_t i;
+    for(i = 0; i < collector->ecu_count; ++i) {
+        DiagnosticVehicleInfo* info = &collector->ecus[i];
+        if(info->active) {
+            diagnostic_process_request(collector->shims, &info->handle, now);
+            if(info->handle.completed) {
+                request_next(info);
+            }
+        }
+        if(info->active) {
+            deadline = MIN(deadline,
+                    diagnostic_request_deadline(&info->handle));
+        }
+    }
+    return deadline;
+}
+
+bool diagnostic_vehicle_info_finished(
+        const DiagnosticVehicleInfoCollector* collector) {
+    if(diagnostic_request_deadline(&collector->discovery) !=
+            DIAGNOSTIC_NO_DEADLINE) {
+        return false;
+    }
+
+    uint8_t i;
+    for(i = 0; i < collector->ecu_count; ++i) {
+        if(collector->ecus[i].active) {
+            return false;
+        }
+    }
+    return true;
+}
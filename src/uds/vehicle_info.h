@@ -0,0 +1,179 @@
+#ifndef __UDS_VEHICLE_INFO_H__
+#define __UDS_VEHICLE_INFO_H__
+
+#include <uds/uds_types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DIAGNOSTIC_VEHICLE_INFO_MAX_ECUS
+#define DIAGNOSTIC_VEHICLE_INFO_MAX_ECUS 8
+#endif
+
+#ifndef DIAGNOSTIC_MAX_CALIBRATIONS
+#define DIAGNOSTIC_MAX_CALIBRATIONS 4
+#endif
+
+#define DIAGNOSTIC_MAX_PERFORMANCE_COUNTERS 20
+
+#define DIAGNOSTIC_VIN_LENGTH 17
+#define DIAGNOSTIC_CALIBRATION_ID_LENGTH 16
+#define DIAGNOSTIC_ECU_NAME_LENGTH 20
+
+// Mode 0x09 InfoTypes
+#define DIAGNOSTIC_INFO_TYPE_SUPPORTED 0x0
+#define DIAGNOSTIC_INFO_TYPE_VIN 0x2
+#define DIAGNOSTIC_INFO_TYPE_CALIBRATION_ID 0x4
+#define DIAGNOSTIC_INFO_TYPE_CVN 0x6
+#define DIAGNOSTIC_INFO_TYPE_SPARK_PERFORMANCE_TRACKING 0x8
+#define DIAGNOSTIC_INFO_TYPE_ECU_NAME 0xa
+#define DIAGNOSTIC_INFO_TYPE_COMPRESSION_PERFORMANCE_TRACKING 0xb
+
+// The bit for an InfoType in a mask of them.
+#define DIAGNOSTIC_INFO_TYPE_BIT(info_type) (1UL << (info_type))
+
+#define DIAGNOSTIC_DEFAULT_INFO_TYPES ( \
+        DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_VIN) | \
+        DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_CALIBRATION_ID) | \
+        DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_CVN) | \
+        DIAGNOSTIC_INFO_TYPE_BIT( \
+            DIAGNOSTIC_INFO_TYPE_SPARK_PERFORMANCE_TRACKING) | \
+        DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_ECU_NAME) | \
+        DIAGNOSTIC_INFO_TYPE_BIT( \
+            DIAGNOSTIC_INFO_TYPE_COMPRESSION_PERFORMANCE_TRACKING))
+
+typedef struct DiagnosticVehicleInfoCollector DiagnosticVehicleInfoCollector;
+
+/* Public: The vehicle information (mode 0x09) read from one ECU, decoded.
+ * Strings are NUL-terminated, and keep any padding the ECU sent.
+ *
+ * request_id - The physical arbitration ID of the ECU.
+ * response_id - The arbitration ID the ECU answers on.
+ * supported - A mask of DIAGNOSTIC_INFO_TYPE_BIT(...) for each InfoType from
+ *      0x01 to 0x1f the ECU supports.
+ * collected - A mask of the InfoTypes that were read and decoded.
+ * vin - The vehicle identification number (InfoType 0x02).
+ * calibration_ids - The calibration IDs (InfoType 0x04).
+ * calibration_id_count - The number of calibration IDs read.
+ * cvns - The calibration verification numbers (InfoType 0x06).
+ * cvn_count - The number of CVNs read.
+ * ecu_name - The ECU name (InfoType 0x0a), usually an acronym and a name.
+ * performance_tracking - The in-use performance tracking counters (InfoType
+ *      0x08 for spark ignition, or 0x0b for compression ignition).
+ * performance_tracking_count - The number of counters read.
+ */
+typedef struct {
+    uint32_t request_id;
+    uint32_t response_id;
+    uint32_t supported;
+    uint32_t collected;
+    char vin[DIAGNOSTIC_VIN_LENGTH + 1];
+    char calibration_ids[DIAGNOSTIC_MAX_CALIBRATIONS][
+            DIAGNOSTIC_CALIBRATION_ID_LENGTH + 1];
+    uint8_t calibration_id_count;
+    uint32_t cvns[DIAGNOSTIC_MAX_CALIBRATIONS];
+    uint8_t cvn_count;
+    char ecu_name[DIAGNOSTIC_ECU_NAME_LENGTH + 1];
+    uint16_t performance_tracking[DIAGNOSTIC_MAX_PERFORMANCE_COUNTERS];
+    uint8_t performance_tracking_count;
+
+    // Private
+    DiagnosticVehicleInfoCollector* collector;
+    DiagnosticRequestHandle handle;
+    uint32_t remaining;
+    bool active;
+} DiagnosticVehicleInfo;
+
+/* Public: The signature for a function called when an ECU's information has
+ * all been read (or given up on).
+ */
+typedef void (*DiagnosticVehicleInfoReceived)(
+        const DiagnosticVehicleInfo* info, void* context);
+
+/* Public: Reads vehicle information from every emission-relevant ECU in one
+ * pass.
+ *
+ * A single functional request for the supported InfoTypes finds the ECUs.
+ * Each ECU is then sent physical requests for the InfoTypes it supports, one
+ * after another as the answers arrive, with all of the ECUs read in
+ * parallel - so the whole check-in takes about as long as the slowest ECU's
+ * answers, instead of a functional request and timeout per InfoType.
+ *
+ * Use diagnostic_vehicle_info_collector_init(...) to create an instance. It
+ * must not move while collecting.
+ *
+ * info_types - A mask of DIAGNOSTIC_INFO_TYPE_BIT(...) for the InfoTypes to
+ *      read - DIAGNOSTIC_DEFAULT_INFO_TYPES unless changed.
+ * ecus - The ECUs that answered, in the order they answered.
+ * ecu_count - The number of ECUs that answered.
+ */
+struct DiagnosticVehicleInfoCollector {
+    DiagnosticShims* shims;
+    DiagnosticVehicleInfoReceived received;
+    void* context;
+    uint32_t info_types;
+    DiagnosticVehicleInfo ecus[DIAGNOSTIC_VEHICLE_INFO_MAX_ECUS];
+    uint8_t ecu_count;
+
+    // Private
+    DiagnosticRequestHandle discovery;
+};
+
+/* Public: Initialize a collector.
+ *
+ * received - (optional) Called as each ECU's information is complete, with
+ *      the context.
+ */
+void diagnostic_vehicle_info_collector_init(
+        DiagnosticVehicleInfoCollector* collector, DiagnosticShims* shims,
+        DiagnosticVehicleInfoReceived received, void* context);
+
+/* Public: Start collecting, forgetting any ECUs read before.
+ *
+ * functional_id - The functional arbitration ID to find the ECUs with, e.g.
+ *      OBD2_FUNCTIONAL_BROADCAST_ID or 0x18db33f1.
+ *
+ * Returns false if the first request couldn't be sent.
+ */
+bool diagnostic_vehicle_info_collect(DiagnosticVehicleInfoCollector* collector,
+        uint32_t functional_id);
+
+/* Public: Pass a received CAN frame to the collector.
+ */
+void diagnostic_vehicle_info_receive_can_frame(
+        DiagnosticVehicleInfoCollector* collector,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size);
+
+/* Public: Finish the search for ECUs and time out silent ones - see
+ * diagnostic_process_request(...).
+ *
+ * Returns the time this should next be called, or DIAGNOSTIC_NO_DEADLINE
+ * once everything has been collected.
+ */
+uint64_t diagnostic_vehicle_info_process(
+        DiagnosticVehicleInfoCollector* collector, uint64_t now);
+
+/* Public: Returns true once no more ECUs are expected to answer and every
+ * ECU's information has been read.
+ */
+bool diagnostic_vehicle_info_finished(
+        const DiagnosticVehicleInfoCollector* collector);
+
+/* Public: Decode the payload of a mode 0x09 response (after the InfoType) in
+ * to an ECU's information.
+ *
+ * Returns false if the InfoType isn't one that's decoded, or the payload is
+ * too short for it.
+ */
+bool diagnostic_vehicle_info_decode(DiagnosticVehicleInfo* info,
+        uint8_t info_type, const uint8_t* payload, uint32_t payload_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UDS_VEHICLE_INFO_H__
@@ -15,6 +15,8 @@ bool can_frame_was_sent;
 DiagnosticResponse last_response_received;
 bool last_response_was_received;
 
+uint64_t mock_time_us;
+
 void debug(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -34,10 +36,15 @@ bool mock_send_can(const uint32_t arbitration_id, const uint8_t* data,
     return true;
 }
 
+uint64_t mock_get_time() {
+    return mock_time_us;
+}
+
 void setup() {
     SHIMS = diagnostic_init_shims(debug, mock_send_can, NULL);
     memset(last_can_payload_sent, 0, sizeof(last_can_payload_sent));
     can_frame_was_sent = false;
     last_response_was_received = false;
+    mock_time_us = 1;
 }
 
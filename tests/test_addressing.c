@@ -0,0 +1,277 @@
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <uds/filter.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern uint8_t last_can_payload_size;
+
+DiagnosticAddressingTable table;
+uint8_t responses_received;
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+    ++responses_received;
+}
+
+void setup_addressing() {
+    setup();
+    diagnostic_addressing_reset(&table);
+    SHIMS.addressing = &table;
+    responses_received = 0;
+}
+
+START_TEST (test_default_addressing)
+{
+    DiagnosticAddress address = diagnostic_addressing_default(0x7e0);
+    ck_assert_int_eq(address.mode, DIAGNOSTIC_ADDRESSING_NORMAL);
+    ck_assert_int_eq(address.response_id, 0x7e8);
+    ck_assert(!diagnostic_addressing_is_functional(&address));
+    ck_assert_int_eq(diagnostic_addressing_flow_control_id(&address, 0x7e8),
+            0x7e0);
+
+    address = diagnostic_addressing_default(OBD2_FUNCTIONAL_BROADCAST_ID);
+    ck_assert(diagnostic_addressing_is_functional(&address));
+    ck_assert_int_eq(diagnostic_addressing_flow_control_id(&address, 0x7eb),
+            0x7e3);
+
+    address = diagnostic_addressing_default(0x18da10f1);
+    ck_assert_int_eq(address.mode, DIAGNOSTIC_ADDRESSING_NORMAL_FIXED);
+    ck_assert_int_eq(address.response_id, 0x18daf110);
+    ck_assert(!diagnostic_addressing_is_functional(&address));
+
+    address = diagnostic_addressing_default(0x18db33f1);
+    ck_assert_int_eq(address.mode, DIAGNOSTIC_ADDRESSING_NORMAL_FIXED);
+    ck_assert_int_eq(address.response_id, 0x18daf100);
+    ck_assert_int_eq(address.response_mask, 0x1fffff00);
+    ck_assert(diagnostic_addressing_is_functional(&address));
+    ck_assert_int_eq(diagnostic_addressing_flow_control_id(&address,
+                0x18daf117), 0x18da17f1);
+}
+END_TEST
+
+START_TEST (test_table_lookup)
+{
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_ADDRESSING_MAX_ENTRIES; ++i) {
+        DiagnosticAddress address = {
+            request_id: 0x6f1,
+            target_address: i,
+            mode: DIAGNOSTIC_ADDRESSING_EXTENDED,
+            response_id: 0x600 + i,
+            response_mask: 0x1fffffff,
+            response_address: 0xf1
+        };
+        ck_assert(diagnostic_addressing_add(&table, &address));
+    }
+
+    DiagnosticAddress extra = {request_id: 0x123};
+    ck_assert(!diagnostic_addressing_add(&table, &extra));
+
+    for(i = 0; i < DIAGNOSTIC_ADDRESSING_MAX_ENTRIES; ++i) {
+        const DiagnosticAddress* address = diagnostic_addressing_lookup(
+                &table, 0x6f1, i);
+        ck_assert(address != NULL);
+        ck_assert_int_eq(address->response_id, 0x600 + i);
+    }
+    ck_assert(diagnostic_addressing_lookup(&table, 0x6f2, 0) == NULL);
+
+    DiagnosticAddress replacement = diagnostic_addressing_default(0x6f1);
+    replacement.target_address = 3;
+    replacement.response_id = 0x700;
+    ck_assert(diagnostic_addressing_add(&table, &replacement));
+    ck_assert_int_eq(table.count, DIAGNOSTIC_ADDRESSING_MAX_ENTRIES);
+    ck_assert_int_eq(diagnostic_addressing_lookup(&table, 0x6f1,
+                3)->response_id, 0x700);
+}
+END_TEST
+
+START_TEST (test_normal_fixed_physical_request)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x18da10f1,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x18da10f1);
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18da10f1 + 0x8,
+            can_data, sizeof(can_data));
+    ck_assert(!last_response_was_received);
+
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18daf110, can_data,
+            sizeof(can_data));
+    ck_assert(last_response_was_received);
+    ck_assert_int_eq(last_response_received.arbitration_id, 0x18daf110);
+    ck_assert(last_response_received.success);
+}
+END_TEST
+
+START_TEST (test_normal_fixed_functional_request)
+{
+    DiagnosticAcceptFilter filter;
+    diagnostic_filter_reset(&filter);
+    SHIMS.filter = &filter;
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x18db33f1,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x18daf1a5));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x18daf2a5));
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18daf210, can_data,
+            sizeof(can_data));
+    ck_assert_int_eq(responses_received, 0);
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18daf110, can_data,
+            sizeof(can_data));
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18daf1a5, can_data,
+            sizeof(can_data));
+    ck_assert_int_eq(responses_received, 2);
+    ck_assert_int_eq(last_response_received.arbitration_id, 0x18daf1a5);
+
+    diagnostic_request_release(&SHIMS, &handle);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x18daf1a5));
+}
+END_TEST
+
+START_TEST (test_flow_control_to_physical_id)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x18db33f1,
+        mode: OBD2_MODE_VEHICLE_INFORMATION,
+        has_pid: true,
+        pid: 0x2
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    const uint8_t first_frame[] = {0x10, 0x14, 0x49, 0x2, 0x1, 'W', 'A',
+            'U'};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x18daf117, first_frame,
+            sizeof(first_frame));
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x18da17f1);
+    ck_assert_int_eq(last_can_payload_sent[0] >> 4, 0x3);
+}
+END_TEST
+
+START_TEST (test_extended_addressing)
+{
+    DiagnosticAddress address = {
+        request_id: 0x6f1,
+        target_address: 0x10,
+        mode: DIAGNOSTIC_ADDRESSING_EXTENDED,
+        response_id: 0x610,
+        response_mask: 0x1fffffff,
+        response_address: 0xf1
+    };
+    diagnostic_addressing_add(&table, &address);
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x6f1,
+        target_address: 0x10,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(!handle.completed);
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x6f1);
+    ck_assert_int_eq(last_can_payload_size, 8);
+    ck_assert_int_eq(last_can_payload_sent[0], 0x10);
+    ck_assert_int_eq(last_can_payload_sent[1], 0x1);
+    ck_assert_int_eq(last_can_payload_sent[2], request.mode);
+
+    const uint8_t wrong_address[] = {0xf2, 0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x610, wrong_address,
+            sizeof(wrong_address));
+    ck_assert(!last_response_was_received);
+
+    const uint8_t can_data[] = {0xf1, 0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x610, can_data,
+            sizeof(can_data));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.payload_length, 1);
+    ck_assert_int_eq(last_response_received.payload[0], 0x23);
+}
+END_TEST
+
+START_TEST (test_extended_addressing_long_request_is_segmented)
+{
+    DiagnosticAddress address = diagnostic_addressing_default(0x6f1);
+    address.mode = DIAGNOSTIC_ADDRESSING_EXTENDED;
+    address.target_address = 0x10;
+    address.response_address = 0xf1;
+    diagnostic_addressing_add(&table, &address);
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x6f1,
+        target_address: 0x10,
+        mode: 0x22,
+        has_pid: true,
+        pid: 0x1234,
+        payload: {0x1, 0x2, 0x3, 0x4},
+        payload_length: 4
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(!handle.completed);
+    ck_assert(!diagnostic_request_sent(&handle));
+    ck_assert_int_eq(last_can_payload_sent[0], 0x10);
+    ck_assert_int_eq(last_can_payload_sent[1], 0x10);
+    ck_assert_int_eq(last_can_payload_sent[2], 0x7);
+    ck_assert_int_eq(last_can_payload_sent[7], 0x2);
+
+    const uint8_t flow_control[] = {0xf1, 0x30, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x6f9, flow_control,
+            sizeof(flow_control));
+    ck_assert(diagnostic_request_sent(&handle));
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x6f1);
+    ck_assert_int_eq(last_can_payload_sent[0], 0x10);
+    ck_assert_int_eq(last_can_payload_sent[1], 0x21);
+    ck_assert_int_eq(last_can_payload_sent[2], 0x3);
+    ck_assert_int_eq(last_can_payload_sent[3], 0x4);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("addressing");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_addressing, NULL);
+    tcase_add_test(tc_core, test_default_addressing);
+    tcase_add_test(tc_core, test_table_lookup);
+    tcase_add_test(tc_core, test_normal_fixed_physical_request);
+    tcase_add_test(tc_core, test_normal_fixed_functional_request);
+    tcase_add_test(tc_core, test_flow_control_to_physical_id);
+    tcase_add_test(tc_core, test_extended_addressing);
+    tcase_add_test(tc_core, test_extended_addressing_long_request_is_segmented);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include <uds/uds.h>
+#include <uds/bytes.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+
+const uint8_t payload[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+        0x11};
+
+START_TEST (test_aligned_reads)
+{
+    ck_assert_int_eq(diagnostic_read_uint16(payload), 0x1234);
+    ck_assert_int_eq(diagnostic_read_uint24(&payload[1]), 0x345678);
+    ck_assert_int_eq(diagnostic_read_uint32(&payload[3]), 0x789abcde);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 8, 8),
+            0x34);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 16, 16),
+            0x5678);
+    ck_assert(diagnostic_read_field(payload, sizeof(payload), 8, 64) ==
+            0x3456789abcdef011ULL);
+}
+END_TEST
+
+START_TEST (test_writes)
+{
+    uint8_t buffer[6] = {0};
+    diagnostic_write_uint16(buffer, 0xbeef);
+    diagnostic_write_uint32(&buffer[2], 0xdeadc0de);
+    const uint8_t expected[] = {0xbe, 0xef, 0xde, 0xad, 0xc0, 0xde};
+    ck_assert(memcmp(buffer, expected, sizeof(expected)) == 0);
+}
+END_TEST
+
+START_TEST (test_unaligned_fields_match_bitfield)
+{
+    // the low nibble of the first byte and the high nibble of the second
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 4, 8),
+            0x23);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 0, 4),
+            0x1);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 12, 12),
+            0x456);
+}
+END_TEST
+
+START_TEST (test_out_of_range_fields)
+{
+    ck_assert_int_eq(diagnostic_read_field(payload, 2, 8, 16), 0);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 0, 0),
+            0);
+    ck_assert_int_eq(diagnostic_read_field(payload, sizeof(payload), 0, 65),
+            0);
+}
+END_TEST
+
+START_TEST (test_array_conversion)
+{
+    uint16_t shorts[4];
+    diagnostic_read_uint16_array(payload, shorts, 4);
+    ck_assert_int_eq(shorts[0], 0x1234);
+    ck_assert_int_eq(shorts[3], 0xdef0);
+
+    uint32_t longs[2];
+    diagnostic_read_uint32_array(&payload[1], longs, 2);
+    ck_assert_int_eq(longs[0], 0x3456789a);
+    ck_assert_int_eq(longs[1], 0xbcdef011);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("bytes");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_aligned_reads);
+    tcase_add_test(tc_core, test_writes);
+    tcase_add_test(tc_core, test_unaligned_fields_match_bitfield);
+    tcase_add_test(tc_core, test_out_of_range_fields);
+    tcase_add_test(tc_core, test_array_conversion);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
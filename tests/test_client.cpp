@@ -0,0 +1,219 @@
+#include <uds/uds.hpp>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+}
+
+static bool task_finished;
+static uds::Response task_response;
+
+static uds::Task read_speed(uds::Client& client) {
+    task_response = co_await client.read_pid(0x7e0, 0xd);
+    task_finished = true;
+}
+
+static int pipelined_completed;
+
+// Both requests are in flight before either is awaited, and the coroutine
+// destroys both when it finishes.
+static uds::Task read_two(uds::Client& client, uint16_t first_pid,
+        uint16_t second_pid) {
+    uds::Request first = client.read_pid(0x7e0, first_pid);
+    uds::Request second = client.read_pid(0x7e0, second_pid);
+    uds::Response first_response = co_await first;
+    uds::Response second_response = co_await second;
+    pipelined_completed = first_response.completed() +
+            second_response.completed();
+    task_finished = true;
+}
+
+static void respond(uds::Client& client, uint32_t arbitration_id,
+        const uint8_t* data, uint8_t size) {
+    uint8_t frame[8] = {size};
+    memcpy(&frame[1], data, size);
+    client.receive(arbitration_id, std::span<const uint8_t>(frame,
+                sizeof(frame)));
+}
+
+void setup_client() {
+    setup();
+    task_finished = false;
+    task_response = uds::Response();
+    pipelined_completed = 0;
+}
+
+START_TEST (test_co_await_request)
+{
+    uds::Client client(SHIMS);
+    read_speed(client);
+    ck_assert(!task_finished);
+    ck_assert_int_eq(client.in_progress(), 1);
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x7e0);
+    ck_assert_int_eq(last_can_payload_sent[1], 0x1);
+    ck_assert_int_eq(last_can_payload_sent[2], 0xd);
+
+    const uint8_t response[] = {0x41, 0xd, 0x45};
+    respond(client, 0x7e8, response, sizeof(response));
+    ck_assert(task_finished);
+    ck_assert(task_response.success());
+    ck_assert_int_eq(task_response.pid(), 0xd);
+    ck_assert_int_eq(task_response.payload().size(), 1);
+    ck_assert_int_eq(task_response.payload()[0], 0x45);
+    ck_assert_int_eq(client.in_progress(), 0);
+}
+END_TEST
+
+START_TEST (test_functional_request_collects_every_response)
+{
+    uds::Client client(SHIMS);
+    uds::Request request = client.read_pid(OBD2_FUNCTIONAL_BROADCAST_ID, 0xc);
+
+    const uint8_t first[] = {0x41, 0xc, 0x1a, 0xf8};
+    respond(client, 0x7e8, first, sizeof(first));
+    ck_assert(request.completed());
+    const uint8_t second[] = {0x41, 0xc, 0x0b, 0xb8};
+    respond(client, 0x7e9, second, sizeof(second));
+
+    ck_assert_int_eq(request.response().arbitration_id(), 0x7e8);
+    ck_assert_int_eq(request.responses().size(), 2);
+    ck_assert_int_eq(request.responses()[0].arbitration_id(), 0x7e8);
+    ck_assert_int_eq(request.responses()[1].arbitration_id(), 0x7e9);
+    ck_assert_int_eq(request.responses()[1].payload()[0], 0x0b);
+
+    // and they're still there when the request is moved
+    uds::Request moved = std::move(request);
+    ck_assert_int_eq(moved.responses().size(), 2);
+}
+END_TEST
+
+START_TEST (test_response_owns_its_payload)
+{
+    uds::Client client(SHIMS);
+    uint8_t response_buffer[256];
+    DiagnosticRequest request = {};
+    request.arbitration_id = 0x7e0;
+    request.mode = 0x22;
+    request.has_pid = true;
+    request.pid = 0xf190;
+    request.response_buffer = response_buffer;
+    request.response_buffer_size = sizeof(response_buffer);
+
+    // longer than a DiagnosticResponse's own payload
+    uint8_t message[200] = {0x62, 0xf1, 0x90};
+    for(size_t i = 3; i < sizeof(message); ++i) {
+        message[i] = i;
+    }
+
+    uds::Response response;
+    {
+        uds::Request pending = client.request(request);
+        DiagnosticFrameSender ecu;
+        uint8_t frame[DIAGNOSTIC_CLASSIC_FRAME_SIZE];
+        diagnostic_framing_send_init(&ecu, DIAGNOSTIC_CLASSIC_FRAME_SIZE,
+                message, sizeof(message), NULL, 0);
+        uint8_t size = diagnostic_framing_next_frame(&ecu, frame);
+        client.receive(0x7e8, std::span<const uint8_t>(frame, size));
+        diagnostic_framing_flow_control(&ecu, last_can_payload_sent, 3);
+        while((size = diagnostic_framing_next_frame(&ecu, frame)) > 0) {
+            client.receive(0x7e8, std::span<const uint8_t>(frame, size));
+        }
+        ck_assert(pending.completed());
+        response = pending.response();
+    }
+    memset(response_buffer, 0, sizeof(response_buffer));
+
+    ck_assert(response.success());
+    ck_assert(response.raw().extended_payload != NULL);
+    std::span<const uint8_t> payload = response.payload();
+    // after the mode and PID
+    ck_assert_int_eq(payload.size(), sizeof(message) - 3);
+    ck_assert(memcmp(payload.data(), &message[3], payload.size()) == 0);
+
+    // a copy has its own
+    uds::Response copy = response;
+    response = uds::Response();
+    ck_assert(copy.raw().extended_payload == copy.payload().data());
+    ck_assert(memcmp(copy.payload().data(), &message[3],
+                sizeof(message) - 3) == 0);
+}
+END_TEST
+
+START_TEST (test_destroying_a_request_stops_it)
+{
+    uds::Client client(SHIMS);
+    {
+        uds::Request request = client.read_pid(0x7e0, 0xc);
+        ck_assert_int_eq(client.in_progress(), 1);
+    }
+    ck_assert_int_eq(client.in_progress(), 0);
+
+    // nothing is waiting for it now
+    const uint8_t response[] = {0x41, 0xc, 0x1a, 0xf8};
+    respond(client, 0x7e8, response, sizeof(response));
+    ck_assert_int_eq(client.in_progress(), 0);
+}
+END_TEST
+
+START_TEST (test_pipelined_requests_time_out_together)
+{
+    SHIMS.get_time = mock_get_time;
+    uds::Client client(SHIMS);
+    read_two(client, 0xc, 0xd);
+    ck_assert_int_eq(client.in_progress(), 2);
+
+    mock_time_us += DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000 + 1;
+    client.process(mock_time_us);
+    ck_assert(task_finished);
+    ck_assert_int_eq(pipelined_completed, 2);
+    ck_assert_int_eq(client.in_progress(), 0);
+}
+END_TEST
+
+START_TEST (test_one_frame_completes_pipelined_requests)
+{
+    uds::Client client(SHIMS);
+    read_two(client, 0xc, 0xc);
+
+    const uint8_t response[] = {0x41, 0xc, 0x1a, 0xf8};
+    respond(client, 0x7e8, response, sizeof(response));
+    ck_assert(task_finished);
+    ck_assert_int_eq(pipelined_completed, 2);
+    ck_assert_int_eq(client.in_progress(), 0);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("client");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_client, NULL);
+    tcase_add_test(tc_core, test_co_await_request);
+    tcase_add_test(tc_core, test_functional_request_collects_every_response);
+    tcase_add_test(tc_core, test_response_owns_its_payload);
+    tcase_add_test(tc_core, test_destroying_a_request_stops_it);
+    tcase_add_test(tc_core, test_pipelined_requests_time_out_together);
+    tcase_add_test(tc_core, test_one_frame_completes_pipelined_requests);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+#include <uds/compression.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define IMAGE_SIZE 20000
+
+uint8_t image[IMAGE_SIZE];
+uint8_t compressed[IMAGE_SIZE * 2];
+uint8_t decompressed[IMAGE_SIZE];
+DiagnosticLzssCompressor compressor;
+uint32_t failing_offset;
+
+bool read_image(uint32_t offset, uint8_t* buffer, uint32_t length,
+        void* context) {
+    if(offset + length > failing_offset) {
+        return false;
+    }
+    memcpy(buffer, (const uint8_t*) context + offset, length);
+    return true;
+}
+
+void setup_compression() {
+    failing_offset = UINT32_MAX;
+    memset(compressed, 0, sizeof(compressed));
+    memset(decompressed, 0, sizeof(decompressed));
+}
+
+// Something like firmware - runs of repeated code and tables, with erased
+// flash in between.
+static void fill_compressible(uint8_t* data, uint32_t length) {
+    const char* text = "mov r0, #1; bl diagnostic_send; ldr r1, [r0, #4]; ";
+    uint32_t i;
+    for(i = 0; i < length; ++i) {
+        if(i % 5000 >= 4000) {
+            data[i] = 0xff;
+        } else {
+            data[i] = text[i % strlen(text)] ^ (i / 700);
+        }
+    }
+}
+
+static void fill_random(uint8_t* data, uint32_t length) {
+    uint32_t state = 12345;
+    uint32_t i;
+    for(i = 0; i < length; ++i) {
+        state = state * 1103515245 + 12345;
+        data[i] = state >> 16;
+    }
+}
+
+// Compress the image in blocks of at most block_length, one after the
+// other, returning the total size.
+static uint32_t compress_all(uint32_t length, uint32_t block_length) {
+    diagnostic_lzss_init(&compressor, length, read_image, image);
+    uint32_t total = 0;
+    uint32_t size;
+    while((size = diagnostic_lzss_compress_block(&compressor,
+                    &compressed[total], block_length)) > 0) {
+        ck_assert_int_le(size, block_length);
+        total += size;
+    }
+    return total;
+}
+
+START_TEST (test_round_trip)
+{
+    fill_compressible(image, IMAGE_SIZE);
+    uint32_t size = compress_all(IMAGE_SIZE, 128);
+    ck_assert(diagnostic_lzss_finished(&compressor));
+    ck_assert(!compressor.failed);
+    ck_assert_int_eq(compressor.consumed, IMAGE_SIZE);
+    ck_assert_int_lt(size, IMAGE_SIZE / 4);
+
+    ck_assert_int_eq(diagnostic_lzss_decompress(compressed, size,
+                decompressed, sizeof(decompressed)), IMAGE_SIZE);
+    ck_assert_int_eq(memcmp(image, decompressed, IMAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_block_sizes)
+{
+    fill_compressible(image, IMAGE_SIZE);
+    uint32_t block_lengths[] = {DIAGNOSTIC_LZSS_GROUP_SIZE, 100, 4093};
+    int i;
+    for(i = 0; i < 3; ++i) {
+        uint32_t size = compress_all(IMAGE_SIZE, block_lengths[i]);
+        ck_assert_int_eq(diagnostic_lzss_decompress(compressed, size,
+                    decompressed, sizeof(decompressed)), IMAGE_SIZE);
+        ck_assert_int_eq(memcmp(image, decompressed, IMAGE_SIZE), 0);
+    }
+
+    // not enough room for a group
+    diagnostic_lzss_init(&compressor, IMAGE_SIZE, read_image, image);
+    ck_assert_int_eq(diagnostic_lzss_compress_block(&compressor, compressed,
+                DIAGNOSTIC_LZSS_GROUP_SIZE - 1), 0);
+    ck_assert_int_eq(compressor.consumed, 0);
+}
+END_TEST
+
+START_TEST (test_incompressible)
+{
+    fill_random(image, IMAGE_SIZE);
+    uint32_t size = compress_all(IMAGE_SIZE, 256);
+    // a flag byte for every 8 literals
+    ck_assert_int_le(size, IMAGE_SIZE + IMAGE_SIZE / 8 + 1);
+    ck_assert_int_eq(diagnostic_lzss_decompress(compressed, size,
+                decompressed, sizeof(decompressed)), IMAGE_SIZE);
+    ck_assert_int_eq(memcmp(image, decompressed, IMAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_short_images)
+{
+    memcpy(image, "aaaaaaaaaa", 10);
+    uint32_t length;
+    for(length = 0; length <= 10; ++length) {
+        uint32_t size = compress_all(length, 64);
+        ck_assert(diagnostic_lzss_finished(&compressor));
+        ck_assert_int_eq(diagnostic_lzss_decompress(compressed, size,
+                    decompressed, sizeof(decompressed)), length);
+        ck_assert_int_eq(memcmp(image, decompressed, length), 0);
+    }
+
+    // a literal and one match that overlaps itself
+    const uint8_t expected[] = {0x2, 'a', 0x0, 0x6};
+    ck_assert_int_eq(compress_all(10, 64), sizeof(expected));
+    ck_assert_int_eq(memcmp(compressed, expected, sizeof(expected)), 0);
+}
+END_TEST
+
+START_TEST (test_read_failure)
+{
+    fill_compressible(image, IMAGE_SIZE);
+    failing_offset = 5000;
+    diagnostic_lzss_init(&compressor, IMAGE_SIZE, read_image, image);
+    uint32_t size;
+    while((size = diagnostic_lzss_compress_block(&compressor, compressed,
+                    256)) > 0);
+    ck_assert(compressor.failed);
+    ck_assert(!diagnostic_lzss_finished(&compressor));
+    ck_assert_int_le(compressor.consumed, 5000);
+}
+END_TEST
+
+START_TEST (test_decompress_rejects_bad_streams)
+{
+    // a match before the start of the output
+    const uint8_t too_far[] = {0x2, 'a', 0x1, 0x0};
+    ck_assert_int_eq(diagnostic_lzss_decompress(too_far, sizeof(too_far),
+                decompressed, sizeof(decompressed)), 0);
+
+    // a match cut short
+    const uint8_t truncated[] = {0x2, 'a', 0x0};
+    ck_assert_int_eq(diagnostic_lzss_decompress(truncated, sizeof(truncated),
+                decompressed, sizeof(decompressed)), 0);
+
+    const uint8_t stream[] = {0x2, 'a', 0x0, 0x6};
+    ck_assert_int_eq(diagnostic_lzss_decompress(stream, sizeof(stream),
+                decompressed, 9), 0);
+    ck_assert_int_eq(diagnostic_lzss_decompress(stream, sizeof(stream),
+                decompressed, 10), 10);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("compression");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_compression, NULL);
+    tcase_add_test(tc_core, test_round_trip);
+    tcase_add_test(tc_core, test_block_sizes);
+    tcase_add_test(tc_core, test_incompressible);
+    tcase_add_test(tc_core, test_short_images);
+    tcase_add_test(tc_core, test_read_failure);
+    tcase_add_test(tc_core, test_decompress_rejects_bad_streams);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
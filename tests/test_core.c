@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
 
 extern bool can_frame_was_sent;
 extern void setup();
@@ -18,6 +19,11 @@ void response_received_handler(const DiagnosticResponse* response) {
     last_response_received = *response;
 }
 
+void count_responses_handler(const DiagnosticResponse* response,
+        void* context) {
+    ++*(int*)context;
+}
+
 START_TEST (test_receive_wrong_arb_id)
 {
     DiagnosticRequest request = {
@@ -478,6 +484,81 @@ START_TEST (test_response_multi_frame)
 }
 END_TEST
 
+START_TEST (test_response_handler_with_context)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            &request, NULL);
+    int calls = 0;
+    handle.handler = count_responses_handler;
+    handle.context = &calls;
+    start_diagnostic_request(&SHIMS, &handle);
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    ck_assert_int_eq(calls, 1);
+}
+END_TEST
+
+START_TEST (test_decode_fixed_point_matches_float)
+{
+    const uint16_t pids[] = {0xa, 0xc, 0xd, 0x33, 0xb, 0x10, 0x11, 0x2f,
+        0x45, 0x4c, 0x52, 0x5a, 0x4, 0x46, 0x5c, 0xf, 0x5, 0x62, 0x1f};
+    DiagnosticResponse response = {
+        payload_length: 2
+    };
+    size_t i;
+    for(i = 0; i < sizeof(pids) / sizeof(pids[0]); ++i) {
+        response.pid = pids[i];
+        uint32_t raw;
+        for(raw = 0; raw <= 0xffff; raw += (raw < 0x200 ? 1 : 97)) {
+            response.payload[0] = raw >> 8;
+            response.payload[1] = raw;
+            if(raw <= 0xff) {
+                response.payload[0] = raw;
+            }
+            DiagnosticFixedPoint fixed = diagnostic_decode_obd2_pid_fixed(
+                    &response);
+            ck_assert_int_eq(fixed.exponent,
+                    diagnostic_obd2_pid_exponent(response.pid));
+            double scaled = diagnostic_decode_obd2_pid(&response) *
+                    pow(10, -fixed.exponent);
+            ck_assert_int_eq(fixed.value, lround(scaled));
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_decode_fixed_point)
+{
+    DiagnosticResponse response = {
+        pid: 0xc,
+        payload: {0x1a, 0xf8},
+        payload_length: 2
+    };
+    DiagnosticFixedPoint rpm = diagnostic_decode_obd2_pid_fixed(&response);
+    ck_assert_int_eq(rpm.value, 172600);
+    ck_assert_int_eq(rpm.exponent, -2);
+
+    response.pid = 0x4;
+    response.payload[0] = 0xff;
+    DiagnosticFixedPoint load = diagnostic_decode_obd2_pid_fixed(&response);
+    ck_assert_int_eq(load.value, 10000);
+    ck_assert_int_eq(load.exponent, -2);
+
+    response.pid = 0x5;
+    response.payload[0] = 0x0;
+    DiagnosticFixedPoint temperature = diagnostic_decode_obd2_pid_fixed(
+            &response);
+    ck_assert_int_eq(temperature.value, -40);
+    ck_assert_int_eq(temperature.exponent, 0);
+}
+END_TEST
+
 Suite* testSuite(void) {
     Suite* s = suite_create("uds");
     TCase *tc_core = tcase_create("core");
@@ -500,7 +581,10 @@ Suite* testSuite(void) {
     tcase_add_test(tc_core, test_wrong_pid_then_right_completes);
     tcase_add_test(tc_core, test_negative_response);
     tcase_add_test(tc_core, test_payload_to_integer);
+    tcase_add_test(tc_core, test_decode_fixed_point_matches_float);
+    tcase_add_test(tc_core, test_decode_fixed_point);
     tcase_add_test(tc_core, test_response_multi_frame);
+    tcase_add_test(tc_core, test_response_handler_with_context);
 
     // TODO these are future work:
     // TODO test request MIL
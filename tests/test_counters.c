@@ -0,0 +1,162 @@
+#include <uds/uds.h>
+#include <uds/counters.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+
+DiagnosticCounters counters;
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+bool failing_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    return false;
+}
+
+void setup_counters() {
+    setup();
+    diagnostic_counters_reset(&counters);
+    SHIMS.counters = &counters;
+}
+
+START_TEST (test_count_request_and_response)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(counters.requests_sent, 1);
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x200, can_data,
+            sizeof(can_data));
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    ck_assert_int_eq(counters.frames_offered, 2);
+    ck_assert_int_eq(counters.frames_ignored, 1);
+    ck_assert_int_eq(counters.frames_routed, 1);
+    ck_assert_int_eq(counters.responses_positive, 1);
+    ck_assert_int_eq(counters.responses_negative, 0);
+}
+END_TEST
+
+START_TEST (test_count_send_failure)
+{
+    SHIMS.send_can_message = failing_send_can;
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    fail_unless(handle.completed);
+    ck_assert_int_eq(counters.send_failures, 1);
+    ck_assert_int_eq(counters.requests_sent, 0);
+}
+END_TEST
+
+START_TEST (test_count_negative_response_codes)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    const uint8_t can_data[] = {0x3, 0x7f, request.mode,
+        NRC_CONDITIONS_NOT_CORRECT};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    ck_assert_int_eq(counters.responses_negative, 1);
+    ck_assert_int_eq(counters.negative_response_codes[
+            NRC_CONDITIONS_NOT_CORRECT], 1);
+    ck_assert_int_eq(counters.negative_response_codes[
+            NRC_SERVICE_NOT_SUPPORTED], 0);
+}
+END_TEST
+
+START_TEST (test_count_unmatched_and_multi_frame)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_VEHICLE_INFORMATION,
+        has_pid: true,
+        pid: 0x2
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    const uint8_t wrong_mode[] = {0x2, 0x1 + 0x40, 0x2};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, wrong_mode, sizeof(wrong_mode));
+    ck_assert_int_eq(counters.responses_unmatched, 1);
+
+    const uint8_t can_data[] = {0x10, 0x9, 0x9 + 0x40, 0x2, 0x1, 0x31, 0x46,
+        0x4d};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    const uint8_t can_data_1[] = {0x21, 0x43, 0x55, 0x39};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data_1, sizeof(can_data_1));
+    fail_unless(handle.completed);
+    ck_assert_int_eq(counters.multi_frame_responses, 1);
+    ck_assert_int_eq(counters.responses_positive, 1);
+}
+END_TEST
+
+START_TEST (test_snapshot_and_reset)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    diagnostic_request(&SHIMS, &request, response_received_handler);
+    diagnostic_request(&SHIMS, &request, response_received_handler);
+
+    DiagnosticCounters snapshot;
+    diagnostic_counters_snapshot(&counters, &snapshot, false);
+    ck_assert_int_eq(snapshot.requests_sent, 2);
+    ck_assert_int_eq(counters.requests_sent, 2);
+
+    diagnostic_counters_snapshot(&counters, &snapshot, true);
+    ck_assert_int_eq(snapshot.requests_sent, 2);
+    ck_assert_int_eq(counters.requests_sent, 0);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("counters");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_counters, NULL);
+    tcase_add_test(tc_core, test_count_request_and_response);
+    tcase_add_test(tc_core, test_count_send_failure);
+    tcase_add_test(tc_core, test_count_negative_response_codes);
+    tcase_add_test(tc_core, test_count_unmatched_and_multi_frame);
+    tcase_add_test(tc_core, test_snapshot_and_reset);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
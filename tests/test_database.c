@@ -0,0 +1,296 @@
+#include <uds/uds.h>
+#include <uds/database.h>
+#include <uds/addressing.h>
+#include <check.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern uint8_t last_can_payload_size;
+
+#define PARAMETER_COUNT 5
+#define INDEX_SIZE 16
+
+// The same layout tools/uds-database.c writes, built by hand.
+typedef struct {
+    DiagnosticDatabaseHeader header;
+    DiagnosticDatabaseEcu ecus[2];
+    DiagnosticDatabaseParameter parameters[PARAMETER_COUNT];
+    uint32_t index[INDEX_SIZE];
+    char strings[128];
+} TestImage;
+
+TestImage image;
+DiagnosticDatabase database;
+uint32_t strings_length;
+
+static uint32_t add_string(const char* string) {
+    uint32_t offset = strings_length;
+    strcpy(&image.strings[offset], string);
+    strings_length += strlen(string) + 1;
+    return offset;
+}
+
+static void add_parameter(uint32_t position, const char* name, uint16_t ecu,
+        uint8_t mode, uint16_t pid, uint16_t bit_offset, uint16_t bit_count,
+        int32_t multiplier, uint8_t shift, int32_t offset, int8_t exponent) {
+    DiagnosticDatabaseParameter* parameter = &image.parameters[position];
+    parameter->name = add_string(name);
+    parameter->ecu = ecu;
+    parameter->mode = mode;
+    parameter->pid = pid;
+    parameter->pid_length = pid > 0xff || mode >= 0x10 ? 2 : 1;
+    parameter->bit_offset = bit_offset;
+    parameter->bit_count = bit_count;
+    parameter->response_length = (bit_offset + bit_count + 7) / 8;
+    parameter->multiplier = multiplier;
+    parameter->shift = shift;
+    parameter->offset = offset;
+    parameter->exponent = exponent;
+
+    uint32_t slot = diagnostic_database_hash(name) & (INDEX_SIZE - 1);
+    while(image.index[slot] != 0) {
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+    image.index[slot] = position + 1;
+}
+
+static void add_ecu(uint32_t position, const char* name, uint32_t request_id,
+        uint32_t first_parameter, uint32_t parameter_count) {
+    DiagnosticAddress address = diagnostic_addressing_default(request_id);
+    DiagnosticDatabaseEcu* ecu = &image.ecus[position];
+    ecu->name = add_string(name);
+    ecu->request_id = request_id;
+    ecu->response_id = address.response_id;
+    ecu->response_mask = address.response_mask;
+    ecu->addressing_mode = address.mode;
+    ecu->first_parameter = first_parameter;
+    ecu->parameter_count = parameter_count;
+}
+
+void setup_database() {
+    setup();
+    memset(&image, 0, sizeof(image));
+    strings_length = 1;
+
+    add_ecu(0, "engine", 0x7e0, 0, 2);
+    add_ecu(1, "body", 0x7e2, 2, 3);
+    add_parameter(0, "engine.coolant", 0, 0x1, 0x5, 0, 8, 1, 0, -40, 0);
+    // RPM is A * 256 + B / 4, in hundredths
+    add_parameter(1, "engine.speed", 0, 0x1, 0xc, 0, 16, 25, 0, 0, -2);
+    // A * 100 / 255 in hundredths, as a fraction of 2^24
+    add_parameter(2, "body.fuel_level", 1, 0x1, 0x2f, 0, 8, 657930266, 24,
+            0, -2);
+    add_parameter(3, "body.mode", 1, 0x22, 0xf40d, 0, 4, 1, 0, 0, 0);
+    add_parameter(4, "body.temperature", 1, 0x22, 0xf40d, 4, 12, 1, 0, 0,
+            -1);
+    image.parameters[4].flags = DIAGNOSTIC_DATABASE_SIGNED;
+    image.parameters[0].poll_interval_ms = 1000;
+
+    DiagnosticDatabaseHeader* header = &image.header;
+    header->magic = DIAGNOSTIC_DATABASE_MAGIC;
+    header->version = DIAGNOSTIC_DATABASE_VERSION;
+    header->ecu_count = 2;
+    header->parameter_count = PARAMETER_COUNT;
+    header->index_size = INDEX_SIZE;
+    header->ecus_offset = offsetof(TestImage, ecus);
+    header->parameters_offset = offsetof(TestImage, parameters);
+    header->index_offset = offsetof(TestImage, index);
+    header->strings_offset = offsetof(TestImage, strings);
+    header->strings_length = strings_length;
+    header->length = sizeof(image);
+    ck_assert(diagnostic_database_open(&database, &image, sizeof(image)));
+}
+
+static DiagnosticResponse response_with(const uint8_t* payload,
+        uint8_t length) {
+    DiagnosticResponse response = {
+        completed: true,
+        success: true,
+        payload_length: length
+    };
+    memcpy(response.payload, payload, length);
+    return response;
+}
+
+START_TEST (test_open_checks_the_header)
+{
+    ck_assert(!diagnostic_database_open(&database, &image,
+                sizeof(image) - 4));
+    ck_assert(!diagnostic_database_open(&database, &image,
+                sizeof(DiagnosticDatabaseHeader) - 1));
+
+    image.header.version = DIAGNOSTIC_DATABASE_VERSION + 1;
+    ck_assert(!diagnostic_database_open(&database, &image, sizeof(image)));
+    image.header.version = DIAGNOSTIC_DATABASE_VERSION;
+
+    // the byte order of another host
+    image.header.magic = __builtin_bswap32(DIAGNOSTIC_DATABASE_MAGIC);
+    ck_assert(!diagnostic_database_open(&database, &image, sizeof(image)));
+    image.header.magic = DIAGNOSTIC_DATABASE_MAGIC;
+
+    image.header.parameter_count = 1000;
+    ck_assert(!diagnostic_database_open(&database, &image, sizeof(image)));
+    image.header.parameter_count = PARAMETER_COUNT;
+
+    image.header.index_size = INDEX_SIZE - 1;
+    ck_assert(!diagnostic_database_open(&database, &image, sizeof(image)));
+    image.header.index_size = INDEX_SIZE;
+
+    image.header.strings_length = 2;
+    ck_assert(!diagnostic_database_open(&database, &image, sizeof(image)));
+    image.header.strings_length = strings_length;
+
+    ck_assert(diagnostic_database_open(&database, &image, sizeof(image)));
+    ck_assert_str_eq(diagnostic_database_string(&database, 1000), "");
+}
+END_TEST
+
+START_TEST (test_find_by_name)
+{
+    const DiagnosticDatabaseParameter* parameter = diagnostic_database_find(
+            &database, "engine.speed");
+    ck_assert(parameter == &database.parameters[1]);
+    ck_assert_str_eq(diagnostic_database_string(&database, parameter->name),
+            "engine.speed");
+    ck_assert(diagnostic_database_find(&database, "body.temperature") ==
+            &database.parameters[4]);
+    ck_assert(diagnostic_database_find(&database, "engine.load") == NULL);
+    ck_assert(diagnostic_database_find(&database, "") == NULL);
+
+    const DiagnosticDatabaseEcu* ecu = diagnostic_database_parameter_ecu(
+            &database, parameter);
+    ck_assert_str_eq(diagnostic_database_string(&database, ecu->name),
+            "engine");
+    ck_assert_int_eq(database.parameters[0].poll_interval_ms, 1000);
+}
+END_TEST
+
+START_TEST (test_find_request)
+{
+    ck_assert(diagnostic_database_find_ecu(&database, 0x7e2) ==
+            &database.ecus[1]);
+    ck_assert(diagnostic_database_find_ecu(&database, 0x7e1) == NULL);
+
+    ck_assert(diagnostic_database_find_request(&database, 0x7e0, 0x1, 0xc) ==
+            &database.parameters[1]);
+    ck_assert(diagnostic_database_find_request(&database, 0x7e2, 0x1, 0xc) ==
+            NULL);
+    ck_assert(diagnostic_database_find_request(&database, 0x7e1, 0x1, 0xc) ==
+            NULL);
+
+    // both fields of the DID, in order
+    const DiagnosticDatabaseParameter* parameter =
+            diagnostic_database_find_request(&database, 0x7e2, 0x22, 0xf40d);
+    ck_assert(parameter == &database.parameters[3]);
+    ck_assert_int_eq(parameter[1].pid, 0xf40d);
+    ck_assert_int_eq(parameter[1].bit_offset, 4);
+}
+END_TEST
+
+START_TEST (test_request_and_address)
+{
+    const DiagnosticDatabaseParameter* parameter = diagnostic_database_find(
+            &database, "body.temperature");
+    DiagnosticRequest request;
+    ck_assert(diagnostic_database_request(&database, parameter, &request));
+    ck_assert_int_eq(request.arbitration_id, 0x7e2);
+    ck_assert_int_eq(request.mode, 0x22);
+    ck_assert(request.has_pid);
+    ck_assert_int_eq(request.pid_length, 2);
+
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            &request, NULL);
+    start_diagnostic_request(&SHIMS, &handle);
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x7e2);
+    const uint8_t expected[] = {0x3, 0x22, 0xf4, 0xd};
+    ck_assert_int_eq(memcmp(last_can_payload_sent, expected,
+                sizeof(expected)), 0);
+
+    DiagnosticAddress address;
+    diagnostic_database_address(
+            diagnostic_database_parameter_ecu(&database, parameter),
+            &address);
+    ck_assert_int_eq(address.request_id, 0x7e2);
+    ck_assert_int_eq(address.response_id, 0x7ea);
+
+    DiagnosticDatabaseParameter broken = *parameter;
+    broken.ecu = 2;
+    ck_assert(!diagnostic_database_request(&database, &broken, &request));
+}
+END_TEST
+
+START_TEST (test_decode)
+{
+    DiagnosticFixedPoint value;
+    const uint8_t speed[] = {0x1a, 0xf8};
+    DiagnosticResponse response = response_with(speed, sizeof(speed));
+    ck_assert(diagnostic_database_decode(&database.parameters[1], &response,
+                &value));
+    ck_assert_int_eq(value.value, 172600);
+    ck_assert_int_eq(value.exponent, -2);
+
+    const uint8_t coolant[] = {0x7b};
+    response = response_with(coolant, sizeof(coolant));
+    ck_assert(diagnostic_database_decode(&database.parameters[0], &response,
+                &value));
+    ck_assert_int_eq(value.value, 83);
+
+    const uint8_t full[] = {0xff};
+    response = response_with(full, sizeof(full));
+    diagnostic_database_decode(&database.parameters[2], &response, &value);
+    ck_assert_int_eq(value.value, 10000);
+    const uint8_t half[] = {0x80};
+    response = response_with(half, sizeof(half));
+    diagnostic_database_decode(&database.parameters[2], &response, &value);
+    ck_assert_int_eq(value.value, 5020);
+
+    const uint8_t status[] = {0x3f, 0xf6};
+    response = response_with(status, sizeof(status));
+    diagnostic_database_decode(&database.parameters[3], &response, &value);
+    ck_assert_int_eq(value.value, 3);
+    diagnostic_database_decode(&database.parameters[4], &response, &value);
+    ck_assert_int_eq(value.value, -10);
+    ck_assert_int_eq(value.exponent, -1);
+
+    response.payload_length = 1;
+    ck_assert(!diagnostic_database_decode(&database.parameters[4], &response,
+                &value));
+    response.payload_length = 2;
+    response.success = false;
+    ck_assert(!diagnostic_database_decode(&database.parameters[4], &response,
+                &value));
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("database");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_database, NULL);
+    tcase_add_test(tc_core, test_open_checks_the_header);
+    tcase_add_test(tc_core, test_find_by_name);
+    tcase_add_test(tc_core, test_find_request);
+    tcase_add_test(tc_core, test_request_and_address);
+    tcase_add_test(tc_core, test_decode);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
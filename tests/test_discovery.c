@@ -0,0 +1,192 @@
+#include <uds/uds.h>
+#include <uds/discovery.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+DiagnosticDiscovery discovery;
+uint16_t frames_sent;
+uint32_t sent_ids[256];
+uint16_t ecus_reported;
+DiagnosticDiscoveredEcu last_ecu;
+
+bool recording_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    if(frames_sent < sizeof(sent_ids) / sizeof(sent_ids[0])) {
+        sent_ids[frames_sent] = arbitration_id;
+    }
+    ++frames_sent;
+    return true;
+}
+
+void ecu_discovered(const DiagnosticDiscoveredEcu* ecu, void* context) {
+    ++ecus_reported;
+    last_ecu = *ecu;
+}
+
+void setup_discovery() {
+    setup();
+    SHIMS.send_can_message = recording_send_can;
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    frames_sent = 0;
+    ecus_reported = 0;
+    diagnostic_discovery_init(&discovery, &SHIMS, ecu_discovered, NULL);
+}
+
+static const uint8_t TESTER_PRESENT_RESPONSE[] = {0x2, 0x7e, 0x0};
+
+START_TEST (test_probes_in_parallel)
+{
+    discovery.max_in_flight = 4;
+    ck_assert(diagnostic_discovery_sweep(&discovery, 0x700, 0x70f, 1));
+    ck_assert_int_eq(frames_sent, 4);
+    ck_assert_int_eq(sent_ids[0], 0x700);
+    ck_assert_int_eq(sent_ids[3], 0x703);
+    ck_assert(!diagnostic_discovery_finished(&discovery));
+
+    // an answer frees its slot for the next address right away, and frames
+    // for addresses not yet probed are ignored
+    mock_time_us = 3000;
+    diagnostic_discovery_receive_can_frame(&discovery, 0x70f,
+            TESTER_PRESENT_RESPONSE, sizeof(TESTER_PRESENT_RESPONSE));
+    ck_assert_int_eq(ecus_reported, 0);
+    diagnostic_discovery_receive_can_frame(&discovery, 0x70a,
+            TESTER_PRESENT_RESPONSE, sizeof(TESTER_PRESENT_RESPONSE));
+    ck_assert_int_eq(ecus_reported, 1);
+    ck_assert_int_eq(last_ecu.request_id, 0x702);
+    ck_assert_int_eq(last_ecu.response_id, 0x70a);
+    ck_assert(last_ecu.success);
+    ck_assert_int_eq(last_ecu.latency_us, 2000);
+    ck_assert_int_eq(frames_sent, 5);
+    ck_assert_int_eq(sent_ids[4], 0x704);
+}
+END_TEST
+
+START_TEST (test_silent_addresses_time_out)
+{
+    discovery.max_in_flight = 2;
+    diagnostic_discovery_sweep(&discovery, 0x700, 0x703, 1);
+    uint64_t deadline = diagnostic_discovery_process(&discovery, mock_time_us);
+    ck_assert_int_eq(deadline, 1000 + DIAGNOSTIC_DISCOVERY_TIMEOUT_MS * 1000);
+
+    mock_time_us = deadline;
+    deadline = diagnostic_discovery_process(&discovery, deadline);
+    ck_assert_int_eq(frames_sent, 4);
+    ck_assert_int_eq(sent_ids[3], 0x703);
+
+    mock_time_us = deadline;
+    ck_assert(diagnostic_discovery_process(&discovery, deadline) ==
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(diagnostic_discovery_finished(&discovery));
+    ck_assert_int_eq(discovery.probes_sent, 4);
+    ck_assert_int_eq(discovery.ecu_count, 0);
+}
+END_TEST
+
+START_TEST (test_negative_response_is_an_ecu)
+{
+    diagnostic_discovery_sweep(&discovery, 0x7e0, 0x7e0, 1);
+    const uint8_t response[] = {0x3, 0x7f, 0x3e, NRC_SERVICE_NOT_SUPPORTED};
+    diagnostic_discovery_receive_can_frame(&discovery, 0x7e8, response,
+            sizeof(response));
+    ck_assert_int_eq(discovery.ecu_count, 1);
+    ck_assert(!discovery.ecus[0].success);
+    ck_assert_int_eq(discovery.ecus[0].negative_response_code,
+            NRC_SERVICE_NOT_SUPPORTED);
+    ck_assert(diagnostic_discovery_finished(&discovery));
+}
+END_TEST
+
+START_TEST (test_functional_id_is_skipped)
+{
+    diagnostic_discovery_sweep(&discovery, 0x7de, 0x7e0, 1);
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert_int_eq(sent_ids[0], 0x7de);
+    ck_assert_int_eq(sent_ids[1], 0x7e0);
+}
+END_TEST
+
+START_TEST (test_extended_range)
+{
+    ck_assert(diagnostic_discovery_sweep(&discovery, 0x18da00f1, 0x18dafff1,
+                0x100));
+    ck_assert_int_eq(frames_sent, DIAGNOSTIC_DISCOVERY_DEFAULT_IN_FLIGHT);
+    ck_assert_int_eq(sent_ids[1], 0x18da01f1);
+
+    diagnostic_discovery_receive_can_frame(&discovery, 0x18daf10a,
+            TESTER_PRESENT_RESPONSE, sizeof(TESTER_PRESENT_RESPONSE));
+    ck_assert_int_eq(last_ecu.request_id, 0x18da0af1);
+
+    // run the rest of the sweep out
+    uint64_t deadline;
+    while((deadline = diagnostic_discovery_process(&discovery,
+                    mock_time_us)) != DIAGNOSTIC_NO_DEADLINE) {
+        mock_time_us = deadline;
+    }
+    ck_assert_int_eq(discovery.probes_sent, 256);
+    ck_assert_int_eq(discovery.ecu_count, 1);
+}
+END_TEST
+
+START_TEST (test_topology_to_addressing)
+{
+    diagnostic_discovery_sweep(&discovery, 0x7e0, 0x7e1, 1);
+    diagnostic_discovery_receive_can_frame(&discovery, 0x7e9,
+            TESTER_PRESENT_RESPONSE, sizeof(TESTER_PRESENT_RESPONSE));
+
+    DiagnosticAddressingTable table;
+    diagnostic_addressing_reset(&table);
+    ck_assert_int_eq(diagnostic_discovery_to_addressing(&discovery, &table),
+            1);
+    const DiagnosticAddress* address = diagnostic_addressing_lookup(&table,
+            0x7e1, 0);
+    ck_assert(address != NULL);
+    ck_assert_int_eq(address->response_id, 0x7e9);
+    ck_assert_int_eq(address->response_mask, 0x1fffffff);
+}
+END_TEST
+
+START_TEST (test_invalid_range)
+{
+    ck_assert(!diagnostic_discovery_sweep(&discovery, 0x701, 0x700, 1));
+    ck_assert(!diagnostic_discovery_sweep(&discovery, 0x700, 0x701, 0));
+    ck_assert_int_eq(frames_sent, 0);
+    ck_assert(diagnostic_discovery_finished(&discovery));
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("discovery");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_discovery, NULL);
+    tcase_add_test(tc_core, test_probes_in_parallel);
+    tcase_add_test(tc_core, test_silent_addresses_time_out);
+    tcase_add_test(tc_core, test_negative_response_is_an_ecu);
+    tcase_add_test(tc_core, test_functional_id_is_skipped);
+    tcase_add_test(tc_core, test_extended_range);
+    tcase_add_test(tc_core, test_topology_to_addressing);
+    tcase_add_test(tc_core, test_invalid_range);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,494 @@
+#include <uds/uds.h>
+#include <uds/doip.h>
+#include <uds/bytes.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+extern bool can_frame_was_sent;
+
+#define ENTITY_ADDRESS 0x1001
+#define DID_LENGTH 3000
+
+DiagnosticDoipConnection connection;
+uint8_t written[256];
+uint32_t written_size;
+uint16_t responses_received;
+DiagnosticResponse last_response;
+uint8_t last_payload[DID_LENGTH];
+
+bool recording_write(const uint8_t* data, uint32_t size, void* context) {
+    if(written_size + size <= sizeof(written)) {
+        memcpy(&written[written_size], data, size);
+    }
+    written_size += size;
+    return true;
+}
+
+void response_received(const DiagnosticResponse* response, void* context) {
+    ++responses_received;
+    last_response = *response;
+    if(response->extended_payload != NULL &&
+            response->extended_payload_length <= sizeof(last_payload)) {
+        // only valid during the callback
+        memcpy(last_payload, response->extended_payload,
+                response->extended_payload_length);
+    }
+}
+
+void setup_doip() {
+    setup();
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    written_size = 0;
+    responses_received = 0;
+    memset(last_payload, 0, sizeof(last_payload));
+    diagnostic_doip_init(&connection, DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS,
+            recording_write, NULL);
+    SHIMS.transport = &connection.transport;
+}
+
+static uint32_t build_message(uint8_t* destination,
+        DiagnosticDoipPayloadType payload_type, const uint8_t* payload,
+        uint32_t payload_length) {
+    size_t length = diagnostic_doip_write_header(destination, payload_type,
+            payload_length);
+    if(payload_length > 0) {
+        memcpy(&destination[length], payload, payload_length);
+    }
+    return length + payload_length;
+}
+
+static uint32_t build_routing_response(uint8_t* destination, uint8_t code) {
+    uint8_t payload[9] = {0};
+    diagnostic_write_uint16(payload, DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS);
+    diagnostic_write_uint16(&payload[2], ENTITY_ADDRESS);
+    payload[4] = code;
+    return build_message(destination,
+            DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_RESPONSE, payload,
+            sizeof(payload));
+}
+
+// A diagnostic message from the entity to the tester, with a 0x62 response
+// to a read of DID 0xf190 carrying 'length' bytes of data.
+static uint32_t build_did_response(uint8_t* destination, uint32_t length) {
+    uint32_t size = diagnostic_doip_write_header(destination,
+            DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE, 4 + 3 + length);
+    diagnostic_write_uint16(&destination[size], ENTITY_ADDRESS);
+    diagnostic_write_uint16(&destination[size + 2],
+            DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS);
+    size += 4;
+    destination[size++] = 0x62;
+    destination[size++] = 0xf1;
+    destination[size++] = 0x90;
+    uint32_t i;
+    for(i = 0; i < length; ++i) {
+        destination[size++] = i & 0xff;
+    }
+    return size;
+}
+
+static DiagnosticRequestHandle start_did_read() {
+    DiagnosticRequest request = {
+        arbitration_id: ENTITY_ADDRESS,
+        mode: 0x22,
+        has_pid: true,
+        pid: 0xf190,
+        pid_length: 2
+    };
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            &request, NULL);
+    handle.handler = response_received;
+    start_diagnostic_request(&SHIMS, &handle);
+    return handle;
+}
+
+static void activate_routing() {
+    uint8_t message[32];
+    ck_assert(diagnostic_doip_activate_routing(&connection));
+    uint32_t size = build_routing_response(message,
+            DIAGNOSTIC_DOIP_ROUTING_SUCCESSFUL);
+    diagnostic_doip_receive(&connection, &SHIMS, NULL, 0, message, size);
+    ck_assert(connection.routing_active);
+    written_size = 0;
+}
+
+START_TEST (test_routing_activation)
+{
+    ck_assert(diagnostic_doip_activate_routing(&connection));
+    ck_assert_int_eq(written_size, 15);
+    ck_assert_int_eq(written[0], 0x2);
+    ck_assert_int_eq(written[1], 0xfd);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[2]),
+            DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_REQUEST);
+    ck_assert_int_eq(diagnostic_read_uint32(&written[4]), 7);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[8]),
+            DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS);
+
+    // a refusal leaves routing inactive
+    uint8_t message[32];
+    uint32_t size = build_routing_response(message, 0x6);
+    diagnostic_doip_receive(&connection, &SHIMS, NULL, 0, message, size);
+    ck_assert(!connection.routing_active);
+    ck_assert_int_eq(connection.routing_response_code, 0x6);
+
+    size = build_routing_response(message, DIAGNOSTIC_DOIP_ROUTING_SUCCESSFUL);
+    diagnostic_doip_receive(&connection, &SHIMS, NULL, 0, message, size);
+    ck_assert(connection.routing_active);
+    ck_assert_int_eq(connection.entity_address, ENTITY_ADDRESS);
+}
+END_TEST
+
+START_TEST (test_request_fails_without_routing)
+{
+    DiagnosticRequestHandle handle = start_did_read();
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+    ck_assert_int_eq(written_size, 0);
+}
+END_TEST
+
+START_TEST (test_request_is_one_message)
+{
+    activate_routing();
+    DiagnosticRequestHandle handle = start_did_read();
+    ck_assert(!handle.completed);
+    ck_assert(!can_frame_was_sent);
+
+    ck_assert_int_eq(written_size, 8 + 4 + 3);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[2]),
+            DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE);
+    ck_assert_int_eq(diagnostic_read_uint32(&written[4]), 7);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[8]),
+            DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[10]), ENTITY_ADDRESS);
+    ck_assert_int_eq(written[12], 0x22);
+    ck_assert_int_eq(written[13], 0xf1);
+    ck_assert_int_eq(written[14], 0x90);
+}
+END_TEST
+
+START_TEST (test_response_split_across_reads)
+{
+    activate_routing();
+    DiagnosticRequestHandle handle = start_did_read();
+    DiagnosticRequestHandle* handles[] = {NULL, &handle};
+
+    static uint8_t message[DID_LENGTH + 32];
+    uint32_t size = build_did_response(message, DID_LENGTH);
+    uint32_t i;
+    for(i = 0; i < size; ++i) {
+        ck_assert_int_eq(responses_received, 0);
+        diagnostic_doip_receive(&connection, &SHIMS, handles, 2,
+                &message[i], 1);
+    }
+
+    ck_assert(handle.completed);
+    ck_assert(handle.success);
+    ck_assert_int_eq(responses_received, 1);
+    ck_assert_int_eq(last_response.pid, 0xf190);
+    ck_assert_int_eq(last_response.extended_payload_length, DID_LENGTH);
+    ck_assert_int_eq(last_payload[1000], 1000 & 0xff);
+    ck_assert_int_eq(last_payload[DID_LENGTH - 1], (DID_LENGTH - 1) & 0xff);
+}
+END_TEST
+
+START_TEST (test_alive_check_and_nack)
+{
+    activate_routing();
+    uint8_t message[64];
+    uint32_t size = build_message(message,
+            DIAGNOSTIC_DOIP_ALIVE_CHECK_REQUEST, NULL, 0);
+    uint8_t nack[] = {0x10, 0x01, 0x0e, 0x00, 0x03};
+    size += build_message(&message[size], DIAGNOSTIC_DOIP_DIAGNOSTIC_NACK,
+            nack, sizeof(nack));
+    diagnostic_doip_receive(&connection, &SHIMS, NULL, 0, message, size);
+
+    ck_assert_int_eq(connection.nacks, 1);
+    ck_assert_int_eq(written_size, 10);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[2]),
+            DIAGNOSTIC_DOIP_ALIVE_CHECK_RESPONSE);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[8]),
+            DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS);
+}
+END_TEST
+
+START_TEST (test_oversized_message_is_skipped)
+{
+    activate_routing();
+    DiagnosticRequestHandle handle = start_did_read();
+    DiagnosticRequestHandle* handles[] = {&handle};
+
+    static uint8_t message[DIAGNOSTIC_DOIP_BUFFER_SIZE * 2];
+    uint32_t size = build_did_response(message,
+            DIAGNOSTIC_DOIP_BUFFER_SIZE + 100);
+    size += build_did_response(&message[size], 10);
+
+    // in pieces, the long one doesn't fit the buffer and is dropped - the
+    // next one is still found
+    uint32_t offset;
+    for(offset = 0; offset < size; offset += 1000) {
+        diagnostic_doip_receive(&connection, &SHIMS, handles, 1,
+                &message[offset], MIN(1000, size - offset));
+    }
+    ck_assert_int_eq(responses_received, 1);
+    ck_assert_int_eq(last_response.payload_length, 10);
+    ck_assert(handle.completed);
+}
+END_TEST
+
+START_TEST (test_huge_length_is_skipped)
+{
+    activate_routing();
+    DiagnosticRequestHandle handle = start_did_read();
+    DiagnosticRequestHandle* handles[] = {&handle};
+
+    // a length that wraps around if the header is added to it, with the
+    // header split across reads
+    const uint8_t header[] = {0x2, 0xfd, 0x80, 0x01, 0xff, 0xff, 0xff, 0xfc};
+    diagnostic_doip_receive(&connection, &SHIMS, handles, 1, header, 5);
+    diagnostic_doip_receive(&connection, &SHIMS, handles, 1, &header[5],
+            sizeof(header) - 5);
+    ck_assert_int_eq(connection.buffered, 0);
+    ck_assert_int_eq(connection.discarding, 0xfffffffc);
+
+    // and whole
+    diagnostic_doip_init(&connection, DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS,
+            recording_write, NULL);
+    const uint8_t whole[] = {0x2, 0xfd, 0x80, 0x01, 0xff, 0xff, 0xff, 0xf8};
+    diagnostic_doip_receive(&connection, &SHIMS, handles, 1, whole,
+            sizeof(whole));
+    ck_assert_int_eq(connection.buffered, 0);
+    ck_assert_int_eq(connection.discarding, 0xfffffff8);
+    ck_assert_int_eq(responses_received, 0);
+    ck_assert(!handle.completed);
+}
+END_TEST
+
+START_TEST (test_invalid_header_is_refused)
+{
+    activate_routing();
+    uint8_t garbage[] = {0x2, 0x2, 0x80, 0x01, 0x0, 0x0, 0x0, 0x0};
+    diagnostic_doip_receive(&connection, &SHIMS, NULL, 0, garbage,
+            sizeof(garbage));
+    ck_assert_int_eq(written_size, 9);
+    ck_assert_int_eq(diagnostic_read_uint16(&written[2]),
+            DIAGNOSTIC_DOIP_GENERIC_NACK);
+    ck_assert_int_eq(written[8], 0x0);
+}
+END_TEST
+
+// A DoIP entity on loopback that answers routing activation, checks the
+// tester is alive and then answers one read with a long response, the way
+// a gateway would over Ethernet - or refuses the read, if it has a
+// nack_code.
+typedef struct {
+    int listener;
+    uint8_t nack_code;
+    bool request_received;
+    bool alive_check_answered;
+} StandIn;
+
+static bool read_exactly(int fd, uint8_t* data, uint32_t size) {
+    while(size > 0) {
+        ssize_t count = recv(fd, data, size, 0);
+        if(count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool read_message(int fd, uint8_t* message, uint32_t capacity) {
+    if(!read_exactly(fd, message, DIAGNOSTIC_DOIP_HEADER_SIZE)) {
+        return false;
+    }
+    uint32_t length = diagnostic_read_uint32(&message[4]);
+    return length <= capacity - DIAGNOSTIC_DOIP_HEADER_SIZE &&
+            read_exactly(fd, &message[DIAGNOSTIC_DOIP_HEADER_SIZE], length);
+}
+
+static void* run_stand_in(void* context) {
+    StandIn* stand_in = (StandIn*) context;
+    int fd = accept(stand_in->listener, NULL, NULL);
+    static uint8_t message[DID_LENGTH + 32];
+
+    if(read_message(fd, message, sizeof(message)) &&
+            diagnostic_read_uint16(&message[2]) ==
+                DIAGNOSTIC_DOIP_ROUTING_ACTIVATION_REQUEST) {
+        uint32_t size = build_routing_response(message,
+                DIAGNOSTIC_DOIP_ROUTING_SUCCESSFUL);
+        send(fd, message, size, 0);
+    }
+
+    if(read_message(fd, message, sizeof(message)) &&
+            diagnostic_read_uint16(&message[2]) ==
+                DIAGNOSTIC_DOIP_DIAGNOSTIC_MESSAGE &&
+            diagnostic_read_uint16(&message[10]) == ENTITY_ADDRESS &&
+            message[12] == 0x22) {
+        stand_in->request_received = true;
+        if(stand_in->nack_code != 0) {
+            uint8_t nack[] = {0x10, 0x01, 0x0e, 0x00, stand_in->nack_code};
+            uint32_t size = build_message(message,
+                    DIAGNOSTIC_DOIP_DIAGNOSTIC_NACK, nack, sizeof(nack));
+            send(fd, message, size, 0);
+            close(fd);
+            return NULL;
+        }
+
+        uint32_t size = build_message(message,
+                DIAGNOSTIC_DOIP_ALIVE_CHECK_REQUEST, NULL, 0);
+        uint8_t ack[] = {0x10, 0x01, 0x0e, 0x00, 0x00};
+        size += build_message(&message[size], DIAGNOSTIC_DOIP_DIAGNOSTIC_ACK,
+                ack, sizeof(ack));
+        send(fd, message, size, 0);
+
+        size = build_did_response(message, DID_LENGTH);
+        send(fd, message, size, 0);
+    }
+
+    if(read_message(fd, message, sizeof(message))) {
+        stand_in->alive_check_answered = diagnostic_read_uint16(&message[2])
+                == DIAGNOSTIC_DOIP_ALIVE_CHECK_RESPONSE;
+    }
+    close(fd);
+    return NULL;
+}
+
+bool socket_write(const uint8_t* data, uint32_t size, void* context) {
+    return send(*(int*) context, data, size, 0) == (ssize_t) size;
+}
+
+// Feed the connection from the socket until 'done' is set, in small reads so
+// messages arrive split.
+static void pump(int fd, DiagnosticRequestHandle* handles[],
+        size_t handle_count, bool* done) {
+    uint8_t data[700];
+    struct pollfd poll_fd = {fd: fd, events: POLLIN};
+    while(!*done && poll(&poll_fd, 1, 2000) > 0) {
+        ssize_t count = recv(fd, data, sizeof(data), 0);
+        if(count <= 0) {
+            break;
+        }
+        diagnostic_doip_receive(&connection, &SHIMS, handles, handle_count,
+                data, count);
+    }
+}
+
+// Connect to a stand-in entity on loopback, activate routing and read the
+// DID from it.
+static DiagnosticRequestHandle read_from_stand_in(StandIn* stand_in) {
+    stand_in->listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    ck_assert_int_eq(bind(stand_in->listener, (struct sockaddr*) &address,
+                sizeof(address)), 0);
+    ck_assert_int_eq(listen(stand_in->listener, 1), 0);
+    getsockname(stand_in->listener, (struct sockaddr*) &address,
+            &address_length);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_stand_in, stand_in);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_eq(connect(fd, (struct sockaddr*) &address,
+                sizeof(address)), 0);
+    diagnostic_doip_init(&connection, DIAGNOSTIC_DOIP_DEFAULT_TESTER_ADDRESS,
+            socket_write, &fd);
+
+    ck_assert(diagnostic_doip_activate_routing(&connection));
+    pump(fd, NULL, 0, &connection.routing_active);
+    ck_assert(connection.routing_active);
+
+    DiagnosticRequestHandle handle = start_did_read();
+    DiagnosticRequestHandle* handles[] = {&handle};
+    pump(fd, handles, 1, &handle.completed);
+
+    shutdown(fd, SHUT_WR);
+    pthread_join(thread, NULL);
+    close(fd);
+    close(stand_in->listener);
+    return handle;
+}
+
+START_TEST (test_loopback_entity)
+{
+    StandIn stand_in = {0};
+    DiagnosticRequestHandle handle = read_from_stand_in(&stand_in);
+
+    ck_assert(stand_in.request_received);
+    ck_assert(stand_in.alive_check_answered);
+    ck_assert(handle.success);
+    ck_assert_int_eq(responses_received, 1);
+    ck_assert_int_eq(last_response.extended_payload_length, DID_LENGTH);
+    ck_assert_int_eq(last_payload[DID_LENGTH - 1], (DID_LENGTH - 1) & 0xff);
+}
+END_TEST
+
+START_TEST (test_loopback_entity_refuses_request)
+{
+    // unknown target address
+    StandIn stand_in = {nack_code: 0x3};
+    DiagnosticRequestHandle handle = read_from_stand_in(&stand_in);
+
+    // without waiting for the response timeout
+    ck_assert(stand_in.request_received);
+    ck_assert_int_eq(connection.nacks, 1);
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+    ck_assert_int_eq(responses_received, 1);
+    ck_assert(!last_response.success);
+    ck_assert(!last_response.timed_out);
+    ck_assert_int_eq(last_response.negative_response_code, 0x3);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            DIAGNOSTIC_NO_DEADLINE);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("doip");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_doip, NULL);
+    tcase_add_test(tc_core, test_routing_activation);
+    tcase_add_test(tc_core, test_request_fails_without_routing);
+    tcase_add_test(tc_core, test_request_is_one_message);
+    tcase_add_test(tc_core, test_response_split_across_reads);
+    tcase_add_test(tc_core, test_alive_check_and_nack);
+    tcase_add_test(tc_core, test_oversized_message_is_skipped);
+    tcase_add_test(tc_core, test_huge_length_is_skipped);
+    tcase_add_test(tc_core, test_invalid_header_is_refused);
+    tcase_add_test(tc_core, test_loopback_entity);
+    tcase_add_test(tc_core, test_loopback_entity_refuses_request);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+#include <uds/uds.h>
+#include <uds/download.h>
+#include <uds/framing.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+
+#define IMAGE_SIZE 6000
+#define MAX_FRAMES 1024
+
+typedef struct {
+    uint8_t data[8];
+    uint8_t size;
+} Frame;
+
+uint8_t image[IMAGE_SIZE];
+DiagnosticDownload download;
+DiagnosticDownloadConfig config;
+
+// The frames the tester has sent that the mock ECU hasn't seen yet.
+Frame sent[MAX_FRAMES];
+int sent_count;
+
+// The mock ECU.
+DiagnosticFrameReceiver ecu_receiver;
+uint8_t ecu_message[4096];
+uint8_t ecu_data_format;
+uint8_t ecu_address_format;
+uint16_t ecu_max_block_length;
+bool ecu_rejects_compression;
+uint8_t ecu_transfer_nrc;
+uint8_t ecu_next_sequence;
+uint32_t ecu_blocks;
+bool ecu_sequence_error;
+uint8_t received[IMAGE_SIZE * 2];
+uint32_t received_length;
+bool transfer_exited;
+
+bool read_image(uint32_t offset, uint8_t* buffer, uint32_t length,
+        void* context) {
+    if(offset + length > IMAGE_SIZE) {
+        return false;
+    }
+    memcpy(buffer, image + offset, length);
+    return true;
+}
+
+bool record_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    ck_assert_int_eq(arbitration_id, 0x7e0);
+    ck_assert_int_lt(sent_count, MAX_FRAMES);
+    memcpy(sent[sent_count].data, data, size);
+    sent[sent_count].size = size;
+    ++sent_count;
+    return true;
+}
+
+static void ecu_reply(const uint8_t* payload, uint8_t length) {
+    uint8_t frame[8] = {length};
+    memcpy(&frame[1], payload, length);
+    diagnostic_download_receive_can_frame(&download, 0x7e8, frame,
+            sizeof(frame));
+}
+
+static void ecu_handle_message(const uint8_t* message, uint32_t length) {
+    switch(message[0]) {
+        case DIAGNOSTIC_SERVICE_REQUEST_DOWNLOAD: {
+            ecu_data_format = message[1];
+            ecu_address_format = message[2];
+            if(ecu_rejects_compression && ecu_data_format != 0) {
+                const uint8_t response[] = {0x7f, 0x34, 0x31};
+                ecu_reply(response, sizeof(response));
+            } else {
+                const uint8_t response[] = {0x74, 0x20,
+                    ecu_max_block_length >> 8, ecu_max_block_length & 0xff};
+                ecu_reply(response, sizeof(response));
+            }
+            break;
+        }
+        case DIAGNOSTIC_SERVICE_TRANSFER_DATA: {
+            if(message[1] != ecu_next_sequence) {
+                ecu_sequence_error = true;
+            }
+            ++ecu_next_sequence;
+            ++ecu_blocks;
+            memcpy(&received[received_length], &message[2], length - 2);
+            received_length += length - 2;
+            if(ecu_transfer_nrc != 0) {
+                const uint8_t response[] = {0x7f, 0x36, ecu_transfer_nrc};
+                ecu_reply(response, sizeof(response));
+            } else {
+                const uint8_t response[] = {0x76, message[1]};
+                ecu_reply(response, sizeof(response));
+            }
+            break;
+        }
+        case DIAGNOSTIC_SERVICE_REQUEST_TRANSFER_EXIT: {
+            transfer_exited = true;
+            const uint8_t response[] = {0x77};
+            ecu_reply(response, sizeof(response));
+            break;
+        }
+    }
+}
+
+// Pass the tester's frames to the ECU, and its flow control and responses
+// back, until neither has anything more to say.
+static void run_ecu() {
+    while(sent_count > 0) {
+        // what the tester sends in reply joins the back of the list
+        Frame frame = sent[0];
+        --sent_count;
+        memmove(&sent[0], &sent[1], sent_count * sizeof(Frame));
+
+        uint8_t flow_control[DIAGNOSTIC_FLOW_CONTROL_LENGTH];
+        uint8_t flow_control_length;
+        DiagnosticFramingStatus status = diagnostic_framing_receive(
+                &ecu_receiver, frame.data, frame.size, flow_control,
+                &flow_control_length);
+        if(flow_control_length > 0) {
+            diagnostic_download_receive_can_frame(&download, 0x7e8,
+                    flow_control, flow_control_length);
+        }
+        if(status == DIAGNOSTIC_FRAMING_COMPLETE) {
+            uint32_t length = ecu_receiver.length;
+            diagnostic_framing_receive_init(&ecu_receiver, ecu_message,
+                    sizeof(ecu_message));
+            ecu_handle_message(ecu_message, length);
+        }
+    }
+}
+
+void setup_download() {
+    setup();
+    SHIMS.send_can_message = record_send_can;
+    sent_count = 0;
+    diagnostic_framing_receive_init(&ecu_receiver, ecu_message,
+            sizeof(ecu_message));
+    ecu_max_block_length = 258;
+    ecu_rejects_compression = false;
+    ecu_transfer_nrc = 0;
+    ecu_next_sequence = 1;
+    ecu_blocks = 0;
+    ecu_sequence_error = false;
+    received_length = 0;
+    transfer_exited = false;
+
+    // compressible, like most firmware
+    int i;
+    for(i = 0; i < IMAGE_SIZE; ++i) {
+        image[i] = i % 3000 < 2000 ? "\x10\xb5\x04\x46\x00\xf0"[i % 6] : 0xff;
+    }
+
+    DiagnosticDownloadConfig defaults = {
+        arbitration_id: 0x7e0,
+        memory_address: 0x8000,
+        memory_size: IMAGE_SIZE,
+        compression: DIAGNOSTIC_COMPRESSION_LZSS,
+        compression_method: 0x1,
+        read: read_image,
+        context: NULL
+    };
+    config = defaults;
+}
+
+START_TEST (test_compressed_download)
+{
+    diagnostic_download_init(&download, &SHIMS, &config);
+    ck_assert(diagnostic_download_start(&download));
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_REQUESTING);
+    run_ecu();
+
+    ck_assert_int_eq(ecu_data_format, 0x10);
+    ck_assert_int_eq(ecu_address_format, 0x44);
+    ck_assert(diagnostic_download_finished(&download));
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_COMPLETE);
+    ck_assert(download.compressed);
+    ck_assert(transfer_exited);
+    ck_assert(!ecu_sequence_error);
+    ck_assert_int_eq(download.block_length, 256);
+    ck_assert_int_eq(download.blocks, ecu_blocks);
+    ck_assert_int_eq(download.image_offset, IMAGE_SIZE);
+    ck_assert_int_eq(download.transferred, received_length);
+    ck_assert_int_lt(download.transferred, IMAGE_SIZE / 5);
+
+    uint8_t decompressed[IMAGE_SIZE];
+    ck_assert_int_eq(diagnostic_lzss_decompress(received, received_length,
+                decompressed, sizeof(decompressed)), IMAGE_SIZE);
+    ck_assert_int_eq(memcmp(decompressed, image, IMAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_falls_back_to_uncompressed)
+{
+    ecu_rejects_compression = true;
+    config.address_length = 3;
+    config.size_length = 2;
+    diagnostic_download_init(&download, &SHIMS, &config);
+    diagnostic_download_start(&download);
+    run_ecu();
+
+    ck_assert_int_eq(ecu_data_format, 0x0);
+    ck_assert_int_eq(ecu_address_format, 0x23);
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_COMPLETE);
+    ck_assert(!download.compressed);
+    ck_assert_int_eq(download.transferred, IMAGE_SIZE);
+    ck_assert_int_eq(download.blocks, (IMAGE_SIZE + 255) / 256);
+    ck_assert_int_eq(received_length, IMAGE_SIZE);
+    ck_assert_int_eq(memcmp(received, image, IMAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_sequence_counter_wraps)
+{
+    config.compression = DIAGNOSTIC_COMPRESSION_NONE;
+    ecu_max_block_length = 12;
+    diagnostic_download_init(&download, &SHIMS, &config);
+    diagnostic_download_start(&download);
+    run_ecu();
+
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_COMPLETE);
+    ck_assert_int_eq(download.blocks, IMAGE_SIZE / 10);
+    ck_assert(!ecu_sequence_error);
+    ck_assert_int_eq(memcmp(received, image, IMAGE_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_failures)
+{
+    // generalProgrammingFailure
+    ecu_transfer_nrc = 0x72;
+    diagnostic_download_init(&download, &SHIMS, &config);
+    diagnostic_download_start(&download);
+    run_ecu();
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_FAILED);
+    ck_assert_int_eq(download.negative_response_code, 0x72);
+    ck_assert_int_eq(download.blocks, 0);
+    ck_assert(!transfer_exited);
+
+    // an image that can't be read
+    setup_download();
+    config.memory_size = IMAGE_SIZE + 1;
+    config.compression = DIAGNOSTIC_COMPRESSION_NONE;
+    ecu_max_block_length = 4095;
+    diagnostic_download_init(&download, &SHIMS, &config);
+    diagnostic_download_start(&download);
+    run_ecu();
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_FAILED);
+    ck_assert_int_eq(download.negative_response_code, NRC_SUCCESS);
+    ck_assert_int_eq(download.blocks, 1);
+
+    // a block too short for compression
+    setup_download();
+    ecu_max_block_length = 10;
+    diagnostic_download_init(&download, &SHIMS, &config);
+    diagnostic_download_start(&download);
+    run_ecu();
+    ck_assert_int_eq(download.state, DIAGNOSTIC_DOWNLOAD_FAILED);
+    ck_assert_int_eq(ecu_blocks, 0);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("download");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_download, NULL);
+    tcase_add_test(tc_core, test_compressed_download);
+    tcase_add_test(tc_core, test_falls_back_to_uncompressed);
+    tcase_add_test(tc_core, test_sequence_counter_wraps);
+    tcase_add_test(tc_core, test_failures);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+#include <uds/uds.h>
+#include <uds/dynamic.h>
+#include <uds/addressing.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern uint8_t last_can_payload_size;
+
+DiagnosticDynamicPoller poller;
+uint16_t signals_seen;
+uint16_t last_source_did;
+uint8_t last_data[8];
+
+void signal_received(const DiagnosticDynamicSignal* signal,
+        const uint8_t* data, void* context) {
+    ++signals_seen;
+    last_source_did = signal->source_did;
+    memcpy(last_data, data, signal->length);
+}
+
+void setup_dynamic() {
+    setup();
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    signals_seen = 0;
+    diagnostic_dynamic_poller_init(&poller, &SHIMS, 0x7e0);
+}
+
+static void receive(const uint8_t* frame, uint8_t size) {
+    diagnostic_dynamic_receive_can_frame(&poller, 0x7e8, frame, size);
+}
+
+static void assert_sent(const uint8_t* frame, uint8_t size) {
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x7e0);
+    ck_assert_int_eq(memcmp(last_can_payload_sent, frame, size), 0);
+}
+
+static const uint8_t FLOW_CONTROL[] = {0x30, 0x0, 0x0};
+static const uint8_t NOTHING_TO_CLEAR[] = {0x3, 0x7f, 0x2c, 0x31};
+static const uint8_t DEFINITION_REFUSED[] = {0x3, 0x7f, 0x2c, 0x31};
+
+START_TEST (test_plan_merges_ranges)
+{
+    diagnostic_dynamic_add_signal(&poller, 0xf40d, 0, 1, NULL, NULL);
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 5, 2, NULL, NULL);
+    diagnostic_dynamic_add_signal(&poller, 0x2000, 0, 1, NULL, NULL);
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 4, 2, NULL, NULL);
+    diagnostic_dynamic_add_signal(&poller, 0xf40d, 1, 1, NULL, NULL);
+    ck_assert(diagnostic_dynamic_plan(&poller));
+
+    // 4 bytes fit a single frame response, so the 3 ranges take 2 DIDs
+    ck_assert_int_eq(poller.composite_count, 2);
+    const DiagnosticDynamicComposite* first = &poller.composites[0];
+    ck_assert_int_eq(first->identifier, 0xf300);
+    ck_assert_int_eq(first->element_count, 2);
+    ck_assert_int_eq(first->length, 4);
+    ck_assert_int_eq(first->elements[0].source_did, 0x1234);
+    ck_assert_int_eq(first->elements[0].position, 4);
+    ck_assert_int_eq(first->elements[0].length, 3);
+    ck_assert_int_eq(first->elements[1].source_did, 0x2000);
+    ck_assert_int_eq(poller.composites[1].identifier, 0xf301);
+    ck_assert_int_eq(poller.composites[1].elements[0].source_did, 0xf40d);
+    ck_assert_int_eq(poller.composites[1].length, 2);
+
+    // two frames hold all of them
+    poller.max_response_frames = 2;
+    ck_assert(diagnostic_dynamic_plan(&poller));
+    ck_assert_int_eq(poller.composite_count, 1);
+    ck_assert_int_eq(poller.composites[0].length, 6);
+}
+END_TEST
+
+START_TEST (test_capacity)
+{
+    DiagnosticAddress address = diagnostic_addressing_default(0x7e0);
+    ck_assert_int_eq(diagnostic_dynamic_capacity(&address, 1), 4);
+    ck_assert_int_eq(diagnostic_dynamic_capacity(&address, 3), 17);
+
+    address.frame_size = 64;
+    ck_assert_int_eq(diagnostic_dynamic_capacity(&address, 1), 59);
+    ck_assert_int_eq(diagnostic_dynamic_capacity(&address, 4),
+            MAX_UDS_RESPONSE_PAYLOAD_LENGTH);
+
+    address.frame_size = 8;
+    address.mode = DIAGNOSTIC_ADDRESSING_EXTENDED;
+    ck_assert_int_eq(diagnostic_dynamic_capacity(&address, 1), 3);
+}
+END_TEST
+
+START_TEST (test_define_then_read)
+{
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 1, 2, signal_received,
+            NULL);
+    ck_assert(diagnostic_dynamic_poll(&poller));
+    ck_assert(!diagnostic_dynamic_poll(&poller));
+
+    const uint8_t clear[] = {0x4, 0x2c, 0x3, 0xf3, 0x0};
+    assert_sent(clear, sizeof(clear));
+    receive(NOTHING_TO_CLEAR, sizeof(NOTHING_TO_CLEAR));
+
+    const uint8_t define[] = {0x10, 0x8, 0x2c, 0x1, 0xf3, 0x0, 0x12, 0x34};
+    assert_sent(define, sizeof(define));
+    receive(FLOW_CONTROL, sizeof(FLOW_CONTROL));
+    const uint8_t rest[] = {0x21, 0x2, 0x2};
+    assert_sent(rest, sizeof(rest));
+
+    const uint8_t defined[] = {0x4, 0x6c, 0x1, 0xf3, 0x0};
+    receive(defined, sizeof(defined));
+    ck_assert(poller.composites[0].defined);
+    const uint8_t read[] = {0x3, 0x22, 0xf3, 0x0};
+    assert_sent(read, sizeof(read));
+
+    const uint8_t data[] = {0x5, 0x62, 0xf3, 0x0, 0xab, 0xcd};
+    receive(data, sizeof(data));
+    ck_assert_int_eq(signals_seen, 1);
+    ck_assert_int_eq(last_source_did, 0x1234);
+    ck_assert_int_eq(last_data[0], 0xab);
+    ck_assert_int_eq(last_data[1], 0xcd);
+    ck_assert(diagnostic_dynamic_finished(&poller));
+    ck_assert_int_eq(poller.polls, 1);
+
+    // the next poll just reads
+    ck_assert(diagnostic_dynamic_poll(&poller));
+    assert_sent(read, sizeof(read));
+    receive(data, sizeof(data));
+    ck_assert_int_eq(signals_seen, 2);
+    ck_assert_int_eq(poller.polls, 2);
+}
+END_TEST
+
+START_TEST (test_forgotten_definition_is_redefined)
+{
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 0, 1, signal_received,
+            NULL);
+    diagnostic_dynamic_plan(&poller);
+    // as if the definitions were made before the ECU was reset
+    poller.composites[0].defined = true;
+
+    diagnostic_dynamic_poll(&poller);
+    const uint8_t read[] = {0x3, 0x22, 0xf3, 0x0};
+    assert_sent(read, sizeof(read));
+    const uint8_t unknown[] = {0x3, 0x7f, 0x22, 0x31};
+    receive(unknown, sizeof(unknown));
+
+    ck_assert_int_eq(poller.redefinitions, 1);
+    const uint8_t clear[] = {0x4, 0x2c, 0x3, 0xf3, 0x0};
+    assert_sent(clear, sizeof(clear));
+    receive(NOTHING_TO_CLEAR, sizeof(NOTHING_TO_CLEAR));
+    receive(FLOW_CONTROL, sizeof(FLOW_CONTROL));
+    const uint8_t defined[] = {0x4, 0x6c, 0x1, 0xf3, 0x0};
+    receive(defined, sizeof(defined));
+
+    // and the poll carries on where it was
+    assert_sent(read, sizeof(read));
+    const uint8_t data[] = {0x4, 0x62, 0xf3, 0x0, 0x7};
+    receive(data, sizeof(data));
+    ck_assert_int_eq(signals_seen, 1);
+    ck_assert_int_eq(last_data[0], 0x7);
+    ck_assert(diagnostic_dynamic_finished(&poller));
+    ck_assert_int_eq(poller.read_failures, 0);
+}
+END_TEST
+
+START_TEST (test_refused_definition_is_replanned)
+{
+    poller.max_response_frames = 2;
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 0, 1, signal_received,
+            NULL);
+    diagnostic_dynamic_add_signal(&poller, 0x2000, 2, 1, signal_received,
+            NULL);
+    diagnostic_dynamic_poll(&poller);
+    ck_assert_int_eq(poller.composite_count, 1);
+
+    receive(NOTHING_TO_CLEAR, sizeof(NOTHING_TO_CLEAR));
+    receive(FLOW_CONTROL, sizeof(FLOW_CONTROL));
+    receive(DEFINITION_REFUSED, sizeof(DEFINITION_REFUSED));
+
+    // split in two, and cleared and defined from the start
+    ck_assert_int_eq(poller.replans, 1);
+    ck_assert_int_eq(poller.max_elements, 1);
+    ck_assert_int_eq(poller.composite_count, 2);
+    const uint8_t clear[] = {0x4, 0x2c, 0x3, 0xf3, 0x0};
+    assert_sent(clear, sizeof(clear));
+
+    // a single range that's refused is read from its own DID
+    receive(NOTHING_TO_CLEAR, sizeof(NOTHING_TO_CLEAR));
+    receive(FLOW_CONTROL, sizeof(FLOW_CONTROL));
+    receive(DEFINITION_REFUSED, sizeof(DEFINITION_REFUSED));
+    ck_assert(poller.composites[0].direct);
+    const uint8_t next_clear[] = {0x4, 0x2c, 0x3, 0xf3, 0x1};
+    assert_sent(next_clear, sizeof(next_clear));
+
+    receive(NOTHING_TO_CLEAR, sizeof(NOTHING_TO_CLEAR));
+    receive(FLOW_CONTROL, sizeof(FLOW_CONTROL));
+    const uint8_t defined[] = {0x4, 0x6c, 0x1, 0xf3, 0x1};
+    receive(defined, sizeof(defined));
+
+    const uint8_t direct_read[] = {0x3, 0x22, 0x12, 0x34};
+    assert_sent(direct_read, sizeof(direct_read));
+    const uint8_t source_data[] = {0x5, 0x62, 0x12, 0x34, 0x42, 0x43};
+    receive(source_data, sizeof(source_data));
+    ck_assert_int_eq(signals_seen, 1);
+    ck_assert_int_eq(last_source_did, 0x1234);
+    ck_assert_int_eq(last_data[0], 0x42);
+
+    const uint8_t read[] = {0x3, 0x22, 0xf3, 0x1};
+    assert_sent(read, sizeof(read));
+    const uint8_t data[] = {0x4, 0x62, 0xf3, 0x1, 0x99};
+    receive(data, sizeof(data));
+    ck_assert_int_eq(signals_seen, 2);
+    ck_assert_int_eq(last_source_did, 0x2000);
+    ck_assert_int_eq(last_data[0], 0x99);
+    ck_assert(diagnostic_dynamic_finished(&poller));
+}
+END_TEST
+
+START_TEST (test_silent_read_is_skipped)
+{
+    diagnostic_dynamic_add_signal(&poller, 0x1234, 0, 4, signal_received,
+            NULL);
+    diagnostic_dynamic_add_signal(&poller, 0x2000, 0, 4, signal_received,
+            NULL);
+    diagnostic_dynamic_plan(&poller);
+    poller.composites[0].defined = true;
+    poller.composites[1].defined = true;
+
+    uint64_t deadline;
+    diagnostic_dynamic_poll(&poller);
+    deadline = diagnostic_dynamic_process(&poller, mock_time_us);
+    mock_time_us = deadline;
+    diagnostic_dynamic_process(&poller, mock_time_us);
+    ck_assert_int_eq(poller.read_failures, 1);
+
+    const uint8_t read[] = {0x3, 0x22, 0xf3, 0x1};
+    assert_sent(read, sizeof(read));
+    ck_assert(!diagnostic_dynamic_finished(&poller));
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("dynamic");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_dynamic, NULL);
+    tcase_add_test(tc_core, test_plan_merges_ranges);
+    tcase_add_test(tc_core, test_capacity);
+    tcase_add_test(tc_core, test_define_then_read);
+    tcase_add_test(tc_core, test_forgotten_definition_is_redefined);
+    tcase_add_test(tc_core, test_refused_definition_is_replanned);
+    tcase_add_test(tc_core, test_silent_read_is_skipped);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
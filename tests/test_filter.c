@@ -0,0 +1,225 @@
+#include <uds/uds.h>
+#include <uds/filter.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+
+DiagnosticAcceptFilter filter;
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+void setup_filter() {
+    setup();
+    diagnostic_filter_reset(&filter);
+    SHIMS.filter = &filter;
+}
+
+START_TEST (test_empty_filter_rejects)
+{
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e8));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x18daf110));
+    DiagnosticFilterRule rules[4];
+    ck_assert_int_eq(diagnostic_filter_export(&filter, rules, 4), 0);
+}
+END_TEST
+
+START_TEST (test_reference_counting)
+{
+    uint32_t generation = filter.generation;
+    ck_assert(diagnostic_filter_add(&filter, 0x7e8));
+    ck_assert(diagnostic_filter_add(&filter, 0x7e8));
+    ck_assert(diagnostic_filter_add(&filter, 0x18daf110));
+    ck_assert(filter.generation != generation);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e8));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e9));
+    ck_assert(diagnostic_filter_accepts(&filter, 0x18daf110));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x18daf111));
+
+    diagnostic_filter_remove(&filter, 0x7e8);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e8));
+    diagnostic_filter_remove(&filter, 0x7e8);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e8));
+    diagnostic_filter_remove(&filter, 0x18daf110);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x18daf110));
+}
+END_TEST
+
+START_TEST (test_overflow_accepts_everything)
+{
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_FILTER_MAX_IDS; ++i) {
+        ck_assert(diagnostic_filter_add(&filter, 0x100 + i));
+    }
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e8));
+    ck_assert(!diagnostic_filter_add(&filter, 0x7e8));
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e8));
+    ck_assert(diagnostic_filter_accepts(&filter, 0x18daf110));
+
+    DiagnosticFilterRule rules[4];
+    ck_assert_int_eq(diagnostic_filter_export(&filter, rules, 4), 1);
+    ck_assert_int_eq(rules[0].mask, 0);
+}
+END_TEST
+
+START_TEST (test_overflow_cleared_by_removal)
+{
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_FILTER_MAX_IDS; ++i) {
+        diagnostic_filter_add(&filter, 0x100 + i);
+    }
+    ck_assert(!diagnostic_filter_add(&filter, 0x7e8));
+    ck_assert(!diagnostic_filter_add(&filter, 0x7e9));
+    ck_assert_int_eq(filter.overflows, 2);
+
+    // a slot comes free, but the overflowed references are still out there
+    diagnostic_filter_remove(&filter, 0x100);
+    ck_assert(diagnostic_filter_add(&filter, 0x7e9));
+    diagnostic_filter_remove(&filter, 0x7e8);
+    ck_assert_int_eq(filter.overflows, 1);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7ea));
+
+    // 0x7e9 has one reference in the filter and one that overflowed
+    diagnostic_filter_remove(&filter, 0x7e9);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7ea));
+    diagnostic_filter_remove(&filter, 0x7e9);
+    ck_assert_int_eq(filter.overflows, 0);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e9));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x100));
+    ck_assert(diagnostic_filter_accepts(&filter, 0x101));
+
+    DiagnosticFilterRule rules[4];
+    ck_assert_int_gt(diagnostic_filter_export(&filter, rules, 4), 1);
+
+    // and a reset clears it too
+    ck_assert(diagnostic_filter_add(&filter, 0x100));
+    ck_assert(!diagnostic_filter_add(&filter, 0x7ea));
+    diagnostic_filter_reset(&filter);
+    ck_assert_int_eq(filter.overflows, 0);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7ea));
+}
+END_TEST
+
+START_TEST (test_export_merges_ranges)
+{
+    uint32_t id;
+    for(id = 0x7e8; id <= 0x7ef; ++id) {
+        diagnostic_filter_add(&filter, id);
+    }
+    diagnostic_filter_add(&filter, 0x101);
+    diagnostic_filter_add(&filter, 0x18daf110);
+
+    DiagnosticFilterRule rules[4];
+    ck_assert_int_eq(diagnostic_filter_export(&filter, rules, 4), 3);
+    ck_assert_int_eq(rules[0].id, 0x101);
+    ck_assert_int_eq(rules[0].mask, 0x7ff);
+    ck_assert_int_eq(rules[1].id, 0x7e8);
+    ck_assert_int_eq(rules[1].mask, 0x7f8);
+    ck_assert(!rules[1].extended);
+    ck_assert_int_eq(rules[2].id, 0x18daf110);
+    ck_assert_int_eq(rules[2].mask, 0x1fffffff);
+    ck_assert(rules[2].extended);
+
+    ck_assert_int_eq(diagnostic_filter_export(&filter, rules, 1), 3);
+}
+END_TEST
+
+START_TEST (test_physical_request_updates_filter)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x108));
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x100));
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x108, can_data,
+            sizeof(can_data));
+    ck_assert(last_response_was_received);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x108));
+}
+END_TEST
+
+START_TEST (test_functional_request_held_until_released)
+{
+    DiagnosticRequest request = {
+        arbitration_id: OBD2_FUNCTIONAL_BROADCAST_ID,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e8));
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7ef));
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, can_data,
+            sizeof(can_data));
+    ck_assert(handle.completed);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e9));
+
+    diagnostic_request_release(&SHIMS, &handle);
+    ck_assert(!diagnostic_filter_accepts(&filter, 0x7e9));
+    // releasing twice must not drop references held by other requests
+    diagnostic_filter_add(&filter, 0x7e9);
+    diagnostic_request_release(&SHIMS, &handle);
+    ck_assert(diagnostic_filter_accepts(&filter, 0x7e9));
+}
+END_TEST
+
+START_TEST (test_unrelated_frames_rejected_early)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    DiagnosticResponse response = diagnostic_receive_can_frame(&SHIMS,
+            &handle, 0x200, can_data, sizeof(can_data));
+    ck_assert(!response.completed);
+    ck_assert(!last_response_was_received);
+    ck_assert_int_eq(handle.timestamps.first_response_frame, 0);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("filter");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_filter, NULL);
+    tcase_add_test(tc_core, test_empty_filter_rejects);
+    tcase_add_test(tc_core, test_reference_counting);
+    tcase_add_test(tc_core, test_overflow_accepts_everything);
+    tcase_add_test(tc_core, test_overflow_cleared_by_removal);
+    tcase_add_test(tc_core, test_export_merges_ranges);
+    tcase_add_test(tc_core, test_physical_request_updates_filter);
+    tcase_add_test(tc_core, test_functional_request_held_until_released);
+    tcase_add_test(tc_core, test_unrelated_frames_rejected_early);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,563 @@
+#include <uds/uds.h>
+#include <uds/framing.h>
+#include <uds/addressing.h>
+#include <uds/counters.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+DiagnosticAddressingTable table;
+uint8_t message[6000];
+uint8_t reassembled[6000];
+uint16_t frames_sent;
+uint32_t last_frame_id;
+uint8_t last_frame[DIAGNOSTIC_FD_FRAME_SIZE];
+uint8_t last_frame_size;
+// The number of frames the driver takes before refusing the rest.
+uint16_t frames_accepted;
+DiagnosticCounters counters;
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+bool recording_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    if(frames_sent == frames_accepted) {
+        return false;
+    }
+    ++frames_sent;
+    last_frame_id = arbitration_id;
+    last_frame_size = size;
+    memcpy(last_frame, data, size);
+    return true;
+}
+
+void setup_framing() {
+    setup();
+    SHIMS.send_can_message = recording_send_can;
+    diagnostic_addressing_reset(&table);
+    SHIMS.addressing = &table;
+    frames_sent = 0;
+    frames_accepted = UINT16_MAX;
+    diagnostic_counters_reset(&counters);
+    SHIMS.counters = &counters;
+
+    uint32_t i;
+    for(i = 0; i < sizeof(message); ++i) {
+        message[i] = i * 7;
+    }
+}
+
+// Run a message through a sender and receiver, returning the number of
+// frames it took.
+static uint16_t transfer(uint8_t frame_size, uint32_t length) {
+    DiagnosticFrameSender sender;
+    DiagnosticFrameReceiver receiver;
+    diagnostic_framing_send_init(&sender, frame_size, message, 3,
+            &message[3], length - 3);
+    diagnostic_framing_receive_init(&receiver, reassembled,
+            sizeof(reassembled));
+
+    uint16_t frames = 0;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    uint8_t flow_control[DIAGNOSTIC_FLOW_CONTROL_LENGTH];
+    uint8_t flow_control_length;
+    DiagnosticFramingStatus status = DIAGNOSTIC_FRAMING_IN_PROGRESS;
+    while(status == DIAGNOSTIC_FRAMING_IN_PROGRESS) {
+        uint8_t size = diagnostic_framing_next_frame(&sender, frame);
+        ck_assert(size > 0);
+        ck_assert(size <= frame_size);
+        ++frames;
+        status = diagnostic_framing_receive(&receiver, frame, size,
+                flow_control, &flow_control_length);
+        if(flow_control_length > 0) {
+            ck_assert_int_eq(diagnostic_framing_flow_control(&sender,
+                        flow_control, flow_control_length),
+                    DIAGNOSTIC_FRAMING_IN_PROGRESS);
+        }
+    }
+
+    ck_assert_int_eq(status, DIAGNOSTIC_FRAMING_COMPLETE);
+    ck_assert(sender.completed);
+    ck_assert(sender.success);
+    ck_assert_int_eq(receiver.length, length);
+    ck_assert(memcmp(reassembled, message, length) == 0);
+    return frames;
+}
+
+START_TEST (test_frame_length)
+{
+    ck_assert_int_eq(diagnostic_framing_frame_length(3), 3);
+    ck_assert_int_eq(diagnostic_framing_frame_length(8), 8);
+    ck_assert_int_eq(diagnostic_framing_frame_length(9), 12);
+    ck_assert_int_eq(diagnostic_framing_frame_length(33), 48);
+    ck_assert_int_eq(diagnostic_framing_frame_length(64), 64);
+
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(0), 8);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(8), 8);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(11), 8);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(12), 12);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(50), 48);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(64), 64);
+    ck_assert_int_eq(diagnostic_framing_max_frame_length(255), 64);
+}
+END_TEST
+
+START_TEST (test_separation_time)
+{
+    ck_assert_int_eq(diagnostic_framing_separation_time_us(0), 0);
+    ck_assert_int_eq(diagnostic_framing_separation_time_us(0x7f), 127000);
+    ck_assert_int_eq(diagnostic_framing_separation_time_us(0xf1), 100);
+    ck_assert_int_eq(diagnostic_framing_separation_time_us(0xf9), 900);
+    ck_assert_int_eq(diagnostic_framing_separation_time_us(0x80), 127000);
+}
+END_TEST
+
+START_TEST (test_fd_single_frame)
+{
+    ck_assert_int_eq(transfer(DIAGNOSTIC_FD_FRAME_SIZE, 5), 1);
+    ck_assert_int_eq(transfer(DIAGNOSTIC_FD_FRAME_SIZE, 62), 1);
+    ck_assert_int_eq(transfer(DIAGNOSTIC_CLASSIC_FRAME_SIZE, 7), 1);
+
+    DiagnosticFrameSender sender;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    diagnostic_framing_send_init(&sender, DIAGNOSTIC_FD_FRAME_SIZE, message,
+            40, NULL, 0);
+    ck_assert_int_eq(diagnostic_framing_next_frame(&sender, frame), 42);
+    ck_assert_int_eq(frame[0], 0x0);
+    ck_assert_int_eq(frame[1], 40);
+}
+END_TEST
+
+START_TEST (test_fd_needs_fewer_frames)
+{
+    ck_assert_int_eq(transfer(DIAGNOSTIC_CLASSIC_FRAME_SIZE, 4000), 572);
+    ck_assert_int_eq(transfer(DIAGNOSTIC_FD_FRAME_SIZE, 4000), 64);
+}
+END_TEST
+
+START_TEST (test_escaped_first_frame)
+{
+    DiagnosticFrameSender sender;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    diagnostic_framing_send_init(&sender, DIAGNOSTIC_FD_FRAME_SIZE, message,
+            5000, NULL, 0);
+    ck_assert_int_eq(diagnostic_framing_next_frame(&sender, frame), 64);
+    ck_assert_int_eq(frame[0], 0x10);
+    ck_assert_int_eq(frame[1], 0x0);
+    ck_assert_int_eq((frame[4] << 8) | frame[5], 5000);
+
+    ck_assert_int_eq(transfer(DIAGNOSTIC_FD_FRAME_SIZE, 5000), 80);
+}
+END_TEST
+
+START_TEST (test_block_size)
+{
+    DiagnosticFrameSender sender;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    diagnostic_framing_send_init(&sender, DIAGNOSTIC_CLASSIC_FRAME_SIZE,
+            message, 100, NULL, 0);
+    ck_assert(diagnostic_framing_next_frame(&sender, frame) > 0);
+    ck_assert_int_eq(diagnostic_framing_next_frame(&sender, frame), 0);
+
+    const uint8_t wait[] = {0x31, 0x0, 0x0};
+    ck_assert_int_eq(diagnostic_framing_flow_control(&sender, wait,
+                sizeof(wait)), DIAGNOSTIC_FRAMING_IN_PROGRESS);
+    ck_assert_int_eq(diagnostic_framing_next_frame(&sender, frame), 0);
+
+    const uint8_t continue_two[] = {0x30, 0x2, 0xf5};
+    diagnostic_framing_flow_control(&sender, continue_two,
+            sizeof(continue_two));
+    ck_assert_int_eq(sender.separation_time_us, 500);
+    ck_assert(diagnostic_framing_next_frame(&sender, frame) > 0);
+    ck_assert_int_eq(frame[0], 0x21);
+    ck_assert(diagnostic_framing_next_frame(&sender, frame) > 0);
+    ck_assert_int_eq(frame[0], 0x22);
+    ck_assert_int_eq(diagnostic_framing_next_frame(&sender, frame), 0);
+    ck_assert(sender.waiting_for_flow_control);
+}
+END_TEST
+
+START_TEST (test_flow_control_overflow_aborts)
+{
+    DiagnosticFrameSender sender;
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    diagnostic_framing_send_init(&sender, DIAGNOSTIC_CLASSIC_FRAME_SIZE,
+            message, 100, NULL, 0);
+    diagnostic_framing_next_frame(&sender, frame);
+
+    const uint8_t overflow[] = {0x32, 0x0, 0x0};
+    ck_assert_int_eq(diagnostic_framing_flow_control(&sender, overflow,
+                sizeof(overflow)), DIAGNOSTIC_FRAMING_ERROR);
+    ck_assert(sender.completed);
+    ck_assert(!sender.success);
+}
+END_TEST
+
+START_TEST (test_receive_errors)
+{
+    DiagnosticFrameReceiver receiver;
+    uint8_t buffer[16];
+    uint8_t flow_control[DIAGNOSTIC_FLOW_CONTROL_LENGTH];
+    uint8_t flow_control_length;
+    diagnostic_framing_receive_init(&receiver, buffer, sizeof(buffer));
+
+    const uint8_t too_long[] = {0x10, 0x20, 1, 2, 3, 4, 5, 6};
+    ck_assert_int_eq(diagnostic_framing_receive(&receiver, too_long,
+                sizeof(too_long), flow_control, &flow_control_length),
+            DIAGNOSTIC_FRAMING_ERROR);
+    ck_assert_int_eq(flow_control_length, 3);
+    ck_assert_int_eq(flow_control[0], 0x32);
+
+    const uint8_t first_frame[] = {0x10, 0x10, 1, 2, 3, 4, 5, 6};
+    ck_assert_int_eq(diagnostic_framing_receive(&receiver, first_frame,
+                sizeof(first_frame), flow_control, &flow_control_length),
+            DIAGNOSTIC_FRAMING_IN_PROGRESS);
+    ck_assert_int_eq(flow_control[0], 0x30);
+
+    const uint8_t out_of_order[] = {0x22, 1, 2, 3, 4, 5, 6, 7};
+    ck_assert_int_eq(diagnostic_framing_receive(&receiver, out_of_order,
+                sizeof(out_of_order), flow_control, &flow_control_length),
+            DIAGNOSTIC_FRAMING_ERROR);
+    ck_assert_int_eq(diagnostic_framing_receive(&receiver, out_of_order,
+                sizeof(out_of_order), flow_control, &flow_control_length),
+            DIAGNOSTIC_FRAMING_IGNORED);
+}
+END_TEST
+
+START_TEST (test_frame_size_rounded_down)
+{
+    DiagnosticAddress address = diagnostic_addressing_default(0x7e0);
+    address.frame_size = 50;
+    diagnostic_addressing_add(&table, &address);
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: message,
+        extended_payload_length: 200
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(last_frame_size, 48);
+
+    const uint8_t flow_control[] = {0x30, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert(diagnostic_request_sent(&handle));
+    // 201 bytes in 46 + 3 * 47 + 14
+    ck_assert_int_eq(frames_sent, 5);
+    ck_assert_int_eq(last_frame_size, 16);
+}
+END_TEST
+
+START_TEST (test_fd_request_and_response)
+{
+    DiagnosticAddress address = diagnostic_addressing_default(0x7e0);
+    address.frame_size = DIAGNOSTIC_FD_FRAME_SIZE;
+    diagnostic_addressing_add(&table, &address);
+
+    uint8_t response_buffer[512];
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        payload: {0x1},
+        payload_length: 1,
+        extended_payload: message,
+        extended_payload_length: 200,
+        response_buffer: response_buffer,
+        response_buffer_size: sizeof(response_buffer)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(!diagnostic_request_sent(&handle));
+    ck_assert_int_eq(frames_sent, 1);
+    ck_assert_int_eq(last_frame_size, 64);
+    ck_assert_int_eq(last_frame[0], 0x10);
+    ck_assert_int_eq(last_frame[1], 202);
+
+    const uint8_t flow_control[] = {0x30, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert(diagnostic_request_sent(&handle));
+    ck_assert_int_eq(frames_sent, 4);
+    // the last frame is padded to a valid CAN FD length
+    ck_assert_int_eq(last_frame_size, 16);
+    ck_assert_int_eq(last_frame[15], DIAGNOSTIC_FRAME_PADDING_BYTE);
+
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    uint8_t response[300] = {0x36 + 0x40};
+    DiagnosticFrameSender ecu;
+    diagnostic_framing_send_init(&ecu, DIAGNOSTIC_FD_FRAME_SIZE, response,
+            sizeof(response), NULL, 0);
+    uint8_t size = diagnostic_framing_next_frame(&ecu, frame);
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, frame, size);
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    ck_assert_int_eq(last_frame[0], 0x30);
+
+    diagnostic_framing_flow_control(&ecu, last_frame, last_frame_size);
+    while((size = diagnostic_framing_next_frame(&ecu, frame)) > 0) {
+        ck_assert(!last_response_was_received);
+        diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, frame, size);
+    }
+
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert(last_response_received.multi_frame);
+    ck_assert_int_eq(last_response_received.payload_length,
+            MAX_UDS_RESPONSE_PAYLOAD_LENGTH);
+    ck_assert(last_response_received.extended_payload == &response_buffer[1]);
+    ck_assert_int_eq(last_response_received.extended_payload_length, 299);
+}
+END_TEST
+
+START_TEST (test_separation_time_is_honoured)
+{
+    SHIMS.get_time = mock_get_time;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: message,
+        extended_payload_length: 19
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(frames_sent, 1);
+
+    const uint8_t flow_control[] = {0x30, 0x0, 0x5};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert_int_eq(frames_sent, 2);
+
+    mock_time_us += 4000;
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 2);
+    mock_time_us += 1000;
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 3);
+    ck_assert(diagnostic_request_sent(&handle));
+    ck_assert_int_eq(handle.timestamps.last_frame_sent, mock_time_us);
+}
+END_TEST
+
+// The request fails as soon as the send is aborted, rather than waiting for
+// a response that will never come.
+static void assert_send_aborted(DiagnosticRequestHandle* handle) {
+    ck_assert(handle->completed);
+    ck_assert(!handle->success);
+    ck_assert(last_response_was_received);
+    ck_assert(!last_response_received.success);
+    ck_assert(!last_response_received.timed_out);
+    ck_assert_int_eq(counters.send_failures, 1);
+    ck_assert_int_eq(diagnostic_request_deadline(handle),
+            DIAGNOSTIC_NO_DEADLINE);
+}
+
+START_TEST (test_flow_control_overflow_fails_request)
+{
+    SHIMS.get_time = mock_get_time;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: message,
+        extended_payload_length: 100
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert(!handle.completed);
+
+    const uint8_t overflow[] = {0x32, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, overflow,
+            sizeof(overflow));
+    assert_send_aborted(&handle);
+    ck_assert_int_eq(frames_sent, 1);
+}
+END_TEST
+
+START_TEST (test_refused_frame_fails_request)
+{
+    SHIMS.get_time = mock_get_time;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: message,
+        extended_payload_length: 100
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    // the driver takes the first frame and two consecutive frames
+    frames_accepted = 3;
+    const uint8_t flow_control[] = {0x30, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    assert_send_aborted(&handle);
+    ck_assert_int_eq(frames_sent, 3);
+
+    // and with a separation time, when the frame is sent later
+    setup_framing();
+    SHIMS.get_time = mock_get_time;
+    last_response_was_received = false;
+    handle = diagnostic_request(&SHIMS, &request, response_received_handler);
+    frames_accepted = 2;
+    const uint8_t paced[] = {0x30, 0x0, 0x5};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, paced,
+            sizeof(paced));
+    ck_assert(!handle.completed);
+    mock_time_us += 5000;
+    diagnostic_process_request(&SHIMS, &handle, mock_time_us);
+    assert_send_aborted(&handle);
+}
+END_TEST
+
+START_TEST (test_streaming_receive)
+{
+    DiagnosticFrameSender sender;
+    DiagnosticFrameReceiver receiver;
+    uint8_t buffer[16];
+    diagnostic_framing_send_init(&sender, DIAGNOSTIC_CLASSIC_FRAME_SIZE,
+            message, 100, NULL, 0);
+    diagnostic_framing_receive_init(&receiver, buffer, sizeof(buffer));
+    receiver.streaming = true;
+
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    uint8_t flow_control[DIAGNOSTIC_FLOW_CONTROL_LENGTH];
+    uint8_t flow_control_length;
+    uint32_t streamed = 0;
+    DiagnosticFramingStatus status = DIAGNOSTIC_FRAMING_IN_PROGRESS;
+    while(status == DIAGNOSTIC_FRAMING_IN_PROGRESS) {
+        uint8_t size = diagnostic_framing_next_frame(&sender, frame);
+        status = diagnostic_framing_receive(&receiver, frame, size,
+                flow_control, &flow_control_length);
+        if(flow_control_length > 0) {
+            ck_assert_int_eq(flow_control[0], 0x30);
+            diagnostic_framing_flow_control(&sender, flow_control,
+                    flow_control_length);
+        }
+
+        // every byte is seen once, in order, straight from the frame
+        ck_assert_int_eq(receiver.chunk_offset, streamed);
+        ck_assert(memcmp(receiver.chunk, &message[streamed],
+                    receiver.chunk_length) == 0);
+        streamed += receiver.chunk_length;
+    }
+
+    ck_assert_int_eq(status, DIAGNOSTIC_FRAMING_COMPLETE);
+    ck_assert_int_eq(streamed, 100);
+    ck_assert_int_eq(receiver.length, 100);
+    ck_assert(memcmp(buffer, message, sizeof(buffer)) == 0);
+}
+END_TEST
+
+uint32_t chunks_received;
+uint32_t chunk_bytes;
+
+void chunk_received(const DiagnosticResponseChunk* chunk, void* context) {
+    ck_assert_int_eq(chunk->arbitration_id, 0x7e8);
+    ck_assert_int_eq(chunk->total_length, 2000);
+    ck_assert_int_eq(chunk->offset, chunk_bytes);
+    ck_assert(memcmp(chunk->data, &((uint8_t*) context)[chunk->offset],
+                chunk->length) == 0);
+    ++chunks_received;
+    chunk_bytes += chunk->length;
+}
+
+START_TEST (test_response_chunks)
+{
+    static uint8_t response[2000];
+    uint32_t i;
+    for(i = 0; i < sizeof(response); ++i) {
+        response[i] = i * 3;
+    }
+    response[0] = 0x62;
+    response[1] = 0xf1;
+    response[2] = 0x90;
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x22,
+        has_pid: true,
+        pid: 0xf190,
+        pid_length: 2
+    };
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            &request, response_received_handler);
+    handle.chunk_handler = chunk_received;
+    handle.context = response;
+    chunks_received = 0;
+    chunk_bytes = 0;
+    start_diagnostic_request(&SHIMS, &handle);
+    ck_assert(diagnostic_request_sent(&handle));
+
+    // far longer than the handle's own buffer, with no response_buffer
+    uint8_t frame[DIAGNOSTIC_FD_FRAME_SIZE];
+    DiagnosticFrameSender ecu;
+    diagnostic_framing_send_init(&ecu, DIAGNOSTIC_CLASSIC_FRAME_SIZE, response,
+            sizeof(response), NULL, 0);
+    uint8_t size = diagnostic_framing_next_frame(&ecu, frame);
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, frame, size);
+    ck_assert_int_eq(last_frame[0], 0x30);
+    ck_assert_int_eq(chunks_received, 1);
+    ck_assert_int_eq(chunk_bytes, 6);
+
+    diagnostic_framing_flow_control(&ecu, last_frame, last_frame_size);
+    while((size = diagnostic_framing_next_frame(&ecu, frame)) > 0) {
+        ck_assert(!last_response_was_received);
+        diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, frame, size);
+    }
+
+    ck_assert_int_eq(chunk_bytes, sizeof(response));
+    ck_assert_int_eq(chunks_received, 1 + (sizeof(response) - 6 + 6) / 7);
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.pid, 0xf190);
+    ck_assert_int_eq(last_response_received.payload[0], response[3]);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("framing");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_framing, NULL);
+    tcase_add_test(tc_core, test_frame_length);
+    tcase_add_test(tc_core, test_separation_time);
+    tcase_add_test(tc_core, test_fd_single_frame);
+    tcase_add_test(tc_core, test_fd_needs_fewer_frames);
+    tcase_add_test(tc_core, test_escaped_first_frame);
+    tcase_add_test(tc_core, test_block_size);
+    tcase_add_test(tc_core, test_flow_control_overflow_aborts);
+    tcase_add_test(tc_core, test_receive_errors);
+    tcase_add_test(tc_core, test_frame_size_rounded_down);
+    tcase_add_test(tc_core, test_fd_request_and_response);
+    tcase_add_test(tc_core, test_separation_time_is_honoured);
+    tcase_add_test(tc_core, test_flow_control_overflow_fails_request);
+    tcase_add_test(tc_core, test_refused_frame_fails_request);
+    tcase_add_test(tc_core, test_streaming_receive);
+    tcase_add_test(tc_core, test_response_chunks);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
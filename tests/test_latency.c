@@ -0,0 +1,211 @@
+#include <uds/uds.h>
+#include <uds/latency.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+START_TEST (test_no_clock_no_timestamps)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    fail_unless(handle.completed);
+    ck_assert_int_eq(handle.timestamps.queued, 0);
+    ck_assert_int_eq(handle.timestamps.completed, 0);
+    ck_assert_int_eq(last_response_received.timestamps.completed, 0);
+}
+END_TEST
+
+START_TEST (test_request_timestamps)
+{
+    SHIMS.get_time = mock_get_time;
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    mock_time_us = 100;
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            &request, response_received_handler);
+    mock_time_us = 250;
+    start_diagnostic_request(&SHIMS, &handle);
+    ck_assert_int_eq(handle.timestamps.queued, 100);
+    ck_assert_int_eq(handle.timestamps.first_frame_sent, 250);
+    ck_assert_int_eq(handle.timestamps.last_frame_sent, 250);
+    ck_assert_int_eq(handle.timestamps.first_response_frame, 0);
+
+    mock_time_us = 300;
+    const uint8_t other_data[] = {0x1, 0x2, 0x3};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x123, other_data,
+            sizeof(other_data));
+    ck_assert_int_eq(handle.timestamps.first_response_frame, 0);
+
+    mock_time_us = 1300;
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    fail_unless(handle.completed);
+    ck_assert_int_eq(handle.timestamps.first_response_frame, 1300);
+    ck_assert_int_eq(handle.timestamps.completed, 1300);
+    fail_unless(last_response_was_received);
+    ck_assert_int_eq(last_response_received.timestamps.queued, 100);
+    ck_assert_int_eq(last_response_received.timestamps.completed, 1300);
+}
+END_TEST
+
+START_TEST (test_multi_frame_first_response_frame)
+{
+    SHIMS.get_time = mock_get_time;
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_VEHICLE_INFORMATION,
+        has_pid: true,
+        pid: 0x2
+    };
+    mock_time_us = 10;
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    mock_time_us = 20;
+    const uint8_t can_data[] = {0x10, 0x9, 0x9 + 0x40, 0x2, 0x1, 0x31, 0x46,
+        0x4d};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    mock_time_us = 30;
+    const uint8_t can_data_1[] = {0x21, 0x43, 0x55, 0x39};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data_1, sizeof(can_data_1));
+    fail_unless(handle.completed);
+    ck_assert_int_eq(handle.timestamps.first_response_frame, 20);
+    ck_assert_int_eq(handle.timestamps.completed, 30);
+}
+END_TEST
+
+START_TEST (test_response_latency_recorded)
+{
+    DiagnosticLatencyStats stats;
+    diagnostic_latency_reset(&stats);
+    SHIMS.get_time = mock_get_time;
+    SHIMS.latency_stats = &stats;
+
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    mock_time_us = 1000;
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    mock_time_us = 6000;
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    SHIMS.latency_stats = NULL;
+
+    DiagnosticLatencyStats snapshot;
+    ck_assert_int_eq(diagnostic_latency_snapshot(&stats, &snapshot), 1);
+    const DiagnosticLatencyHistogram* histogram = diagnostic_latency_find(
+            &snapshot, request.arbitration_id + 0x8, request.mode);
+    fail_if(histogram == NULL);
+    ck_assert_int_eq(histogram->count, 1);
+    ck_assert_int_eq(histogram->max_us, 5000);
+    ck_assert_int_eq(histogram->buckets[
+            diagnostic_latency_bucket_index(5000)], 1);
+    fail_unless(diagnostic_latency_find(&snapshot, 0x108, 0x1) == NULL);
+}
+END_TEST
+
+START_TEST (test_bucket_boundaries)
+{
+    uint8_t bucket;
+    for(bucket = 0; bucket < DIAGNOSTIC_LATENCY_BUCKET_COUNT; ++bucket) {
+        uint32_t lower_bound = diagnostic_latency_bucket_lower_bound(bucket);
+        ck_assert_int_eq(diagnostic_latency_bucket_index(lower_bound), bucket);
+        if(bucket > 0) {
+            ck_assert_int_eq(diagnostic_latency_bucket_index(lower_bound - 1),
+                    bucket - 1);
+        }
+    }
+    ck_assert_int_eq(diagnostic_latency_bucket_index(UINT32_MAX),
+            DIAGNOSTIC_LATENCY_BUCKET_COUNT - 1);
+}
+END_TEST
+
+START_TEST (test_percentile)
+{
+    DiagnosticLatencyStats stats;
+    diagnostic_latency_reset(&stats);
+    uint32_t i;
+    for(i = 1; i <= 100; ++i) {
+        diagnostic_latency_record(&stats, 0x7e8, 0x1, i * 100);
+    }
+
+    const DiagnosticLatencyHistogram* histogram = diagnostic_latency_find(
+            &stats, 0x7e8, 0x1);
+    ck_assert_int_eq(histogram->count, 100);
+    uint32_t median = diagnostic_latency_percentile(histogram, 50);
+    ck_assert_int_ge(median, 5000);
+    ck_assert_int_le(median, 5000 * 5 / 4);
+    ck_assert_int_eq(diagnostic_latency_percentile(histogram, 100), 10000);
+}
+END_TEST
+
+START_TEST (test_series_exhausted)
+{
+    DiagnosticLatencyStats stats;
+    diagnostic_latency_reset(&stats);
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_LATENCY_MAX_SERIES; ++i) {
+        fail_unless(diagnostic_latency_record(&stats, 0x7e8 + i, 0x1, 10));
+    }
+    fail_if(diagnostic_latency_record(&stats, 0x7e0, 0x1, 10));
+    ck_assert_int_eq(stats.dropped, 1);
+    fail_unless(diagnostic_latency_record(&stats, 0x7e8, 0x1, 10));
+    ck_assert_int_eq(diagnostic_latency_find(&stats, 0x7e8, 0x1)->count, 2);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("latency");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_no_clock_no_timestamps);
+    tcase_add_test(tc_core, test_request_timestamps);
+    tcase_add_test(tc_core, test_multi_frame_first_response_frame);
+    tcase_add_test(tc_core, test_response_latency_recorded);
+    tcase_add_test(tc_core, test_bucket_boundaries);
+    tcase_add_test(tc_core, test_percentile);
+    tcase_add_test(tc_core, test_series_exhausted);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
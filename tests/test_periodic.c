@@ -0,0 +1,238 @@
+#include <uds/uds.h>
+#include <uds/periodic.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern uint8_t last_can_payload_size;
+extern bool can_frame_was_sent;
+
+DiagnosticPeriodicReceiver receiver;
+uint16_t samples_seen;
+uint16_t last_identifier;
+uint8_t last_data[8];
+uint8_t last_length;
+uint64_t last_time;
+
+void sample_received(const DiagnosticPeriodicSample* sample, void* context) {
+    ++samples_seen;
+    last_identifier = sample->identifier;
+    last_length = sample->length;
+    last_time = sample->time;
+    memcpy(last_data, sample->data, sample->length);
+}
+
+void setup_periodic() {
+    setup();
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    samples_seen = 0;
+    last_identifier = 0;
+    diagnostic_periodic_init(&receiver, &SHIMS, 0x7e0, 0x7e8,
+            DIAGNOSTIC_PERIODIC_FORMAT_SINGLE_FRAME);
+}
+
+static const uint8_t POSITIVE_RESPONSE[] = {0x1, 0x6a};
+
+static void respond_positive() {
+    diagnostic_periodic_receive_can_frame(&receiver, 0x7e8,
+            POSITIVE_RESPONSE, sizeof(POSITIVE_RESPONSE));
+}
+
+START_TEST (test_identifiers_are_started_by_rate)
+{
+    ck_assert(diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL));
+    ck_assert(diagnostic_periodic_subscribe(&receiver, 0xf205,
+            DIAGNOSTIC_PERIODIC_RATE_SLOW, sample_received, NULL));
+    ck_assert(diagnostic_periodic_subscribe(&receiver, 0xf202,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL));
+    ck_assert(!can_frame_was_sent);
+    ck_assert(!diagnostic_periodic_settled(&receiver));
+
+    ck_assert(diagnostic_periodic_process(&receiver, mock_time_us) !=
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x7e0);
+    const uint8_t fast[] = {0x4, 0x2a, 0x3, 0x1, 0x2};
+    ck_assert_int_eq(memcmp(last_can_payload_sent, fast, sizeof(fast)), 0);
+
+    // the next rate goes out as soon as the first is accepted
+    respond_positive();
+    const uint8_t slow[] = {0x3, 0x2a, 0x1, 0x5};
+    ck_assert_int_eq(memcmp(last_can_payload_sent, slow, sizeof(slow)), 0);
+    ck_assert_int_eq(receiver.subscribers[0].active_rate,
+            DIAGNOSTIC_PERIODIC_RATE_FAST);
+    ck_assert_int_eq(receiver.subscribers[1].active_rate, 0);
+
+    respond_positive();
+    ck_assert_int_eq(receiver.subscribers[1].active_rate,
+            DIAGNOSTIC_PERIODIC_RATE_SLOW);
+    ck_assert(diagnostic_periodic_settled(&receiver));
+    ck_assert_int_eq(diagnostic_periodic_process(&receiver, mock_time_us),
+            DIAGNOSTIC_NO_DEADLINE);
+}
+END_TEST
+
+START_TEST (test_pushed_frames_reach_subscribers)
+{
+    diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    respond_positive();
+
+    mock_time_us = 5000;
+    const uint8_t pushed[] = {0x5, 0x6a, 0x1, 0x12, 0x34, 0x56, 0x0, 0x0};
+    ck_assert(diagnostic_periodic_receive_can_frame(&receiver, 0x7e8, pushed,
+            sizeof(pushed)));
+    ck_assert_int_eq(samples_seen, 1);
+    ck_assert_int_eq(last_identifier, 0xf201);
+    ck_assert_int_eq(last_length, 3);
+    ck_assert_int_eq(last_data[0], 0x12);
+    ck_assert_int_eq(last_data[2], 0x56);
+    ck_assert_int_eq(last_time, 5000);
+    ck_assert_int_eq(receiver.subscribers[0].samples, 1);
+
+    // an identifier nobody subscribed to is still consumed, and other
+    // traffic isn't
+    const uint8_t other[] = {0x3, 0x6a, 0x9, 0x1};
+    ck_assert(diagnostic_periodic_receive_can_frame(&receiver, 0x7e8, other,
+            sizeof(other)));
+    ck_assert_int_eq(receiver.samples_unsubscribed, 1);
+    ck_assert(!diagnostic_periodic_receive_can_frame(&receiver, 0x7e9, pushed,
+            sizeof(pushed)));
+    ck_assert_int_eq(samples_seen, 1);
+    ck_assert_int_eq(receiver.samples_received, 1);
+}
+END_TEST
+
+START_TEST (test_uudt_frames)
+{
+    diagnostic_periodic_init(&receiver, &SHIMS, 0x7e0, 0x5e8,
+            DIAGNOSTIC_PERIODIC_FORMAT_UUDT);
+    diagnostic_periodic_subscribe(&receiver, 0xf2a0,
+            DIAGNOSTIC_PERIODIC_RATE_MEDIUM, sample_received, NULL);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    respond_positive();
+    ck_assert(diagnostic_periodic_settled(&receiver));
+
+    const uint8_t pushed[] = {0xa0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7};
+    ck_assert(diagnostic_periodic_receive_can_frame(&receiver, 0x5e8, pushed,
+            sizeof(pushed)));
+    ck_assert_int_eq(samples_seen, 1);
+    ck_assert_int_eq(last_identifier, 0xf2a0);
+    ck_assert_int_eq(last_length, 7);
+    ck_assert_int_eq(last_data[6], 0x7);
+}
+END_TEST
+
+START_TEST (test_unsubscribe_stops_transmission)
+{
+    diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    respond_positive();
+
+    ck_assert(diagnostic_periodic_unsubscribe(&receiver, 0xf201));
+    ck_assert(!diagnostic_periodic_unsubscribe(&receiver, 0xf201));
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    const uint8_t stop[] = {0x3, 0x2a, 0x4, 0x1};
+    ck_assert_int_eq(memcmp(last_can_payload_sent, stop, sizeof(stop)), 0);
+
+    // frames still on their way aren't passed on
+    const uint8_t pushed[] = {0x3, 0x6a, 0x1, 0x12};
+    diagnostic_periodic_receive_can_frame(&receiver, 0x7e8, pushed,
+            sizeof(pushed));
+    ck_assert_int_eq(samples_seen, 0);
+
+    respond_positive();
+    ck_assert(diagnostic_periodic_settled(&receiver));
+    ck_assert(!receiver.subscribers[0].in_use);
+
+    // one that was never started doesn't need a request
+    can_frame_was_sent = false;
+    diagnostic_periodic_subscribe(&receiver, 0xf203,
+            DIAGNOSTIC_PERIODIC_RATE_SLOW, sample_received, NULL);
+    diagnostic_periodic_unsubscribe_all(&receiver);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    ck_assert(!can_frame_was_sent);
+    ck_assert(diagnostic_periodic_settled(&receiver));
+}
+END_TEST
+
+START_TEST (test_refused_identifier_fails)
+{
+    ck_assert(!diagnostic_periodic_subscribe(&receiver, 0xf190,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL));
+    diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+
+    const uint8_t refused[] = {0x3, 0x7f, 0x2a, 0x31};
+    diagnostic_periodic_receive_can_frame(&receiver, 0x7e8, refused,
+            sizeof(refused));
+    ck_assert(receiver.subscribers[0].failed);
+    ck_assert_int_eq(receiver.subscribers[0].negative_response_code,
+            NRC_REQUEST_OUT_OF_RANGE);
+    ck_assert_int_eq(receiver.subscribers[0].active_rate, 0);
+
+    // it isn't asked for again until it's subscribed again
+    can_frame_was_sent = false;
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    ck_assert(!can_frame_was_sent);
+    ck_assert(diagnostic_periodic_settled(&receiver));
+
+    diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_SLOW, sample_received, NULL);
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    ck_assert(can_frame_was_sent);
+    ck_assert(!receiver.subscribers[0].failed);
+}
+END_TEST
+
+START_TEST (test_silent_ecu_times_out)
+{
+    diagnostic_periodic_subscribe(&receiver, 0xf201,
+            DIAGNOSTIC_PERIODIC_RATE_FAST, sample_received, NULL);
+    uint64_t deadline = diagnostic_periodic_process(&receiver, mock_time_us);
+
+    mock_time_us = deadline;
+    diagnostic_periodic_process(&receiver, mock_time_us);
+    ck_assert(receiver.subscribers[0].failed);
+    ck_assert(diagnostic_periodic_settled(&receiver));
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("periodic");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_periodic, NULL);
+    tcase_add_test(tc_core, test_identifiers_are_started_by_rate);
+    tcase_add_test(tc_core, test_pushed_frames_reach_subscribers);
+    tcase_add_test(tc_core, test_uudt_frames);
+    tcase_add_test(tc_core, test_unsubscribe_stops_transmission);
+    tcase_add_test(tc_core, test_refused_identifier_fails);
+    tcase_add_test(tc_core, test_silent_ecu_times_out);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
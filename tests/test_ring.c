@@ -0,0 +1,199 @@
+#include <uds/uds.h>
+#include <uds/ring.h>
+#include <check.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+
+#define PRODUCER_COUNT 4
+#define SUBMISSIONS_PER_PRODUCER 20000
+
+DiagnosticSubmissionRing submissions;
+DiagnosticCompletionRing completions;
+
+bool failing_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    return false;
+}
+
+void setup_ring() {
+    setup();
+    diagnostic_submission_ring_init(&submissions);
+    diagnostic_completion_ring_init(&completions);
+}
+
+static DiagnosticSubmission pid_submission(uint16_t pid, uint64_t user_data) {
+    DiagnosticSubmission submission = {
+        request: {
+            arbitration_id: 0x7e0,
+            mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+            has_pid: true,
+            pid: pid
+        },
+        completions: &completions,
+        user_data: user_data
+    };
+    return submission;
+}
+
+START_TEST (test_submissions_in_order)
+{
+    DiagnosticSubmission submission;
+    ck_assert(!diagnostic_submission_ring_pop(&submissions, &submission));
+
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_SUBMISSION_RING_SIZE; ++i) {
+        submission = pid_submission(i, i);
+        ck_assert(diagnostic_submission_ring_push(&submissions, &submission));
+    }
+    ck_assert(!diagnostic_submission_ring_push(&submissions, &submission));
+    ck_assert_int_eq(submissions.full, 1);
+
+    for(i = 0; i < DIAGNOSTIC_SUBMISSION_RING_SIZE; ++i) {
+        ck_assert(diagnostic_submission_ring_pop(&submissions, &submission));
+        ck_assert_int_eq(submission.user_data, i);
+        ck_assert_int_eq(submission.request.pid, i);
+    }
+    ck_assert(!diagnostic_submission_ring_pop(&submissions, &submission));
+
+    // and again, past the end of the slots
+    submission = pid_submission(0xc, 1234);
+    ck_assert(diagnostic_submission_ring_push(&submissions, &submission));
+    ck_assert(diagnostic_submission_ring_pop(&submissions, &submission));
+    ck_assert_int_eq(submission.user_data, 1234);
+}
+END_TEST
+
+START_TEST (test_completion_overflow)
+{
+    DiagnosticResponse response = {completed: true, pid: 0xc};
+    uint32_t i;
+    for(i = 0; i < DIAGNOSTIC_COMPLETION_RING_SIZE; ++i) {
+        ck_assert(diagnostic_completion_ring_push(&completions, i, &response));
+    }
+    ck_assert(!diagnostic_completion_ring_push(&completions, 99, &response));
+    ck_assert_int_eq(completions.overflows, 1);
+
+    DiagnosticCompletion completion;
+    ck_assert(diagnostic_completion_ring_pop(&completions, &completion));
+    ck_assert_int_eq(completion.user_data, 0);
+    ck_assert_int_eq(completion.response.pid, 0xc);
+    ck_assert(diagnostic_completion_ring_push(&completions, 100, &response));
+}
+END_TEST
+
+START_TEST (test_submitted_request_posts_response)
+{
+    DiagnosticSubmission submission = pid_submission(0xc, 42);
+    diagnostic_submission_ring_push(&submissions, &submission);
+
+    DiagnosticSubmission received;
+    DiagnosticSubmittedRequest request;
+    ck_assert(diagnostic_submission_ring_pop(&submissions, &received));
+    diagnostic_submission_start(&SHIMS, &received, &request);
+
+    DiagnosticCompletion completion;
+    ck_assert(!diagnostic_completion_ring_pop(&completions, &completion));
+
+    const uint8_t response[] = {0x4, 0x41, 0xc, 0x1, 0x2};
+    diagnostic_receive_can_frame(&SHIMS, &request.handle, 0x7e8, response,
+            sizeof(response));
+    ck_assert(diagnostic_completion_ring_pop(&completions, &completion));
+    ck_assert_int_eq(completion.user_data, 42);
+    ck_assert(completion.response.success);
+    ck_assert_int_eq(completion.response.pid, 0xc);
+    ck_assert_int_eq(completion.response.payload_length, 2);
+}
+END_TEST
+
+START_TEST (test_unsent_request_posts_failure)
+{
+    SHIMS.send_can_message = failing_send_can;
+    DiagnosticSubmission submission = pid_submission(0xc, 7);
+    DiagnosticSubmittedRequest request;
+    diagnostic_submission_start(&SHIMS, &submission, &request);
+
+    DiagnosticCompletion completion;
+    ck_assert(diagnostic_completion_ring_pop(&completions, &completion));
+    ck_assert_int_eq(completion.user_data, 7);
+    ck_assert(completion.response.completed);
+    ck_assert(!completion.response.success);
+    ck_assert(!completion.response.timed_out);
+}
+END_TEST
+
+static void* produce(void* argument) {
+    uint64_t producer = (uintptr_t) argument;
+    uint32_t i;
+    for(i = 0; i < SUBMISSIONS_PER_PRODUCER; ++i) {
+        DiagnosticSubmission submission = pid_submission(0xc,
+                (producer << 32) | i);
+        while(!diagnostic_submission_ring_push(&submissions, &submission)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+START_TEST (test_concurrent_producers)
+{
+    pthread_t threads[PRODUCER_COUNT];
+    uintptr_t i;
+    for(i = 0; i < PRODUCER_COUNT; ++i) {
+        pthread_create(&threads[i], NULL, produce, (void*) i);
+    }
+
+    uint32_t next[PRODUCER_COUNT] = {0};
+    uint32_t received = 0;
+    while(received < PRODUCER_COUNT * SUBMISSIONS_PER_PRODUCER) {
+        DiagnosticSubmission submission;
+        if(!diagnostic_submission_ring_pop(&submissions, &submission)) {
+            continue;
+        }
+
+        // each producer's submissions arrive in the order it made them
+        uint32_t producer = submission.user_data >> 32;
+        ck_assert_int_lt(producer, PRODUCER_COUNT);
+        ck_assert_int_eq((uint32_t) submission.user_data, next[producer]);
+        ++next[producer];
+        ++received;
+    }
+
+    for(i = 0; i < PRODUCER_COUNT; ++i) {
+        pthread_join(threads[i], NULL);
+        ck_assert_int_eq(next[i], SUBMISSIONS_PER_PRODUCER);
+    }
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("ring");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_ring, NULL);
+    tcase_add_test(tc_core, test_submissions_in_order);
+    tcase_add_test(tc_core, test_completion_overflow);
+    tcase_add_test(tc_core, test_submitted_request_posts_response);
+    tcase_add_test(tc_core, test_unsent_request_posts_failure);
+    tcase_add_test(tc_core, test_concurrent_producers);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+#include <uds/uds.h>
+#include <uds/serialize.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+extern uint32_t last_can_frame_sent_arb_id;
+extern uint8_t last_can_payload_sent[8];
+extern bool can_frame_was_sent;
+extern DiagnosticResponse last_response_received;
+extern bool last_response_was_received;
+
+uint8_t long_payload[300];
+
+// Where the frame sender and receiver are in the saved state, at the end of
+// the header.
+#define SENDER_STATE (DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE - 26)
+#define RECEIVER_STATE (SENDER_STATE + 13)
+
+static void response_received(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+static DiagnosticResponse pid_response() {
+    DiagnosticResponse response = {
+        completed: true,
+        success: true,
+        arbitration_id: 0x7e8,
+        mode: 0x1,
+        has_pid: true,
+        pid: 0xc,
+        payload: {0x1a, 0xa0},
+        payload_length: 2
+    };
+    response.timestamps.first_frame_sent = 1000;
+    response.timestamps.completed = 1850;
+    return response;
+}
+
+START_TEST (test_json)
+{
+    DiagnosticResponse response = pid_response();
+    char line[256];
+    const char* expected = "{\"time\":1850,\"arb_id\":2024,\"mode\":1,"
+            "\"pid\":12,\"success\":true,\"latency_us\":850,"
+            "\"payload\":\"1aa0\"}\n";
+    ck_assert_int_eq(diagnostic_response_to_json(&response, line,
+                sizeof(line)), strlen(expected));
+    ck_assert_str_eq(line, expected);
+}
+END_TEST
+
+START_TEST (test_json_negative_response)
+{
+    DiagnosticResponse response = {
+        completed: true,
+        success: false,
+        arbitration_id: 0x18daf110,
+        mode: 0x22,
+        negative_response_code: NRC_SERVICE_NOT_SUPPORTED,
+        timed_out: false
+    };
+    char line[256];
+    ck_assert(diagnostic_response_to_json(&response, line, sizeof(line)) > 0);
+    ck_assert_str_eq(line, "{\"time\":0,\"arb_id\":417001744,\"mode\":34,"
+            "\"success\":false,\"nrc\":17,\"payload\":\"\"}\n");
+}
+END_TEST
+
+START_TEST (test_json_full_payload)
+{
+    uint32_t i;
+    for(i = 0; i < sizeof(long_payload); ++i) {
+        long_payload[i] = i;
+    }
+    DiagnosticResponse response = pid_response();
+    response.extended_payload = long_payload;
+    response.extended_payload_length = sizeof(long_payload);
+
+    char line[1024];
+    size_t length = diagnostic_response_to_json(&response, line,
+            sizeof(line));
+    ck_assert(length > 0);
+    ck_assert(strstr(line, "\"payload\":\"000102") != NULL);
+    ck_assert(strstr(line, "292a2b\"}\n") != NULL);
+
+    // no partial lines
+    ck_assert_int_eq(diagnostic_response_to_json(&response, line, length - 1),
+            0);
+}
+END_TEST
+
+START_TEST (test_binary_round_trip)
+{
+    DiagnosticResponse response = pid_response();
+    response.multi_frame = true;
+    uint8_t buffer[128];
+    size_t size = diagnostic_response_to_binary(&response, buffer,
+            sizeof(buffer));
+    ck_assert_int_eq(size, DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE + 2);
+
+    // a second record straight after the first
+    response.pid = 0xd;
+    response.payload_length = 1;
+    size_t second = diagnostic_response_to_binary(&response, buffer + size,
+            sizeof(buffer) - size);
+    ck_assert(second > 0);
+
+    DiagnosticResponseRecord record;
+    ck_assert_int_eq(diagnostic_response_record_read(buffer, size + second,
+                &record), size);
+    ck_assert_int_eq(record.timestamp, 1850);
+    ck_assert_int_eq(record.arbitration_id, 0x7e8);
+    ck_assert(record.completed);
+    ck_assert(record.success);
+    ck_assert(record.multi_frame);
+    ck_assert(!record.timed_out);
+    ck_assert(record.has_pid);
+    ck_assert_int_eq(record.pid, 0xc);
+    ck_assert_int_eq(record.payload_length, 2);
+    ck_assert_int_eq(record.payload[1], 0xa0);
+
+    ck_assert_int_eq(diagnostic_response_record_read(buffer + size, second,
+                &record), second);
+    ck_assert_int_eq(record.pid, 0xd);
+    ck_assert_int_eq(record.payload_length, 1);
+
+    ck_assert_int_eq(diagnostic_response_record_read(buffer, size - 1,
+                &record), 0);
+    ck_assert_int_eq(diagnostic_response_to_binary(&response, buffer,
+                DIAGNOSTIC_RESPONSE_RECORD_HEADER_SIZE), 0);
+}
+END_TEST
+
+START_TEST (test_to_string_prints_whole_payload)
+{
+    DiagnosticResponse response = pid_response();
+    char string[128];
+    diagnostic_response_to_string(&response, string, sizeof(string));
+    ck_assert_str_eq(string,
+            "arb_id: 0x7e8, mode: 0x1, pid: 0xc, payload: 0x1aa0");
+
+    response.extended_payload = long_payload;
+    response.extended_payload_length = sizeof(long_payload);
+    diagnostic_response_to_string(&response, string, 48);
+    ck_assert_int_eq(strlen(string), 47);
+
+    diagnostic_response_to_string(&response, string, 10);
+    ck_assert_int_eq(strlen(string), 9);
+}
+END_TEST
+
+START_TEST (test_restore_mid_request)
+{
+    static uint8_t payload[19] = {0xaa};
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: payload,
+        extended_payload_length: sizeof(payload)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received);
+    const uint8_t flow_control[] = {0x30, 0x0, 0x5};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert_int_eq(last_can_payload_sent[0], 0x21);
+
+    uint8_t state[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE];
+    ck_assert_int_eq(diagnostic_request_handle_save(&handle, state,
+                sizeof(state)), DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE);
+    ck_assert_int_eq(diagnostic_request_handle_save(&handle, state,
+                sizeof(state) - 1), 0);
+    memset(&handle, 0xff, sizeof(handle));
+
+    DiagnosticRequestHandle restored = generate_diagnostic_request(&SHIMS,
+            &request, response_received);
+    ck_assert(diagnostic_request_handle_restore(&SHIMS, &restored, state,
+                sizeof(state)));
+    ck_assert(!diagnostic_request_sent(&restored));
+    ck_assert_int_eq(restored.timestamps.first_frame_sent, 1000);
+
+    // the ECU's separation time still counts from the last frame
+    can_frame_was_sent = false;
+    mock_time_us = 5999;
+    diagnostic_continue_request(&SHIMS, &restored);
+    ck_assert(!can_frame_was_sent);
+    mock_time_us = 6000;
+    diagnostic_continue_request(&SHIMS, &restored);
+    ck_assert(can_frame_was_sent);
+    ck_assert_int_eq(last_can_payload_sent[0], 0x22);
+    ck_assert(diagnostic_request_sent(&restored));
+
+    const uint8_t response[] = {0x1, 0x76};
+    diagnostic_receive_can_frame(&SHIMS, &restored, 0x7e8, response,
+            sizeof(response));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.mode, 0x36);
+}
+END_TEST
+
+START_TEST (test_restore_mid_response)
+{
+    uint8_t response_buffer[32];
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x22,
+        has_pid: true,
+        pid: 0xf190,
+        response_buffer: response_buffer,
+        response_buffer_size: sizeof(response_buffer)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received);
+    const uint8_t first[] = {0x10, 0x14, 0x62, 0xf1, 0x90, 'W', 'V', 'W'};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, first,
+            sizeof(first));
+    ck_assert_int_eq(last_can_frame_sent_arb_id, 0x7e0);
+    ck_assert_int_eq(last_can_payload_sent[0], 0x30);
+    const uint8_t second[] = {0x21, 'Z', 'Z', 'Z', '1', 'K', 'Z', '1'};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, second,
+            sizeof(second));
+
+    uint8_t state[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE + 32];
+    size_t size = diagnostic_request_handle_save(&handle, state,
+            sizeof(state));
+    ck_assert_int_eq(size, DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE + 13);
+
+    // in to the new process's buffer
+    uint8_t new_response_buffer[32];
+    request.response_buffer = new_response_buffer;
+    DiagnosticRequestHandle restored = generate_diagnostic_request(&SHIMS,
+            &request, response_received);
+    ck_assert(diagnostic_request_handle_restore(&SHIMS, &restored, state,
+                size));
+
+    const uint8_t third[] = {0x22, 'A', '1', '2', '3', '4', '5', '6'};
+    diagnostic_receive_can_frame(&SHIMS, &restored, 0x7e8, third,
+            sizeof(third));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert(last_response_received.multi_frame);
+    ck_assert_int_eq(last_response_received.pid, 0xf190);
+    ck_assert_int_eq(last_response_received.payload_length, 17);
+    ck_assert_int_eq(memcmp(last_response_received.payload,
+                "WVWZZZ1KZ1A123456", 17), 0);
+}
+END_TEST
+
+START_TEST (test_restore_checks_the_state)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x1,
+        has_pid: true,
+        pid: 0xc
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received);
+    uint8_t state[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE];
+    size_t size = diagnostic_request_handle_save(&handle, state,
+            sizeof(state));
+    ck_assert_int_eq(size, sizeof(state));
+
+    DiagnosticRequestHandle restored = generate_diagnostic_request(&SHIMS,
+            &request, response_received);
+    ck_assert(!diagnostic_request_handle_restore(&SHIMS, &restored, state,
+                size - 1));
+
+    state[4] = DIAGNOSTIC_REQUEST_STATE_VERSION + 1;
+    ck_assert(!diagnostic_request_handle_restore(&SHIMS, &restored, state,
+                size));
+    state[4] = DIAGNOSTIC_REQUEST_STATE_VERSION;
+
+    DiagnosticRequest other = request;
+    other.pid = 0xd;
+    DiagnosticRequestHandle wrong = generate_diagnostic_request(&SHIMS,
+            &other, response_received);
+    ck_assert(!diagnostic_request_handle_restore(&SHIMS, &wrong, state,
+                size));
+    ck_assert(!wrong.isotp_send_handle.completed);
+
+    // a single frame response, reassembled by isotp-c
+    ck_assert(diagnostic_request_handle_restore(&SHIMS, &restored, state,
+                size));
+    const uint8_t response[] = {0x4, 0x41, 0xc, 0x1a, 0xf8};
+    diagnostic_receive_can_frame(&SHIMS, &restored, 0x7e8, response,
+            sizeof(response));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.payload[0], 0x1a);
+}
+END_TEST
+
+static void write_uint32(uint8_t* destination, uint32_t value) {
+    int i;
+    for(i = 0; i < 4; ++i) {
+        destination[i] = value >> (i * 8);
+    }
+}
+
+// Returns true if the state restores with one byte changed.
+static bool restores_with(const uint8_t* state, size_t offset, uint8_t value,
+        DiagnosticRequest* request) {
+    uint8_t changed[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE];
+    memcpy(changed, state, sizeof(changed));
+    changed[offset] = value;
+    DiagnosticRequestHandle handle = generate_diagnostic_request(&SHIMS,
+            request, response_received);
+    return diagnostic_request_handle_restore(&SHIMS, &handle, changed,
+            sizeof(changed));
+}
+
+START_TEST (test_restore_checks_the_transfer)
+{
+    static uint8_t payload[19];
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: payload,
+        extended_payload_length: sizeof(payload)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received);
+    uint8_t state[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE];
+    ck_assert_int_eq(diagnostic_request_handle_save(&handle, state,
+                sizeof(state)), sizeof(state));
+    ck_assert_int_eq(state[SENDER_STATE], DIAGNOSTIC_CLASSIC_FRAME_SIZE);
+    ck_assert(restores_with(state, SENDER_STATE, 48, &request));
+
+    // a frame size that isn't a CAN FD length, or is too big
+    ck_assert(!restores_with(state, SENDER_STATE, 50, &request));
+    ck_assert(!restores_with(state, SENDER_STATE, 65, &request));
+    ck_assert(!restores_with(state, SENDER_STATE, 0, &request));
+
+    // more header than the handle has
+    ck_assert(!restores_with(state, SENDER_STATE + 5,
+                sizeof(handle.request_header) + 1, &request));
+
+    // sent past the end of the request, the mode and the payload
+    ck_assert_int_eq(state[SENDER_STATE + 5], 1);
+    ck_assert(restores_with(state, SENDER_STATE + 6, 20, &request));
+    ck_assert(!restores_with(state, SENDER_STATE + 6, 21, &request));
+
+    // more of the response received than its length
+    ck_assert(!restores_with(state, RECEIVER_STATE + 4, 1, &request));
+
+    // a response longer than the buffer
+    uint8_t changed[DIAGNOSTIC_REQUEST_STATE_HEADER_SIZE];
+    memcpy(changed, state, sizeof(changed));
+    write_uint32(&changed[RECEIVER_STATE], sizeof(handle.framing_buffer) + 1);
+    DiagnosticRequestHandle restored = generate_diagnostic_request(&SHIMS,
+            &request, response_received);
+    ck_assert(!diagnostic_request_handle_restore(&SHIMS, &restored, changed,
+                sizeof(changed)));
+    write_uint32(&changed[RECEIVER_STATE], sizeof(handle.framing_buffer));
+    ck_assert(diagnostic_request_handle_restore(&SHIMS, &restored, changed,
+                sizeof(changed)));
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("serialize");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, NULL);
+    tcase_add_test(tc_core, test_json);
+    tcase_add_test(tc_core, test_json_negative_response);
+    tcase_add_test(tc_core, test_json_full_payload);
+    tcase_add_test(tc_core, test_binary_round_trip);
+    tcase_add_test(tc_core, test_to_string_prints_whole_payload);
+    tcase_add_test(tc_core, test_restore_mid_request);
+    tcase_add_test(tc_core, test_restore_mid_response);
+    tcase_add_test(tc_core, test_restore_checks_the_state);
+    tcase_add_test(tc_core, test_restore_checks_the_transfer);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
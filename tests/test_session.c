@@ -0,0 +1,291 @@
+#include <uds/uds.h>
+#include <uds/session.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+DiagnosticSessionManager manager;
+uint16_t frames_sent;
+uint32_t last_frame_id;
+uint8_t last_frame[8];
+uint16_t keys_computed;
+
+bool recording_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    ++frames_sent;
+    last_frame_id = arbitration_id;
+    memcpy(last_frame, data, size);
+    return true;
+}
+
+// The key is the seed with every bit flipped.
+bool invert_seed(uint32_t arbitration_id, uint8_t level, const uint8_t* seed,
+        uint8_t seed_length, uint8_t* key, uint8_t* key_length,
+        void* context) {
+    uint8_t i;
+    for(i = 0; i < seed_length; ++i) {
+        key[i] = ~seed[i];
+    }
+    *key_length = seed_length;
+    ++keys_computed;
+    return true;
+}
+
+void setup_session() {
+    setup();
+    SHIMS.send_can_message = recording_send_can;
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    frames_sent = 0;
+    keys_computed = 0;
+    diagnostic_session_manager_init(&manager, &SHIMS, invert_seed, NULL);
+    diagnostic_session_add(&manager, 0x7e0);
+    diagnostic_session_add(&manager, 0x7e1);
+}
+
+static void respond(uint32_t request_id, const uint8_t* data, uint8_t size) {
+    uint8_t frame[8] = {size};
+    memcpy(&frame[1], data, size);
+    diagnostic_session_receive_can_frame(&manager, request_id + 0x8, frame,
+            sizeof(frame));
+}
+
+static void unlock(uint32_t request_id, uint8_t seed) {
+    const uint8_t session_response[] = {0x50, 0x2, 0x0, 0x32, 0x1, 0xf4};
+    respond(request_id, session_response, sizeof(session_response));
+    const uint8_t seed_response[] = {0x67, 0x1, 0x12, seed};
+    respond(request_id, seed_response, sizeof(seed_response));
+    const uint8_t key_response[] = {0x67, 0x2};
+    respond(request_id, key_response, sizeof(key_response));
+}
+
+START_TEST (test_unlock_ecus_in_parallel)
+{
+    ck_assert(diagnostic_session_enter_all(&manager, 0x2, 0x1));
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert(!diagnostic_session_settled(&manager));
+
+    const uint8_t session_response[] = {0x50, 0x2, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    const uint8_t seed_request[] = {0x2, 0x27, 0x1};
+    ck_assert(memcmp(last_frame, seed_request, sizeof(seed_request)) == 0);
+
+    const uint8_t seed_response[] = {0x67, 0x1, 0x12, 0x34};
+    respond(0x7e0, seed_response, sizeof(seed_response));
+    const uint8_t key_request[] = {0x4, 0x27, 0x2, 0xed, 0xcb};
+    ck_assert(memcmp(last_frame, key_request, sizeof(key_request)) == 0);
+
+    const uint8_t key_response[] = {0x67, 0x2};
+    respond(0x7e0, key_response, sizeof(key_response));
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_READY);
+    ck_assert_int_eq(ecu->session, 0x2);
+    ck_assert_int_eq(ecu->security_level, 0x1);
+
+    // the other ECU is still waiting for its session
+    ck_assert(!diagnostic_session_settled(&manager));
+    unlock(0x7e1, 0x56);
+    ck_assert(diagnostic_session_settled(&manager));
+    ck_assert_int_eq(diagnostic_session_find(&manager, 0x7e1)->security_level,
+            0x1);
+}
+END_TEST
+
+START_TEST (test_redundant_transitions_are_skipped)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1);
+    unlock(0x7e0, 0x34);
+    uint16_t sent = frames_sent;
+
+    ck_assert(diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1));
+    ck_assert_int_eq(frames_sent, sent);
+    ck_assert_int_eq(diagnostic_session_find(&manager, 0x7e0)->state,
+            DIAGNOSTIC_SESSION_READY);
+
+    // already in the default session
+    ck_assert(diagnostic_session_enter(&manager, 0x7e1,
+                DIAGNOSTIC_DEFAULT_SESSION, 0));
+    ck_assert_int_eq(frames_sent, sent);
+}
+END_TEST
+
+START_TEST (test_time_delay_is_waited_out)
+{
+    diagnostic_session_enter_all(&manager, 0x2, 0x1);
+    const uint8_t session_response[] = {0x50, 0x2, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    const uint8_t delay[] = {0x7f, 0x27, NRC_TIME_DELAY_NOT_EXPIRED};
+    respond(0x7e0, delay, sizeof(delay));
+
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_WAITING_FOR_DELAY);
+
+    // the other ECU isn't held up
+    unlock(0x7e1, 0x56);
+    ck_assert_int_eq(diagnostic_session_find(&manager, 0x7e1)->state,
+            DIAGNOSTIC_SESSION_READY);
+
+    // both are kept in the session while the first waits, but it doesn't
+    // ask for a seed yet
+    uint64_t retry = 1000 + DIAGNOSTIC_SECURITY_DELAY_MS * 1000;
+    uint16_t sent = frames_sent;
+    ck_assert_int_eq(diagnostic_session_process(&manager, retry - 1), retry);
+    ck_assert_int_eq(frames_sent, sent + 2);
+    ck_assert_int_eq(last_frame[1], 0x3e);
+    sent = frames_sent;
+
+    mock_time_us = retry;
+    diagnostic_session_process(&manager, retry);
+    ck_assert_int_eq(frames_sent, sent + 1);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_REQUESTING_SEED);
+    const uint8_t seed_request[] = {0x2, 0x27, 0x1};
+    ck_assert(memcmp(last_frame, seed_request, sizeof(seed_request)) == 0);
+}
+END_TEST
+
+START_TEST (test_zero_seed_is_already_unlocked)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1);
+    const uint8_t session_response[] = {0x50, 0x2, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    uint16_t sent = frames_sent;
+    const uint8_t seed_response[] = {0x67, 0x1, 0x0, 0x0};
+    respond(0x7e0, seed_response, sizeof(seed_response));
+
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(frames_sent, sent);
+    ck_assert_int_eq(keys_computed, 0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_READY);
+    ck_assert_int_eq(ecu->security_level, 0x1);
+}
+END_TEST
+
+START_TEST (test_keys_are_cached_by_seed)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1);
+    unlock(0x7e0, 0x34);
+    ck_assert_int_eq(keys_computed, 1);
+
+    // a new session locks the ECU again
+    diagnostic_session_enter(&manager, 0x7e0, 0x3, 0x1);
+    const uint8_t session_response[] = {0x50, 0x3, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->security_level, 0);
+
+    const uint8_t seed_response[] = {0x67, 0x1, 0x12, 0x34};
+    respond(0x7e0, seed_response, sizeof(seed_response));
+    ck_assert_int_eq(keys_computed, 1);
+    const uint8_t key_request[] = {0x4, 0x27, 0x2, 0xed, 0xcb};
+    ck_assert(memcmp(last_frame, key_request, sizeof(key_request)) == 0);
+}
+END_TEST
+
+START_TEST (test_invalid_key_fails)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1);
+    const uint8_t session_response[] = {0x50, 0x2, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    const uint8_t seed_response[] = {0x67, 0x1, 0x12, 0x34};
+    respond(0x7e0, seed_response, sizeof(seed_response));
+    const uint8_t invalid[] = {0x7f, 0x27, NRC_INVALID_KEY};
+    respond(0x7e0, invalid, sizeof(invalid));
+
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_FAILED);
+    ck_assert_int_eq(ecu->negative_response_code, NRC_INVALID_KEY);
+    ck_assert_int_eq(ecu->session, 0x2);
+    ck_assert_int_eq(ecu->security_level, 0);
+}
+END_TEST
+
+START_TEST (test_unresponsive_ecu_times_out)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0);
+    diagnostic_session_process(&manager,
+            1000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_FAILED);
+    ck_assert(ecu->timed_out);
+    ck_assert_int_eq(ecu->session, DIAGNOSTIC_DEFAULT_SESSION);
+}
+END_TEST
+
+START_TEST (test_tester_present_keeps_the_session)
+{
+    diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1);
+    unlock(0x7e0, 0x34);
+    uint16_t sent = frames_sent;
+
+    uint64_t due = 1000 + DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS * 1000;
+    ck_assert_int_eq(diagnostic_session_process(&manager, due - 1), due);
+    ck_assert_int_eq(frames_sent, sent);
+
+    mock_time_us = due;
+    ck_assert_int_eq(diagnostic_session_process(&manager, due),
+            due + DIAGNOSTIC_TESTER_PRESENT_INTERVAL_MS * 1000);
+    ck_assert_int_eq(frames_sent, sent + 1);
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    const uint8_t tester_present[] = {0x2, 0x3e, 0x80};
+    ck_assert(memcmp(last_frame, tester_present,
+                sizeof(tester_present)) == 0);
+
+    // nothing is waiting for a response, and the cached session still holds
+    DiagnosticEcuSession* ecu = diagnostic_session_find(&manager, 0x7e0);
+    ck_assert_int_eq(ecu->state, DIAGNOSTIC_SESSION_READY);
+    ck_assert(diagnostic_session_settled(&manager));
+    sent = frames_sent;
+    ck_assert(diagnostic_session_enter(&manager, 0x7e0, 0x2, 0x1));
+    ck_assert_int_eq(frames_sent, sent);
+
+    // and the ECU in the default session isn't sent anything
+    diagnostic_session_process(&manager, due * 10);
+    ck_assert_int_eq(frames_sent, sent + 1);
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+
+    diagnostic_session_enter(&manager, 0x7e0, DIAGNOSTIC_DEFAULT_SESSION, 0);
+    const uint8_t session_response[] = {0x50, 0x1, 0x0, 0x32, 0x1, 0xf4};
+    respond(0x7e0, session_response, sizeof(session_response));
+    sent = frames_sent;
+    ck_assert_int_eq(diagnostic_session_process(&manager, due * 20),
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert_int_eq(frames_sent, sent);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("session");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_session, NULL);
+    tcase_add_test(tc_core, test_unlock_ecus_in_parallel);
+    tcase_add_test(tc_core, test_redundant_transitions_are_skipped);
+    tcase_add_test(tc_core, test_time_delay_is_waited_out);
+    tcase_add_test(tc_core, test_zero_seed_is_already_unlocked);
+    tcase_add_test(tc_core, test_keys_are_cached_by_seed);
+    tcase_add_test(tc_core, test_invalid_key_fails);
+    tcase_add_test(tc_core, test_unresponsive_ecu_times_out);
+    tcase_add_test(tc_core, test_tester_present_keeps_the_session);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+#include <uds/uds.h>
+#include <uds/counters.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+DiagnosticCounters counters;
+uint16_t frames_sent;
+uint8_t payload[100];
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+bool counting_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    ++frames_sent;
+    return true;
+}
+
+void setup_timeouts() {
+    setup();
+    SHIMS.send_can_message = counting_send_can;
+    SHIMS.get_time = mock_get_time;
+    memset(&counters, 0, sizeof(counters));
+    SHIMS.counters = &counters;
+    frames_sent = 0;
+    mock_time_us = 1000;
+}
+
+START_TEST (test_response_deadline)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+        has_pid: true,
+        pid: 0xc,
+        timeout_ms: 50
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), 51000);
+
+    ck_assert_int_eq(diagnostic_process_request(&SHIMS, &handle, 50999),
+            51000);
+    ck_assert(!handle.completed);
+    ck_assert(!last_response_was_received);
+
+    mock_time_us = 51000;
+    ck_assert(diagnostic_process_request(&SHIMS, &handle, 51000) ==
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.completed);
+    ck_assert(last_response_received.timed_out);
+    ck_assert(!last_response_received.success);
+    ck_assert_int_eq(last_response_received.arbitration_id, 0x7e8);
+    ck_assert_int_eq(last_response_received.pid, 0xc);
+    ck_assert_int_eq(counters.timeouts, 1);
+
+    // a late response is ignored
+    last_response_was_received = false;
+    const uint8_t late[] = {0x3, 0x41, 0xc, 0x1};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, late, sizeof(late));
+    ck_assert(!last_response_was_received);
+}
+END_TEST
+
+START_TEST (test_default_response_timeout)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_STANDARD_PID, 0x7e0, 0xc, response_received_handler);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            1000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+}
+END_TEST
+
+START_TEST (test_no_deadline_after_response)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_STANDARD_PID, 0x7e0, 0xc, response_received_handler);
+    const uint8_t response[] = {0x4, 0x41, 0xc, 0x1, 0x2};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, response,
+            sizeof(response));
+    ck_assert(handle.completed);
+    ck_assert(diagnostic_request_deadline(&handle) == DIAGNOSTIC_NO_DEADLINE);
+
+    last_response_was_received = false;
+    diagnostic_process_request(&SHIMS, &handle, 10000000);
+    ck_assert(handle.success);
+    ck_assert(!last_response_was_received);
+    ck_assert_int_eq(counters.timeouts, 0);
+}
+END_TEST
+
+START_TEST (test_flow_control_and_separation_deadlines)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x2e,
+        extended_payload: payload,
+        extended_payload_length: 19
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    ck_assert_int_eq(frames_sent, 1);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            1000 + DIAGNOSTIC_TRANSFER_TIMEOUT_MS * 1000);
+
+    // no block limit, 10ms between frames
+    mock_time_us = 2000;
+    const uint8_t flow_control[] = {0x30, 0x0, 0xa};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), 12000);
+
+    ck_assert_int_eq(diagnostic_process_request(&SHIMS, &handle, 11999),
+            12000);
+    ck_assert_int_eq(frames_sent, 2);
+
+    // the last frame starts the wait for the response
+    mock_time_us = 12000;
+    ck_assert_int_eq(diagnostic_process_request(&SHIMS, &handle, 12000),
+            12000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+    ck_assert_int_eq(frames_sent, 3);
+    ck_assert(diagnostic_request_sent(&handle));
+}
+END_TEST
+
+START_TEST (test_flow_control_timeout)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x2e,
+        extended_payload: payload,
+        extended_payload_length: 19
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    diagnostic_process_request(&SHIMS, &handle,
+            1000 + DIAGNOSTIC_TRANSFER_TIMEOUT_MS * 1000);
+    ck_assert(handle.completed);
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.timed_out);
+}
+END_TEST
+
+START_TEST (test_aborted_send_is_never_left_waiting)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x2e,
+        extended_payload: payload,
+        extended_payload_length: 19
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    const uint8_t overflow[] = {0x32, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, overflow,
+            sizeof(overflow));
+    ck_assert(handle.completed);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            DIAGNOSTIC_NO_DEADLINE);
+
+    // a handle left part way through an abort, as one saved before it was
+    // seen and restored would be, is due right away
+    setup_timeouts();
+    handle = diagnostic_request(&SHIMS, &request, response_received_handler);
+    handle.frame_sender.completed = true;
+    handle.frame_sender.success = false;
+    handle.timeout_us = 0;
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), 0);
+    ck_assert_int_eq(diagnostic_process_request(&SHIMS, &handle, 2000),
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(handle.completed);
+    ck_assert(last_response_was_received);
+    ck_assert(!last_response_received.success);
+    ck_assert_int_eq(counters.send_failures, 1);
+}
+END_TEST
+
+START_TEST (test_functional_request_released_after_timeout)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_STANDARD_PID, OBD2_FUNCTIONAL_BROADCAST_ID, 0xc,
+            response_received_handler);
+    mock_time_us = 20000;
+    const uint8_t response[] = {0x4, 0x41, 0xc, 0x1, 0x2};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e9, response,
+            sizeof(response));
+    ck_assert(last_response_was_received);
+
+    // still listening for the other ECUs, from the last response
+    uint64_t deadline = diagnostic_request_deadline(&handle);
+    ck_assert_int_eq(deadline,
+            20000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+
+    last_response_was_received = false;
+    ck_assert(diagnostic_process_request(&SHIMS, &handle, deadline) ==
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(handle.success);
+    ck_assert(!last_response_was_received);
+    ck_assert_int_eq(counters.timeouts, 0);
+
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7ea, response,
+            sizeof(response));
+    ck_assert(!last_response_was_received);
+}
+END_TEST
+
+START_TEST (test_timeout_without_clock)
+{
+    SHIMS.get_time = NULL;
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_STANDARD_PID, 0x7e0, 0xc, response_received_handler);
+
+    // due right away, to start the timeout from the first call
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), 0);
+    ck_assert_int_eq(diagnostic_process_request(&SHIMS, &handle, 5000),
+            5000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+    diagnostic_process_request(&SHIMS, &handle,
+            5000 + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+    ck_assert(handle.completed);
+    ck_assert(last_response_received.timed_out);
+}
+END_TEST
+
+START_TEST (test_process_requests_returns_earliest)
+{
+    DiagnosticRequest slow = {
+        arbitration_id: 0x7e0,
+        mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+        has_pid: true,
+        pid: 0xc,
+        timeout_ms: 500
+    };
+    DiagnosticRequest fast = slow;
+    fast.arbitration_id = 0x7e1;
+    fast.timeout_ms = 20;
+
+    DiagnosticRequestHandle first = diagnostic_request(&SHIMS, &slow, NULL);
+    DiagnosticRequestHandle second = diagnostic_request(&SHIMS, &fast, NULL);
+    DiagnosticRequestHandle* handles[] = {&first, NULL, &second};
+    ck_assert_int_eq(diagnostic_process_requests(&SHIMS, handles, 3, 2000),
+            21000);
+    ck_assert_int_eq(diagnostic_process_requests(&SHIMS, handles, 3, 21000),
+            501000);
+    ck_assert(second.completed);
+    ck_assert(!first.completed);
+}
+END_TEST
+
+START_TEST (test_response_pending_extends_deadline)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x31,
+        has_pid: true,
+        pid: 0xff00
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+
+    mock_time_us = 40000;
+    const uint8_t pending[] = {0x3, 0x7f, 0x31, NRC_RESPONSE_PENDING};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, pending,
+            sizeof(pending));
+    ck_assert(!handle.completed);
+    ck_assert(!last_response_was_received);
+    ck_assert_int_eq(counters.responses_pending, 1);
+    ck_assert_int_eq(counters.responses_negative, 0);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            40000 + DIAGNOSTIC_RESPONSE_PENDING_TIMEOUT_MS * 1000);
+
+    // still waiting long after the normal timeout
+    diagnostic_process_request(&SHIMS, &handle, 2000000);
+    ck_assert(!handle.completed);
+
+    mock_time_us = 2000000;
+    const uint8_t response[] = {0x4, 0x71, 0xff, 0x0, 0x1};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, response,
+            sizeof(response));
+    ck_assert(handle.completed);
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.payload[0], 0x1);
+}
+END_TEST
+
+START_TEST (test_busy_response_is_retried)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_ENHANCED_PID, 0x7e0, 0xf190, response_received_handler);
+    ck_assert_int_eq(frames_sent, 1);
+
+    const uint8_t busy[] = {0x3, 0x7f, 0x22, NRC_BUSY_REPEAT_REQUEST};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, busy, sizeof(busy));
+    ck_assert(!handle.completed);
+    ck_assert(!last_response_was_received);
+    uint64_t retry = 1000 + DIAGNOSTIC_BUSY_RETRY_DELAY_MS * 1000;
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), retry);
+
+    diagnostic_process_request(&SHIMS, &handle, retry - 1);
+    ck_assert_int_eq(frames_sent, 1);
+    mock_time_us = retry;
+    diagnostic_process_request(&SHIMS, &handle, retry);
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert_int_eq(counters.busy_retries, 1);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            retry + DIAGNOSTIC_DEFAULT_RESPONSE_TIMEOUT_MS * 1000);
+
+    const uint8_t response[] = {0x5, 0x62, 0xf1, 0x90, 0x1, 0x2};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, response,
+            sizeof(response));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+    ck_assert_int_eq(last_response_received.timestamps.first_frame_sent,
+            1000);
+}
+END_TEST
+
+START_TEST (test_busy_retries_back_off_and_give_up)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_pid(&SHIMS,
+            DIAGNOSTIC_ENHANCED_PID, 0x7e0, 0xf190, response_received_handler);
+    const uint8_t busy[] = {0x3, 0x7f, 0x22, NRC_BUSY_REPEAT_REQUEST};
+    uint32_t delay = DIAGNOSTIC_BUSY_RETRY_DELAY_MS * 1000;
+    int i;
+    for(i = 0; i < DIAGNOSTIC_BUSY_RETRY_COUNT; ++i) {
+        diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, busy,
+                sizeof(busy));
+        ck_assert(!last_response_was_received);
+        ck_assert_int_eq(diagnostic_request_deadline(&handle),
+                mock_time_us + delay);
+        mock_time_us += delay;
+        diagnostic_process_request(&SHIMS, &handle, mock_time_us);
+        delay *= 2;
+    }
+    ck_assert_int_eq(frames_sent, DIAGNOSTIC_BUSY_RETRY_COUNT + 1);
+
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, busy, sizeof(busy));
+    ck_assert(handle.completed);
+    ck_assert(last_response_was_received);
+    ck_assert(!last_response_received.success);
+    ck_assert_int_eq(last_response_received.negative_response_code,
+            NRC_BUSY_REPEAT_REQUEST);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("timeouts");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_timeouts, NULL);
+    tcase_add_test(tc_core, test_response_deadline);
+    tcase_add_test(tc_core, test_default_response_timeout);
+    tcase_add_test(tc_core, test_no_deadline_after_response);
+    tcase_add_test(tc_core, test_flow_control_and_separation_deadlines);
+    tcase_add_test(tc_core, test_flow_control_timeout);
+    tcase_add_test(tc_core, test_aborted_send_is_never_left_waiting);
+    tcase_add_test(tc_core, test_functional_request_released_after_timeout);
+    tcase_add_test(tc_core, test_timeout_without_clock);
+    tcase_add_test(tc_core, test_process_requests_returns_earliest);
+    tcase_add_test(tc_core, test_response_pending_extends_deadline);
+    tcase_add_test(tc_core, test_busy_response_is_retried);
+    tcase_add_test(tc_core, test_busy_retries_back_off_and_give_up);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
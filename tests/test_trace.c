@@ -0,0 +1,256 @@
+#include <uds/uds.h>
+#include <uds/trace.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+uint8_t log_buffer[1024];
+size_t log_length;
+DiagnosticTraceRecorder recorder;
+
+void response_received_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+bool write_to_buffer(void* context, const uint8_t* data, size_t size) {
+    if(log_length + size > sizeof(log_buffer)) {
+        return false;
+    }
+    memcpy(log_buffer + log_length, data, size);
+    log_length += size;
+    return true;
+}
+
+void setup_trace() {
+    setup();
+    log_length = 0;
+    recorder = diagnostic_trace_recorder_init(write_to_buffer, NULL,
+            DIAGNOSTIC_TRACE_SENT | DIAGNOSTIC_TRACE_RECEIVED);
+    SHIMS.get_time = mock_get_time;
+    SHIMS.trace = &recorder;
+}
+
+START_TEST (test_record_request_and_response)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST,
+        no_frame_padding: true
+    };
+    mock_time_us = 1000;
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    mock_time_us = 1500;
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    ck_assert_int_eq(recorder.records, 2);
+
+    DiagnosticTraceReader reader;
+    fail_unless(diagnostic_trace_reader_init(&reader, log_buffer, log_length));
+
+    DiagnosticTraceRecord record;
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    ck_assert_int_eq(record.direction, DIAGNOSTIC_TRACE_SENT);
+    ck_assert_int_eq(record.timestamp, 1000);
+    ck_assert_int_eq(record.arbitration_id, request.arbitration_id);
+    ck_assert_int_eq(record.size, 2);
+    ck_assert_int_eq(record.data[1], request.mode);
+
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    ck_assert_int_eq(record.direction, DIAGNOSTIC_TRACE_RECEIVED);
+    ck_assert_int_eq(record.timestamp, 1500);
+    ck_assert_int_eq(record.arbitration_id, request.arbitration_id + 0x8);
+    ck_assert_int_eq(record.size, sizeof(can_data));
+    fail_unless(memcmp(record.data, can_data, sizeof(can_data)) == 0);
+
+    fail_if(diagnostic_trace_next(&reader, &record));
+}
+END_TEST
+
+START_TEST (test_directions_filter)
+{
+    recorder.directions = DIAGNOSTIC_TRACE_SENT;
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_EMISSIONS_DTC_REQUEST
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    const uint8_t can_data[] = {0x2, request.mode + 0x40, 0x23};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    ck_assert_int_eq(recorder.records, 1);
+}
+END_TEST
+
+START_TEST (test_large_time_gap)
+{
+    const uint8_t data[] = {0x1, 0x2};
+    diagnostic_trace_record(&recorder, DIAGNOSTIC_TRACE_RECEIVED, 10, 0x7e8,
+            data, sizeof(data));
+    uint64_t later = 10 + 0x100000000ULL * 3;
+    diagnostic_trace_record(&recorder, DIAGNOSTIC_TRACE_RECEIVED, later,
+            0x7e8, data, sizeof(data));
+    diagnostic_trace_record(&recorder, DIAGNOSTIC_TRACE_RECEIVED, later + 5,
+            0x7e8, data, sizeof(data));
+
+    DiagnosticTraceReader reader;
+    fail_unless(diagnostic_trace_reader_init(&reader, log_buffer, log_length));
+    DiagnosticTraceRecord record;
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    ck_assert_int_eq(record.timestamp, 10);
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    fail_unless(record.timestamp == later);
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    fail_unless(record.timestamp == later + 5);
+}
+END_TEST
+
+START_TEST (test_truncated_log)
+{
+    const uint8_t data[] = {0x1, 0x2, 0x3};
+    diagnostic_trace_record(&recorder, DIAGNOSTIC_TRACE_RECEIVED, 10, 0x7e8,
+            data, sizeof(data));
+    diagnostic_trace_record(&recorder, DIAGNOSTIC_TRACE_RECEIVED, 20, 0x7e8,
+            data, sizeof(data));
+
+    DiagnosticTraceReader reader;
+    fail_unless(diagnostic_trace_reader_init(&reader, log_buffer,
+                log_length - 1));
+    DiagnosticTraceRecord record;
+    fail_unless(diagnostic_trace_next(&reader, &record));
+    fail_if(diagnostic_trace_next(&reader, &record));
+
+    fail_if(diagnostic_trace_reader_init(&reader, (const uint8_t*) "UDSTRACX",
+                8));
+}
+END_TEST
+
+START_TEST (test_short_log)
+{
+    DiagnosticTraceReader reader;
+    DiagnosticTraceRecord record;
+    size_t length;
+    for(length = 0; length < DIAGNOSTIC_TRACE_HEADER_SIZE; ++length) {
+        fail_if(diagnostic_trace_reader_init(&reader, log_buffer, length));
+        fail_if(diagnostic_trace_next(&reader, &record));
+    }
+
+    // a long enough log without the header has nothing to read either
+    uint8_t data[64] = {0};
+    fail_if(diagnostic_trace_reader_init(&reader, data, sizeof(data)));
+    fail_if(diagnostic_trace_next(&reader, &record));
+}
+END_TEST
+
+typedef struct {
+    DiagnosticRequestHandle* handle;
+    uint32_t responses;
+} ReplayContext;
+
+uint64_t replay_time;
+
+uint64_t replay_get_time() {
+    return replay_time;
+}
+
+void replay_frame(void* context, const DiagnosticTraceRecord* record) {
+    ReplayContext* replay = (ReplayContext*) context;
+    replay_time = record->timestamp;
+    if(record->direction == DIAGNOSTIC_TRACE_RECEIVED) {
+        DiagnosticResponse response = diagnostic_receive_can_frame(&SHIMS,
+                replay->handle, record->arbitration_id, record->data,
+                record->size);
+        if(response.completed) {
+            ++replay->responses;
+        }
+    }
+}
+
+START_TEST (test_replay_is_deterministic)
+{
+    DiagnosticRequest request = {
+        arbitration_id: 0x100,
+        mode: OBD2_MODE_VEHICLE_INFORMATION,
+        has_pid: true,
+        pid: 0x2
+    };
+    mock_time_us = 100;
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_received_handler);
+    mock_time_us = 400;
+    const uint8_t can_data[] = {0x10, 0x9, 0x9 + 0x40, 0x2, 0x1, 0x31, 0x46,
+        0x4d};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data, sizeof(can_data));
+    mock_time_us = 900;
+    const uint8_t can_data_1[] = {0x21, 0x43, 0x55, 0x39};
+    diagnostic_receive_can_frame(&SHIMS, &handle,
+            request.arbitration_id + 0x8, can_data_1, sizeof(can_data_1));
+    fail_unless(handle.completed);
+    SHIMS.trace = NULL;
+    SHIMS.get_time = replay_get_time;
+
+    uint8_t run;
+    for(run = 0; run < 2; ++run) {
+        replay_time = 100;
+        DiagnosticRequestHandle replayed = diagnostic_request(&SHIMS,
+                &request, response_received_handler);
+        ReplayContext context = {
+            handle: &replayed,
+            responses: 0
+        };
+
+        DiagnosticTraceReader reader;
+        fail_unless(diagnostic_trace_reader_init(&reader, log_buffer,
+                    log_length));
+        // the request, first frame, flow control and consecutive frame
+        ck_assert_int_eq(diagnostic_trace_replay(&reader,
+                    DIAGNOSTIC_TRACE_REPLAY_MAX_SPEED, NULL, replay_frame,
+                    &context), 4);
+        ck_assert_int_eq(context.responses, 1);
+        fail_unless(replayed.completed);
+        ck_assert_int_eq(replayed.timestamps.first_response_frame, 400);
+        ck_assert_int_eq(replayed.timestamps.completed, 900);
+        ck_assert_int_eq(last_response_received.payload_length, 7);
+    }
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("trace");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_trace, NULL);
+    tcase_add_test(tc_core, test_record_request_and_response);
+    tcase_add_test(tc_core, test_directions_filter);
+    tcase_add_test(tc_core, test_large_time_gap);
+    tcase_add_test(tc_core, test_truncated_log);
+    tcase_add_test(tc_core, test_short_log);
+    tcase_add_test(tc_core, test_replay_is_deterministic);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+#include <uds/uds.h>
+#include <uds/tx_queue.h>
+#include <uds/counters.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+extern bool last_response_was_received;
+extern DiagnosticResponse last_response_received;
+
+#define MAX_SENT_FRAMES 64
+
+DiagnosticTxQueue queue;
+DiagnosticCounters counters;
+// The number of frames the mock driver will take before its mailboxes are
+// full.
+uint16_t free_mailboxes;
+uint16_t frames_sent;
+uint32_t sent_ids[MAX_SENT_FRAMES];
+uint8_t sent_frames[MAX_SENT_FRAMES][8];
+
+bool mailbox_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    if(free_mailboxes == 0) {
+        return false;
+    }
+    --free_mailboxes;
+    sent_ids[frames_sent] = arbitration_id;
+    memcpy(sent_frames[frames_sent], data, size < 8 ? size : 8);
+    ++frames_sent;
+    return true;
+}
+
+void response_handler(const DiagnosticResponse* response) {
+    last_response_was_received = true;
+    last_response_received = *response;
+}
+
+void setup_tx_queue() {
+    setup();
+    SHIMS.send_can_message = mailbox_send_can;
+    diagnostic_tx_queue_init(&queue);
+    SHIMS.tx_queue = &queue;
+    diagnostic_counters_reset(&counters);
+    SHIMS.counters = &counters;
+    free_mailboxes = 0;
+    frames_sent = 0;
+}
+
+static DiagnosticRequest pid_request(uint32_t arbitration_id, uint16_t pid) {
+    DiagnosticRequest request = {
+        arbitration_id: arbitration_id,
+        mode: OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST,
+        has_pid: true,
+        pid: pid
+    };
+    return request;
+}
+
+START_TEST (test_request_waits_for_a_mailbox)
+{
+    DiagnosticRequest request = pid_request(0x7e0, 0xc);
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_handler);
+    ck_assert(!handle.completed);
+    ck_assert(diagnostic_request_sent(&handle));
+    ck_assert_int_eq(frames_sent, 0);
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 1);
+    ck_assert_int_eq(queue.deferred, 1);
+    ck_assert_int_eq(counters.frames_deferred, 1);
+    ck_assert_int_eq(counters.send_failures, 0);
+
+    // still full
+    ck_assert_int_eq(diagnostic_tx_queue_drain(&SHIMS), 0);
+
+    free_mailboxes = 1;
+    ck_assert_int_eq(diagnostic_tx_queue_drain(&SHIMS), 1);
+    ck_assert_int_eq(frames_sent, 1);
+    ck_assert_int_eq(sent_ids[0], 0x7e0);
+    const uint8_t expected[] = {0x2, 0x1, 0xc};
+    ck_assert_int_eq(memcmp(sent_frames[0], expected, sizeof(expected)), 0);
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 0);
+
+    const uint8_t response[] = {0x4, 0x41, 0xc, 0x1a, 0xf8};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, response,
+            sizeof(response));
+    ck_assert(last_response_was_received);
+    ck_assert(last_response_received.success);
+}
+END_TEST
+
+START_TEST (test_frames_keep_their_order)
+{
+    DiagnosticRequest first = pid_request(0x7e0, 0xc);
+    DiagnosticRequest second = pid_request(0x7e1, 0xd);
+    diagnostic_request(&SHIMS, &first, NULL);
+
+    // the driver has room again, but the first request is still waiting
+    free_mailboxes = 10;
+    diagnostic_request(&SHIMS, &second, NULL);
+    ck_assert_int_eq(frames_sent, 0);
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 2);
+    ck_assert_int_eq(queue.high_water, 2);
+
+    ck_assert_int_eq(diagnostic_tx_queue_drain(&SHIMS), 2);
+    ck_assert_int_eq(sent_ids[0], 0x7e0);
+    ck_assert_int_eq(sent_ids[1], 0x7e1);
+
+    // and once it's empty, frames go straight out
+    diagnostic_request(&SHIMS, &first, NULL);
+    ck_assert_int_eq(frames_sent, 3);
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 0);
+}
+END_TEST
+
+START_TEST (test_full_queue_fails_the_request)
+{
+    DiagnosticRequest request = pid_request(0x7e0, 0xc);
+    int i;
+    for(i = 0; i < DIAGNOSTIC_TX_QUEUE_SIZE; ++i) {
+        DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+                NULL);
+        ck_assert(!handle.completed);
+    }
+    ck_assert(diagnostic_tx_queue_full(&queue));
+
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            NULL);
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+    ck_assert_int_eq(queue.overflows, 1);
+    ck_assert_int_eq(counters.send_failures, 1);
+
+    // without a queue, a full mailbox fails the request right away
+    SHIMS.tx_queue = NULL;
+    handle = diagnostic_request(&SHIMS, &request, NULL);
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+}
+END_TEST
+
+START_TEST (test_full_queue_fails_a_multi_frame_request)
+{
+    static uint8_t payload[19];
+    free_mailboxes = 1;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: payload,
+        extended_payload_length: sizeof(payload)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_handler);
+    ck_assert_int_eq(frames_sent, 1);
+
+    // other requests fill the queue while the ECU gets ready
+    DiagnosticRequest other = pid_request(0x7e1, 0xc);
+    int i;
+    for(i = 0; i < DIAGNOSTIC_TX_QUEUE_SIZE; ++i) {
+        diagnostic_request(&SHIMS, &other, NULL);
+    }
+    ck_assert(diagnostic_tx_queue_full(&queue));
+
+    const uint8_t flow_control[] = {0x30, 0x0, 0x0};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert(handle.completed);
+    ck_assert(!handle.success);
+    ck_assert(last_response_was_received);
+    ck_assert(!last_response_received.success);
+    ck_assert(!last_response_received.timed_out);
+    ck_assert_int_eq(queue.overflows, 1);
+    ck_assert_int_eq(counters.send_failures, 1);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            DIAGNOSTIC_NO_DEADLINE);
+
+    // and nothing more of it is sent once the queue drains
+    free_mailboxes = DIAGNOSTIC_TX_QUEUE_SIZE + 10;
+    diagnostic_tx_queue_drain(&SHIMS);
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 1 + DIAGNOSTIC_TX_QUEUE_SIZE);
+}
+END_TEST
+
+START_TEST (test_separation_time_is_kept)
+{
+    static uint8_t payload[19];
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    free_mailboxes = 1;
+    DiagnosticRequest request = {
+        arbitration_id: 0x7e0,
+        mode: 0x36,
+        extended_payload: payload,
+        extended_payload_length: sizeof(payload)
+    };
+    DiagnosticRequestHandle handle = diagnostic_request(&SHIMS, &request,
+            response_handler);
+    ck_assert_int_eq(frames_sent, 1);
+
+    // the first consecutive frame has to wait for a mailbox
+    const uint8_t flow_control[] = {0x30, 0x0, 0x5};
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, flow_control,
+            sizeof(flow_control));
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 1);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle),
+            DIAGNOSTIC_NO_DEADLINE);
+
+    // and the second isn't sent while it does, however long it waits
+    mock_time_us = 7000;
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(diagnostic_tx_queue_length(&queue), 1);
+
+    free_mailboxes = 10;
+    diagnostic_tx_queue_drain(&SHIMS);
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert_int_eq(sent_frames[1][0], 0x21);
+
+    // the separation time counts from when it left
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 2);
+    ck_assert_int_eq(diagnostic_request_deadline(&handle), 12000);
+    mock_time_us = 11999;
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 2);
+    mock_time_us = 12000;
+    diagnostic_continue_request(&SHIMS, &handle);
+    ck_assert_int_eq(frames_sent, 3);
+    ck_assert_int_eq(sent_frames[2][0], 0x22);
+    ck_assert(diagnostic_request_sent(&handle));
+    ck_assert(!handle.completed);
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("tx_queue");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_tx_queue, NULL);
+    tcase_add_test(tc_core, test_request_waits_for_a_mailbox);
+    tcase_add_test(tc_core, test_frames_keep_their_order);
+    tcase_add_test(tc_core, test_full_queue_fails_the_request);
+    tcase_add_test(tc_core, test_full_queue_fails_a_multi_frame_request);
+    tcase_add_test(tc_core, test_separation_time_is_kept);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include <uds/uds.h>
+#include <uds/vehicle_info.h>
+#include <uds/extras.h>
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern void setup();
+extern DiagnosticShims SHIMS;
+extern uint64_t mock_time_us;
+extern uint64_t mock_get_time();
+
+DiagnosticVehicleInfoCollector collector;
+uint16_t frames_sent;
+uint16_t flow_control_frames_sent;
+uint32_t last_frame_id;
+uint8_t last_frame[8];
+uint8_t ecus_received;
+char last_vin[DIAGNOSTIC_VIN_LENGTH + 1];
+
+bool recording_send_can(const uint32_t arbitration_id, const uint8_t* data,
+        const uint8_t size) {
+    ++frames_sent;
+    if((data[0] & 0xf0) == 0x30) {
+        ++flow_control_frames_sent;
+    }
+    last_frame_id = arbitration_id;
+    memcpy(last_frame, data, size);
+    return true;
+}
+
+void info_received(const DiagnosticVehicleInfo* info, void* context) {
+    ++ecus_received;
+}
+
+void vin_received(uint8_t vin[]) {
+    strcpy(last_vin, (char*) vin);
+}
+
+void setup_vehicle_info() {
+    setup();
+    SHIMS.send_can_message = recording_send_can;
+    SHIMS.get_time = mock_get_time;
+    mock_time_us = 1000;
+    frames_sent = 0;
+    flow_control_frames_sent = 0;
+    ecus_received = 0;
+    last_vin[0] = '\0';
+    diagnostic_vehicle_info_collector_init(&collector, &SHIMS, info_received,
+            NULL);
+}
+
+static void receive(uint32_t arbitration_id, const uint8_t* data,
+        uint8_t size) {
+    diagnostic_vehicle_info_receive_can_frame(&collector, arbitration_id,
+            data, size);
+}
+
+// VIN, CALID, CVN and ECU name
+static const uint8_t SUPPORTED_RESPONSE[] = {0x6, 0x49, 0x0, 0x54, 0x40, 0x0,
+    0x0};
+static const uint8_t VIN_FIRST_FRAME[] = {0x10, 0x14, 0x49, 0x2, 0x1, '1',
+    'G', '1'};
+static const uint8_t VIN_FRAME_1[] = {0x21, 'J', 'C', '5', '4', '4', '4',
+    'R'};
+static const uint8_t VIN_FRAME_2[] = {0x22, '7', '2', '5', '2', '3', '6',
+    '7'};
+
+START_TEST (test_ecus_are_read_in_parallel)
+{
+    ck_assert(diagnostic_vehicle_info_collect(&collector,
+                OBD2_FUNCTIONAL_BROADCAST_ID));
+    ck_assert_int_eq(frames_sent, 1);
+    ck_assert_int_eq(last_frame_id, 0x7df);
+
+    // the first ECU to answer is asked for its VIN straight away
+    receive(0x7e8, SUPPORTED_RESPONSE, sizeof(SUPPORTED_RESPONSE));
+    ck_assert_int_eq(collector.ecu_count, 1);
+    ck_assert_int_eq(collector.ecus[0].request_id, 0x7e0);
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    const uint8_t vin_request[] = {0x2, 0x9, 0x2};
+    ck_assert(memcmp(last_frame, vin_request, sizeof(vin_request)) == 0);
+
+    // and the second doesn't wait for the first
+    const uint8_t vin_only[] = {0x6, 0x49, 0x0, 0x40, 0x0, 0x0, 0x0};
+    receive(0x7e9, vin_only, sizeof(vin_only));
+    ck_assert_int_eq(collector.ecu_count, 2);
+    ck_assert_int_eq(last_frame_id, 0x7e1);
+
+    receive(0x7e8, VIN_FIRST_FRAME, sizeof(VIN_FIRST_FRAME));
+    ck_assert_int_eq(flow_control_frames_sent, 1);
+    receive(0x7e8, VIN_FRAME_1, sizeof(VIN_FRAME_1));
+    receive(0x7e8, VIN_FRAME_2, sizeof(VIN_FRAME_2));
+    ck_assert_str_eq(collector.ecus[0].vin, "1G1JC5444R7252367");
+    const uint8_t calibration_request[] = {0x2, 0x9, 0x4};
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    ck_assert(memcmp(last_frame, calibration_request,
+                sizeof(calibration_request)) == 0);
+
+    // the second ECU only has a VIN
+    receive(0x7e9, VIN_FIRST_FRAME, sizeof(VIN_FIRST_FRAME));
+    receive(0x7e9, VIN_FRAME_1, sizeof(VIN_FRAME_1));
+    receive(0x7e9, VIN_FRAME_2, sizeof(VIN_FRAME_2));
+    ck_assert_int_eq(ecus_received, 1);
+    ck_assert(!collector.ecus[1].active);
+    ck_assert_int_eq(collector.ecus[1].collected,
+            DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_VIN));
+    ck_assert(!diagnostic_vehicle_info_finished(&collector));
+}
+END_TEST
+
+START_TEST (test_finished_after_search_and_reads)
+{
+    collector.info_types = DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_VIN);
+    diagnostic_vehicle_info_collect(&collector, OBD2_FUNCTIONAL_BROADCAST_ID);
+    receive(0x7e8, SUPPORTED_RESPONSE, sizeof(SUPPORTED_RESPONSE));
+    receive(0x7e8, VIN_FIRST_FRAME, sizeof(VIN_FIRST_FRAME));
+    receive(0x7e8, VIN_FRAME_1, sizeof(VIN_FRAME_1));
+    receive(0x7e8, VIN_FRAME_2, sizeof(VIN_FRAME_2));
+    ck_assert_int_eq(ecus_received, 1);
+
+    // still listening for other ECUs
+    ck_assert(!diagnostic_vehicle_info_finished(&collector));
+    uint64_t deadline = diagnostic_vehicle_info_process(&collector,
+            mock_time_us);
+    ck_assert(deadline != DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(diagnostic_vehicle_info_process(&collector, deadline) ==
+            DIAGNOSTIC_NO_DEADLINE);
+    ck_assert(diagnostic_vehicle_info_finished(&collector));
+    ck_assert_int_eq(collector.ecu_count, 1);
+}
+END_TEST
+
+START_TEST (test_silent_info_type_is_skipped)
+{
+    diagnostic_vehicle_info_collect(&collector, OBD2_FUNCTIONAL_BROADCAST_ID);
+    receive(0x7e8, SUPPORTED_RESPONSE, sizeof(SUPPORTED_RESPONSE));
+    uint64_t deadline = diagnostic_vehicle_info_process(&collector,
+            mock_time_us);
+
+    // no VIN comes, so the CALID is asked for next
+    mock_time_us = deadline;
+    diagnostic_vehicle_info_process(&collector, deadline);
+    const uint8_t calibration_request[] = {0x2, 0x9, 0x4};
+    ck_assert_int_eq(last_frame_id, 0x7e0);
+    ck_assert(memcmp(last_frame, calibration_request,
+                sizeof(calibration_request)) == 0);
+    ck_assert(!(collector.ecus[0].collected &
+            DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_VIN)));
+}
+END_TEST
+
+START_TEST (test_decode_calibrations)
+{
+    DiagnosticVehicleInfo info;
+    memset(&info, 0, sizeof(info));
+    uint8_t calibration_ids[1 + 2 * DIAGNOSTIC_CALIBRATION_ID_LENGTH] = {0x2};
+    memcpy(&calibration_ids[1], "JMB*36761500", 12);
+    memcpy(&calibration_ids[17], "JMB*47872611", 12);
+    ck_assert(diagnostic_vehicle_info_decode(&info,
+                DIAGNOSTIC_INFO_TYPE_CALIBRATION_ID, calibration_ids,
+                sizeof(calibration_ids)));
+    ck_assert_int_eq(info.calibration_id_count, 2);
+    ck_assert_str_eq(info.calibration_ids[1], "JMB*47872611");
+
+    const uint8_t cvns[] = {0x2, 0x17, 0x91, 0xbc, 0x82, 0x16, 0xe0, 0x62,
+        0xbe};
+    ck_assert(diagnostic_vehicle_info_decode(&info, DIAGNOSTIC_INFO_TYPE_CVN,
+                cvns, sizeof(cvns)));
+    ck_assert_int_eq(info.cvn_count, 2);
+    ck_assert_int_eq(info.cvns[0], 0x1791bc82);
+    ck_assert_int_eq(info.cvns[1], 0x16e062be);
+
+    // the count is limited by what's actually there
+    const uint8_t short_cvns[] = {0x3, 0x17, 0x91, 0xbc, 0x82, 0x16};
+    ck_assert(diagnostic_vehicle_info_decode(&info, DIAGNOSTIC_INFO_TYPE_CVN,
+                short_cvns, sizeof(short_cvns)));
+    ck_assert_int_eq(info.cvn_count, 1);
+}
+END_TEST
+
+START_TEST (test_decode_name_and_tracking)
+{
+    DiagnosticVehicleInfo info;
+    memset(&info, 0, sizeof(info));
+    uint8_t name[1 + DIAGNOSTIC_ECU_NAME_LENGTH] = {0x1};
+    memcpy(&name[1], "ECM-EngineControl", 17);
+    ck_assert(diagnostic_vehicle_info_decode(&info,
+                DIAGNOSTIC_INFO_TYPE_ECU_NAME, name, sizeof(name)));
+    ck_assert_str_eq(info.ecu_name, "ECM-EngineControl");
+
+    const uint8_t tracking[] = {0x2, 0x1, 0x2c, 0x0, 0x64};
+    ck_assert(diagnostic_vehicle_info_decode(&info,
+                DIAGNOSTIC_INFO_TYPE_SPARK_PERFORMANCE_TRACKING, tracking,
+                sizeof(tracking)));
+    ck_assert_int_eq(info.performance_tracking_count, 2);
+    ck_assert_int_eq(info.performance_tracking[0], 300);
+    ck_assert_int_eq(info.performance_tracking[1], 100);
+
+    ck_assert(!diagnostic_vehicle_info_decode(&info, DIAGNOSTIC_INFO_TYPE_VIN,
+                name, 10));
+    ck_assert(!diagnostic_vehicle_info_decode(&info, 0x1, name,
+                sizeof(name)));
+    ck_assert_int_eq(info.collected,
+            DIAGNOSTIC_INFO_TYPE_BIT(DIAGNOSTIC_INFO_TYPE_ECU_NAME) |
+            DIAGNOSTIC_INFO_TYPE_BIT(
+                DIAGNOSTIC_INFO_TYPE_SPARK_PERFORMANCE_TRACKING));
+}
+END_TEST
+
+START_TEST (test_request_vin)
+{
+    DiagnosticRequestHandle handle = diagnostic_request_vin(&SHIMS,
+            vin_received);
+    ck_assert(!handle.completed);
+    ck_assert_int_eq(last_frame_id, 0x7df);
+
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, VIN_FIRST_FRAME,
+            sizeof(VIN_FIRST_FRAME));
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, VIN_FRAME_1,
+            sizeof(VIN_FRAME_1));
+    diagnostic_receive_can_frame(&SHIMS, &handle, 0x7e8, VIN_FRAME_2,
+            sizeof(VIN_FRAME_2));
+    ck_assert_str_eq(last_vin, "1G1JC5444R7252367");
+}
+END_TEST
+
+Suite* testSuite(void) {
+    Suite* s = suite_create("vehicle_info");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup_vehicle_info, NULL);
+    tcase_add_test(tc_core, test_ecus_are_read_in_parallel);
+    tcase_add_test(tc_core, test_finished_after_search_and_reads);
+    tcase_add_test(tc_core, test_silent_info_type_is_skipped);
+    tcase_add_test(tc_core, test_decode_calibrations);
+    tcase_add_test(tc_core, test_decode_name_and_tracking);
+    tcase_add_test(tc_core, test_request_vin);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = testSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
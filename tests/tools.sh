@@ -0,0 +1,90 @@
+# Smoke test the command line tools - each is run on a small input and the
+# results compared to what's expected.
+#
+# Usage: sh tests/tools.sh <directory with the built tools>
+
+echo "Running tool tests:"
+
+TOOLS=$1
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+fail() {
+    echo "ERROR in tool test $1:"
+    cat "$WORK/output"
+    exit 1
+}
+
+expect() {
+    grep -q -- "$2" "$WORK/output" || fail "$1 (expected '$2')"
+}
+
+# uds-database: a database dumps as it was compiled
+cat > "$WORK/database.txt" <<EOF
+ecu engine 0x7e0
+param engine.speed engine 0x1 pid=0xc length=2 scale=0.25 exponent=-2
+EOF
+$TOOLS/uds-database compile "$WORK/database.txt" "$WORK/database.bin" \
+    > "$WORK/output" 2>&1 || fail uds-database
+expect uds-database "1 ECUs, 1 parameters"
+$TOOLS/uds-database dump "$WORK/database.bin" > "$WORK/output" 2>&1 ||
+    fail uds-database
+expect uds-database "ecu engine 0x7e0 response=0x7e8"
+expect uds-database "param engine.speed engine 0x1 pid=0xc bits=0:16"
+echo "uds-database PASS"
+
+# uds-analyze: an engine speed request and its response, in candump's format
+cat > "$WORK/candump.log" <<EOF
+(1600000000.000000) can0 7DF#02010C0000000000
+(1600000000.010000) can0 7E8#04410C1AF8000000
+EOF
+$TOOLS/uds-analyze -j 2 -o "$WORK/analyze" "$WORK/candump.log" \
+    > "$WORK/output" 2>&1 || fail uds-analyze
+expect uds-analyze "requests: 1 (0 dropped"
+expect uds-analyze "responses: 1,"
+test $(cat "$WORK"/analyze/part-*/arbitration_id.u32 | wc -c) -eq 4 ||
+    fail uds-analyze
+
+# the same on 29-bit IDs, with a frame from an ECU it isn't told about
+cat > "$WORK/candump.log" <<EOF
+(1600000000.000000) can0 18DB33F1#02010C0000000000
+(1600000000.010000) can0 18DAF110#04410C1AF8000000
+(1600000000.020000) can0 7C8#04410C1AF8000000
+EOF
+$TOOLS/uds-analyze -j 2 --split=id -o "$WORK/analyze-29" \
+    "$WORK/candump.log" > "$WORK/output" 2>&1 || fail uds-analyze
+expect uds-analyze "requests: 2 (0 dropped"
+expect uds-analyze "responses: 1,"
+expect uds-analyze "skipped: 1 diagnostic-looking"
+
+# and an ECU on IDs given with --ids
+cat > "$WORK/candump.log" <<EOF
+(1600000000.000000) can0 7C0#02010C0000000000
+(1600000000.010000) can0 7C8#04410C1AF8000000
+EOF
+$TOOLS/uds-analyze --ids 7c0 -o "$WORK/analyze-ids" "$WORK/candump.log" \
+    > "$WORK/output" 2>&1 || fail uds-analyze
+expect uds-analyze "responses: 1,"
+grep -q skipped "$WORK/output" && fail uds-analyze
+echo "uds-analyze PASS"
+
+# uds-replay: the same request and response, as a trace
+printf 'UDSTRACE\001\000\000\000' > "$WORK/trace.bin"
+printf '\000\000\000\000\337\007\000\200\010' >> "$WORK/trace.bin"
+printf '\002\001\014\000\000\000\000\000' >> "$WORK/trace.bin"
+printf '\020\047\000\000\350\007\000\000\010' >> "$WORK/trace.bin"
+printf '\004\101\014\032\370\000\000\000' >> "$WORK/trace.bin"
+$TOOLS/uds-replay "$WORK/trace.bin" > "$WORK/output" 2>&1 ||
+    fail uds-replay
+expect uds-replay "frames: 2"
+expect uds-replay "requests: 1 (0 dropped"
+expect uds-replay "responses: 1"
+echo "uds-replay PASS"
+
+# and both readers refuse what isn't theirs
+$TOOLS/uds-replay "$WORK/database.bin" > "$WORK/output" 2>&1 &&
+    fail uds-replay
+$TOOLS/uds-database dump "$WORK/trace.bin" > "$WORK/output" 2>&1 &&
+    fail uds-database
+
+echo "All tool tests passed."
@@ -0,0 +1,67 @@
+#ifndef __UDS_TOOLS_MAPPED_FILE_H__
+#define __UDS_TOOLS_MAPPED_FILE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Private: A read-only mapping of a whole file, shared between the command
+ * line tools.
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+} MappedFile;
+
+/* Private: Map the file at the given path in to memory.
+ *
+ * Returns true if the file was mapped. An empty file is mapped as a NULL data
+ * pointer with a length of 0.
+ */
+static inline bool map_file(const char* path, MappedFile* file) {
+    file->data = NULL;
+    file->length = 0;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        perror(path);
+        return false;
+    }
+
+    struct stat status;
+    if(fstat(fd, &status) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    if(status.st_size > 0) {
+        void* data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED) {
+            perror(path);
+            close(fd);
+            return false;
+        }
+        // the whole file is read front to back
+        madvise(data, status.st_size, MADV_SEQUENTIAL);
+        file->data = (const uint8_t*) data;
+        file->length = status.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+static inline void unmap_file(MappedFile* file) {
+    if(file->data != NULL) {
+        munmap((void*) file->data, file->length);
+        file->data = NULL;
+        file->length = 0;
+    }
+}
+
+#endif // __UDS_TOOLS_MAPPED_FILE_H__
@@ -0,0 +1,187 @@
+#ifndef __UDS_TOOLS_REQUEST_POOL_H__
+#define __UDS_TOOLS_REQUEST_POOL_H__
+
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define REQUEST_POOL_SIZE 64
+
+/* Private: Rebuilds diagnostic requests from the request frames seen in a
+ * capture and runs them through the library, passively - nothing is actually
+ * sent to a bus. Shared by the command line tools.
+ *
+ * Only single frame requests with normal addressing are rebuilt - multi-frame
+ * requests and those with extended or mixed addressing aren't, so their
+ * responses aren't decoded.
+ *
+ * requests - The number of requests started.
+ * dropped_requests - Requests not started because the pool was full.
+ */
+typedef struct {
+    DiagnosticShims shims;
+    DiagnosticRequestHandle handles[REQUEST_POOL_SIZE];
+    bool active[REQUEST_POOL_SIZE];
+    unsigned long requests;
+    unsigned long dropped_requests;
+} RequestPool;
+
+typedef void (*RequestPoolResponseHandler)(void* context,
+        const DiagnosticRequestHandle* handle,
+        const DiagnosticResponse* response);
+
+static bool request_pool_discard_can_message(const uint32_t arbitration_id,
+        const uint8_t* data, const uint8_t size) {
+    return true;
+}
+
+static inline void request_pool_init(RequestPool* pool,
+        GetTimeShim get_time) {
+    memset(pool, 0, sizeof(RequestPool));
+    pool->shims = diagnostic_init_shims(NULL,
+            request_pool_discard_can_message, NULL);
+    pool->shims.get_time = get_time;
+}
+
+/* Private: Rebuild the DiagnosticRequest from a single frame request as it
+ * was sent.
+ */
+static inline bool request_pool_parse_request(const uint32_t arbitration_id,
+        const uint8_t data[], const uint8_t size,
+        DiagnosticRequest* request) {
+    if(size < 2 || (data[0] >> 4) != 0) {
+        return false;
+    }
+
+    uint8_t length = data[0] & 0xf;
+    if(length == 0 || length > size - 1) {
+        return false;
+    }
+
+    const uint8_t* payload = &data[1];
+    memset(request, 0, sizeof(DiagnosticRequest));
+    request->arbitration_id = arbitration_id;
+    request->mode = payload[0];
+    request->no_frame_padding = size < CAN_MESSAGE_BYTE_SIZE;
+
+    uint8_t index = 1;
+    if((request->mode == OBD2_MODE_POWERTRAIN_DIAGNOSTIC_REQUEST ||
+            request->mode == OBD2_MODE_POWERTRAIN_FREEZE_FRAME_REQUEST ||
+            request->mode == OBD2_MODE_VEHICLE_INFORMATION) && length >= 2) {
+        request->has_pid = true;
+        request->pid = payload[1];
+        request->pid_length = 1;
+        index = 2;
+    } else if(request->mode == OBD2_MODE_ENHANCED_DIAGNOSTIC_REQUEST &&
+            length >= 3) {
+        request->has_pid = true;
+        request->pid = (payload[1] << 8) | payload[2];
+        request->pid_length = 2;
+        index = 3;
+    }
+
+    request->payload_length = length - index;
+    if(request->payload_length > MAX_UDS_REQUEST_PAYLOAD_LENGTH) {
+        return false;
+    }
+    memcpy(request->payload, &payload[index], request->payload_length);
+    return true;
+}
+
+/* Private: Stop tracking any request in progress to the given arbitration
+ * ID, because a new request was sent to it. This is also how functional
+ * requests (that stay open for more responses) are retired.
+ */
+static inline void request_pool_retire(RequestPool* pool,
+        const uint32_t arbitration_id) {
+    int slot;
+    for(slot = 0; slot < REQUEST_POOL_SIZE; ++slot) {
+        if(pool->active[slot] && pool->handles[slot].request.arbitration_id
+                == arbitration_id) {
+            pool->active[slot] = false;
+        }
+    }
+}
+
+/* Private: Start tracking the request in a frame that was sent, retiring any
+ * request still in progress to the same arbitration ID.
+ *
+ * Returns true if the frame was a request and it's now being tracked.
+ */
+static inline bool request_pool_start(RequestPool* pool,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size) {
+    DiagnosticRequest request;
+    if(!request_pool_parse_request(arbitration_id, data, size, &request)) {
+        return false;
+    }
+
+    request_pool_retire(pool, arbitration_id);
+    int free_slot = -1;
+    int slot;
+    for(slot = 0; slot < REQUEST_POOL_SIZE; ++slot) {
+        if(!pool->active[slot]) {
+            free_slot = slot;
+            break;
+        }
+    }
+
+    if(free_slot < 0) {
+        ++pool->dropped_requests;
+        return false;
+    }
+
+    pool->handles[free_slot] = diagnostic_request(&pool->shims, &request,
+            NULL);
+    pool->active[free_slot] = !pool->handles[free_slot].completed;
+    ++pool->requests;
+    return pool->active[free_slot];
+}
+
+/* Private: Offer a received frame to every request in progress.
+ *
+ * Returns the number of responses completed by the frame.
+ */
+static inline int request_pool_receive(RequestPool* pool,
+        const uint32_t arbitration_id, const uint8_t data[],
+        const uint8_t size, RequestPoolResponseHandler handler,
+        void* context) {
+    int completed = 0;
+    int slot;
+    for(slot = 0; slot < REQUEST_POOL_SIZE; ++slot) {
+        if(!pool->active[slot]) {
+            continue;
+        }
+
+        DiagnosticRequestHandle* handle = &pool->handles[slot];
+        DiagnosticResponse response = diagnostic_receive_can_frame(
+                &pool->shims, handle, arbitration_id, data, size);
+        if(response.completed) {
+            ++completed;
+            if(handler != NULL) {
+                handler(context, handle, &response);
+            }
+            // functional requests stay open for the other ECUs' responses
+            if(!diagnostic_addressing_is_functional(&handle->address)) {
+                pool->active[slot] = false;
+            }
+        }
+    }
+    return completed;
+}
+
+/* Private: Returns true if any request is still waiting for a response.
+ */
+static inline bool request_pool_busy(RequestPool* pool) {
+    int slot;
+    for(slot = 0; slot < REQUEST_POOL_SIZE; ++slot) {
+        if(pool->active[slot]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // __UDS_TOOLS_REQUEST_POOL_H__
@@ -0,0 +1,689 @@
+/* Decode the OBD-II requests and responses in large raw CAN logs offline,
+ * using every core.
+ *
+ * The log is mapped in to memory and split between worker threads, either:
+ *
+ *  --split=time (default) - Each worker takes an equal share of the file's
+ *      bytes, cut at line boundaries - as a log is in time order, that's a
+ *      stretch of time, but not an equal one if the bus load varies. A worker
+ *      owns the requests sent in its slice, and keeps reading past the end of
+ *      it until those requests are answered or time out, so a
+ *      request/response pair that straddles two slices is still decoded once.
+ *  --split=id - Each worker reads the whole file, but only decodes the
+ *      requests and responses for its share of the ECUs. This keeps every
+ *      ECU's traffic in one place at the cost of each worker scanning every
+ *      line. Functional requests go to every worker.
+ *
+ * Each worker runs the frames through the library exactly as they'd have
+ * arrived live, decodes positive responses with diagnostic_decode_obd2_pid
+ * and streams the results as columns of raw little-endian values to its own
+ * directory, <output>/part-NNN/:
+ *
+ *  timestamp_us.u64 - When the response was completed, from the log.
+ *  arbitration_id.u32 - The arbitration ID of the response.
+ *  mode.u8, pid.u16 - The service and PID of the request (0 if no PID).
+ *  nrc.u8 - The negative response code, or 0 for a positive response.
+ *  value.f32 - The decoded value, or NaN for a negative response.
+ *
+ * Requests are recognized on the OBD-II IDs:
+ *
+ *  - 11-bit: the functional broadcast ID 0x7df and the physical IDs
+ *      0x7e0-0x7e7, answered on 0x7e8-0x7ef.
+ *  - 29-bit (ISO 15765-4 normal fixed addressing, from tester 0xf1): the
+ *      functional ID 0x18db33f1 and the physical IDs 0x18da<ECU>f1, answered
+ *      on 0x18daf1<ECU>.
+ *
+ * --ids adds the request IDs of other ECUs, with their response IDs from
+ * diagnostic_addressing_default(...) - e.g. --ids 0x7c0,0x18da40f1. Other
+ * frames that look like diagnostic traffic (11-bit 0x700-0x7ff, or 29-bit
+ * 0x18da/0x18db) are counted as skipped, so a log of ECUs that need --ids
+ * doesn't just come out empty.
+ *
+ * Supported formats are candump's log format (candump -l, including CAN FD
+ * frames) and Vector ASC with hexadecimal IDs.
+ *
+ * Usage: uds-analyze [-j workers] [--split=time|id] [--ids id,...]
+ *          [-o output] <log>
+ */
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "mapped_file.h"
+#include "request_pool.h"
+
+#define MAX_WORKERS 256
+#define MAX_FRAME_SIZE 64
+#define MAX_EXTRA_IDS 64
+#define PHYSICAL_REQUEST_START 0x7e0
+#define PHYSICAL_REQUEST_END 0x7e7
+#define RESPONSE_END 0x7ef
+#define ARBITRATION_ID_OFFSET 0x8
+#define DIAGNOSTIC_ID_START 0x700
+#define STANDARD_ID_END 0x7ff
+#define TESTER_ADDRESS 0xf1
+#define NORMAL_FIXED_FUNCTIONAL_REQUEST 0x18db33f1
+#define NORMAL_FIXED_PHYSICAL 0x18da0000
+#define NORMAL_FIXED_FORMAT_MASK 0x00fe0000
+#define NORMAL_FIXED_FORMAT 0x00da0000
+#define NORMAL_FIXED_SOURCE_MASK 0x1fff00ff
+#define NORMAL_FIXED_TARGET_MASK 0x1fffff00
+// How long a worker keeps reading past the end of its slice for the
+// responses to its last requests, in log time.
+#define LOOKAHEAD_US 5000000
+#define COLUMN_BUFFER_SIZE (1 << 20)
+
+typedef enum {
+    SPLIT_BY_TIME,
+    SPLIT_BY_ID
+} SplitMode;
+
+typedef enum {
+    TRAFFIC_NONE,
+    TRAFFIC_REQUEST,
+    TRAFFIC_RESPONSE
+} Traffic;
+
+typedef struct {
+    uint64_t timestamp;
+    uint32_t arbitration_id;
+    uint8_t size;
+    uint8_t data[MAX_FRAME_SIZE];
+} Frame;
+
+typedef enum {
+    COLUMN_TIMESTAMP,
+    COLUMN_ARBITRATION_ID,
+    COLUMN_MODE,
+    COLUMN_PID,
+    COLUMN_NRC,
+    COLUMN_VALUE,
+    COLUMN_COUNT
+} Column;
+
+static const char* COLUMN_NAMES[COLUMN_COUNT] = {
+    "timestamp_us.u64",
+    "arbitration_id.u32",
+    "mode.u8",
+    "pid.u16",
+    "nrc.u8",
+    "value.f32"
+};
+
+typedef struct {
+    int index;
+    int worker_count;
+    SplitMode split;
+    const char* output;
+    const char* begin;
+    const char* end;
+    const char* file_end;
+
+    RequestPool pool;
+    FILE* columns[COLUMN_COUNT];
+    char* buffers[COLUMN_COUNT];
+    unsigned long lines;
+    unsigned long frames;
+    unsigned long skipped;
+    unsigned long rows;
+    bool failed;
+} Worker;
+
+// The ECUs added with --ids, set before the workers start.
+static DiagnosticAddress extra_ids[MAX_EXTRA_IDS];
+static int extra_id_count;
+
+// each worker drives its own requests, so each thread has its own clock
+static __thread uint64_t log_time;
+
+static uint64_t get_log_time() {
+    return log_time;
+}
+
+static const int8_t HEX_VALUES[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6,
+    ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+// HEX_VALUES is offset by one so that 0 can mean "not a hex digit"
+static inline int hex_value(char c) {
+    return HEX_VALUES[(uint8_t) c] - 1;
+}
+
+static const char* skip_spaces(const char* cursor, const char* end) {
+    while(cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+        ++cursor;
+    }
+    return cursor;
+}
+
+static const char* skip_token(const char* cursor, const char* end) {
+    while(cursor < end && *cursor != ' ' && *cursor != '\t') {
+        ++cursor;
+    }
+    return cursor;
+}
+
+// Parse "seconds.fraction" in to microseconds, without going through a
+// double so no precision is lost on long captures.
+static const char* parse_timestamp(const char* cursor, const char* end,
+        uint64_t* timestamp) {
+    uint64_t seconds = 0;
+    while(cursor < end && *cursor >= '0' && *cursor <= '9') {
+        seconds = seconds * 10 + (*cursor++ - '0');
+    }
+
+    uint64_t micros = 0;
+    int digits = 0;
+    if(cursor < end && *cursor == '.') {
+        ++cursor;
+        while(cursor < end && *cursor >= '0' && *cursor <= '9') {
+            if(digits < 6) {
+                micros = micros * 10 + (*cursor - '0');
+                ++digits;
+            }
+            ++cursor;
+        }
+    }
+    while(digits++ < 6) {
+        micros *= 10;
+    }
+    *timestamp = seconds * 1000000 + micros;
+    return cursor;
+}
+
+static const char* parse_hex(const char* cursor, const char* end,
+        uint32_t* value) {
+    *value = 0;
+    int digit;
+    while(cursor < end && (digit = hex_value(*cursor)) >= 0) {
+        *value = (*value << 4) | digit;
+        ++cursor;
+    }
+    return cursor;
+}
+
+// (1436509052.249713) can0 7E8#04410C1AF8000000
+// (1436509052.249713) can0 7E8##1044100C...
+static bool parse_candump_line(const char* cursor, const char* end,
+        Frame* frame, bool id_only) {
+    cursor = parse_timestamp(cursor + 1, end, &frame->timestamp);
+    if(cursor >= end || *cursor != ')') {
+        return false;
+    }
+    cursor = skip_spaces(cursor + 1, end);
+    cursor = skip_spaces(skip_token(cursor, end), end);
+
+    const char* id_start = cursor;
+    cursor = parse_hex(cursor, end, &frame->arbitration_id);
+    if(cursor == id_start || cursor >= end || *cursor != '#') {
+        return false;
+    }
+    if(id_only) {
+        return true;
+    }
+
+    ++cursor;
+    if(cursor < end && *cursor == '#') {
+        // CAN FD - skip the flags nibble
+        cursor += 2;
+    } else if(cursor < end && *cursor == 'R') {
+        return false;
+    }
+
+    frame->size = 0;
+    while(cursor + 1 < end && frame->size < MAX_FRAME_SIZE) {
+        if(*cursor == '.') {
+            ++cursor;
+            continue;
+        }
+        int high = hex_value(cursor[0]);
+        int low = hex_value(cursor[1]);
+        if(high < 0 || low < 0) {
+            break;
+        }
+        frame->data[frame->size++] = (high << 4) | low;
+        cursor += 2;
+    }
+    return true;
+}
+
+//    0.012345 1  7E8             Rx   d 8 04 41 0C 1A F8 00 00 00
+static bool parse_asc_line(const char* cursor, const char* end, Frame* frame,
+        bool id_only) {
+    cursor = parse_timestamp(cursor, end, &frame->timestamp);
+    cursor = skip_spaces(cursor, end);
+    if(cursor >= end || *cursor < '0' || *cursor > '9') {
+        return false;
+    }
+    cursor = skip_spaces(skip_token(cursor, end), end);
+
+    const char* id_start = cursor;
+    cursor = parse_hex(cursor, end, &frame->arbitration_id);
+    if(cursor == id_start) {
+        return false;
+    }
+    if(cursor < end && *cursor == 'x') {
+        ++cursor;
+    }
+    if(id_only) {
+        return true;
+    }
+
+    cursor = skip_spaces(skip_token(skip_spaces(cursor, end), end), end);
+    if(cursor >= end || *cursor != 'd') {
+        return false;
+    }
+    cursor = skip_spaces(cursor + 1, end);
+
+    uint32_t length;
+    cursor = parse_hex(cursor, end, &length);
+    if(length > 8) {
+        return false;
+    }
+
+    frame->size = 0;
+    while(frame->size < length) {
+        cursor = skip_spaces(cursor, end);
+        if(cursor + 1 >= end) {
+            return false;
+        }
+        int high = hex_value(cursor[0]);
+        int low = hex_value(cursor[1]);
+        if(high < 0 || low < 0) {
+            return false;
+        }
+        frame->data[frame->size++] = (high << 4) | low;
+        cursor += 2;
+    }
+    return true;
+}
+
+static bool parse_line(const char* cursor, const char* end, Frame* frame,
+        bool id_only) {
+    cursor = skip_spaces(cursor, end);
+    if(cursor >= end) {
+        return false;
+    }
+    if(*cursor == '(') {
+        return parse_candump_line(cursor, end, frame, id_only);
+    }
+    if(*cursor >= '0' && *cursor <= '9') {
+        return parse_asc_line(cursor, end, frame, id_only);
+    }
+    return false;
+}
+
+// Whether a frame is a request or a response the tool decodes. For anything
+// but a functional request, 'ecu' is set to the request ID of the ECU it's
+// to or from, which --split=id shares out between the workers.
+static Traffic classify(uint32_t arbitration_id, uint32_t* ecu) {
+    *ecu = 0;
+    if(arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID ||
+            arbitration_id == NORMAL_FIXED_FUNCTIONAL_REQUEST) {
+        return TRAFFIC_REQUEST;
+    } else if(arbitration_id >= PHYSICAL_REQUEST_START &&
+            arbitration_id <= PHYSICAL_REQUEST_END) {
+        *ecu = arbitration_id;
+        return TRAFFIC_REQUEST;
+    } else if(arbitration_id >= OBD2_FUNCTIONAL_RESPONSE_START &&
+            arbitration_id <= RESPONSE_END) {
+        *ecu = arbitration_id - ARBITRATION_ID_OFFSET;
+        return TRAFFIC_RESPONSE;
+    } else if((arbitration_id & NORMAL_FIXED_SOURCE_MASK) ==
+            (NORMAL_FIXED_PHYSICAL | TESTER_ADDRESS)) {
+        *ecu = arbitration_id;
+        return TRAFFIC_REQUEST;
+    } else if((arbitration_id & NORMAL_FIXED_TARGET_MASK) ==
+            (NORMAL_FIXED_PHYSICAL | TESTER_ADDRESS << 8)) {
+        // swap the source and target
+        *ecu = NORMAL_FIXED_PHYSICAL | (arbitration_id & 0xff) << 8 |
+                TESTER_ADDRESS;
+        return TRAFFIC_RESPONSE;
+    }
+
+    int i;
+    for(i = 0; i < extra_id_count; ++i) {
+        const DiagnosticAddress* address = &extra_ids[i];
+        bool functional = diagnostic_addressing_is_functional(address);
+        if(arbitration_id == address->request_id) {
+            *ecu = functional ? 0 : address->request_id;
+            return TRAFFIC_REQUEST;
+        } else if((arbitration_id & address->response_mask) ==
+                (address->response_id & address->response_mask)) {
+            *ecu = functional ? arbitration_id : address->request_id;
+            return TRAFFIC_RESPONSE;
+        }
+    }
+    return TRAFFIC_NONE;
+}
+
+// Diagnostic traffic on IDs that classify(...) doesn't know.
+static bool looks_diagnostic(uint32_t arbitration_id) {
+    if(arbitration_id <= STANDARD_ID_END) {
+        return arbitration_id >= DIAGNOSTIC_ID_START;
+    }
+    return (arbitration_id & NORMAL_FIXED_FORMAT_MASK) == NORMAL_FIXED_FORMAT;
+}
+
+// With --split=id, the worker that owns the traffic to and from an ECU.
+static inline int owner(Worker* worker, uint32_t ecu) {
+    // Fibonacci hashing, so 29-bit IDs that only differ in one byte spread
+    // out too
+    uint32_t hash = ecu * 2654435761u;
+    return (hash >> 16) % worker->worker_count;
+}
+
+static bool open_columns(Worker* worker) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/part-%03d", worker->output,
+            worker->index);
+    if(mkdir(path, 0755) < 0 && errno != EEXIST) {
+        perror(path);
+        return false;
+    }
+
+    int column;
+    for(column = 0; column < COLUMN_COUNT; ++column) {
+        snprintf(path, sizeof(path), "%s/part-%03d/%s", worker->output,
+                worker->index, COLUMN_NAMES[column]);
+        worker->columns[column] = fopen(path, "wb");
+        if(worker->columns[column] == NULL) {
+            perror(path);
+            return false;
+        }
+        worker->buffers[column] = (char*) malloc(COLUMN_BUFFER_SIZE);
+        setvbuf(worker->columns[column], worker->buffers[column], _IOFBF,
+                COLUMN_BUFFER_SIZE);
+    }
+    return true;
+}
+
+static void close_columns(Worker* worker) {
+    int column;
+    for(column = 0; column < COLUMN_COUNT; ++column) {
+        if(worker->columns[column] != NULL) {
+            if(fclose(worker->columns[column]) != 0) {
+                worker->failed = true;
+            }
+            worker->columns[column] = NULL;
+        }
+        free(worker->buffers[column]);
+        worker->buffers[column] = NULL;
+    }
+}
+
+static void write_row(void* context, const DiagnosticRequestHandle* handle,
+        const DiagnosticResponse* response) {
+    Worker* worker = (Worker*) context;
+    uint64_t timestamp = response->timestamps.completed;
+    uint32_t arbitration_id = response->arbitration_id;
+    uint8_t mode = response->mode;
+    uint16_t pid = response->has_pid ? response->pid : 0;
+    uint8_t nrc = response->success ? 0 : response->negative_response_code;
+    float value = response->success ?
+            diagnostic_decode_obd2_pid(response) : NAN;
+
+    fwrite(&timestamp, sizeof(timestamp), 1,
+            worker->columns[COLUMN_TIMESTAMP]);
+    fwrite(&arbitration_id, sizeof(arbitration_id), 1,
+            worker->columns[COLUMN_ARBITRATION_ID]);
+    fwrite(&mode, sizeof(mode), 1, worker->columns[COLUMN_MODE]);
+    fwrite(&pid, sizeof(pid), 1, worker->columns[COLUMN_PID]);
+    fwrite(&nrc, sizeof(nrc), 1, worker->columns[COLUMN_NRC]);
+    fwrite(&value, sizeof(value), 1, worker->columns[COLUMN_VALUE]);
+    ++worker->rows;
+}
+
+static const char* next_line(const char* cursor, const char* end) {
+    const char* newline = memchr(cursor, '\n', end - cursor);
+    return newline != NULL ? newline + 1 : end;
+}
+
+// Returns false once the worker is done with the lookahead past its slice.
+static bool process_line(Worker* worker, const char* line,
+        const char* line_end, bool in_slice, uint64_t* last_request) {
+    Frame frame;
+    ++worker->lines;
+    if(!parse_line(line, line_end, &frame, true)) {
+        return true;
+    }
+
+    uint32_t ecu;
+    Traffic traffic = classify(frame.arbitration_id, &ecu);
+    if(traffic == TRAFFIC_NONE) {
+        // with --split=id every worker sees every frame, so only one counts
+        if(in_slice && looks_diagnostic(frame.arbitration_id) &&
+                (worker->split == SPLIT_BY_TIME || worker->index == 0)) {
+            ++worker->skipped;
+        }
+        return true;
+    }
+    bool request = traffic == TRAFFIC_REQUEST;
+
+    if(worker->split == SPLIT_BY_ID && ecu != 0 &&
+            owner(worker, ecu) != worker->index) {
+        return true;
+    }
+
+    if(!parse_line(line, line_end, &frame, false)) {
+        return true;
+    }
+    ++worker->frames;
+    log_time = frame.timestamp;
+
+    if(!in_slice && frame.timestamp > *last_request + LOOKAHEAD_US) {
+        return false;
+    }
+
+    if(request) {
+        if(in_slice) {
+            request_pool_start(&worker->pool, frame.arbitration_id,
+                    frame.data, frame.size);
+            *last_request = frame.timestamp;
+        } else {
+            // a request from the next slice - it belongs to the next worker
+            // but any of ours to the same ID are finished
+            request_pool_retire(&worker->pool, frame.arbitration_id);
+        }
+    } else {
+        request_pool_receive(&worker->pool, frame.arbitration_id, frame.data,
+                frame.size, write_row, worker);
+    }
+    return in_slice || request_pool_busy(&worker->pool);
+}
+
+static void* run_worker(void* argument) {
+    Worker* worker = (Worker*) argument;
+    request_pool_init(&worker->pool, get_log_time);
+    if(!open_columns(worker)) {
+        worker->failed = true;
+        close_columns(worker);
+        return NULL;
+    }
+
+    uint64_t last_request = 0;
+    const char* line = worker->begin;
+    while(line < worker->end) {
+        const char* line_end = next_line(line, worker->end);
+        process_line(worker, line, line_end, true, &last_request);
+        line = line_end;
+    }
+
+    while(line < worker->file_end && request_pool_busy(&worker->pool)) {
+        const char* line_end = next_line(line, worker->file_end);
+        if(!process_line(worker, line, line_end, false, &last_request)) {
+            break;
+        }
+        line = line_end;
+    }
+
+    close_columns(worker);
+    return NULL;
+}
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+            (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-j workers] [--split=time|id] "
+            "[--ids id,...] [-o output] <log>\n", name);
+}
+
+// Parse a comma separated list of hexadecimal request IDs.
+static bool parse_ids(const char* list) {
+    while(*list != '\0') {
+        char* end;
+        unsigned long id = strtoul(list, &end, 16);
+        if(end == list || id > 0x1fffffff || (*end != ',' && *end != '\0') ||
+                extra_id_count >= MAX_EXTRA_IDS) {
+            return false;
+        }
+        extra_ids[extra_id_count++] = diagnostic_addressing_default(id);
+        list = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    SplitMode split = SPLIT_BY_TIME;
+    const char* output = "uds-analyze-output";
+    const char* path = NULL;
+
+    int i;
+    for(i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            worker_count = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if(strcmp(argv[i], "--ids") == 0 && i + 1 < argc) {
+            if(!parse_ids(argv[++i])) {
+                fprintf(stderr, "Invalid --ids %s\n", argv[i]);
+                return 1;
+            }
+        } else if(strcmp(argv[i], "--split=time") == 0) {
+            split = SPLIT_BY_TIME;
+        } else if(strcmp(argv[i], "--split=id") == 0) {
+            split = SPLIT_BY_ID;
+        } else if(argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(path == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(worker_count < 1) {
+        worker_count = 1;
+    } else if(worker_count > MAX_WORKERS) {
+        worker_count = MAX_WORKERS;
+    }
+
+    if(mkdir(output, 0755) < 0 && errno != EEXIST) {
+        perror(output);
+        return 1;
+    }
+
+    MappedFile file;
+    if(!map_file(path, &file)) {
+        return 1;
+    }
+    const char* begin = (const char*) file.data;
+    const char* end = begin + file.length;
+
+    Worker* workers = (Worker*) calloc(worker_count, sizeof(Worker));
+    pthread_t* threads = (pthread_t*) calloc(worker_count, sizeof(pthread_t));
+    const char* slice_start = begin;
+    for(i = 0; i < worker_count; ++i) {
+        Worker* worker = &workers[i];
+        worker->index = i;
+        worker->worker_count = worker_count;
+        worker->split = split;
+        worker->output = output;
+        worker->file_end = end;
+        if(split == SPLIT_BY_TIME) {
+            // slices start on a line boundary
+            const char* slice_end = i == worker_count - 1 ? end :
+                    begin + file.length / worker_count * (i + 1);
+            if(slice_end < slice_start) {
+                slice_end = slice_start;
+            } else if(slice_end < end && slice_end > begin &&
+                    slice_end[-1] != '\n') {
+                slice_end = next_line(slice_end, end);
+            }
+            worker->begin = slice_start;
+            worker->end = slice_end;
+            slice_start = slice_end;
+        } else {
+            worker->begin = begin;
+            worker->end = end;
+        }
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    bool failed = false;
+    int started_count;
+    for(started_count = 0; started_count < worker_count; ++started_count) {
+        int error = pthread_create(&threads[started_count], NULL, run_worker,
+                &workers[started_count]);
+        if(error != 0) {
+            fprintf(stderr, "Unable to start worker %d: %s\n",
+                    started_count, strerror(error));
+            failed = true;
+            break;
+        }
+    }
+
+    unsigned long frames = 0, skipped = 0, requests = 0, rows = 0;
+    unsigned long dropped = 0;
+    for(i = 0; i < started_count; ++i) {
+        pthread_join(threads[i], NULL);
+        frames += workers[i].frames;
+        skipped += workers[i].skipped;
+        requests += workers[i].pool.requests;
+        dropped += workers[i].pool.dropped_requests;
+        rows += workers[i].rows;
+        failed |= workers[i].failed;
+    }
+    double elapsed = seconds_since(&started);
+
+    printf("workers: %d (split by %s)\n", worker_count,
+            split == SPLIT_BY_TIME ? "time" : "id");
+    printf("diagnostic frames: %lu\n", frames);
+    if(skipped > 0) {
+        printf("skipped: %lu diagnostic-looking frames on other IDs "
+                "(see --ids)\n", skipped);
+    }
+    printf("requests: %lu (%lu dropped, too many in progress)\n", requests,
+            dropped);
+    printf("responses: %lu, written to %s/part-*\n", rows, output);
+    printf("elapsed: %.3fs (%.1f MB/s)\n", elapsed,
+            elapsed > 0 ? file.length / elapsed / 1e6 : 0);
+
+    free(threads);
+    free(workers);
+    unmap_file(&file);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,582 @@
+/* Compile a diagnostic database from its text source in to the binary image
+ * read by uds/database.h, or list what's in an image.
+ *
+ * The source has one ECU or parameter per line, with optional key=value
+ * fields. Numbers may be decimal or 0x hexadecimal, and '#' starts a comment:
+ *
+ *  ecu <name> <request_id> [response=<id>] [mask=<mask>]
+ *      [mode=normal|fixed|extended|mixed] [target=<address>]
+ *      [response_address=<address>] [frame_size=<bytes>]
+ *  param <name> <ecu> <service> [pid=<pid>] [pid_length=<1|2>]
+ *      [length=<bytes>] [bits=<offset>:<count>] [signed] [scale=<factor>]
+ *      [offset=<value>] [exponent=<e>] [rate=<ms>]
+ *
+ * For example:
+ *
+ *  ecu engine 0x7e0
+ *  param engine.speed engine 0x1 pid=0xc length=2 scale=0.25 exponent=-2
+ *  param engine.coolant engine 0x1 pid=0x5 length=1 offset=-40 rate=1000
+ *
+ * An ECU's addressing defaults to diagnostic_addressing_default(...). A
+ * parameter's value is (raw * scale + offset), decoded in units of
+ * 10^exponent - e.g. exponent=-2 for hundredths. 'bits' defaults to the whole
+ * payload, and 'length' to the end of 'bits'. The PID is 2 bytes long if it's
+ * over 0xff or the service is a UDS one (0x10 or more), unless pid_length
+ * says otherwise.
+ *
+ * ODX and JSON exports can be converted to this with a short script - the
+ * point of the compiler is that nothing has to be parsed at startup.
+ *
+ * Usage: uds-database compile <source> <database>
+ *        uds-database dump <database>
+ */
+#include <uds/uds.h>
+#include <uds/addressing.h>
+#include <uds/database.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mapped_file.h"
+
+#define MAX_LINE_LENGTH 1024
+#define MAX_TOKENS 32
+// The largest shift used to scale a fractional factor - it leaves 2^24
+// steps between whole units, which is past the precision of the exponent.
+#define MAX_SHIFT 24
+
+typedef struct {
+    char* name;
+    DiagnosticAddress address;
+    // Where it was in the source, before the ECUs are sorted
+    size_t position;
+} SourceEcu;
+
+typedef struct {
+    char* name;
+    // The position of its ECU in the source
+    size_t ecu;
+    DiagnosticDatabaseParameter record;
+} SourceParameter;
+
+typedef struct {
+    const char* path;
+    unsigned line;
+    SourceEcu* ecus;
+    size_t ecu_count;
+    SourceParameter* parameters;
+    size_t parameter_count;
+} Source;
+
+static bool fail(const Source* source, const char* message,
+        const char* detail) {
+    fprintf(stderr, "%s:%u: %s%s%s\n", source->path, source->line, message,
+            detail != NULL ? ": " : "", detail != NULL ? detail : "");
+    return false;
+}
+
+static bool parse_number(const char* text, unsigned long maximum,
+        unsigned long* value) {
+    char* end;
+    *value = strtoul(text, &end, 0);
+    return end != text && *end == '\0' && *value <= maximum;
+}
+
+static bool parse_integer(const char* text, long minimum, long maximum,
+        long* value) {
+    char* end;
+    *value = strtol(text, &end, 0);
+    return end != text && *end == '\0' && *value >= minimum &&
+            *value <= maximum;
+}
+
+static bool parse_real(const char* text, double* value) {
+    char* end;
+    *value = strtod(text, &end);
+    return end != text && *end == '\0' && isfinite(*value);
+}
+
+static SourceEcu* find_ecu(Source* source, const char* name) {
+    size_t i;
+    for(i = 0; i < source->ecu_count; ++i) {
+        if(strcmp(source->ecus[i].name, name) == 0) {
+            return &source->ecus[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parse_ecu(Source* source, char** tokens, int count) {
+    unsigned long request_id;
+    if(count < 3 || !parse_number(tokens[2], 0x1fffffff, &request_id)) {
+        return fail(source, "expected ecu <name> <request_id>", NULL);
+    }
+    if(find_ecu(source, tokens[1]) != NULL) {
+        return fail(source, "duplicate ECU", tokens[1]);
+    }
+    if(source->ecu_count == UINT16_MAX) {
+        return fail(source, "too many ECUs", NULL);
+    }
+
+    SourceEcu ecu = {
+        address: diagnostic_addressing_default(request_id),
+        position: source->ecu_count
+    };
+    int i;
+    for(i = 3; i < count; ++i) {
+        char* value = strchr(tokens[i], '=');
+        unsigned long number = 0;
+        if(value == NULL) {
+            return fail(source, "expected key=value", tokens[i]);
+        }
+        *value++ = '\0';
+
+        if(strcmp(tokens[i], "mode") == 0) {
+            if(strcmp(value, "normal") == 0) {
+                ecu.address.mode = DIAGNOSTIC_ADDRESSING_NORMAL;
+            } else if(strcmp(value, "fixed") == 0) {
+                ecu.address.mode = DIAGNOSTIC_ADDRESSING_NORMAL_FIXED;
+            } else if(strcmp(value, "extended") == 0) {
+                ecu.address.mode = DIAGNOSTIC_ADDRESSING_EXTENDED;
+            } else if(strcmp(value, "mixed") == 0) {
+                ecu.address.mode = DIAGNOSTIC_ADDRESSING_MIXED;
+            } else {
+                return fail(source, "unknown addressing mode", value);
+            }
+        } else if(strcmp(tokens[i], "response") == 0 &&
+                parse_number(value, 0x1fffffff, &number)) {
+            ecu.address.response_id = number;
+        } else if(strcmp(tokens[i], "mask") == 0 &&
+                parse_number(value, 0x1fffffff, &number)) {
+            ecu.address.response_mask = number;
+        } else if(strcmp(tokens[i], "target") == 0 &&
+                parse_number(value, UINT8_MAX, &number)) {
+            ecu.address.target_address = number;
+        } else if(strcmp(tokens[i], "response_address") == 0 &&
+                parse_number(value, UINT8_MAX, &number)) {
+            ecu.address.response_address = number;
+        } else if(strcmp(tokens[i], "frame_size") == 0 &&
+                parse_number(value, 64, &number)) {
+            ecu.address.frame_size = number;
+        } else {
+            return fail(source, "bad ECU field", tokens[i]);
+        }
+    }
+
+    ecu.name = strdup(tokens[1]);
+    source->ecus = realloc(source->ecus,
+            (source->ecu_count + 1) * sizeof(SourceEcu));
+    source->ecus[source->ecu_count++] = ecu;
+    return true;
+}
+
+// Find the multiplier and shift for a factor, exactly if it can be, and
+// otherwise with as much precision as fits in the multiplier.
+static bool scale_factor(double factor, int32_t* multiplier, uint8_t* shift) {
+    uint8_t candidate_shift;
+    bool found = false;
+    for(candidate_shift = 0; candidate_shift <= MAX_SHIFT; ++candidate_shift) {
+        double candidate = ldexp(factor, candidate_shift);
+        if(fabs(candidate) > INT32_MAX) {
+            break;
+        }
+        *multiplier = (int32_t) lround(candidate);
+        *shift = candidate_shift;
+        found = true;
+        if(fabs(candidate - *multiplier) < 1e-9) {
+            break;
+        }
+    }
+    return found && *multiplier != 0;
+}
+
+static bool parse_parameter(Source* source, char** tokens, int count) {
+    unsigned long mode;
+    if(count < 4 || !parse_number(tokens[3], UINT8_MAX, &mode)) {
+        return fail(source, "expected param <name> <ecu> <service>", NULL);
+    }
+    SourceEcu* ecu = find_ecu(source, tokens[2]);
+    if(ecu == NULL) {
+        return fail(source, "unknown ECU", tokens[2]);
+    }
+
+    SourceParameter parameter = {
+        ecu: ecu->position
+    };
+    DiagnosticDatabaseParameter* record = &parameter.record;
+    record->mode = mode;
+    double scale = 1;
+    double offset = 0;
+    long exponent = 0;
+    bool has_pid = false;
+    bool has_pid_length = false;
+    bool has_bits = false;
+    unsigned long length = 0;
+    int i;
+    for(i = 4; i < count; ++i) {
+        if(strcmp(tokens[i], "signed") == 0) {
+            record->flags |= DIAGNOSTIC_DATABASE_SIGNED;
+            continue;
+        }
+
+        char* value = strchr(tokens[i], '=');
+        unsigned long number = 0;
+        if(value == NULL) {
+            return fail(source, "expected key=value", tokens[i]);
+        }
+        *value++ = '\0';
+
+        if(strcmp(tokens[i], "pid") == 0 &&
+                parse_number(value, UINT16_MAX, &number)) {
+            record->pid = number;
+            has_pid = true;
+        } else if(strcmp(tokens[i], "pid_length") == 0 &&
+                parse_number(value, 2, &number) && number > 0) {
+            record->pid_length = number;
+            has_pid_length = true;
+        } else if(strcmp(tokens[i], "length") == 0 &&
+                parse_number(value, UINT8_MAX, &number)) {
+            length = number;
+        } else if(strcmp(tokens[i], "bits") == 0) {
+            char* bit_count = strchr(value, ':');
+            unsigned long bit_offset;
+            if(bit_count == NULL) {
+                return fail(source, "expected bits=<offset>:<count>", value);
+            }
+            *bit_count++ = '\0';
+            if(!parse_number(value, UINT16_MAX, &bit_offset) ||
+                    !parse_number(bit_count, 32, &number) || number == 0) {
+                return fail(source, "bad bits", value);
+            }
+            record->bit_offset = bit_offset;
+            record->bit_count = number;
+            has_bits = true;
+        } else if(strcmp(tokens[i], "scale") == 0 &&
+                parse_real(value, &scale)) {
+        } else if(strcmp(tokens[i], "offset") == 0 &&
+                parse_real(value, &offset)) {
+        } else if(strcmp(tokens[i], "exponent") == 0 &&
+                parse_integer(value, -9, 9, &exponent)) {
+        } else if(strcmp(tokens[i], "rate") == 0 &&
+                parse_number(value, UINT32_MAX, &number)) {
+            record->poll_interval_ms = number;
+        } else {
+            return fail(source, "bad parameter field", tokens[i]);
+        }
+    }
+
+    if(has_pid_length && !has_pid) {
+        return fail(source, "pid_length without a pid", NULL);
+    }
+    if(has_pid && !has_pid_length) {
+        record->pid_length = record->pid > UINT8_MAX || mode >= 0x10 ? 2 : 1;
+    }
+    if(record->pid_length == 1 && record->pid > UINT8_MAX) {
+        return fail(source, "pid doesn't fit in pid_length", NULL);
+    }
+
+    if(!has_bits) {
+        if(length == 0 || length > 4) {
+            return fail(source, "need bits=, or a length of 1 to 4", NULL);
+        }
+        record->bit_count = length * 8;
+    }
+    unsigned long end = (record->bit_offset + record->bit_count + 7) / 8;
+    if(length == 0) {
+        length = end;
+    }
+    if(end > length || length > UINT8_MAX) {
+        return fail(source, "bits don't fit in the length", NULL);
+    }
+    record->response_length = length;
+
+    double unit = pow(10, exponent);
+    double fixed_offset = round(offset / unit);
+    if(!scale_factor(scale / unit, &record->multiplier, &record->shift) ||
+            fabs(fixed_offset) > INT32_MAX) {
+        return fail(source, "scale or offset out of range for the exponent",
+                NULL);
+    }
+    record->offset = (int32_t) fixed_offset;
+    record->exponent = exponent;
+
+    parameter.name = strdup(tokens[1]);
+    source->parameters = realloc(source->parameters,
+            (source->parameter_count + 1) * sizeof(SourceParameter));
+    source->parameters[source->parameter_count++] = parameter;
+    return true;
+}
+
+static bool parse_source(Source* source, const MappedFile* file) {
+    size_t position = 0;
+    source->line = 0;
+    while(position < file->length) {
+        char line[MAX_LINE_LENGTH];
+        size_t length = 0;
+        while(position < file->length && file->data[position] != '\n') {
+            if(length < sizeof(line) - 1) {
+                line[length++] = file->data[position];
+            }
+            ++position;
+        }
+        ++position;
+        ++source->line;
+        line[length] = '\0';
+
+        char* comment = strchr(line, '#');
+        if(comment != NULL) {
+            *comment = '\0';
+        }
+        char* tokens[MAX_TOKENS];
+        int count = 0;
+        char* token = strtok(line, " \t\r");
+        while(token != NULL && count < MAX_TOKENS) {
+            tokens[count++] = token;
+            token = strtok(NULL, " \t\r");
+        }
+
+        if(count == 0) {
+            continue;
+        } else if(strcmp(tokens[0], "ecu") == 0) {
+            if(!parse_ecu(source, tokens, count)) {
+                return false;
+            }
+        } else if(strcmp(tokens[0], "param") == 0) {
+            if(!parse_parameter(source, tokens, count)) {
+                return false;
+            }
+        } else {
+            return fail(source, "expected ecu or param", tokens[0]);
+        }
+    }
+    return true;
+}
+
+static int compare_ecus(const void* a, const void* b) {
+    uint32_t left = ((const SourceEcu*) a)->address.request_id;
+    uint32_t right = ((const SourceEcu*) b)->address.request_id;
+    return left < right ? -1 : left > right;
+}
+
+// The order the tables are searched in - by ECU, then request, then field.
+static int compare_parameters(const void* a, const void* b) {
+    const SourceParameter* left = (const SourceParameter*) a;
+    const SourceParameter* right = (const SourceParameter*) b;
+    uint64_t left_key = ((uint64_t) left->record.ecu << 40) |
+            ((uint64_t) left->record.mode << 32) |
+            ((uint32_t) left->record.pid << 16) | left->record.bit_offset;
+    uint64_t right_key = ((uint64_t) right->record.ecu << 40) |
+            ((uint64_t) right->record.mode << 32) |
+            ((uint32_t) right->record.pid << 16) | right->record.bit_offset;
+    return left_key < right_key ? -1 : left_key > right_key;
+}
+
+static uint32_t align(uint32_t offset) {
+    return (offset + sizeof(uint32_t) - 1) & ~(uint32_t) (sizeof(uint32_t) - 1);
+}
+
+static bool write_database(Source* source, const char* path) {
+    size_t i;
+    qsort(source->ecus, source->ecu_count, sizeof(SourceEcu), compare_ecus);
+    uint16_t* sorted_ecus = calloc(source->ecu_count + 1, sizeof(uint16_t));
+    for(i = 0; i < source->ecu_count; ++i) {
+        if(i > 0 && source->ecus[i].address.request_id ==
+                source->ecus[i - 1].address.request_id) {
+            fprintf(stderr, "%s and %s have the same request ID\n",
+                    source->ecus[i - 1].name, source->ecus[i].name);
+            free(sorted_ecus);
+            return false;
+        }
+        sorted_ecus[source->ecus[i].position] = i;
+    }
+    for(i = 0; i < source->parameter_count; ++i) {
+        SourceParameter* parameter = &source->parameters[i];
+        parameter->record.ecu = sorted_ecus[parameter->ecu];
+    }
+    free(sorted_ecus);
+    qsort(source->parameters, source->parameter_count,
+            sizeof(SourceParameter), compare_parameters);
+
+    uint32_t index_size = 1;
+    while(index_size < source->parameter_count * 2) {
+        index_size <<= 1;
+    }
+
+    // the string table starts with the empty string
+    uint32_t strings_length = 1;
+    for(i = 0; i < source->ecu_count; ++i) {
+        strings_length += strlen(source->ecus[i].name) + 1;
+    }
+    for(i = 0; i < source->parameter_count; ++i) {
+        strings_length += strlen(source->parameters[i].name) + 1;
+    }
+
+    DiagnosticDatabaseHeader header = {
+        magic: DIAGNOSTIC_DATABASE_MAGIC,
+        version: DIAGNOSTIC_DATABASE_VERSION,
+        ecu_count: source->ecu_count,
+        parameter_count: source->parameter_count,
+        index_size: index_size
+    };
+    header.ecus_offset = sizeof(header);
+    header.parameters_offset = header.ecus_offset +
+            source->ecu_count * sizeof(DiagnosticDatabaseEcu);
+    header.index_offset = header.parameters_offset +
+            source->parameter_count * sizeof(DiagnosticDatabaseParameter);
+    header.strings_offset = header.index_offset +
+            index_size * sizeof(uint32_t);
+    header.strings_length = strings_length;
+    header.length = align(header.strings_offset + strings_length);
+
+    uint8_t* image = calloc(1, header.length);
+    char* strings = (char*) &image[header.strings_offset];
+    uint32_t string_offset = 1;
+    DiagnosticDatabaseEcu* ecus =
+            (DiagnosticDatabaseEcu*) &image[header.ecus_offset];
+    for(i = 0; i < source->ecu_count; ++i) {
+        const SourceEcu* ecu = &source->ecus[i];
+        ecus[i].name = string_offset;
+        string_offset += sprintf(&strings[string_offset], "%s", ecu->name) + 1;
+        ecus[i].request_id = ecu->address.request_id;
+        ecus[i].response_id = ecu->address.response_id;
+        ecus[i].response_mask = ecu->address.response_mask;
+        ecus[i].addressing_mode = ecu->address.mode;
+        ecus[i].target_address = ecu->address.target_address;
+        ecus[i].response_address = ecu->address.response_address;
+        ecus[i].frame_size = ecu->address.frame_size;
+    }
+
+    DiagnosticDatabaseParameter* parameters =
+            (DiagnosticDatabaseParameter*) &image[header.parameters_offset];
+    uint32_t* index = (uint32_t*) &image[header.index_offset];
+    bool ok = true;
+    for(i = 0; i < source->parameter_count; ++i) {
+        const SourceParameter* parameter = &source->parameters[i];
+        parameters[i] = parameter->record;
+        parameters[i].name = string_offset;
+        string_offset += sprintf(&strings[string_offset], "%s",
+                parameter->name) + 1;
+
+        DiagnosticDatabaseEcu* ecu = &ecus[parameter->record.ecu];
+        if(ecu->parameter_count == 0) {
+            ecu->first_parameter = i;
+        }
+        ++ecu->parameter_count;
+
+        uint32_t slot = diagnostic_database_hash(parameter->name) &
+                (index_size - 1);
+        while(index[slot] != 0) {
+            if(strcmp(source->parameters[index[slot] - 1].name,
+                        parameter->name) == 0) {
+                fprintf(stderr, "duplicate parameter %s\n", parameter->name);
+                ok = false;
+            }
+            slot = (slot + 1) & (index_size - 1);
+        }
+        index[slot] = i + 1;
+    }
+    memcpy(image, &header, sizeof(header));
+
+    if(ok) {
+        FILE* output = fopen(path, "wb");
+        if(output == NULL || fwrite(image, header.length, 1, output) != 1) {
+            perror(path);
+            ok = false;
+        }
+        if(output != NULL && fclose(output) != 0) {
+            perror(path);
+            ok = false;
+        }
+    }
+    if(ok) {
+        printf("%zu ECUs, %zu parameters, %u bytes\n", source->ecu_count,
+                source->parameter_count, header.length);
+    }
+    free(image);
+    return ok;
+}
+
+static int compile(const char* source_path, const char* database_path) {
+    // the image is written as the host lays out the structs
+    const uint16_t byte_order = 1;
+    if(*(const uint8_t*) &byte_order != 1) {
+        fprintf(stderr, "databases can only be compiled on a little-endian "
+                "host\n");
+        return 1;
+    }
+
+    MappedFile file;
+    if(!map_file(source_path, &file)) {
+        return 1;
+    }
+
+    Source source = {
+        path: source_path
+    };
+    bool ok = parse_source(&source, &file) &&
+            write_database(&source, database_path);
+
+    size_t i;
+    for(i = 0; i < source.ecu_count; ++i) {
+        free(source.ecus[i].name);
+    }
+    for(i = 0; i < source.parameter_count; ++i) {
+        free(source.parameters[i].name);
+    }
+    free(source.ecus);
+    free(source.parameters);
+    unmap_file(&file);
+    return ok ? 0 : 1;
+}
+
+static int dump(const char* path) {
+    MappedFile file;
+    if(!map_file(path, &file)) {
+        return 1;
+    }
+
+    DiagnosticDatabase database;
+    if(!diagnostic_database_open(&database, file.data, file.length)) {
+        fprintf(stderr, "%s is not a diagnostic database\n", path);
+        unmap_file(&file);
+        return 1;
+    }
+
+    uint32_t i;
+    for(i = 0; i < database.header->ecu_count; ++i) {
+        const DiagnosticDatabaseEcu* ecu = &database.ecus[i];
+        printf("ecu %s 0x%x response=0x%x mask=0x%x\n",
+                diagnostic_database_string(&database, ecu->name),
+                ecu->request_id, ecu->response_id, ecu->response_mask);
+    }
+    for(i = 0; i < database.header->parameter_count; ++i) {
+        const DiagnosticDatabaseParameter* parameter =
+                &database.parameters[i];
+        const DiagnosticDatabaseEcu* ecu = diagnostic_database_parameter_ecu(
+                &database, parameter);
+        printf("param %s %s 0x%x pid=0x%x bits=%u:%u multiplier=%d "
+                "shift=%u offset=%d exponent=%d rate=%u\n",
+                diagnostic_database_string(&database, parameter->name),
+                ecu != NULL ? diagnostic_database_string(&database,
+                    ecu->name) : "?", parameter->mode, parameter->pid,
+                parameter->bit_offset, parameter->bit_count,
+                parameter->multiplier, parameter->shift, parameter->offset,
+                parameter->exponent, parameter->poll_interval_ms);
+    }
+    unmap_file(&file);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc == 4 && strcmp(argv[1], "compile") == 0) {
+        return compile(argv[2], argv[3]);
+    } else if(argc == 3 && strcmp(argv[1], "dump") == 0) {
+        return dump(argv[2]);
+    }
+
+    fprintf(stderr, "Usage: %s compile <source> <database>\n"
+            "       %s dump <database>\n", argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,126 @@
+/* Replay a binary trace captured with a DiagnosticTraceRecorder through the
+ * library, either as fast as possible (to benchmark the receive path) or with
+ * the original timing.
+ *
+ * Every request frame the library sent in the trace is turned back in to a
+ * DiagnosticRequestHandle, and every received frame is offered to all handles
+ * in progress. The library's clock is driven by the trace timestamps, so
+ * repeated runs take exactly the same path through the code.
+ *
+ * Usage: uds-replay [--real-time] <trace>
+ */
+#include <uds/uds.h>
+#include <uds/trace.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mapped_file.h"
+#include "request_pool.h"
+
+typedef struct {
+    RequestPool pool;
+    uint64_t first_timestamp;
+    struct timespec started;
+    unsigned long responses;
+} Replay;
+
+static uint64_t trace_time;
+
+static uint64_t get_trace_time() {
+    return trace_time;
+}
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+            (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void wait_until(void* context, uint64_t timestamp) {
+    Replay* replay = (Replay*) context;
+    if(replay->first_timestamp == 0) {
+        replay->first_timestamp = timestamp;
+        clock_gettime(CLOCK_MONOTONIC, &replay->started);
+        return;
+    }
+
+    uint64_t offset = timestamp - replay->first_timestamp;
+    struct timespec deadline = replay->started;
+    deadline.tv_sec += offset / 1000000;
+    deadline.tv_nsec += (offset % 1000000) * 1000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+            != 0) {
+    }
+}
+
+static void replay_frame(void* context, const DiagnosticTraceRecord* record) {
+    Replay* replay = (Replay*) context;
+    trace_time = record->timestamp;
+
+    if(record->direction == DIAGNOSTIC_TRACE_SENT) {
+        request_pool_start(&replay->pool, record->arbitration_id,
+                record->data, record->size);
+    } else {
+        replay->responses += request_pool_receive(&replay->pool,
+                record->arbitration_id, record->data, record->size, NULL,
+                NULL);
+    }
+}
+
+int main(int argc, char** argv) {
+    DiagnosticTraceReplayMode mode = DIAGNOSTIC_TRACE_REPLAY_MAX_SPEED;
+    const char* path = NULL;
+    int i;
+    for(i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--real-time") == 0) {
+            mode = DIAGNOSTIC_TRACE_REPLAY_REAL_TIME;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if(path == NULL) {
+        fprintf(stderr, "Usage: %s [--real-time] <trace>\n", argv[0]);
+        return 1;
+    }
+
+    MappedFile file;
+    if(!map_file(path, &file)) {
+        return 1;
+    }
+
+    DiagnosticTraceReader reader;
+    if(!diagnostic_trace_reader_init(&reader, file.data, file.length)) {
+        fprintf(stderr, "%s is not a trace log\n", path);
+        unmap_file(&file);
+        return 1;
+    }
+
+    Replay* replay = (Replay*) calloc(1, sizeof(Replay));
+    request_pool_init(&replay->pool, get_trace_time);
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    size_t frames = diagnostic_trace_replay(&reader, mode, wait_until,
+            replay_frame, replay);
+    double elapsed = seconds_since(&started);
+
+    printf("frames: %zu\n", frames);
+    printf("requests: %lu (%lu dropped, too many in progress)\n",
+            replay->pool.requests, replay->pool.dropped_requests);
+    printf("responses: %lu\n", replay->responses);
+    printf("elapsed: %.6fs (%.0f frames/s)\n", elapsed,
+            elapsed > 0 ? frames / elapsed : 0);
+
+    free(replay);
+    unmap_file(&file);
+    return 0;
+}